@@ -0,0 +1,209 @@
+#include "AssetStreamer.h"
+
+#include <cstring>
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+AssetStreamer::AssetStreamer(UploadDevice &device, const FrameClock &clock, int ioThreads)
+	: mDevice(device)
+	, mClock(clock)
+	, mUploading(nullptr)
+	, mLastBytes(0)
+	, mLastLevels(0)
+	, mLastPumpMs(0.0)
+	, mMsPerByte(0.0)
+	, mQuit(false)
+{
+	// reading is mostly waiting on the disk, two threads keep one request in flight while the other copies
+	if (ioThreads <= 0)
+		ioThreads = 2;
+	for (int i = 0; i < ioThreads; i++)
+		mThreads.push_back(std::thread(&AssetStreamer::IoLoop, this));
+}
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+AssetStreamer::~AssetStreamer()
+{
+	{
+		std::lock_guard<std::mutex> lock(mMutex);
+		mQuit = true;
+	}
+	mWakeUp.notify_all();
+	for (size_t i = 0; i < mThreads.size(); i++)
+		mThreads[i].join();
+
+	for (size_t i = 0; i < mAssets.size(); i++)
+		if (mAssets[i]->resource)
+			mDevice.ReleaseTexture(mAssets[i]->resource);
+}
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+AssetId AssetStreamer::RequestTexture(const char *path)
+{
+	mAssets.push_back(std::unique_ptr<Asset>(new Asset));
+	Asset *asset = mAssets.back().get();
+	asset->path = path;
+	{
+		std::lock_guard<std::mutex> lock(mMutex);
+		mRequests.push_back(asset);
+	}
+	mWakeUp.notify_one();
+	return static_cast<AssetId>(mAssets.size() - 1);
+}
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+void AssetStreamer::IoLoop()
+{
+	for (;;)
+	{
+		Asset *asset = nullptr;
+		{
+			std::unique_lock<std::mutex> lock(mMutex);
+			mWakeUp.wait(lock, [this] { return mQuit || !mRequests.empty(); });
+			if (mQuit)
+				return;
+			asset = mRequests.front();
+			mRequests.pop_front();
+		}
+
+		asset->state.store(Asset_Loading, std::memory_order_relaxed);
+		if (!LoadTexture(*asset))
+		{
+			asset->state.store(Asset_Failed, std::memory_order_release);
+			continue;
+		}
+
+		// the release store publishes the staged levels to the render thread
+		std::lock_guard<std::mutex> lock(mMutex);
+		asset->state.store(Asset_Staged, std::memory_order_release);
+		mStaged.push_back(asset);
+	}
+}
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+bool AssetStreamer::LoadTexture(Asset &asset)
+{
+	DdsFile file;
+	if (!file.Open(asset.path.c_str()))
+		return false;
+
+	// the copy faults every page in here, on the I/O thread, instead of inside the upload on the render thread
+	asset.format = file.GetFormat();
+	std::vector<TextureImage> generated;
+	const TextureLevel &top = file.GetLevel(0);
+	if (file.GetFormat() == Texture_RGBA8 && file.GetMipCount() == 1 && GetMipCount(top.width, top.height) > 1)
+		GenerateMips(static_cast<const uint32_t*>(top.data), top.width, top.height, generated);
+
+	uint32_t count = generated.empty() ? file.GetMipCount() : static_cast<uint32_t>(generated.size());
+	asset.levels.resize(count);
+	size_t size = 0;
+	for (uint32_t i = 0; i < count; i++)
+	{
+		TextureLevel &level = asset.levels[i];
+		level.width = generated.empty() ? file.GetLevel(i).width : generated[i].width;
+		level.height = generated.empty() ? file.GetLevel(i).height : generated[i].height;
+		level.rowPitch = GetRowPitch(asset.format, level.width);
+		level.size = GetLevelSize(asset.format, level.width, level.height);
+		size += level.size;
+	}
+
+	asset.data.resize(size);
+	size_t offset = 0;
+	for (uint32_t i = 0; i < count; i++)
+	{
+		TextureLevel &level = asset.levels[i];
+		memcpy(&asset.data[offset], generated.empty() ? file.GetLevel(i).data : generated[i].texels.data(), level.size);
+		level.data = &asset.data[offset];
+		offset += level.size;
+	}
+	return true;
+}
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+size_t AssetStreamer::Pump(const StreamBudget &budget)
+{
+	double startMs = mClock.NowMs();
+	size_t bytes = 0;
+	size_t levels = 0;
+	for (;;)
+	{
+		if (!mUploading)
+		{
+			std::lock_guard<std::mutex> lock(mMutex);
+			if (mStaged.empty())
+				break;
+			mUploading = mStaged.front();
+			mStaged.pop_front();
+		}
+
+		Asset &asset = *mUploading;
+		if (!asset.resource)
+		{
+			const TextureLevel &top = asset.levels[0];
+			asset.resource = mDevice.CreateTexture(asset.format, top.width, top.height, static_cast<uint32_t>(asset.levels.size()));
+			if (!asset.resource)
+			{
+				asset.state.store(Asset_Failed, std::memory_order_relaxed);
+				std::vector<unsigned char>().swap(asset.data);
+				mUploading = nullptr;
+				continue;
+			}
+			asset.state.store(Asset_Uploading, std::memory_order_relaxed);
+		}
+
+		// the time budget is checked with the level's predicted cost, so a level is not started just before the limit
+		const TextureLevel &level = asset.levels[asset.uploadedLevels];
+		double levelStartMs = mClock.NowMs();
+		if (levels && (bytes + level.size > budget.maxBytes || levelStartMs - startMs + level.size * mMsPerByte > budget.maxMs))
+			break;
+
+		mDevice.UploadTextureLevel(asset.resource, asset.uploadedLevels, level);
+		if (level.size)
+		{
+			double msPerByte = (mClock.NowMs() - levelStartMs) / level.size;
+			mMsPerByte = mMsPerByte > 0.0 ? mMsPerByte + (msPerByte - mMsPerByte) * 0.125 : msPerByte;
+		}
+		bytes += level.size;
+		levels++;
+		if (++asset.uploadedLevels == asset.levels.size())
+		{
+			// staging memory goes as soon as the GPU copy is complete
+			std::vector<unsigned char>().swap(asset.data);
+			asset.levels.clear();
+			asset.state.store(Asset_Resident, std::memory_order_relaxed);
+			mUploading = nullptr;
+		}
+	}
+
+	mLastBytes = bytes;
+	mLastLevels = levels;
+	mLastPumpMs = mClock.NowMs() - startMs;
+	return bytes;
+}
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+void* AssetStreamer::GetResource(AssetId id) const
+{
+	return GetState(id) == Asset_Resident ? mAssets[id]->resource : nullptr;
+}
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+bool AssetStreamer::IsIdle() const
+{
+	for (size_t i = 0; i < mAssets.size(); i++)
+	{
+		AssetState state = GetState(static_cast<AssetId>(i));
+		if (state != Asset_Resident && state != Asset_Failed)
+			return false;
+	}
+	return true;
+}
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+StreamStats AssetStreamer::GetStats() const
+{
+	StreamStats stats;
+	stats.requested = mAssets.size();
+	stats.resident = 0;
+	stats.failed = 0;
+	for (size_t i = 0; i < mAssets.size(); i++)
+	{
+		AssetState state = GetState(static_cast<AssetId>(i));
+		stats.resident += state == Asset_Resident;
+		stats.failed += state == Asset_Failed;
+	}
+	stats.uploadedBytes = mLastBytes;
+	stats.uploadedLevels = mLastLevels;
+	stats.pumpMs = mLastPumpMs;
+	return stats;
+}
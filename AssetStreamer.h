@@ -0,0 +1,129 @@
+#pragma once
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Asynchronous texture streaming with a budgeted upload queue.
+// RequestTexture returns at once; a small pool of I/O threads maps the DDS, copies its levels into staging memory
+// (generating the mip chain for single level RGBA8 files) and queues the result. The render thread calls Pump once per
+// frame, which creates the texture and uploads it one mip level at a time until the frame's byte or time budget is
+// spent, so a large texture is spread over several frames instead of stalling one. Until GetResource returns non null
+// the caller keeps drawing its placeholder.
+// The device is an interface: D3D11 in main.cpp, a recording fake in HeadlessMain.cpp.
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+#include "FrameStats.h"
+#include "Texture.h"
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+// render thread only
+class UploadDevice
+{
+public:
+	virtual ~UploadDevice() {}
+
+	// an opaque resource with mipCount empty levels, nullptr on failure
+	virtual void* CreateTexture(TextureFormat format, uint32_t width, uint32_t height, uint32_t mipCount) = 0;
+	// level.data is only valid during the call
+	virtual void UploadTextureLevel(void *texture, uint32_t level, const TextureLevel &data) = 0;
+	virtual void ReleaseTexture(void *texture) = 0;
+};
+
+struct StreamBudget
+{
+	size_t maxBytes; // per Pump
+	double maxMs;    // per Pump, by the streamer's clock
+};
+
+enum AssetState
+{
+	Asset_Queued,    // waiting for an I/O thread
+	Asset_Loading,   // being read on an I/O thread
+	Asset_Staged,    // in memory, waiting for Pump
+	Asset_Uploading, // some levels uploaded
+	Asset_Resident,  // GetResource is valid
+	Asset_Failed,    // missing or unsupported file, keep the placeholder
+};
+
+struct StreamStats
+{
+	size_t requested;
+	size_t resident;
+	size_t failed;
+	// last Pump
+	size_t uploadedBytes;
+	size_t uploadedLevels;
+	double pumpMs;
+};
+
+typedef uint32_t AssetId;
+
+class AssetStreamer
+{
+public:
+	// ioThreads 0 picks 2
+	AssetStreamer(UploadDevice &device, const FrameClock &clock, int ioThreads = 0);
+	// joins the I/O threads and releases every texture through the device
+	~AssetStreamer();
+
+	// render thread
+	AssetId RequestTexture(const char *path);
+	// uploads staged levels in request order while the bytes and the predicted time fit the budget; the first level of
+	// a call always goes, so a level larger than the budget still makes progress. Returns the bytes uploaded.
+	size_t Pump(const StreamBudget &budget);
+
+	AssetState GetState(AssetId id) const { return static_cast<AssetState>(mAssets[id]->state.load(std::memory_order_acquire)); }
+	// the device's texture once Asset_Resident, nullptr before
+	void* GetResource(AssetId id) const;
+	// true when nothing is queued, loading, staged or uploading
+	bool IsIdle() const;
+	StreamStats GetStats() const;
+
+private:
+	struct Asset
+	{
+		std::string      path;
+		std::atomic<int> state;
+
+		// written by the I/O thread before Asset_Staged
+		TextureFormat              format;
+		std::vector<TextureLevel>  levels; // into data
+		std::vector<unsigned char> data;
+
+		// render thread
+		void     *resource;
+		uint32_t uploadedLevels;
+
+		Asset() : state(Asset_Queued), format(Texture_RGBA8), resource(nullptr), uploadedLevels(0) {}
+	};
+
+	AssetStreamer(const AssetStreamer&);
+	AssetStreamer& operator=(const AssetStreamer&);
+
+	void IoLoop();
+	static bool LoadTexture(Asset &asset);
+
+	UploadDevice      &mDevice;
+	const FrameClock  &mClock;
+
+	// owned by the render thread, the I/O threads only see the Asset pointers they are handed
+	std::vector<std::unique_ptr<Asset>> mAssets;
+	Asset                               *mUploading;
+	size_t                              mLastBytes;
+	size_t                              mLastLevels;
+	double                              mLastPumpMs;
+	double                              mMsPerByte; // running average of the device's upload cost
+
+	std::vector<std::thread> mThreads;
+	std::mutex               mMutex;
+	std::condition_variable  mWakeUp;
+	std::deque<Asset*>       mRequests; // under mMutex
+	std::deque<Asset*>       mStaged;   // under mMutex
+	bool                     mQuit;
+};
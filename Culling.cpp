@@ -0,0 +1,472 @@
+#include "Culling.h"
+#include "FrameArena.h"
+
+#include <algorithm>
+#include <cmath>
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#else
+#include <emmintrin.h>
+#endif
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+namespace
+{
+	// stack entries with this bit set are accepted without a test, their whole subtree is inside
+	const uint32_t kInsideFlag = 0x80000000;
+
+	Aabb Union(const Aabb &a, const Aabb &b)
+	{
+		Aabb r;
+		r.min.x = std::min(a.min.x, b.min.x);
+		r.min.y = std::min(a.min.y, b.min.y);
+		r.min.z = std::min(a.min.z, b.min.z);
+		r.max.x = std::max(a.max.x, b.max.x);
+		r.max.y = std::max(a.max.y, b.max.y);
+		r.max.z = std::max(a.max.z, b.max.z);
+		return r;
+	}
+
+	bool Contains(const Aabb &outer, const Aabb &inner)
+	{
+		return outer.min.x <= inner.min.x && outer.min.y <= inner.min.y && outer.min.z <= inner.min.z &&
+			inner.max.x <= outer.max.x && inner.max.y <= outer.max.y && inner.max.z <= outer.max.z;
+	}
+
+	bool Overlaps(const Aabb &a, const Aabb &b)
+	{
+		return a.min.x <= b.max.x && b.min.x <= a.max.x && a.min.y <= b.max.y && b.min.y <= a.max.y &&
+			a.min.z <= b.max.z && b.min.z <= a.max.z;
+	}
+
+	bool Equal(const Aabb &a, const Aabb &b)
+	{
+		return a.min.x == b.min.x && a.min.y == b.min.y && a.min.z == b.min.z &&
+			a.max.x == b.max.x && a.max.y == b.max.y && a.max.z == b.max.z;
+	}
+
+	// half the surface area, the insertion cost
+	float Area(const Aabb &box)
+	{
+		float dx = box.max.x - box.min.x, dy = box.max.y - box.min.y, dz = box.max.z - box.min.z;
+		return dx * dy + dy * dz + dz * dx;
+	}
+
+	void SetPlane(Frustum &frustum, int plane, float a, float b, float c, float d)
+	{
+		// normalized so the margin and the extents are in world units
+		float length = std::sqrt(a * a + b * b + c * c);
+		float inv = length > 0.0f ? 1.0f / length : 0.0f;
+		frustum.a[plane] = a * inv;
+		frustum.b[plane] = b * inv;
+		frustum.c[plane] = c * inv;
+		frustum.d[plane] = d * inv;
+		frustum.absA[plane] = std::fabs(frustum.a[plane]);
+		frustum.absB[plane] = std::fabs(frustum.b[plane]);
+		frustum.absC[plane] = std::fabs(frustum.c[plane]);
+	}
+}
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+Frustum ExtractFrustum(const Mat4 &viewProj)
+{
+	// clip = v * viewProj, so each clip coordinate is the dot product with a column
+	const Mat4 &m = viewProj;
+	Frustum frustum;
+	SetPlane(frustum, 0, m.m[0][3] + m.m[0][0], m.m[1][3] + m.m[1][0], m.m[2][3] + m.m[2][0], m.m[3][3] + m.m[3][0]); // left
+	SetPlane(frustum, 1, m.m[0][3] - m.m[0][0], m.m[1][3] - m.m[1][0], m.m[2][3] - m.m[2][0], m.m[3][3] - m.m[3][0]); // right
+	SetPlane(frustum, 2, m.m[0][3] + m.m[0][1], m.m[1][3] + m.m[1][1], m.m[2][3] + m.m[2][1], m.m[3][3] + m.m[3][1]); // bottom
+	SetPlane(frustum, 3, m.m[0][3] - m.m[0][1], m.m[1][3] - m.m[1][1], m.m[2][3] - m.m[2][1], m.m[3][3] - m.m[3][1]); // top
+	SetPlane(frustum, 4, m.m[0][2], m.m[1][2], m.m[2][2], m.m[3][2]); // near
+	SetPlane(frustum, 5, m.m[0][3] - m.m[0][2], m.m[1][3] - m.m[1][2], m.m[2][3] - m.m[2][2], m.m[3][3] - m.m[3][2]); // far
+
+	for (int plane = 6; plane < 8; plane++)
+	{
+		frustum.a[plane] = frustum.b[plane] = frustum.c[plane] = 0.0f;
+		frustum.absA[plane] = frustum.absB[plane] = frustum.absC[plane] = 0.0f;
+		frustum.d[plane] = 1.0f;
+	}
+	return frustum;
+}
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+CullResult TestAabb(const Frustum &frustum, const Aabb &box)
+{
+	float cx = (box.min.x + box.max.x) * 0.5f, cy = (box.min.y + box.max.y) * 0.5f, cz = (box.min.z + box.max.z) * 0.5f;
+	float ex = (box.max.x - box.min.x) * 0.5f, ey = (box.max.y - box.min.y) * 0.5f, ez = (box.max.z - box.min.z) * 0.5f;
+
+	// signed distance of the center and projected radius of the box, for every plane at once
+#if defined(__AVX2__)
+	__m256 distance = _mm256_fmadd_ps(_mm256_load_ps(frustum.a), _mm256_set1_ps(cx), _mm256_load_ps(frustum.d));
+	distance = _mm256_fmadd_ps(_mm256_load_ps(frustum.b), _mm256_set1_ps(cy), distance);
+	distance = _mm256_fmadd_ps(_mm256_load_ps(frustum.c), _mm256_set1_ps(cz), distance);
+	__m256 radius = _mm256_mul_ps(_mm256_load_ps(frustum.absA), _mm256_set1_ps(ex));
+	radius = _mm256_fmadd_ps(_mm256_load_ps(frustum.absB), _mm256_set1_ps(ey), radius);
+	radius = _mm256_fmadd_ps(_mm256_load_ps(frustum.absC), _mm256_set1_ps(ez), radius);
+
+	const __m256 zero = _mm256_setzero_ps();
+	if (_mm256_movemask_ps(_mm256_cmp_ps(_mm256_add_ps(distance, radius), zero, _CMP_LT_OQ)))
+		return CullOutside;
+	if (_mm256_movemask_ps(_mm256_cmp_ps(_mm256_sub_ps(distance, radius), zero, _CMP_LT_OQ)))
+		return CullIntersect;
+	return CullInside;
+#else
+	int outside = 0, crossing = 0;
+	for (int half = 0; half < 8; half += 4)
+	{
+		__m128 distance = _mm_add_ps(_mm_mul_ps(_mm_load_ps(frustum.a + half), _mm_set1_ps(cx)), _mm_load_ps(frustum.d + half));
+		distance = _mm_add_ps(_mm_mul_ps(_mm_load_ps(frustum.b + half), _mm_set1_ps(cy)), distance);
+		distance = _mm_add_ps(_mm_mul_ps(_mm_load_ps(frustum.c + half), _mm_set1_ps(cz)), distance);
+		__m128 radius = _mm_mul_ps(_mm_load_ps(frustum.absA + half), _mm_set1_ps(ex));
+		radius = _mm_add_ps(_mm_mul_ps(_mm_load_ps(frustum.absB + half), _mm_set1_ps(ey)), radius);
+		radius = _mm_add_ps(_mm_mul_ps(_mm_load_ps(frustum.absC + half), _mm_set1_ps(ez)), radius);
+
+		const __m128 zero = _mm_setzero_ps();
+		outside |= _mm_movemask_ps(_mm_cmplt_ps(_mm_add_ps(distance, radius), zero));
+		crossing |= _mm_movemask_ps(_mm_cmplt_ps(_mm_sub_ps(distance, radius), zero));
+	}
+	return outside ? CullOutside : (crossing ? CullIntersect : CullInside);
+#endif
+}
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+void ComputeBounds(const TransformStore &transforms, size_t begin, size_t end, const Aabb &local, Aabb *bounds)
+{
+	const float *component[TransformStore::NumComponents];
+	for (int c = 0; c < TransformStore::NumComponents; c++)
+		component[c] = transforms.GetComponent(static_cast<TransformStore::Component>(c));
+
+	float lc[3] = { (local.min.x + local.max.x) * 0.5f, (local.min.y + local.max.y) * 0.5f, (local.min.z + local.max.z) * 0.5f };
+	float le[3] = { (local.max.x - local.min.x) * 0.5f, (local.max.y - local.min.y) * 0.5f, (local.max.z - local.min.z) * 0.5f };
+
+	for (size_t i = begin; i < end; i++)
+	{
+		Vec3 position = { component[TransformStore::PositionX][i], component[TransformStore::PositionY][i], component[TransformStore::PositionZ][i] };
+		Vec4 rotation = { component[TransformStore::RotationX][i], component[TransformStore::RotationY][i],
+			component[TransformStore::RotationZ][i], component[TransformStore::RotationW][i] };
+		Vec3 scale = { component[TransformStore::ScaleX][i], component[TransformStore::ScaleY][i], component[TransformStore::ScaleZ][i] };
+		Mat4 world = TransformStore::Compose(position, rotation, scale);
+
+		// rows 0-2 are the scaled axes: the center transforms as a point, the extents by the absolute axes
+		float center[3], extents[3];
+		for (int j = 0; j < 3; j++)
+		{
+			center[j] = lc[0] * world.m[0][j] + lc[1] * world.m[1][j] + lc[2] * world.m[2][j] + world.m[3][j];
+			extents[j] = le[0] * std::fabs(world.m[0][j]) + le[1] * std::fabs(world.m[1][j]) + le[2] * std::fabs(world.m[2][j]);
+		}
+
+		Aabb &box = bounds[i - begin];
+		box.min = Vec3{ center[0] - extents[0], center[1] - extents[1], center[2] - extents[2] };
+		box.max = Vec3{ center[0] + extents[0], center[1] + extents[1], center[2] + extents[2] };
+	}
+}
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+void CullBoxes(const Frustum &frustum, const Aabb *boxes, size_t count, std::vector<uint32_t> &visible)
+{
+	for (size_t i = 0; i < count; i++)
+		if (TestAabb(frustum, boxes[i]) != CullOutside)
+			visible.push_back(static_cast<uint32_t>(i));
+}
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+Bvh::Bvh(float margin)
+	: mRoot(kNullNode)
+	, mFreeList(kNullNode)
+	, mFreeCount(0)
+	, mLeavesCount(0)
+	, mMargin(margin)
+	, mRefitLeaves(0)
+	, mReinsertedLeaves(0)
+{
+}
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+uint32_t Bvh::AllocateNode()
+{
+	uint32_t node;
+	if (mFreeList != kNullNode)
+	{
+		node = mFreeList;
+		mFreeList = mNodes[node].parent;
+		mFreeCount--;
+	}
+	else
+	{
+		node = static_cast<uint32_t>(mNodes.size());
+		mNodes.push_back(Node());
+	}
+
+	Node &n = mNodes[node];
+	n.parent = kNullNode;
+	n.child[0] = n.child[1] = kNullNode;
+	n.userData = kNullNode;
+	n.height = 0;
+	n.queued = false;
+	return node;
+}
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+void Bvh::FreeNode(uint32_t node)
+{
+	mNodes[node].parent = mFreeList;
+	mNodes[node].height = -1;
+	mFreeList = node;
+	mFreeCount++;
+}
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+uint32_t Bvh::Insert(const Aabb &bounds, uint32_t userData)
+{
+	uint32_t leaf = AllocateNode();
+	Node &node = mNodes[leaf];
+	node.bounds.min = Vec3{ bounds.min.x - mMargin, bounds.min.y - mMargin, bounds.min.z - mMargin };
+	node.bounds.max = Vec3{ bounds.max.x + mMargin, bounds.max.y + mMargin, bounds.max.z + mMargin };
+	node.userData = userData;
+
+	InsertLeaf(leaf);
+	mLeavesCount++;
+	return leaf;
+}
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+void Bvh::Remove(uint32_t proxy)
+{
+	RemoveLeaf(proxy);
+	FreeNode(proxy);
+	mLeavesCount--;
+
+	// a queued leaf stays in the queue, Refit skips freed nodes
+}
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+bool Bvh::Move(uint32_t proxy, const Aabb &bounds)
+{
+	if (Contains(mNodes[proxy].bounds, bounds))
+		return false;
+
+	Aabb fat;
+	fat.min = Vec3{ bounds.min.x - mMargin, bounds.min.y - mMargin, bounds.min.z - mMargin };
+	fat.max = Vec3{ bounds.max.x + mMargin, bounds.max.y + mMargin, bounds.max.z + mMargin };
+
+	// a jump somewhere else would stretch every ancestor across the gap, find it a new place instead
+	if (!Overlaps(mNodes[proxy].bounds, bounds))
+	{
+		RemoveLeaf(proxy);
+		mNodes[proxy].bounds = fat;
+		InsertLeaf(proxy);
+		mReinsertedLeaves++;
+		return true;
+	}
+
+	Node &node = mNodes[proxy];
+	node.bounds = fat;
+	if (!node.queued)
+	{
+		node.queued = true;
+		mRefitQueue.push_back(proxy);
+	}
+	mRefitLeaves++;
+	return true;
+}
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+void Bvh::Refit()
+{
+	for (size_t i = 0; i < mRefitQueue.size(); i++)
+	{
+		uint32_t leaf = mRefitQueue[i];
+		if (mNodes[leaf].height != 0 || !mNodes[leaf].queued)
+			continue;
+		mNodes[leaf].queued = false;
+
+		// ancestors only, the first one that does not change means the rest is up to date for this leaf
+		for (uint32_t index = mNodes[leaf].parent; index != kNullNode; index = mNodes[index].parent)
+		{
+			Node &node = mNodes[index];
+			Aabb bounds = Union(mNodes[node.child[0]].bounds, mNodes[node.child[1]].bounds);
+			if (Equal(bounds, node.bounds))
+				break;
+			node.bounds = bounds;
+		}
+	}
+	mRefitQueue.clear();
+}
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+size_t Bvh::Cull(const Frustum &frustum, ArenaVector<uint32_t> &visible) const
+{
+	if (mRoot == kNullNode)
+		return 0;
+
+	// runs every frame: the stack stays on the thread's stack unless the tree is very deep
+	size_t tested = 0;
+	ScratchArena<128 * sizeof(uint32_t)> scratch;
+	ArenaVector<uint32_t> stack(&scratch);
+	stack.reserve(128);
+	stack.push_back(mRoot);
+
+	while (!stack.empty())
+	{
+		uint32_t entry = stack.back();
+		stack.pop_back();
+
+		const Node &node = mNodes[entry & ~kInsideFlag];
+		bool inside = (entry & kInsideFlag) != 0;
+		if (!inside)
+		{
+			tested++;
+			CullResult result = TestAabb(frustum, node.bounds);
+			if (result == CullOutside)
+				continue;
+			inside = result == CullInside;
+		}
+
+		if (node.IsLeaf())
+			visible.push_back(node.userData);
+		else
+		{
+			uint32_t flag = inside ? kInsideFlag : 0;
+			stack.push_back(node.child[1] | flag);
+			stack.push_back(node.child[0] | flag);
+		}
+	}
+	return tested;
+}
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+void Bvh::InsertLeaf(uint32_t leaf)
+{
+	if (mRoot == kNullNode)
+	{
+		mRoot = leaf;
+		mNodes[leaf].parent = kNullNode;
+		return;
+	}
+
+	// descend towards the sibling with the cheapest increase in area, stop where pairing here is cheaper
+	Aabb leafBounds = mNodes[leaf].bounds;
+	uint32_t index = mRoot;
+	while (!mNodes[index].IsLeaf())
+	{
+		const Node &node = mNodes[index];
+		float area = Area(node.bounds);
+		float combinedArea = Area(Union(node.bounds, leafBounds));
+
+		float cost = 2.0f * combinedArea;
+		float inheritance = 2.0f * (combinedArea - area);
+
+		float childCost[2];
+		for (int c = 0; c < 2; c++)
+		{
+			const Node &child = mNodes[node.child[c]];
+			float grown = Area(Union(child.bounds, leafBounds));
+			childCost[c] = (child.IsLeaf() ? grown : grown - Area(child.bounds)) + inheritance;
+		}
+
+		if (cost < childCost[0] && cost < childCost[1])
+			break;
+		index = childCost[0] < childCost[1] ? node.child[0] : node.child[1];
+	}
+
+	uint32_t sibling = index;
+	uint32_t oldParent = mNodes[sibling].parent;
+	uint32_t newParent = AllocateNode();
+
+	Node &parent = mNodes[newParent];
+	parent.parent = oldParent;
+	parent.bounds = Union(leafBounds, mNodes[sibling].bounds);
+	parent.height = mNodes[sibling].height + 1;
+	parent.child[0] = sibling;
+	parent.child[1] = leaf;
+	mNodes[sibling].parent = newParent;
+	mNodes[leaf].parent = newParent;
+
+	if (oldParent == kNullNode)
+		mRoot = newParent;
+	else
+	{
+		Node &old = mNodes[oldParent];
+		old.child[old.child[0] == sibling ? 0 : 1] = newParent;
+	}
+
+	FixUpwards(oldParent);
+}
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+void Bvh::RemoveLeaf(uint32_t leaf)
+{
+	if (leaf == mRoot)
+	{
+		mRoot = kNullNode;
+		return;
+	}
+
+	uint32_t parent = mNodes[leaf].parent;
+	uint32_t grandParent = mNodes[parent].parent;
+	uint32_t sibling = mNodes[parent].child[0] == leaf ? mNodes[parent].child[1] : mNodes[parent].child[0];
+
+	mNodes[sibling].parent = grandParent;
+	FreeNode(parent);
+
+	if (grandParent == kNullNode)
+	{
+		mRoot = sibling;
+		return;
+	}
+
+	Node &grand = mNodes[grandParent];
+	grand.child[grand.child[0] == parent ? 0 : 1] = sibling;
+	FixUpwards(grandParent);
+}
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+void Bvh::FixUpwards(uint32_t index)
+{
+	while (index != kNullNode)
+	{
+		index = Balance(index);
+
+		Node &node = mNodes[index];
+		const Node &child0 = mNodes[node.child[0]];
+		const Node &child1 = mNodes[node.child[1]];
+		node.height = 1 + std::max(child0.height, child1.height);
+		node.bounds = Union(child0.bounds, child1.bounds);
+
+		index = node.parent;
+	}
+}
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+uint32_t Bvh::Balance(uint32_t iA)
+{
+	Node &a = mNodes[iA];
+	if (a.IsLeaf() || a.height < 2)
+		return iA;
+
+	int balance = mNodes[a.child[1]].height - mNodes[a.child[0]].height;
+	if (balance >= -1 && balance <= 1)
+		return iA;
+
+	// the taller child t takes the place of a, a keeps the shorter child and the shorter grandchild
+	int tall = balance > 1 ? 1 : 0;
+	uint32_t iT = a.child[tall];
+	uint32_t iS = a.child[1 - tall];
+	Node &t = mNodes[iT];
+	Node &s = mNodes[iS];
+	uint32_t iF = t.child[0];
+	uint32_t iG = t.child[1];
+	Node &f = mNodes[iF];
+	Node &g = mNodes[iG];
+
+	t.child[0] = iA;
+	t.parent = a.parent;
+	a.parent = iT;
+
+	if (t.parent == kNullNode)
+		mRoot = iT;
+	else
+	{
+		Node &parent = mNodes[t.parent];
+		parent.child[parent.child[0] == iA ? 0 : 1] = iT;
+	}
+
+	uint32_t iKeep = f.height > g.height ? iF : iG;
+	uint32_t iGive = f.height > g.height ? iG : iF;
+	Node &keep = mNodes[iKeep];
+	Node &give = mNodes[iGive];
+
+	t.child[1] = iKeep;
+	a.child[tall] = iGive;
+	give.parent = iA;
+
+	a.bounds = Union(s.bounds, give.bounds);
+	a.height = 1 + std::max(s.height, give.height);
+	t.bounds = Union(a.bounds, keep.bounds);
+	t.height = 1 + std::max(a.height, keep.height);
+	return iT;
+}
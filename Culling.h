@@ -0,0 +1,114 @@
+#pragma once
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// View frustum culling over a dynamic bounding volume hierarchy.
+// Every object owns a leaf of a dynamic AABB tree (Box2D style: surface area heuristic insertion, AVL rotations).
+// Leaves are fattened by a margin, so a small motion inside the fat box costs nothing; larger motions refit the
+// ancestors of the moved leaves once per frame and a jump to a disjoint box reinserts the leaf.
+// Cull walks the tree against the six planes of the camera, a subtree fully inside is accepted without further tests.
+// The box against six planes test is a single AVX2 (or two SSE) evaluation of all planes at once.
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+#include "FrameArena.h"
+#include "MathUtils.h"
+#include "TransformStore.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+struct Aabb
+{
+	Vec3 min;
+	Vec3 max;
+};
+
+// planes a * x + b * y + c * z + d >= 0 inside, stored per coefficient and padded to 8 with always-inside planes
+struct Frustum
+{
+	alignas(32) float a[8];
+	alignas(32) float b[8];
+	alignas(32) float c[8];
+	alignas(32) float d[8];
+	alignas(32) float absA[8];
+	alignas(32) float absB[8];
+	alignas(32) float absC[8];
+};
+
+enum CullResult
+{
+	CullOutside,
+	CullIntersect,
+	CullInside
+};
+
+// row vector view * projection as in CreateCBuffers, D3D clip space with 0 <= z <= w
+Frustum ExtractFrustum(const Mat4 &viewProj);
+CullResult TestAabb(const Frustum &frustum, const Aabb &box);
+
+// world bounds of the local box under transforms [begin, end), bounds[i - begin]
+void ComputeBounds(const TransformStore &transforms, size_t begin, size_t end, const Aabb &local, Aabb *bounds);
+
+// brute force reference: indices of the boxes touching the frustum, in order
+void CullBoxes(const Frustum &frustum, const Aabb *boxes, size_t count, std::vector<uint32_t> &visible);
+
+class Bvh
+{
+public:
+	static const uint32_t kNullNode = 0xFFFFFFFF;
+
+	// margin in world units added around each leaf
+	explicit Bvh(float margin = 0.25f);
+
+	// returns the proxy of the new leaf, userData is what Cull reports for it
+	uint32_t Insert(const Aabb &bounds, uint32_t userData);
+	void Remove(uint32_t proxy);
+	// true if the leaf had to change; the ancestors are only up to date after Refit
+	bool Move(uint32_t proxy, const Aabb &bounds);
+	void Refit();
+
+	// appends the userData of the leaves touching the frustum, returns the number of nodes tested
+	size_t Cull(const Frustum &frustum, ArenaVector<uint32_t> &visible) const;
+
+	size_t GetLeavesCount() const { return mLeavesCount; }
+	size_t GetNodesCount() const { return mNodes.size() - mFreeCount; }
+	int GetHeight() const { return mRoot == kNullNode ? 0 : mNodes[mRoot].height; }
+	const Aabb& GetFatBounds(uint32_t proxy) const { return mNodes[proxy].bounds; }
+
+	// Move outcomes since the last ResetCounters
+	size_t GetRefitLeaves() const { return mRefitLeaves; }
+	size_t GetReinsertedLeaves() const { return mReinsertedLeaves; }
+	void ResetCounters() { mRefitLeaves = mReinsertedLeaves = 0; }
+
+private:
+	struct Node
+	{
+		Aabb     bounds;
+		uint32_t parent; // next free node while on the free list
+		uint32_t child[2];
+		uint32_t userData;
+		int      height; // 0 for leaves, -1 when free
+		bool     queued; // leaf waiting for Refit
+
+		bool IsLeaf() const { return child[0] == kNullNode; }
+	};
+
+	Bvh(const Bvh&);
+	Bvh& operator=(const Bvh&);
+
+	uint32_t AllocateNode();
+	void FreeNode(uint32_t node);
+	void InsertLeaf(uint32_t leaf);
+	void RemoveLeaf(uint32_t leaf);
+	uint32_t Balance(uint32_t node);
+	void FixUpwards(uint32_t node);
+
+	std::vector<Node>     mNodes;
+	std::vector<uint32_t> mRefitQueue;
+	uint32_t              mRoot;
+	uint32_t              mFreeList;
+	size_t                mFreeCount;
+	size_t                mLeavesCount;
+	float                 mMargin;
+
+	size_t mRefitLeaves;
+	size_t mReinsertedLeaves;
+};
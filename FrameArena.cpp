@@ -0,0 +1,274 @@
+#include "FrameArena.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cassert>
+#include <cstdlib>
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+#if defined(COUNT_HEAP_ALLOCATIONS)
+namespace
+{
+	// counted by the operator new below; plain data, so it needs no initialization when a thread starts
+	thread_local uint64_t tHeapAllocations = 0;
+}
+
+void* operator new(size_t size)
+{
+	tHeapAllocations++;
+	if (!size)
+		size = 1;
+	for (;;)
+	{
+		void *p = malloc(size);
+		if (p)
+			return p;
+		std::new_handler handler = std::get_new_handler();
+		if (!handler)
+			throw std::bad_alloc();
+		handler();
+	}
+}
+
+void* operator new(size_t size, const std::nothrow_t&) noexcept
+{
+	try
+	{
+		return operator new(size);
+	}
+	catch (...)
+	{
+		return nullptr;
+	}
+}
+
+void operator delete(void *p) noexcept
+{
+	free(p);
+}
+
+void operator delete(void *p, const std::nothrow_t&) noexcept
+{
+	free(p);
+}
+
+void operator delete(void *p, size_t) noexcept
+{
+	free(p);
+}
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+uint64_t GetThreadHeapAllocations()
+{
+	return tHeapAllocations;
+}
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+bool IsCountingHeapAllocations()
+{
+	return true;
+}
+#else
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+uint64_t GetThreadHeapAllocations()
+{
+	return 0;
+}
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+bool IsCountingHeapAllocations()
+{
+	return false;
+}
+#endif
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+class HeapResource : public MemoryResource
+{
+public:
+	void* Allocate(size_t size, size_t alignment) override
+	{
+		// C++14 has no aligned operator new
+		assert(alignment <= alignof(std::max_align_t));
+		(void)alignment;
+		return ::operator new(size);
+	}
+
+	void Deallocate(void *p, size_t, size_t) override { ::operator delete(p); }
+};
+
+MemoryResource* GetHeapResource()
+{
+	static HeapResource heap;
+	return &heap;
+}
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+LinearArena::LinearArena(size_t blockSize)
+	: mBlockSize(blockSize)
+	, mBuffer(nullptr)
+	, mBufferSize(0)
+	, mBlocks(nullptr)
+	, mCursor(nullptr)
+	, mEnd(nullptr)
+	, mUsed(0)
+	, mPeak(0)
+	, mReserved(0)
+	, mBlockAllocations(0)
+{
+}
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+LinearArena::LinearArena(void *buffer, size_t size, size_t blockSize)
+	: mBlockSize(blockSize)
+	, mBuffer(static_cast<unsigned char*>(buffer))
+	, mBufferSize(size)
+	, mBlocks(nullptr)
+	, mCursor(mBuffer)
+	, mEnd(mBuffer + size)
+	, mUsed(0)
+	, mPeak(0)
+	, mReserved(0)
+	, mBlockAllocations(0)
+{
+}
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+LinearArena::~LinearArena()
+{
+	FreeBlocks();
+}
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+void* LinearArena::Allocate(size_t size, size_t alignment)
+{
+	assert(alignment && !(alignment & (alignment - 1)));
+	if (!size)
+		size = 1;
+
+	uintptr_t cursor = reinterpret_cast<uintptr_t>(mCursor);
+	uintptr_t end = reinterpret_cast<uintptr_t>(mEnd);
+	uintptr_t p = (cursor + alignment - 1) & ~static_cast<uintptr_t>(alignment - 1);
+	if (!mCursor || p > end || size > end - p)
+		return AllocateBlock(size, alignment);
+
+	mUsed += p + size - cursor;
+	mCursor = reinterpret_cast<unsigned char*>(p + size);
+	return reinterpret_cast<void*>(p);
+}
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// the rest of the current block is left unused
+void* LinearArena::AllocateBlock(size_t size, size_t alignment)
+{
+	if (size > std::numeric_limits<size_t>::max() - sizeof(Block) - alignment)
+		throw std::bad_alloc();
+	NewBlock(std::max(mBlockSize, sizeof(Block) + size + alignment));
+	return Allocate(size, alignment);
+}
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+void LinearArena::NewBlock(size_t size)
+{
+	Block *block = static_cast<Block*>(::operator new(size));
+	block->next = mBlocks;
+	block->size = size;
+	mBlocks = block;
+	mReserved += size;
+	mBlockAllocations++;
+	mCursor = reinterpret_cast<unsigned char*>(block + 1);
+	mEnd = reinterpret_cast<unsigned char*>(block) + size;
+}
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+void LinearArena::FreeBlocks()
+{
+	while (mBlocks)
+	{
+		Block *next = mBlocks->next;
+		mReserved -= mBlocks->size;
+		::operator delete(mBlocks);
+		mBlocks = next;
+	}
+}
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+void LinearArena::Reset()
+{
+	mPeak = GetPeak();
+	mUsed = 0;
+
+	// still in its first region: start over there
+	if (!mBlocks)
+	{
+		mCursor = mBuffer;
+		mEnd = mBuffer + mBufferSize;
+		return;
+	}
+	if (!mBlocks->next && !mBuffer)
+	{
+		mCursor = reinterpret_cast<unsigned char*>(mBlocks + 1);
+		mEnd = reinterpret_cast<unsigned char*>(mBlocks) + mBlocks->size;
+		return;
+	}
+
+	// grown out of it: one block that holds the peak with room for different padding, the buffer is too small
+	FreeBlocks();
+	mBuffer = nullptr;
+	mBufferSize = 0;
+	NewBlock(std::max(mBlockSize, sizeof(Block) + mPeak + mPeak / 8));
+}
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+namespace
+{
+	// the frame arenas of all threads; each thread adds its own numbers to the totals when it resets its arena
+	std::atomic<uint64_t> gArenaFrame(0);
+	std::atomic<size_t>   gArenaPeak(0);
+	std::atomic<size_t>   gArenaReserved(0);
+	std::atomic<uint64_t> gArenaBlockAllocations(0);
+
+	const size_t kFrameArenaBlockSize = 256 * 1024;
+
+	struct ThreadFrameArena
+	{
+		LinearArena arena;
+		uint64_t    frame;
+		size_t      reserved; // already in the totals
+		uint64_t    blockAllocations;
+
+		ThreadFrameArena() : arena(kFrameArenaBlockSize), frame(0), reserved(0), blockAllocations(0) {}
+		~ThreadFrameArena() { gArenaReserved -= reserved; }
+
+		void Publish()
+		{
+			size_t peak = arena.GetPeak();
+			size_t known = gArenaPeak.load(std::memory_order_relaxed);
+			while (peak > known && !gArenaPeak.compare_exchange_weak(known, peak, std::memory_order_relaxed))
+			{
+			}
+			gArenaReserved += arena.GetReserved() - reserved;
+			reserved = arena.GetReserved();
+			gArenaBlockAllocations += arena.GetBlockAllocations() - blockAllocations;
+			blockAllocations = arena.GetBlockAllocations();
+		}
+	};
+
+	thread_local ThreadFrameArena tFrameArena;
+}
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+void BeginArenaFrame()
+{
+	gArenaFrame.fetch_add(1, std::memory_order_relaxed);
+}
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+LinearArena& GetFrameArena()
+{
+	ThreadFrameArena &local = tFrameArena;
+	uint64_t frame = gArenaFrame.load(std::memory_order_relaxed);
+	if (local.frame != frame)
+	{
+		local.arena.Reset();
+		local.Publish();
+		local.frame = frame;
+	}
+	return local.arena;
+}
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+ArenaStats GetFrameArenaStats()
+{
+	tFrameArena.Publish();
+
+	ArenaStats stats;
+	stats.frames = gArenaFrame.load(std::memory_order_relaxed);
+	stats.peakBytes = gArenaPeak.load(std::memory_order_relaxed);
+	stats.reservedBytes = gArenaReserved.load(std::memory_order_relaxed);
+	stats.blockAllocations = gArenaBlockAllocations.load(std::memory_order_relaxed);
+	return stats;
+}
@@ -0,0 +1,160 @@
+#pragma once
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Linear allocators for transient data.
+// LinearArena hands out memory by bumping a pointer through blocks taken from the heap and frees everything at once in
+// Reset, single allocations are never freed: a growing container leaves every old buffer behind, reserve what is known.
+// A Reset after the arena had to grow replaces its blocks with one as large as the peak, so a steady workload stops
+// going to the heap after its first frames.
+// The frame arena is a LinearArena per thread that is reset the first time its thread asks for it in a new frame:
+// BeginArenaFrame on the render thread starts the frame, nothing allocated from it may outlive the frame.
+// ScratchArena<N> starts in an N byte buffer of its own and only takes blocks once that is full, it holds the
+// temporary data of one function, on its stack; owned by one thread, it needs no locking in the init tasks.
+// ArenaAllocator<T> plugs any MemoryResource into the STL containers, the resource is picked at run time like with
+// std::pmr::polymorphic_allocator, which C++14 does not have.
+// Built with COUNT_HEAP_ALLOCATIONS, FrameArena.cpp replaces the global operator new to count heap allocations per
+// thread, so a frame can check that nothing in it went to the heap; the headless benchmarks define it, the app keeps
+// the runtime's operator new and counts nothing.
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <new>
+#include <type_traits>
+#include <vector>
+
+class MemoryResource
+{
+public:
+	virtual ~MemoryResource() {}
+
+	// alignment is a power of two
+	virtual void* Allocate(size_t size, size_t alignment) = 0;
+	virtual void Deallocate(void *p, size_t size, size_t alignment) = 0;
+};
+
+// the global operator new and delete
+MemoryResource* GetHeapResource();
+
+class LinearArena : public MemoryResource
+{
+public:
+	// blockSize is the smallest block taken from the heap, larger allocations get a block of their own
+	explicit LinearArena(size_t blockSize = 64 * 1024);
+	~LinearArena() override;
+
+	void* Allocate(size_t size, size_t alignment) override;
+	// the memory is reclaimed by Reset
+	void Deallocate(void*, size_t, size_t) override {}
+
+	// frees every allocation at once
+	void Reset();
+
+	// bytes handed out since the last Reset, alignment padding included
+	size_t GetUsed() const { return mUsed; }
+	// the most GetUsed reached between two resets
+	size_t GetPeak() const { return mUsed > mPeak ? mUsed : mPeak; }
+	// held in heap blocks, the ScratchArena buffer is not counted
+	size_t GetReserved() const { return mReserved; }
+	// blocks taken from the heap so far, stays flat once the arena fits its workload
+	uint64_t GetBlockAllocations() const { return mBlockAllocations; }
+
+protected:
+	// starts in buffer, which the arena does not own
+	LinearArena(void *buffer, size_t size, size_t blockSize);
+
+private:
+	// at the start of every heap block
+	struct Block
+	{
+		Block  *next;
+		size_t size;
+	};
+
+	LinearArena(const LinearArena&);
+	LinearArena& operator=(const LinearArena&);
+
+	void* AllocateBlock(size_t size, size_t alignment);
+	void  FreeBlocks();
+	void  NewBlock(size_t size);
+
+	size_t        mBlockSize;
+	unsigned char *mBuffer;
+	size_t        mBufferSize;
+
+	Block         *mBlocks; // newest first
+	unsigned char *mCursor;
+	unsigned char *mEnd;
+
+	size_t   mUsed;
+	size_t   mPeak;
+	size_t   mReserved;
+	uint64_t mBlockAllocations;
+};
+
+template <size_t Size>
+class ScratchArena : public LinearArena
+{
+public:
+	explicit ScratchArena(size_t blockSize = 64 * 1024) : LinearArena(mStorage, Size, blockSize) {}
+
+private:
+	alignas(16) unsigned char mStorage[Size];
+};
+
+// from the render thread, before the frame's first allocation on any thread
+void BeginArenaFrame();
+// the calling thread's arena for the current frame; a thread asks again every frame, which resets it when it is stale
+LinearArena& GetFrameArena();
+
+struct ArenaStats
+{
+	uint64_t frames;
+	size_t   peakBytes;         // the most one thread used in one frame
+	size_t   reservedBytes;     // held by the frame arenas of all threads
+	uint64_t blockAllocations;  // heap blocks taken by all of them
+};
+// frames a thread did not use its arena in are not counted for it, the current frame only for the calling thread
+ArenaStats GetFrameArenaStats();
+
+// allocations through the global operator new by the calling thread since it started, 0 when they are not counted
+uint64_t GetThreadHeapAllocations();
+// whether the build defines COUNT_HEAP_ALLOCATIONS
+bool IsCountingHeapAllocations();
+
+// an STL allocator over a MemoryResource; copies of containers go back to the heap, moves and swaps keep theirs: a
+// container assigned a new frame's vector takes its resource along
+template <class T>
+class ArenaAllocator
+{
+public:
+	typedef T value_type;
+	typedef std::true_type propagate_on_container_move_assignment;
+	typedef std::true_type propagate_on_container_swap;
+
+	ArenaAllocator() : mResource(GetHeapResource()) {}
+	ArenaAllocator(MemoryResource *resource) : mResource(resource) {}
+	template <class U>
+	ArenaAllocator(const ArenaAllocator<U> &other) : mResource(other.GetResource()) {}
+
+	T* allocate(size_t count)
+	{
+		if (count > std::numeric_limits<size_t>::max() / sizeof(T))
+			throw std::bad_alloc();
+		return static_cast<T*>(mResource->Allocate(count * sizeof(T), alignof(T)));
+	}
+	void deallocate(T *p, size_t count) { mResource->Deallocate(p, count * sizeof(T), alignof(T)); }
+
+	ArenaAllocator select_on_container_copy_construction() const { return ArenaAllocator(); }
+	MemoryResource* GetResource() const { return mResource; }
+
+private:
+	MemoryResource *mResource;
+};
+
+template <class T, class U>
+bool operator==(const ArenaAllocator<T> &a, const ArenaAllocator<U> &b) { return a.GetResource() == b.GetResource(); }
+template <class T, class U>
+bool operator!=(const ArenaAllocator<T> &a, const ArenaAllocator<U> &b) { return a.GetResource() != b.GetResource(); }
+
+template <class T>
+using ArenaVector = std::vector<T, ArenaAllocator<T>>;
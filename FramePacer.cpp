@@ -0,0 +1,85 @@
+#include "FramePacer.h"
+
+#include <algorithm>
+#include <cmath>
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+FramePacer::FramePacer(const FrameClock &clock, PresentMode mode, double refreshMs)
+	: mClock(clock)
+	, mMode(mode)
+	, mMarginMs(1.0)
+	, mLastVBlankMs(-1.0)
+	, mRefreshMs(refreshMs)
+	, mTargetMs(-1.0)
+	, mFrameStartMs(0.0)
+	, mMeanMs(0.0)
+	, mDeviationMs(0.0)
+	, mHasSample(false)
+	, mLateFrames(0)
+{
+}
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+void FramePacer::OnVBlank(double vblankMs)
+{
+	if (vblankMs <= mLastVBlankMs)
+		return;
+
+	if (mLastVBlankMs >= 0.0)
+	{
+		// reported vblanks can be several intervals apart: a gap well under the interval means the guess was too
+		// long, otherwise the gap divided by the whole intervals in it refines the estimate
+		double gapMs = vblankMs - mLastVBlankMs;
+		if (gapMs < 0.75 * mRefreshMs)
+			mRefreshMs = gapMs;
+		else
+		{
+			double sampleMs = gapMs / std::floor(gapMs / mRefreshMs + 0.5);
+			if (std::fabs(sampleMs - mRefreshMs) < 0.1 * mRefreshMs)
+				mRefreshMs += (sampleMs - mRefreshMs) * 0.1;
+		}
+	}
+	mLastVBlankMs = vblankMs;
+}
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+double FramePacer::ScheduleFrame()
+{
+	double nowMs = mClock.NowMs();
+	if (mMode == Present_Uncapped || mLastVBlankMs < 0.0)
+	{
+		mTargetMs = -1.0;
+		return nowMs;
+	}
+
+	// the vblank is picked with the average cost, so a noisy frame does not skip one it would usually make, and never the
+	// one the previous frame took; the start leaves room for the conservative prediction when there is time for it
+	double readyMs = std::max(nowMs + mMeanMs + mMarginMs, mTargetMs + 0.5 * mRefreshMs);
+	mTargetMs = mLastVBlankMs + std::ceil((readyMs - mLastVBlankMs) / mRefreshMs) * mRefreshMs;
+	return mTargetMs - GetPredictedWorkMs() - mMarginMs;
+}
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+void FramePacer::BeginFrame()
+{
+	mFrameStartMs = mClock.NowMs();
+}
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+void FramePacer::EndFrame()
+{
+	double endMs = mClock.NowMs();
+	double workMs = endMs - mFrameStartMs;
+	if (mTargetMs >= 0.0 && endMs > mTargetMs - mMarginMs)
+	{
+		// past the target the frame is shown at the next vblank, the next one has to aim past that
+		mLateFrames++;
+		mTargetMs = std::max(mTargetMs, mLastVBlankMs + std::ceil((endMs - mLastVBlankMs) / mRefreshMs) * mRefreshMs);
+	}
+
+	// mean and mean deviation like TCP's round trip estimate: a spike widens the prediction within a frame or two
+	if (!mHasSample)
+	{
+		mMeanMs = workMs;
+		mDeviationMs = workMs * 0.5;
+		mHasSample = true;
+		return;
+	}
+	mDeviationMs += (std::fabs(workMs - mMeanMs) - mDeviationMs) * 0.25;
+	mMeanMs += (workMs - mMeanMs) * 0.125;
+}
@@ -0,0 +1,61 @@
+#pragma once
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Just in time frame pacing.
+// The pacer tracks the display's vblank phase and refresh interval from the vblank timestamps it is fed, and a
+// prediction of the frame's CPU work (running mean and mean deviation). ScheduleFrame picks the first vblank the next
+// frame can make on average and returns the moment to start so that even a slow frame (mean plus four deviations)
+// ends a margin before it: input is sampled as late as possible and nothing piles up in the present queue.
+// Uncapped frames start at once.
+// Nothing here knows about DXGI, main.cpp feeds frame statistics and HeadlessMain.cpp a synthetic display.
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+#include "FrameStats.h"
+
+#include <cstdint>
+
+enum PresentMode
+{
+	Present_VSync,      // Present(1, 0) on the blt model chain, up to three frames queued
+	Present_Uncapped,   // Present(0, 0), frames are shown as soon as they are done and tear
+	Present_LowLatency, // flip model with a frame latency waitable object, one frame queued
+};
+
+class FramePacer
+{
+public:
+	// refreshMs is a first guess, vblanks closer than that correct it
+	FramePacer(const FrameClock &clock, PresentMode mode, double refreshMs);
+
+	PresentMode GetMode() const { return mMode; }
+	// frames aim to be done this long before their vblank, it covers Present and the GPU
+	void SetMarginMs(double ms) { mMarginMs = ms; }
+
+	// the latest vblank the display reported; older or repeated timestamps are ignored
+	void OnVBlank(double vblankMs);
+	// when the next frame should start, the current time or earlier means at once
+	double ScheduleFrame();
+	// around the frame's CPU work, BeginFrame after waiting for the scheduled start
+	void BeginFrame();
+	void EndFrame();
+
+	double GetRefreshMs() const { return mRefreshMs; }
+	double GetPredictedWorkMs() const { return mMeanMs + 4.0 * mDeviationMs; }
+	// the vblank the last scheduled frame aims for, negative until the first vblank is known
+	double GetTargetMs() const { return mTargetMs; }
+	// frames that ended after the margin before their target
+	uint64_t GetLateFrames() const { return mLateFrames; }
+
+private:
+	const FrameClock &mClock;
+	PresentMode      mMode;
+	double           mMarginMs;
+
+	double mLastVBlankMs; // negative until OnVBlank
+	double mRefreshMs;
+	double mTargetMs;
+
+	double   mFrameStartMs;
+	double   mMeanMs;
+	double   mDeviationMs;
+	bool     mHasSample;
+	uint64_t mLateFrames;
+};
@@ -0,0 +1,205 @@
+#include "FrameStats.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+double SteadyFrameClock::NowMs() const
+{
+	std::chrono::duration<double, std::milli> now = std::chrono::steady_clock::now().time_since_epoch();
+	return now.count();
+}
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+FrameStats::FrameStats(const FrameClock &clock)
+	: mClock(clock)
+	, mWritten(0)
+	, mFrameIndex(0)
+	, mFrameStart(0.0)
+	, mSubmitEnd(0.0)
+	, mLastPresentEnd(-1.0)
+	, mTitleIntervalMs(250.0)
+	, mLastTitleUpdate(-1.0)
+	, mExportFile(nullptr)
+	, mExportFormat(FrameStats_CSV)
+	, mExportIntervalMs(1000.0)
+	, mLastExport(0.0)
+{
+	for (size_t i = 0; i < kSlots; i++)
+		mGpuMs[i].store(-1.0f, std::memory_order_relaxed);
+}
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+FrameStats::~FrameStats()
+{
+	if (mExportFile)
+		fclose(mExportFile);
+}
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+void FrameStats::BeginFrame()
+{
+	mFrameIndex = mWritten.load(std::memory_order_relaxed);
+	mFrameStart = mClock.NowMs();
+	mSubmitEnd = mFrameStart;
+}
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+void FrameStats::EndSubmit()
+{
+	mSubmitEnd = mClock.NowMs();
+}
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+void FrameStats::EndPresent()
+{
+	double now = mClock.NowMs();
+
+	FrameTimes &sample = mSamples[mFrameIndex % kSlots];
+	// the very first frame has no previous present, its own duration is the best guess
+	sample.frameMs = static_cast<float>(now - (mLastPresentEnd < 0.0 ? mFrameStart : mLastPresentEnd));
+	sample.cpuSubmitMs = static_cast<float>(mSubmitEnd - mFrameStart);
+	sample.presentWaitMs = static_cast<float>(now - mSubmitEnd);
+	mGpuMs[mFrameIndex % kSlots].store(-1.0f, std::memory_order_relaxed);
+	mWritten.store(mFrameIndex + 1, std::memory_order_release);
+	mLastPresentEnd = now;
+
+	if (mExportFile && now - mLastExport >= mExportIntervalMs)
+	{
+		mLastExport = now;
+		Export();
+	}
+}
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+void FrameStats::ReportGpuTime(uint64_t frame, float ms)
+{
+	uint64_t written = mWritten.load(std::memory_order_relaxed);
+	if (frame < written && written - frame <= kWindowSize)
+		mGpuMs[frame % kSlots].store(ms, std::memory_order_relaxed);
+}
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+FrameTimes FrameStats::GetLastFrame() const
+{
+	size_t slot = static_cast<size_t>((mWritten.load(std::memory_order_relaxed) - 1) % kSlots);
+	FrameTimes times = mSamples[slot];
+	times.gpuMs = mGpuMs[slot].load(std::memory_order_relaxed);
+	return times;
+}
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// nearest-rank percentile of sorted values
+static float Percentile(const float *values, size_t count, double p)
+{
+	size_t rank = static_cast<size_t>(std::ceil(p * count));
+	return values[std::min(count, std::max<size_t>(rank, 1)) - 1];
+}
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+FrameSummary FrameStats::Summarize() const
+{
+	FrameTimes copy[kWindowSize];
+	uint64_t end = mWritten.load(std::memory_order_acquire);
+	uint64_t begin = end > kWindowSize ? end - kWindowSize : 0;
+	for (uint64_t i = begin; i < end; i++)
+	{
+		copy[i - begin] = mSamples[i % kSlots];
+		copy[i - begin].gpuMs = mGpuMs[i % kSlots].load(std::memory_order_relaxed);
+	}
+
+	// the writer may have lapped the oldest slots while they were copied, and it may be writing frame after over the
+	// slot of frame after - kSlots right now. The fence keeps the copy above from moving past the second read.
+	std::atomic_thread_fence(std::memory_order_acquire);
+	uint64_t after = mWritten.load(std::memory_order_relaxed);
+	uint64_t first = after + 1 > kSlots + begin ? after + 1 - kSlots : begin;
+	const FrameTimes *samples = copy + (std::min(first, end) - begin);
+	size_t count = static_cast<size_t>(end - std::min(first, end));
+
+	FrameSummary summary = {};
+	summary.frames = count;
+	summary.gpuMs = -1.0f;
+	if (!count)
+		return summary;
+
+	float sorted[kWindowSize];
+	double total = 0.0, jitter = 0.0, submit = 0.0, present = 0.0, gpu = 0.0;
+	size_t gpuFrames = 0;
+	for (size_t i = 0; i < count; i++)
+	{
+		sorted[i] = samples[i].frameMs;
+		total += samples[i].frameMs;
+		submit += samples[i].cpuSubmitMs;
+		present += samples[i].presentWaitMs;
+		if (i > 0)
+			jitter += std::fabs(samples[i].frameMs - samples[i - 1].frameMs);
+		if (samples[i].gpuMs >= 0.0f)
+		{
+			gpu += samples[i].gpuMs;
+			gpuFrames++;
+		}
+	}
+	std::sort(sorted, sorted + count);
+
+	summary.avgMs = static_cast<float>(total / count);
+	summary.p50Ms = Percentile(sorted, count, 0.50);
+	summary.p95Ms = Percentile(sorted, count, 0.95);
+	summary.p99Ms = Percentile(sorted, count, 0.99);
+	summary.maxMs = sorted[count - 1];
+	summary.jitterMs = count > 1 ? static_cast<float>(jitter / (count - 1)) : 0.0f;
+	summary.cpuSubmitMs = static_cast<float>(submit / count);
+	summary.presentWaitMs = static_cast<float>(present / count);
+	if (gpuFrames)
+		summary.gpuMs = static_cast<float>(gpu / gpuFrames);
+	return summary;
+}
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+bool FrameStats::TitleUpdateDue()
+{
+	double now = mClock.NowMs();
+	if (mLastTitleUpdate < 0.0)
+	{
+		mLastTitleUpdate = now;
+		return false;
+	}
+	if (now - mLastTitleUpdate < mTitleIntervalMs)
+		return false;
+	mLastTitleUpdate = now;
+	return true;
+}
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+int FrameStats::FormatTitle(char *buffer, size_t size, const char *prefix) const
+{
+	FrameSummary s = Summarize();
+	float fps = s.avgMs > 0.0f ? 1000.0f / s.avgMs : 0.0f;
+	return snprintf(buffer, size, "%s FPS: %6.0f  p50 %.2f  p99 %.2f  max %.2f ms  cpu %.2f ms",
+		prefix, fps, s.p50Ms, s.p99Ms, s.maxMs, s.cpuSubmitMs);
+}
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+bool FrameStats::EnableExport(const char *path, FrameStatsFormat format, double intervalMs)
+{
+	if (mExportFile)
+		fclose(mExportFile);
+
+	mExportFile = fopen(path, "a");
+	if (!mExportFile)
+		return false;
+
+	mExportFormat = format;
+	mExportIntervalMs = intervalMs;
+	mLastExport = mClock.NowMs();
+
+	fseek(mExportFile, 0, SEEK_END);
+	if (format == FrameStats_CSV && ftell(mExportFile) == 0)
+		fprintf(mExportFile, "time_ms,frame,frames,avg_ms,p50_ms,p95_ms,p99_ms,max_ms,jitter_ms,cpu_submit_ms,present_wait_ms,gpu_ms\n");
+	return true;
+}
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+void FrameStats::Export()
+{
+	FrameSummary s = Summarize();
+	unsigned long long frame = static_cast<unsigned long long>(mFrameIndex);
+	if (mExportFormat == FrameStats_CSV)
+	{
+		fprintf(mExportFile, "%.3f,%llu,%zu,%.4f,%.4f,%.4f,%.4f,%.4f,%.4f,%.4f,%.4f,%.4f\n",
+			mLastExport, frame, s.frames, s.avgMs, s.p50Ms, s.p95Ms, s.p99Ms, s.maxMs, s.jitterMs, s.cpuSubmitMs, s.presentWaitMs, s.gpuMs);
+	}
+	else
+	{
+		fprintf(mExportFile, "{\"time_ms\":%.3f,\"frame\":%llu,\"frames\":%zu,\"avg_ms\":%.4f,\"p50_ms\":%.4f,\"p95_ms\":%.4f,"
+			"\"p99_ms\":%.4f,\"max_ms\":%.4f,\"jitter_ms\":%.4f,\"cpu_submit_ms\":%.4f,\"present_wait_ms\":%.4f,\"gpu_ms\":%.4f}\n",
+			mLastExport, frame, s.frames, s.avgMs, s.p50Ms, s.p95Ms, s.p99Ms, s.maxMs, s.jitterMs, s.cpuSubmitMs, s.presentWaitMs, s.gpuMs);
+	}
+	fflush(mExportFile);
+}
@@ -0,0 +1,110 @@
+#pragma once
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Frame-time statistics for the main loop.
+// The render thread brackets every frame with BeginFrame / EndSubmit / EndPresent, samples go to a fixed rolling
+// window that other threads can summarize without locks. Title updates and CSV / JSON export are throttled here,
+// so the hot path never formats strings or touches the window title. The clock is injected, a synthetic clock
+// makes the numbers fully deterministic.
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+
+class FrameClock
+{
+public:
+	virtual ~FrameClock() {}
+	virtual double NowMs() const = 0;
+};
+
+class SteadyFrameClock : public FrameClock
+{
+public:
+	double NowMs() const override;
+};
+
+struct FrameTimes
+{
+	float frameMs;       // EndPresent to EndPresent
+	float cpuSubmitMs;   // BeginFrame to EndSubmit
+	float presentWaitMs; // EndSubmit to EndPresent
+	float gpuMs;         // negative until ReportGpuTime
+};
+
+struct FrameSummary
+{
+	size_t frames; // samples in the window
+	float  avgMs, p50Ms, p95Ms, p99Ms, maxMs;
+	float  jitterMs; // mean absolute difference between consecutive frame times
+	float  cpuSubmitMs, presentWaitMs;
+	float  gpuMs; // average over frames with a GPU time, negative if none
+};
+
+enum FrameStatsFormat
+{
+	FrameStats_CSV,
+	FrameStats_JSON, // one object per line
+};
+
+class FrameStats
+{
+public:
+	static const size_t kWindowSize = 256;
+
+	explicit FrameStats(const FrameClock &clock);
+	~FrameStats();
+
+	// render thread, in this order once per frame
+	void BeginFrame();
+	void EndSubmit();
+	void EndPresent();
+
+	// render thread, GPU spans usually arrive a few frames late; ignored if the frame already left the window
+	void ReportGpuTime(uint64_t frame, float ms);
+	// index of the frame opened by the last BeginFrame, starting at 0
+	uint64_t GetFrameIndex() const { return mFrameIndex; }
+	// render thread, the frame closed by the last EndPresent; only valid after the first one
+	FrameTimes GetLastFrame() const;
+
+	// any thread, no locks and no allocations
+	FrameSummary Summarize() const;
+
+	// true at most once per interval, the first call after construction only starts the interval
+	void SetTitleInterval(double ms) { mTitleIntervalMs = ms; }
+	bool TitleUpdateDue();
+	// snprintf semantics
+	int FormatTitle(char *buffer, size_t size, const char *prefix) const;
+
+	// appends one summary line per interval to path, returns false if the file cannot be opened
+	bool EnableExport(const char *path, FrameStatsFormat format, double intervalMs);
+
+private:
+	FrameStats(const FrameStats&);
+	FrameStats& operator=(const FrameStats&);
+
+	void Export();
+
+	const FrameClock &mClock;
+
+	// single writer ring: a slot is published by bumping mWritten, readers drop slots that were overwritten meanwhile.
+	// One slot more than the window, the one EndPresent may be writing while a reader copies the window.
+	// The GPU times arrive after their frame was published, they are kept apart in atomics; mSamples' gpuMs is unused
+	static const size_t kSlots = kWindowSize + 1;
+	FrameTimes            mSamples[kSlots];
+	std::atomic<float>    mGpuMs[kSlots];
+	std::atomic<uint64_t> mWritten;
+
+	uint64_t mFrameIndex;
+	double   mFrameStart;
+	double   mSubmitEnd;
+	double   mLastPresentEnd;
+
+	double mTitleIntervalMs;
+	double mLastTitleUpdate;
+
+	FILE            *mExportFile;
+	FrameStatsFormat mExportFormat;
+	double           mExportIntervalMs;
+	double           mLastExport;
+};
@@ -0,0 +1,4472 @@
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Headless entry point: renders the main.cpp scene with the CPU backend, no window and no GPU needed.
+// Built from every translation unit except the Win32 main.cpp:
+//   g++ -std=c++14 -O2 -mavx2 -mfma -pthread -DCOUNT_HEAP_ALLOCATIONS $(ls *.cpp | grep -vx main.cpp) -o DXMinimalAppHeadless
+//   DXMinimalAppHeadless -frames 100 -threads 4 -out frame.ppm -stats frames.csv
+//   DXMinimalAppHeadless -frames 100 -trace frames.json (Chrome trace-event JSON, debug builds)
+//   DXMinimalAppHeadless -instances 10000 -draw instanced -sort depth -textures 16
+//   DXMinimalAppHeadless -bench scene -instances 5000 -draw perobject -texsize 1024 -frames 300 -warmup 30 -json result.json
+//   DXMinimalAppHeadless -bench instancing
+//   DXMinimalAppHeadless -bench ring
+//   DXMinimalAppHeadless -bench framestats
+//   DXMinimalAppHeadless -bench shadercache
+//   DXMinimalAppHeadless -bench permutations
+//   DXMinimalAppHeadless -bench statefilter
+//   DXMinimalAppHeadless -bench jobs -threads 8
+//   DXMinimalAppHeadless -bench simulation
+//   DXMinimalAppHeadless -bench transforms
+//   DXMinimalAppHeadless -bench culling
+//   DXMinimalAppHeadless -bench mesh
+//   DXMinimalAppHeadless -bench texture -threads 8
+//   DXMinimalAppHeadless -bench streaming
+//   DXMinimalAppHeadless -bench taskgraph -threads 8
+//   DXMinimalAppHeadless -bench pacing
+//   DXMinimalAppHeadless -bench resolution -frametimes frametimes.txt
+//   DXMinimalAppHeadless -bench loop
+//   DXMinimalAppHeadless -bench arena -threads 8
+//   DXMinimalAppHeadless -bench statecache -threads 8
+//   DXMinimalAppHeadless -bench renderqueue
+//   DXMinimalAppHeadless -bench atlas
+//   DXMinimalAppHeadless -bench rendergraph
+//   DXMinimalAppHeadless -bench trace
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+#include "AssetStreamer.h"
+#include "Culling.h"
+#include "FrameArena.h"
+#include "FramePacer.h"
+#include "FrameStats.h"
+#include "InstanceBatcher.h"
+#include "JobSystem.h"
+#include "LoopScheduler.h"
+#include "Mesh.h"
+#include "RenderGraph.h"
+#include "RenderQueue.h"
+#include "ResolutionScaler.h"
+#include "ShaderCache.h"
+#include "ShaderPermutations.h"
+#include "Simulation.h"
+#include "SoftRasterizer.h"
+#include "StateCache.h"
+#include "StateFilter.h"
+#include "TaskGraph.h"
+#include "Texture.h"
+#include "TextureAtlas.h"
+#include "Trace.h"
+#include "TransformStore.h"
+#include "UploadRing.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <condition_variable>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <map>
+#include <mutex>
+#include <set>
+#include <string>
+#include <thread>
+#include <vector>
+
+#if defined(_WIN32)
+#include <windows.h>
+#include <psapi.h>
+#pragma comment(lib, "psapi.lib")
+#else
+#include <sys/resource.h>
+#include <unistd.h>
+#endif
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+const int gWidth = 600;
+const int gHeight = 450;
+
+bool gUseInstancing = true;
+int  gInstancesCount = 2; // the two main.cpp quads, extra copies go to a grid behind them
+int  gTexturesCount = 1;  // checkers spread over the objects, like main.cpp -textures
+
+const float gNearZ = 0.1f;
+const float gFarZ = 100.0f;
+bool        gSortDraws = true;
+DrawOrder   gOpaqueOrder = Order_State;
+
+// binning is reported as CPU submit and Flush as present wait
+SteadyFrameClock gFrameClock;
+FrameStats       gFrameStats(gFrameClock);
+
+// headless frames are exactly one simulation step apart whatever they cost, so the output is reproducible
+class SteppedClock : public FrameClock
+{
+public:
+	SteppedClock() : mNowMs(0.0) {}
+	double NowMs() const override { return mNowMs; }
+	void Advance(double ms) { mNowMs += ms; }
+
+private:
+	double mNowMs;
+};
+
+SteppedClock gSimulationClock;
+const double gSimulationStepMs = 1000.0 / 60.0;
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+struct HeadlessScene
+{
+	std::vector<SoftVertex>  vertices;
+	std::vector<uint32_t>    indices;
+	Aabb                     bounds;
+	std::vector<uint32_t>    checker;      // the slices one after the other
+	uint32_t                 checkerSize;
+	std::vector<TextureSlot> checkerSlots; // per checker, all in array 0
+	Mat4                     projMat;
+	Mat4                     viewMat;
+};
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// same as GetCheckerTint
+uint32_t GetCheckerTint(uint32_t checker)
+{
+	return checker ? 0xFF404040 | (checker * 2654435761u) >> 8 : 0xFFFFFFFF;
+}
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// same data as CreateGeometry, CreateDefaultTexture and CreateCBuffers; other checker sizes keep 8 x 8 cells and are
+// cached as Checker<size>.dds
+bool CreateScene(HeadlessScene &scene, uint32_t checkerSize = 8)
+{
+	// the same Quad.dxmesh as main.cpp, decoded back to floats for the rasterizer
+	const MeshVertex vBuf[] = {
+		{ -1.0f, -1.0f, 0.0f, 0.0f, 0.0f, }, { -1.0f, 1.0f, 0.0f, 0.0f, 1.0f }, { 1.0f, 1.0f, 0.0f, 1.0f, 1.0f },
+		{ 1.0f, 1.0f, 0.0f, 1.0f, 1.0f }, { 1.0f, -1.0f, 0.0f, 1.0f, 0.0f }, { -1.0f, -1.0f, 0.0f, 0.0f, 0.0f } };
+	MeshFile mesh;
+	std::vector<MeshVertex> vertices;
+	if (!OpenOrBuildMesh(mesh, "Quad.dxmesh", vBuf, sizeof(vBuf) / sizeof(vBuf[0])) || !mesh.Decode(vertices, scene.indices))
+	{
+		fprintf(stderr, "failed to load Quad.dxmesh\n");
+		return false;
+	}
+	scene.vertices.resize(vertices.size());
+	memcpy(scene.vertices.data(), vertices.data(), vertices.size() * sizeof(SoftVertex));
+	scene.bounds.min = mesh.GetBoundsMin();
+	scene.bounds.max = mesh.GetBoundsMax();
+
+	// the same Checker.dds and CheckerTint<N>.dds as well, the rasterizer only samples the top level
+	const uint32_t iWidth = std::max(checkerSize, 8u);
+	const uint32_t iHeight = iWidth;
+	const uint32_t cell = iWidth / 8;
+	const uint32_t checkersCount = static_cast<uint32_t>(gTexturesCount);
+	TextureArrayAllocator arrays;
+	std::vector<uint32_t> checker(iWidth * iHeight);
+	scene.checker.resize(size_t(checkersCount) * iWidth * iHeight);
+	scene.checkerSize = iWidth;
+	scene.checkerSlots.resize(checkersCount);
+	for (uint32_t c = 0; c < checkersCount; c++)
+	{
+		for (uint32_t i = 0; i < iHeight; i++)
+			for (uint32_t j = 0; j < iWidth; j++)
+				checker[i * iWidth + j] = ((j / cell + i / cell) % 2) ? GetCheckerTint(c) : 0x00000000;
+		char path[32] = "Checker.dds";
+		if (iWidth != 8)
+			snprintf(path, sizeof(path), c ? "Checker%uTint%u.dds" : "Checker%u.dds", iWidth, c);
+		else if (c)
+			snprintf(path, sizeof(path), "CheckerTint%u.dds", c);
+		DdsFile texture;
+		TextureSlot &slot = scene.checkerSlots[c];
+		if (!OpenOrBuildTexture(texture, path, checker.data(), iWidth, iHeight, Texture_BC1, nullptr) ||
+			texture.GetWidth() != iWidth || texture.GetHeight() != iHeight)
+		{
+			fprintf(stderr, "failed to load %s\n", path);
+			return false;
+		}
+		TextureArrayDesc layout = { texture.GetFormat(), iWidth, iHeight, texture.GetMipCount() };
+		if (!arrays.Allocate(layout, slot) || slot.array != 0 ||
+			!DecompressBlocks(static_cast<const unsigned char*>(texture.GetLevel(0).data), iWidth, iHeight, texture.GetFormat(),
+				&scene.checker[size_t(slot.slice) * iWidth * iHeight]))
+		{
+			fprintf(stderr, "failed to load %s\n", path);
+			return false;
+		}
+	}
+
+	scene.projMat = MatPerspectiveFovLH(ToRadians(45.0f), static_cast<float>(gWidth) / gHeight, gNearZ, gFarZ);
+
+	Vec3 target = { 0.0f, 0.0f, 1.0f };
+	Vec3 pos = { 0.0f, 0.0f, -5.0f };
+	Vec3 up = { 0.0f, 1.0f, 0.0f };
+	scene.viewMat = MatLookAtLH(pos, target, up);
+	return true;
+}
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// what SetTexture takes for a slice of the checker array
+SoftTexture GetCheckerSlice(const HeadlessScene &scene, uint32_t slice)
+{
+	SoftTexture texture = { scene.checkerSize, scene.checkerSize, &scene.checker[size_t(slice) * scene.checkerSize * scene.checkerSize] };
+	return texture;
+}
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// same as GetObjectTexture
+uint32_t GetObjectTexture(const HeadlessScene &scene, uint32_t object)
+{
+	return scene.checkerSlots[object % scene.checkerSlots.size()].slice;
+}
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// stands in for D3DStateSink, counts what would reach the device context
+class RecordingStateSink : public StateSink
+{
+public:
+	RecordingStateSink() : mCalls(0), mSlots(0), mLastStart(0), mLastCount(0) {}
+
+	void SetShader(ShaderStage, const void*) override { mCalls++; }
+	void SetInputLayout(const void*) override { mCalls++; }
+	void SetPrimitiveTopology(unsigned) override { mCalls++; }
+	void SetVertexBuffers(unsigned start, unsigned count, const void *const*, const unsigned*, const unsigned*) override { Record(start, count); }
+	void SetIndexBuffer(const void*, unsigned, unsigned) override { mCalls++; }
+	void SetConstantBuffers(ShaderStage, unsigned start, unsigned count, const void *const*, const unsigned*, const unsigned*) override { Record(start, count); }
+	void SetSamplers(ShaderStage, unsigned start, unsigned count, const void *const*) override { Record(start, count); }
+	void SetShaderResources(ShaderStage, unsigned start, unsigned count, const void *const*) override { Record(start, count); }
+
+	unsigned GetCalls() const { return mCalls; }
+	unsigned GetSlots() const { return mSlots; }
+	// the slots of the last slot array call
+	unsigned GetLastStart() const { return mLastStart; }
+	unsigned GetLastCount() const { return mLastCount; }
+
+private:
+	void Record(unsigned start, unsigned count) { mCalls++; mSlots += count; mLastStart = start; mLastCount = count; }
+
+	unsigned mCalls;
+	unsigned mSlots;
+	unsigned mLastStart;
+	unsigned mLastCount;
+};
+
+// RenderTick makes the binding calls of main.cpp on stand-in objects: the rasterizer has no pipeline state, but the
+// benchmark reports the state calls and draws the D3D path would issue for the same frame
+RecordingStateSink gStateSink;
+StateFilter        gStateFilter(gStateSink);
+uint64_t           gDrawCalls = 0;
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// CPU counterpart of D3DInstanceBackend: the instance buffer is plain memory and every instance is a Draw of its slice
+class SoftInstanceBackend : public InstanceBackend
+{
+public:
+	SoftInstanceBackend(SoftRasterizer &rasterizer, const HeadlessScene &scene, size_t capacity)
+		: mRasterizer(rasterizer), mScene(scene), mInstances(capacity) {}
+
+	size_t GetInstanceCapacity() const override { return mInstances.size(); }
+	InstanceData* MapInstances(size_t count) override { return count <= mInstances.size() ? &mInstances[0] : nullptr; }
+	void UnmapInstances() override {}
+
+	void DrawInstanced(size_t verticesCount, size_t instanceCount) override
+	{
+		TRACE_SCOPE("draw instanced");
+		gStateFilter.Apply();
+		gDrawCalls++;
+		for (size_t i = 0; i < instanceCount; i++)
+		{
+			mRasterizer.SetTexture(GetCheckerSlice(mScene, mInstances[i].texture));
+			mRasterizer.DrawIndexed(mScene.vertices.data(), mScene.vertices.size(), mScene.indices.data(), verticesCount,
+				reinterpret_cast<const Mat4&>(mInstances[i].world));
+		}
+	}
+
+private:
+	SoftRasterizer            &mRasterizer;
+	const HeadlessScene       &mScene;
+	std::vector<InstanceData> mInstances;
+};
+
+// only packs the instances, measures the CPU side of the instanced path
+class NullInstanceBackend : public InstanceBackend
+{
+public:
+	explicit NullInstanceBackend(size_t capacity) : mInstances(capacity), mDrawCalls(0) {}
+
+	size_t GetInstanceCapacity() const override { return mInstances.size(); }
+	InstanceData* MapInstances(size_t count) override { return count <= mInstances.size() ? &mInstances[0] : nullptr; }
+	void UnmapInstances() override {}
+	void DrawInstanced(size_t, size_t) override { mDrawCalls++; }
+
+	size_t GetDrawCalls() const { return mDrawCalls; }
+
+private:
+	std::vector<InstanceData> mInstances;
+	size_t                    mDrawCalls;
+};
+
+// keeps what every draw was given: its vertex count and a copy of the instances it was mapped
+class RecordingInstanceBackend : public InstanceBackend
+{
+public:
+	explicit RecordingInstanceBackend(size_t capacity) : mInstances(capacity) {}
+
+	size_t GetInstanceCapacity() const override { return mInstances.size(); }
+	InstanceData* MapInstances(size_t count) override { return count <= mInstances.size() ? &mInstances[0] : nullptr; }
+	void UnmapInstances() override {}
+	void DrawInstanced(size_t verticesCount, size_t instanceCount) override
+	{
+		mDrawVertices.push_back(verticesCount);
+		mDrawn.insert(mDrawn.end(), mInstances.begin(), mInstances.begin() + instanceCount);
+	}
+
+	const std::vector<size_t>& GetDrawVertices() const { return mDrawVertices; }
+	const std::vector<InstanceData>& GetDrawn() const { return mDrawn; }
+
+private:
+	std::vector<InstanceData> mInstances;
+	std::vector<size_t>       mDrawVertices;
+	std::vector<InstanceData> mDrawn;
+};
+
+// same capacity as gMaxInstances in main.cpp
+const size_t gMaxInstances = 4096;
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+Mat4 GridInstanceMatrix(int instance, const Mat4 &rotation)
+{
+	Vec3 position = SceneGridPosition(instance);
+	return MatMultiply(rotation, MatTranslation(position.x, position.y, position.z));
+}
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// same as CullObjects, local is the mesh bounds
+void CullObjects(const TransformStore &transforms, const Aabb &local, const Frustum &frustum, Bvh &bvh, std::vector<uint32_t> &proxies,
+	std::vector<Aabb> &bounds, ArenaVector<uint32_t> &visible)
+{
+	size_t count = transforms.GetCount();
+	bounds.resize(count);
+	ComputeBounds(transforms, 0, count, local, bounds.data());
+
+	for (size_t i = proxies.size(); i < count; i++)
+		proxies.push_back(bvh.Insert(bounds[i], static_cast<uint32_t>(i)));
+	for (size_t i = 0; i < count; i++)
+		bvh.Move(proxies[i], bounds[i]);
+	bvh.Refit();
+
+	// back to object order, the two quads at the origin depend on it with the depth test and the draw sort is stable;
+	// reserved for every object, a frame arena vector that grows leaves its old buffers behind
+	visible.clear();
+	visible.reserve(count);
+	bvh.Cull(frustum, visible);
+	std::sort(visible.begin(), visible.end());
+}
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// same as SortVisibleObjects
+void SortVisibleObjects(const HeadlessScene &scene, const TransformStore &transforms, const Mat4 &viewProj, RenderQueue &queue,
+	ArenaVector<uint32_t> &visible)
+{
+	if (!gSortDraws)
+		return;
+
+	const float *x = transforms.GetComponent(TransformStore::PositionX);
+	const float *y = transforms.GetComponent(TransformStore::PositionY);
+	const float *z = transforms.GetComponent(TransformStore::PositionZ);
+	queue.Clear();
+	queue.Reserve(visible.size());
+	for (size_t i = 0; i < visible.size(); i++)
+	{
+		uint32_t object = visible[i];
+		float depth = x[object] * viewProj.m[0][3] + y[object] * viewProj.m[1][3] + z[object] * viewProj.m[2][3] + viewProj.m[3][3];
+		queue.Add(MakeSortKey(0, gOpaqueOrder, 0, GetObjectTexture(scene, object), QuantizeDepth(depth, gNearZ, gFarZ)), object);
+	}
+	queue.Sort();
+	for (size_t i = 0; i < visible.size(); i++)
+		visible[i] = queue[i].payload;
+}
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// the objects main.cpp binds
+struct StandInObjects
+{
+	char vs, vsInstanced, ps, layout, layoutInstanced, vertices, indices, instances, uploadBuffer, sampler, texture;
+	char upscaleVS, upscalePS, upscaleConstants, upscaleSampler;
+} gStandIns;
+
+// the bindings shared by RenderTickInstanced and RenderTickPerObject
+void BindSceneState(bool instanced)
+{
+	const unsigned strides[2] = { sizeof(MeshVertexQuantized), sizeof(InstanceData) };
+	const unsigned offsets[2] = { 0, 0 };
+	const void *buffers[2] = { &gStandIns.vertices, &gStandIns.instances };
+	const void *sampler = &gStandIns.sampler;
+	const void *texture = &gStandIns.texture;
+	gStateFilter.SetShader(Stage_Vertex, instanced ? &gStandIns.vsInstanced : &gStandIns.vs);
+	gStateFilter.SetShader(Stage_Pixel, &gStandIns.ps);
+	gStateFilter.SetInputLayout(instanced ? &gStandIns.layoutInstanced : &gStandIns.layout);
+	gStateFilter.SetIndexBuffer(&gStandIns.indices, 57, 0); // DXGI_FORMAT_R16_UINT
+	gStateFilter.SetVertexBuffers(0, instanced ? 2 : 1, buffers, strides, offsets);
+	gStateFilter.SetPrimitiveTopology(4); // D3D11_PRIMITIVE_TOPOLOGY_TRIANGLELIST
+	gStateFilter.SetSamplers(Stage_Pixel, 0, 1, &sampler);
+	// the per-object draws bind their slice each
+	if (instanced)
+		gStateFilter.SetShaderResources(Stage_Pixel, 0, 1, &texture);
+}
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// UpscaleScene's draw, the rasterizer renders at the output size and has nothing to stretch
+void BindUpscaleState()
+{
+	TRACE_SCOPE("upscale");
+	const void *constants = &gStandIns.upscaleConstants;
+	const void *sampler = &gStandIns.upscaleSampler;
+	gStateFilter.SetShader(Stage_Vertex, &gStandIns.upscaleVS);
+	gStateFilter.SetShader(Stage_Pixel, &gStandIns.upscalePS);
+	gStateFilter.SetInputLayout(nullptr);
+	gStateFilter.SetPrimitiveTopology(4);
+	gStateFilter.SetConstantBuffers(Stage_Vertex, 0, 1, &constants);
+	gStateFilter.SetConstantBuffers(Stage_Pixel, 0, 1, &constants);
+	gStateFilter.SetSamplers(Stage_Pixel, 0, 1, &sampler);
+	gStateFilter.Apply();
+	gDrawCalls++;
+}
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// D3DRenderTargetFactory without a device: a copy of the desc stands in for the texture and its views
+class StandInTargetFactory : public RenderTargetFactory
+{
+public:
+	StandInTargetFactory() : mCreated(0), mLiveBytes(0) {}
+
+	void* CreateTarget(const RenderTargetDesc &desc, unsigned) override
+	{
+		mCreated++;
+		mLiveBytes += uint64_t(desc.width) * desc.height * desc.bytesPerTexel;
+		return new RenderTargetDesc(desc);
+	}
+
+	void ReleaseTarget(void *target) override
+	{
+		RenderTargetDesc *desc = static_cast<RenderTargetDesc*>(target);
+		mLiveBytes -= uint64_t(desc->width) * desc->height * desc->bytesPerTexel;
+		delete desc;
+	}
+
+	uint64_t GetCreatedCount() const { return mCreated; }
+	uint64_t GetLiveBytes() const { return mLiveBytes; }
+
+private:
+	uint64_t mCreated;
+	uint64_t mLiveBytes;
+};
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// same as D3DRenderGraphBackend; the rasterizer has one color and one depth buffer that stand in for every target, so
+// a pass's clears become one Clear
+class SoftRenderGraphBackend : public RenderGraphBackend
+{
+public:
+	SoftRenderGraphBackend(SoftRasterizer &rasterizer, const RenderTargetPool &targets)
+		: mRasterizer(rasterizer), mTargets(targets)
+	{
+	}
+
+	void BeginPass(const RenderGraph &graph, RenderPassId pass) override
+	{
+		const std::vector<RenderResourceId> &clears = graph.GetClears(pass);
+		float color[4] = { 0.0f, 0.0f, 0.0f, 0.0f };
+		float depth = 1.0f;
+		for (size_t i = 0; i < clears.size(); i++)
+		{
+			const RenderTargetDesc &desc = graph.GetDesc(clears[i]);
+			if (desc.depth)
+				depth = desc.clear[0];
+			else
+				memcpy(color, desc.clear, sizeof(color));
+		}
+		if (!clears.empty())
+			mRasterizer.Clear(color, depth);
+
+		const std::vector<RenderResourceId> &reads = graph.GetReads(pass);
+		for (size_t i = 0; i < reads.size(); i++)
+		{
+			const void *view = mTargets.GetTargetOf(graph, reads[i]);
+			gStateFilter.SetShaderResources(Stage_Pixel, static_cast<unsigned>(i), 1, &view);
+		}
+	}
+
+	void EndPass(const RenderGraph &graph, RenderPassId pass) override
+	{
+		const void *noView = nullptr;
+		for (size_t i = 0; i < graph.GetReads(pass).size(); i++)
+			gStateFilter.SetShaderResources(Stage_Pixel, static_cast<unsigned>(i), 1, &noView);
+		gStateFilter.Apply();
+	}
+
+private:
+	SoftRasterizer         &mRasterizer;
+	const RenderTargetPool &mTargets;
+};
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// what the passes of a frame draw; the graph is built once and RenderTick points it at the frame
+struct HeadlessFrame
+{
+	SoftRasterizer              *rasterizer;
+	const HeadlessScene         *scene;
+	InstanceBatcher             *batcher;
+	InstanceBackend             *backend;
+	const ArenaVector<Mat4>     *worlds;
+	const ArenaVector<uint32_t> *visible;
+};
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// same as DrawScene
+void DrawScene(const HeadlessFrame &frame)
+{
+	const HeadlessScene &scene = *frame.scene;
+	const ArenaVector<Mat4> &worlds = *frame.worlds;
+	const ArenaVector<uint32_t> &visible = *frame.visible;
+	TRACE_SCOPE("scene");
+	BindSceneState(gUseInstancing);
+	if (gUseInstancing)
+	{
+		frame.batcher->Begin();
+		for (size_t i = 0; i < worlds.size(); i++)
+			frame.batcher->Add(worlds[i], GetObjectTexture(scene, visible[i]));
+		frame.batcher->Submit(*frame.backend, scene.indices.size());
+	}
+	else
+	{
+		// every object gets its own window of the upload ring
+		const void *uploadBuffer = &gStandIns.uploadBuffer;
+		const unsigned numConstants = UploadRing::kAlignment / 16;
+		for (size_t i = 0; i < worlds.size(); i++)
+		{
+			TRACE_SCOPE("draw");
+			// the slice texels stand in for the slice views
+			SoftTexture texture = GetCheckerSlice(scene, GetObjectTexture(scene, visible[i]));
+			const void *view = texture.texels;
+			unsigned firstConstant = static_cast<unsigned>(i) * numConstants;
+			gStateFilter.SetShaderResources(Stage_Pixel, 0, 1, &view);
+			gStateFilter.SetConstantBuffers(Stage_Vertex, 0, 1, &uploadBuffer, &firstConstant, &numConstants);
+			gStateFilter.Apply();
+			gDrawCalls++;
+			frame.rasterizer->SetTexture(texture);
+			frame.rasterizer->DrawIndexed(scene.vertices.data(), scene.vertices.size(), scene.indices.data(), scene.indices.size(), worlds[i]);
+		}
+	}
+}
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// same as CreateSceneTargets, at the output size
+bool CreateFrameGraph(RenderGraph &graph, RenderTargetPool &targets, const HeadlessFrame &frame)
+{
+	RenderTargetDesc colorDesc = { gWidth, gHeight, 28, 4, false, { 0.941176534f, 0.972549081f, 1.0f, 1.0f } }; // DXGI_FORMAT_R8G8B8A8_UNORM
+	RenderTargetDesc depthDesc = { gWidth, gHeight, 45, 4, true, { 1.0f, 0.0f } }; // DXGI_FORMAT_D24_UNORM_S8_UINT
+	RenderTargetDesc backBufferDesc = { gWidth, gHeight, 28, 4, false, {} };
+
+	graph.Clear();
+	RenderResourceId sceneColor = graph.CreateTarget("scene color", colorDesc);
+	RenderResourceId sceneDepth = graph.CreateTarget("scene depth", depthDesc);
+	RenderResourceId backBuffer = graph.ImportTarget("back buffer", backBufferDesc);
+
+	RenderPassId scene = graph.AddPass("scene", [&frame] { DrawScene(frame); });
+	graph.Write(scene, sceneColor);
+	graph.Write(scene, sceneDepth);
+	RenderPassId upscale = graph.AddPass("upscale", [] { BindUpscaleState(); });
+	graph.Read(upscale, sceneColor);
+	graph.Write(upscale, backBuffer);
+
+	return graph.Compile() && targets.Realize(graph);
+}
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// same as RenderTick
+void RenderTick(SoftRasterizer &rasterizer, const HeadlessScene &scene, Simulation &simulation, InstanceBatcher &batcher,
+	InstanceBackend &backend)
+{
+	TRACE_SCOPE("render tick");
+	BeginArenaFrame();
+	gStateFilter.ResetStats();
+
+	// the simulation thread of main.cpp, run inline: one step per frame
+	static TransformStore transforms;
+	{
+		TRACE_SCOPE("simulation");
+		simulation.Step();
+		gSimulationClock.Advance(simulation.GetStepMs());
+		simulation.Interpolate(gSimulationClock.NowMs(), transforms);
+	}
+
+	// only the objects in view get a matrix and a draw; the lists of the frame are made on the frame arena, the tree and
+	// the bounds of every object are kept
+	static Bvh bvh;
+	static std::vector<uint32_t> proxies;
+	static std::vector<Aabb> bounds;
+	LinearArena &arena = GetFrameArena();
+	ArenaVector<uint32_t> visible(&arena);
+	ArenaVector<Mat4> worlds(&arena);
+	RenderQueue queue(&arena);
+	Mat4 viewProj = MatMultiply(scene.viewMat, scene.projMat);
+	{
+		TRACE_SCOPE("cull and sort");
+		CullObjects(transforms, scene.bounds, ExtractFrustum(viewProj), bvh, proxies, bounds, visible);
+		SortVisibleObjects(scene, transforms, viewProj, queue, visible);
+	}
+
+	// premultiplied like ComputeObjectMatrices, the rasterizer's own view and projection are identity
+	worlds.resize(visible.size());
+	{
+		TRACE_SCOPE("object matrices");
+		transforms.ComputeWorldViewProjIndexed(visible.data(), visible.size(), viewProj, worlds.data());
+	}
+
+	// the output size never changes, the graph is compiled on the first frame
+	static HeadlessFrame frame;
+	static StandInTargetFactory targetFactory;
+	static RenderTargetPool targets(targetFactory);
+	static RenderGraph graph;
+	HeadlessFrame current = { &rasterizer, &scene, &batcher, &backend, &worlds, &visible };
+	frame = current;
+	if (!graph.GetPassesCount() && !CreateFrameGraph(graph, targets, frame))
+		return;
+	SoftRenderGraphBackend graphBackend(rasterizer, targets);
+	graph.Execute(graphBackend);
+
+	gFrameStats.EndSubmit();
+	// the rasterizer's Flush is the Present of main.cpp
+	TRACE_SCOPE("present");
+	rasterizer.Flush();
+}
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+bool BenchInstancing()
+{
+	const int counts[] = { 1000, 10000, 100000 };
+	const int iterations = 100;
+	Mat4 rotation = MatRotationAxis(Vec3{ 0.0f, 1.0f, 0.0f }, 0.3f);
+
+	// a known frame: three meshes of 9000, 4096 and 1 instances, each on 5 texture slices, one Submit per mesh, is
+	// 3 + 1 + 1 draws. The instances the draws were mapped must be the ones added, in order, with their slice
+	bool passed = true;
+	{
+		const size_t meshInstances[3] = { 9000, gMaxInstances, 1 };
+		const size_t meshVertices[3] = { 6, 36, 2880 };
+		RecordingInstanceBackend backend(gMaxInstances);
+		InstanceBatcher batcher;
+		std::vector<size_t> expectedDraws;
+		std::vector<Mat4> worlds;
+		std::vector<uint32_t> textures;
+		std::vector<size_t> spots;
+		bool submitted = true;
+		size_t batches = 0;
+		for (int mesh = 0; mesh < 3; mesh++)
+		{
+			// the first and last instance of every buffer-full are spot checked
+			for (size_t first = 0; first < meshInstances[mesh]; first += gMaxInstances)
+			{
+				spots.push_back(worlds.size() + first);
+				spots.push_back(worlds.size() + std::min(first + gMaxInstances, meshInstances[mesh]) - 1);
+				expectedDraws.push_back(meshVertices[mesh]);
+			}
+			batcher.Begin();
+			for (size_t i = 0; i < meshInstances[mesh]; i++)
+			{
+				worlds.push_back(GridInstanceMatrix(static_cast<int>(worlds.size()) + 2, rotation));
+				textures.push_back(static_cast<uint32_t>(worlds.size() % 5));
+				batcher.Add(worlds.back(), textures.back());
+			}
+			submitted = submitted && batcher.Submit(backend, meshVertices[mesh]);
+			batches += batcher.GetBatchesCount();
+		}
+		for (size_t i = 0; i < worlds.size(); i += 997)
+			spots.push_back(i);
+
+		const std::vector<InstanceData> &drawn = backend.GetDrawn();
+		bool packed = drawn.size() == worlds.size();
+		for (size_t s = 0; packed && s < spots.size(); s++)
+		{
+			size_t i = spots[s];
+			packed = !memcmp(drawn[i].world, worlds[i].m, sizeof(drawn[i].world)) && drawn[i].texture == textures[i];
+		}
+		bool counted = submitted && batches == 5 && backend.GetDrawVertices() == expectedDraws;
+		printf("instancing check: %zu instances of 3 meshes in %zu draws, %zu instances spot checked, %s, %s\n", worlds.size(),
+			backend.GetDrawVertices().size(), spots.size(), counted ? "one draw per mesh and buffer-full" : "WRONG DRAWS",
+			packed ? "transforms and slices packed in order" : "WRONG INSTANCE DATA");
+		passed = counted && packed;
+	}
+
+	for (int c = 0; c < 3; c++)
+	{
+		NullInstanceBackend backend(gMaxInstances);
+		InstanceBatcher batcher;
+
+		std::chrono::high_resolution_clock::time_point start = std::chrono::high_resolution_clock::now();
+		for (int it = 0; it < iterations; it++)
+		{
+			batcher.Begin();
+			for (int i = 0; i < counts[c]; i++)
+				batcher.Add(GridInstanceMatrix(i + 2, rotation));
+			batcher.Submit(backend, 6);
+		}
+		std::chrono::duration<double, std::milli> elapsed = std::chrono::high_resolution_clock::now() - start;
+
+		double msPerFrame = elapsed.count() / iterations;
+		printf("instancing %6d instances: %.3f ms/frame, %.2f ns/instance, %zu draw calls/frame\n",
+			counts[c], msPerFrame, msPerFrame * 1e6 / counts[c], backend.GetDrawCalls() / iterations);
+	}
+	return passed;
+}
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+bool BenchUploadRing()
+{
+	// gUploadRingSize from main.cpp, 64 byte per-object constants like CB_Object, three frames in flight
+	const size_t ringSize = 1024 * 1024;
+	const int objectsPerFrame = 1024;
+	const int frames = 2000;
+	const int maxThreads = std::max(1, static_cast<int>(std::thread::hardware_concurrency()));
+
+	// one thread against a model of the GPU running 1 to 4 frames behind, stalled for a while: every 256 byte slot
+	// remembers the frame that wrote it last and may only be handed out again once that frame's fence has retired;
+	// a refused request must have had such a slot in its way, the skipped end of a lap included. Each allocation must
+	// land aligned right after the previous one, or at 0 when the rest of the lap is too short
+	bool passed = true;
+	{
+		const size_t checkSize = 64 * 1024;
+		const uint64_t checkFrames = 2000;
+		UploadRing ring(checkSize);
+		std::vector<uint64_t> owners(checkSize / UploadRing::kAlignment, 0);
+		uint64_t completed = 0, laps = 0, mappedLaps = ~0ull;
+		size_t end = 0; // where the next allocation goes unless the rest of the lap is too short
+		size_t allocations = 0, refused = 0, wraps = 0, discards = 0;
+		size_t misplaced = 0, reused = 0, unjustified = 0, wrongDiscards = 0;
+		uint32_t seed = 99;
+		for (uint64_t frame = 1; frame <= checkFrames; frame++)
+		{
+			// DISCARD on the first frame and after the previous frames crossed the end of the buffer, only then
+			bool discard = ring.BeginFrame();
+			wrongDiscards += discard != (laps != mappedLaps);
+			discards += discard;
+			mappedLaps = laps;
+
+			seed = seed * 1664525u + 1013904223u;
+			int requests = 1 + (seed >> 8) % 24;
+			for (int r = 0; r < requests; r++)
+			{
+				seed = seed * 1664525u + 1013904223u;
+				size_t bytes = 1 + (seed >> 8) % 2048;
+				size_t aligned = (bytes + UploadRing::kAlignment - 1) / UploadRing::kAlignment * UploadRing::kAlignment;
+				bool wrap = end + aligned > checkSize;
+				size_t first = wrap ? 0 : end;
+				bool blocked = false;
+				for (size_t slot = end / UploadRing::kAlignment; wrap && slot < owners.size(); slot++)
+					blocked = blocked || owners[slot] > completed;
+				for (size_t slot = first / UploadRing::kAlignment; slot < (first + aligned) / UploadRing::kAlignment; slot++)
+					blocked = blocked || owners[slot] > completed;
+
+				size_t offset = ring.Allocate(bytes);
+				if (offset == UploadRing::kInvalidOffset)
+				{
+					refused++;
+					unjustified += !blocked;
+					continue;
+				}
+				allocations++;
+				misplaced += offset != first;
+				reused += blocked;
+				for (size_t slot = end / UploadRing::kAlignment; wrap && slot < owners.size(); slot++)
+					owners[slot] = frame;
+				for (size_t slot = first / UploadRing::kAlignment; slot < (first + aligned) / UploadRing::kAlignment; slot++)
+					owners[slot] = frame;
+				wraps += wrap;
+				laps += wrap;
+				end = first + aligned;
+				if (end == checkSize)
+				{
+					end = 0;
+					laps++;
+				}
+			}
+
+			ring.EndFrame(frame);
+			seed = seed * 1664525u + 1013904223u;
+			uint64_t lag = 1 + (seed >> 8) % 4;
+			bool stalled = frame >= 500 && frame < 520;
+			if (!stalled && frame > lag && frame - lag > completed)
+			{
+				completed = frame - lag;
+				ring.Retire(completed);
+			}
+		}
+
+		bool valid = !misplaced && !reused && !unjustified && !wrongDiscards && wraps && refused;
+		printf("ring check %llu frames: %zu allocations, %zu wraps, %zu discards, %zu refused while the GPU was behind; "
+			"%zu misplaced, %zu reused before retiring, %zu refused with room, %zu wrong discards, %s\n",
+			static_cast<unsigned long long>(checkFrames), allocations, wraps, discards, refused, misplaced, reused, unjustified,
+			wrongDiscards, valid ? "as expected" : "RING VIOLATED");
+		passed = valid;
+	}
+
+	for (int threads = 1; threads <= maxThreads; threads *= 2)
+	{
+		UploadRing ring(ringSize);
+		std::vector<unsigned char> memory(ring.GetCapacity());
+
+		// workers fill one frame each generation, the render thread opens and closes frames around them
+		std::mutex mutex;
+		std::condition_variable wakeUp, done;
+		int generation = 0;
+		int busy = 0;
+
+		std::vector<std::thread> workers;
+		for (int t = 0; t < threads; t++)
+			workers.push_back(std::thread([&, t]()
+			{
+				Mat4 world = MatIdentity();
+				int count = objectsPerFrame / threads + (t < objectsPerFrame % threads ? 1 : 0);
+				for (int seen = 0; seen < frames; seen++)
+				{
+					{
+						std::unique_lock<std::mutex> lock(mutex);
+						while (generation == seen)
+							wakeUp.wait(lock);
+					}
+					for (int i = 0; i < count; i++)
+					{
+						size_t offset = ring.Allocate(sizeof(world));
+						if (offset != UploadRing::kInvalidOffset)
+							memcpy(&memory[offset], &world, sizeof(world));
+					}
+					{
+						std::lock_guard<std::mutex> lock(mutex);
+						busy--;
+					}
+					done.notify_one();
+				}
+			}));
+
+		std::chrono::high_resolution_clock::time_point start = std::chrono::high_resolution_clock::now();
+		for (int frame = 1; frame <= frames; frame++)
+		{
+			ring.BeginFrame();
+			{
+				std::lock_guard<std::mutex> lock(mutex);
+				generation++;
+				busy = threads;
+			}
+			wakeUp.notify_all();
+			{
+				std::unique_lock<std::mutex> lock(mutex);
+				while (busy > 0)
+					done.wait(lock);
+			}
+			ring.EndFrame(frame);
+			if (frame > 3)
+				ring.Retire(frame - 3);
+		}
+		std::chrono::duration<double, std::milli> elapsed = std::chrono::high_resolution_clock::now() - start;
+		for (size_t t = 0; t < workers.size(); t++)
+			workers[t].join();
+
+		size_t total = static_cast<size_t>(frames) * objectsPerFrame;
+		printf("ring %2d threads: %.3f ms/frame, %.2f ns/allocation, %zu of %zu allocations failed (ring full)\n",
+			threads, elapsed.count() / frames, elapsed.count() * 1e6 / total, ring.GetFailedAllocations(), total);
+		// three frames in flight fill the ring exactly
+		passed = passed && !ring.GetFailedAllocations();
+	}
+	return passed;
+}
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// the window's statistics on a stepped clock, exact to the last bit, then a thread summarizing while frames are written
+bool BenchFrameStats()
+{
+	// a first lap of 1 s frames that must have left the window, then a lap of 1, 256, 2, 255, ... ms: p50 is the 128th
+	// of 256 sorted frame times, p95 the 244th and p99 the 254th; the consecutive differences are 255 down to 1, so the
+	// jitter is 128. GPU times alternate between 2 and 4 ms, one reported for a frame that has left the window is dropped
+	bool passed = true;
+	{
+		SteppedClock clock;
+		FrameStats stats(clock);
+		const uint64_t window = FrameStats::kWindowSize;
+		for (uint64_t frame = 0; frame < 2 * window; frame++)
+		{
+			uint64_t k = frame - window;
+			double frameMs = frame < window ? 1000.0 : k % 2 ? double(window - k / 2) : double(k / 2 + 1);
+			stats.BeginFrame();
+			clock.Advance(0.25);
+			stats.EndSubmit();
+			clock.Advance(frameMs - 0.25);
+			stats.EndPresent();
+			stats.ReportGpuTime(frame, frame % 2 ? 2.0f : 4.0f);
+		}
+		stats.ReportGpuTime(window - 2, 1000.0f);
+		stats.ReportGpuTime(2 * window, 1000.0f);
+
+		FrameSummary summary = stats.Summarize();
+		bool exact = summary.frames == window && summary.avgMs == 128.5f && summary.p50Ms == 128.0f && summary.p95Ms == 244.0f &&
+			summary.p99Ms == 254.0f && summary.maxMs == 256.0f && summary.jitterMs == 128.0f && summary.cpuSubmitMs == 0.25f &&
+			summary.presentWaitMs == 128.25f && summary.gpuMs == 3.0f;
+		printf("framestats stepped clock: %zu frames, avg %.2f p50 %.2f p95 %.2f p99 %.2f max %.2f jitter %.2f submit %.2f wait %.2f "
+			"gpu %.2f ms, %s\n", summary.frames, summary.avgMs, summary.p50Ms, summary.p95Ms, summary.p99Ms, summary.maxMs,
+			summary.jitterMs, summary.cpuSubmitMs, summary.presentWaitMs, summary.gpuMs, exact ? "exact" : "WRONG SUMMARY");
+		passed = exact;
+	}
+
+	// frame n lasts n ms, so a window of consecutive frames has a jitter of exactly 1; a slot the writer lapped or is
+	// writing while Summarize copies it would show up as a jump of a whole lap
+	{
+		SteppedClock clock;
+		FrameStats stats(clock);
+		const uint64_t frames = 200000;
+		std::atomic<bool> done(false);
+		uint64_t summaries = 0, torn = 0;
+		std::thread reader([&]()
+		{
+			while (!done.load())
+			{
+				FrameSummary summary = stats.Summarize();
+				summaries++;
+				torn += summary.frames > 1 && summary.jitterMs != 1.0f;
+			}
+		});
+		for (uint64_t frame = 0; frame < frames; frame++)
+		{
+			stats.BeginFrame();
+			clock.Advance(double(frame + 1));
+			stats.EndSubmit();
+			stats.EndPresent();
+			if (frame >= 3)
+				stats.ReportGpuTime(frame - 3, 1.0f);
+		}
+		done = true;
+		reader.join();
+		printf("framestats concurrent: %llu frames, %llu summaries while writing, %llu with a lapped slot\n",
+			static_cast<unsigned long long>(frames), static_cast<unsigned long long>(summaries),
+			static_cast<unsigned long long>(torn));
+		passed = passed && !torn;
+	}
+	return passed;
+}
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// stands in for D3DShaderCompiler: a fixed delay per compile and bytecode derived from the inputs
+class StubShaderCompiler : public ShaderCompiler
+{
+public:
+	const char* GetVersion() const override { return "stub_1"; }
+
+	bool Compile(const ShaderSource &source, std::vector<unsigned char> &bytecode, ShaderReflection &reflection) override
+	{
+		std::this_thread::sleep_for(std::chrono::milliseconds(20));
+
+		uint64_t key = ShaderCache::ComputeKey(source, *this);
+		bytecode.resize(4096);
+		for (size_t i = 0; i < bytecode.size(); i++)
+			bytecode[i] = static_cast<unsigned char>(key >> (i % 8 * 8));
+
+		ShaderCBufferBinding globals = { "$Globals", 2, sizeof(Mat4) };
+		reflection.cbuffers.push_back(globals);
+		return true;
+	}
+};
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+bool BenchShaderCache()
+{
+	// the two VS entry points and the PS of main.cpp, plus a few define permutations
+	const char code[] = "float4x4 perObjectWorldMatrix;";
+	const char *entryPoints[] = { "SimpleVertexShader", "SimpleVertexShaderInstanced", "SimplePixelShader" };
+	const int permutations = 4;
+
+	StubShaderCompiler compiler;
+	bool passed = true;
+	for (int pass = 0; pass < 2; pass++)
+	{
+		ShaderCache cache("ShaderCacheBench");
+		std::chrono::high_resolution_clock::time_point start = std::chrono::high_resolution_clock::now();
+		for (int e = 0; e < 3; e++)
+			for (int p = 0; p < permutations; p++)
+			{
+				ShaderSource source = { "Bench", code, sizeof(code), entryPoints[e], e < 2 ? "vs_4_0" : "ps_4_0", {} };
+				ShaderDefine define = { "PERMUTATION", std::to_string(p) };
+				source.defines.push_back(define);
+
+				ShaderBlob blob;
+				if (!cache.Load(source, compiler, blob) || blob.GetReflection().FindCBuffer("$Globals") != 2)
+				{
+					fprintf(stderr, "shader cache returned a bad entry\n");
+					passed = false;
+				}
+			}
+		std::chrono::duration<double, std::milli> elapsed = std::chrono::high_resolution_clock::now() - start;
+
+		ShaderCacheStats stats = cache.GetStats();
+		printf("shadercache pass %d: %.2f ms, %u hits, %u misses, %.2f ms compiling, %.3f ms loading, %.2f ms saved\n",
+			pass + 1, elapsed.count(), stats.hits, stats.misses, stats.compileMs, stats.loadMs, stats.savedMs);
+	}
+
+	// a missing entry compiled and stored by four caches on the same directory at once, like several processes
+	// starting together: the entry left behind is whole
+	ShaderSource source = { "Bench", code, sizeof(code), entryPoints[0], "vs_4_0", {} };
+	ShaderDefine define = { "PERMUTATION", "racing" };
+	source.defines.push_back(define);
+	char path[64];
+	snprintf(path, sizeof(path), "ShaderCacheBench/%016llx.dxsc", static_cast<unsigned long long>(ShaderCache::ComputeKey(source, compiler)));
+	remove(path);
+	std::vector<unsigned char> reference;
+	ShaderReflection reflection;
+	compiler.Compile(source, reference, reflection);
+	auto matches = [&reference](const ShaderBlob &blob)
+	{
+		return blob.GetBytecodeSize() == reference.size() && !memcmp(blob.GetBytecode(), &reference[0], reference.size()) &&
+			blob.GetReflection().FindCBuffer("$Globals") == 2;
+	};
+	std::atomic<int> racing(0);
+	std::vector<std::thread> writers;
+	for (int w = 0; w < 4; w++)
+		writers.push_back(std::thread([&]()
+		{
+			ShaderCache cache("ShaderCacheBench");
+			ShaderBlob blob;
+			racing += cache.Load(source, compiler, blob) && matches(blob);
+		}));
+	for (size_t w = 0; w < writers.size(); w++)
+		writers[w].join();
+	bool whole = false;
+	{
+		ShaderCache cache("ShaderCacheBench");
+		ShaderBlob blob;
+		whole = cache.Load(source, compiler, blob) && blob.IsFromCache() && matches(blob);
+	}
+
+	// a truncated entry and one whose cbuffer count runs past the file are misses that compile again
+	int rejected = 0;
+	for (int damage = 0; damage < 2; damage++)
+	{
+		std::vector<unsigned char> bytes;
+		if (FILE *file = fopen(path, "rb"))
+		{
+			unsigned char buffer[4096];
+			for (size_t read; (read = fread(buffer, 1, sizeof(buffer), file)) > 0;)
+				bytes.insert(bytes.end(), buffer, buffer + read);
+			fclose(file);
+		}
+		if (bytes.size() < 32)
+			break;
+		// the header is magic, version, key, compile time, then the cbuffer count at byte 20
+		if (damage)
+			memset(&bytes[20], 0xFF, 4);
+		else
+			bytes.resize(bytes.size() / 2);
+		if (FILE *file = fopen(path, "wb"))
+		{
+			fwrite(&bytes[0], 1, bytes.size(), file);
+			fclose(file);
+		}
+		ShaderCache cache("ShaderCacheBench");
+		ShaderBlob blob;
+		rejected += cache.Load(source, compiler, blob) && !blob.IsFromCache() && matches(blob) && cache.GetStats().misses == 1;
+	}
+	remove(path);
+	printf("shadercache racing writers: %d of 4 compiled the right bytecode, %s; damaged entries: %d of 2 recompiled\n",
+		racing.load(), whole ? "the stored entry is whole" : "THE STORED ENTRY IS BROKEN", rejected);
+	return passed && racing == 4 && whole && rejected == 2;
+}
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// stands in for D3DShaderCompiler in the permutation bench: like the real compiler the bytecode only depends on the
+// defines the source reads, and a define BROKEN=1 is a compile error
+class PermutationStubCompiler : public ShaderCompiler
+{
+public:
+	explicit PermutationStubCompiler(int delayMs) : mDelayMs(delayMs), mCompiles(0) {}
+
+	const char* GetVersion() const override { return "permutation_stub_1"; }
+
+	bool Compile(const ShaderSource &source, std::vector<unsigned char> &bytecode, ShaderReflection&) override
+	{
+		mCompiles++;
+		std::this_thread::sleep_for(std::chrono::milliseconds(mDelayMs));
+		std::string code(source.code, source.codeSize);
+		std::string used = source.entryPoint;
+		for (size_t i = 0; i < source.defines.size(); i++)
+		{
+			const ShaderDefine &define = source.defines[i];
+			if (define.name == "BROKEN" && define.value == "1")
+				return false;
+			if (code.find(define.name) != std::string::npos)
+				used += " " + define.name + "=" + define.value;
+		}
+		bytecode.assign(used.begin(), used.end());
+		return true;
+	}
+
+	int GetCompiles() const { return mCompiles; }
+
+private:
+	int              mDelayMs;
+	std::atomic<int> mCompiles;
+};
+
+// the shader object is the bytecode it was created from
+class StubShaderObjectFactory : public ShaderObjectFactory
+{
+public:
+	StubShaderObjectFactory() : mLive(0) {}
+
+	void* CreateShader(const ShaderProgramDesc&, const ShaderBlob &blob) override
+	{
+		mLive++;
+		const char *bytecode = static_cast<const char*>(blob.GetBytecode());
+		return new std::string(bytecode, bytecode + blob.GetBytecodeSize());
+	}
+
+	void ReleaseShader(void *shader) override
+	{
+		mLive--;
+		delete static_cast<std::string*>(shader);
+	}
+
+	// created and not released yet
+	int GetLive() const { return mLive; }
+
+private:
+	std::atomic<int> mLive;
+};
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// removes the cache entries of every variant so each run compiles them
+void RemovePermutationEntries(const ShaderProgramDesc &program, const ShaderCompiler &compiler, const char *directory)
+{
+	for (uint32_t bits = 0; bits <= AllShaderFeatures(program.featuresCount).bits; bits++)
+	{
+		ShaderSource source = { program.name, program.code, program.codeSize, program.entryPoint, program.target, {} };
+		GetVariantDefines(program, ShaderVariantKey{ bits }, source.defines);
+		char path[64];
+		snprintf(path, sizeof(path), "%s/%016llx.dxsc", directory,
+			static_cast<unsigned long long>(ShaderCache::ComputeKey(source, compiler)));
+		remove(path);
+	}
+}
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// variant keys and their defines, then a frame loop that draws every variant of a 6 feature program from the first
+// frame on: how long the fallback is drawn with 1 to 8 compile threads, that GetShader never waits for a compile,
+// and how many shaders the 64 variants need once the features the source does not read are deduplicated
+bool BenchPermutations()
+{
+	enum BenchFeature { Feature_Skinning, Feature_Fog, Feature_AlphaTest, Feature_Shadows, Feature_Instanced, Feature_DebugView, Feature_Count };
+	const char *const features[Feature_Count] = { "SKINNING", "FOG", "ALPHA_TEST", "SHADOWS", "INSTANCED", "DEBUG_VIEW" };
+	constexpr ShaderVariantKey skinnedShadows = ShaderFeature(Feature_Skinning) | ShaderFeature(Feature_Shadows);
+	static_assert(skinnedShadows.bits == 9 && skinnedShadows.Has(ShaderFeature(Feature_Shadows)), "variant key bits");
+	static_assert(AllShaderFeatures(Feature_Count).bits == 63, "variant key mask");
+
+	// INSTANCED and DEBUG_VIEW are only read by the vertex shader, the pixel shader's variants ignore them
+	const char code[] = "#if SKINNING\n#endif\n#if FOG\n#endif\n#if ALPHA_TEST\n#endif\n#if SHADOWS\n#endif\n";
+	ShaderProgramDesc program = { "BenchPS", code, sizeof(code), "main", "ps_4_0", features, Feature_Count, ShaderVariantKey{ 0 } };
+	std::vector<ShaderDefine> defines;
+	GetVariantDefines(program, skinnedShadows, defines);
+	std::string definesText;
+	for (size_t i = 0; i < defines.size(); i++)
+		definesText += (i ? " " : "") + defines[i].name + "=" + defines[i].value;
+	printf("permutations key SKINNING|SHADOWS = %u: %s\n", skinnedShadows.bits, definesText.c_str());
+
+	const char *directory = "ShaderPermutationBench";
+	const uint32_t variantsCount = AllShaderFeatures(Feature_Count).bits + 1;
+	const int threadCounts[4] = { 1, 2, 4, 8 };
+	bool passed = true;
+	for (int t = 0; t < 4; t++)
+	{
+		PermutationStubCompiler compiler(5);
+		StubShaderObjectFactory factory;
+		ShaderCache cache(directory);
+		RemovePermutationEntries(program, compiler, directory);
+		ShaderPermutations permutations(cache, compiler, factory, threadCounts[t]);
+		ShaderProgramId id;
+		if (!permutations.AddProgram(program, id))
+		{
+			printf("permutations: the fallback does not compile\n");
+			return false;
+		}
+
+		// a 1 ms frame draws every variant until all of them are ready
+		std::chrono::high_resolution_clock::time_point start = std::chrono::high_resolution_clock::now();
+		double maxGetUs = 0.0;
+		int frames = 0;
+		for (bool waiting = true; waiting; frames++)
+		{
+			waiting = false;
+			for (uint32_t bits = 0; bits < variantsCount; bits++)
+			{
+				std::chrono::high_resolution_clock::time_point get = std::chrono::high_resolution_clock::now();
+				permutations.GetShader(id, ShaderVariantKey{ bits });
+				std::chrono::duration<double, std::micro> getUs = std::chrono::high_resolution_clock::now() - get;
+				maxGetUs = std::max(maxGetUs, getUs.count());
+				// the variants without SKINNING, FOG, ALPHA_TEST and SHADOWS share the fallback's shader
+				waiting = waiting || permutations.GetState(id, ShaderVariantKey{ bits }) != Variant_Ready;
+			}
+			std::this_thread::sleep_for(std::chrono::milliseconds(1));
+		}
+		std::chrono::duration<double, std::milli> elapsed = std::chrono::high_resolution_clock::now() - start;
+
+		// every variant's object is the bytecode of its own defines
+		bool correct = true;
+		for (uint32_t bits = 0; bits < variantsCount; bits++)
+		{
+			ShaderSource source = { program.name, program.code, program.codeSize, program.entryPoint, program.target, {} };
+			GetVariantDefines(program, ShaderVariantKey{ bits }, source.defines);
+			std::vector<unsigned char> bytecode;
+			ShaderReflection reflection;
+			PermutationStubCompiler reference(0);
+			reference.Compile(source, bytecode, reflection);
+			const std::string *shader = static_cast<const std::string*>(permutations.GetShader(id, ShaderVariantKey{ bits }));
+			correct = correct && permutations.GetState(id, ShaderVariantKey{ bits }) == Variant_Ready &&
+				*shader == std::string(bytecode.begin(), bytecode.end());
+		}
+		ShaderPermutationStats stats = permutations.GetStats();
+		printf("permutations %d threads: %u variants ready after %.1f ms (%d frames), %llu fallback draws, GetShader max %.1f us; "
+			"%d compiles, %u shaders, %s\n", threadCounts[t], stats.compiled, elapsed.count(), frames,
+			static_cast<unsigned long long>(stats.fallbackServed), maxGetUs, compiler.GetCompiles(), stats.shaders,
+			correct ? "bytecode matches" : "WRONG SHADER");
+		passed = passed && correct;
+	}
+
+	// the cache still has the last run's entries: a restart only loads them
+	{
+		PermutationStubCompiler compiler(5);
+		StubShaderObjectFactory factory;
+		ShaderCache cache(directory);
+		ShaderPermutations permutations(cache, compiler, factory, 2);
+		ShaderProgramId id;
+		permutations.AddProgram(program, id);
+		std::chrono::high_resolution_clock::time_point start = std::chrono::high_resolution_clock::now();
+		for (uint32_t bits = 0; bits < variantsCount; bits++)
+			permutations.Prefetch(id, ShaderVariantKey{ bits });
+		permutations.WaitIdle();
+		std::chrono::duration<double, std::milli> elapsed = std::chrono::high_resolution_clock::now() - start;
+		ShaderCacheStats cacheStats = cache.GetStats();
+		printf("permutations warm cache: %u variants ready after %.1f ms, %u hits, %d compiles\n",
+			permutations.GetStats().compiled, elapsed.count(), cacheStats.hits, compiler.GetCompiles());
+		RemovePermutationEntries(program, compiler, directory);
+	}
+
+	// a variant that does not compile keeps drawing the fallback
+	{
+		const char *const brokenFeatures[1] = { "BROKEN" };
+		ShaderProgramDesc broken = { "BrokenPS", code, sizeof(code), "main", "ps_4_0", brokenFeatures, 1, ShaderVariantKey{ 0 } };
+		PermutationStubCompiler compiler(0);
+		StubShaderObjectFactory factory;
+		ShaderCache cache(directory);
+		ShaderPermutations permutations(cache, compiler, factory, 1);
+		ShaderProgramId id;
+		bool added = permutations.AddProgram(broken, id);
+		void *fallback = permutations.GetShader(id, ShaderVariantKey{ 0 });
+		permutations.Prefetch(id, ShaderFeature(0));
+		permutations.WaitIdle();
+		// bits past the program's features are masked off, the key is the fallback's
+		bool masked = permutations.GetShader(id, ShaderFeature(5)) == fallback && permutations.GetVariantKey(id, ShaderFeature(5)).bits == 0;
+		bool failed = added && permutations.GetState(id, ShaderFeature(0)) == Variant_Failed &&
+			permutations.GetShader(id, ShaderFeature(0)) == fallback && permutations.GetStats().failed == 1;
+		printf("permutations broken variant: %s; unknown feature bits: %s\n", failed ? "failed, draws the fallback" : "WRONG STATE",
+			masked ? "masked to the fallback" : "NOT MASKED");
+		passed = passed && failed && masked;
+		RemovePermutationEntries(broken, compiler, directory);
+	}
+
+	// destroyed with every variant queued: the queue is dropped, the compiles already started finish and every object
+	// they created is released
+	{
+		const int delayMs = 20;
+		PermutationStubCompiler compiler(delayMs);
+		StubShaderObjectFactory factory;
+		ShaderCache cache(directory);
+		RemovePermutationEntries(program, compiler, directory);
+		std::chrono::high_resolution_clock::time_point start;
+		{
+			ShaderPermutations permutations(cache, compiler, factory, 2);
+			ShaderProgramId id;
+			permutations.AddProgram(program, id);
+			for (uint32_t bits = 0; bits < variantsCount; bits++)
+				permutations.Prefetch(id, ShaderVariantKey{ bits });
+			start = std::chrono::high_resolution_clock::now();
+		}
+		std::chrono::duration<double, std::milli> elapsed = std::chrono::high_resolution_clock::now() - start;
+		// the fallback and about one variant per thread, compiling them all would take 32 compiles per thread
+		bool dropped = compiler.GetCompiles() < int(variantsCount / 4) && elapsed.count() < (variantsCount / 4) * delayMs;
+		printf("permutations destroyed with %u variants queued: %d compiles, %.1f ms, %d shaders left, %s\n", variantsCount,
+			compiler.GetCompiles(), elapsed.count(), factory.GetLive(), dropped && !factory.GetLive() ?
+			"queue dropped, compiles finished" : "QUEUE NOT DROPPED OR SHADERS LEAKED");
+		passed = passed && dropped && !factory.GetLive();
+		RemovePermutationEntries(program, compiler, directory);
+	}
+	return passed;
+}
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+bool BenchStateFilter()
+{
+	// fake objects standing in for the main.cpp globals
+	static char vs, vsInstanced, ps, layout, layoutInstanced, quad, quadIndices, instances, cbApp, cbFrame, cbObject, sampler, srv;
+	const void *appAndFrame[2] = { &cbApp, &cbFrame };
+	const void *objectBuffer[1] = { &cbObject };
+	const void *samplers[1] = { &sampler };
+	const void *views[1] = { &srv };
+	const void *quadBuffers[1] = { &quad };
+	const void *instancedBuffers[2] = { &quad, &instances };
+	const unsigned strides[2] = { sizeof(MeshVertexQuantized), sizeof(InstanceData) };
+	const unsigned indexFormat = 57; // DXGI_FORMAT_R16_UINT
+	const unsigned offsets[2] = { 0, 0 };
+	const unsigned triangleList = 4; // D3D11_PRIMITIVE_TOPOLOGY_TRIANGLELIST
+	const int frames = 100;
+	bool passed = true;
+
+	for (int mode = 0; mode < 2; mode++)
+	{
+		RecordingStateSink sink;
+		StateFilter filter(sink);
+		unsigned requested = 0;
+		unsigned firstFrameIssued = 0;
+		unsigned firstFrameCalls = 0;
+
+		// the binding sequence of RenderTickPerObject (two draws) and RenderTickInstanced (one draw)
+		for (int frame = 0; frame < frames; frame++)
+		{
+			filter.ResetStats();
+			filter.SetShader(Stage_Vertex, mode ? &vsInstanced : &vs);
+			filter.SetShader(Stage_Pixel, &ps);
+			filter.SetInputLayout(mode ? &layoutInstanced : &layout);
+			filter.SetVertexBuffers(0, mode ? 2 : 1, mode ? instancedBuffers : quadBuffers, strides, offsets);
+			filter.SetIndexBuffer(&quadIndices, indexFormat, 0);
+			filter.SetPrimitiveTopology(triangleList);
+			filter.SetConstantBuffers(Stage_Vertex, 0, 2, appAndFrame);
+			filter.SetSamplers(Stage_Pixel, 0, 1, samplers);
+			filter.SetShaderResources(Stage_Pixel, 0, 1, views);
+			for (int draw = 0; draw < (mode ? 1 : 2); draw++)
+			{
+				if (!mode)
+					filter.SetConstantBuffers(Stage_Vertex, 2, 1, objectBuffer);
+				filter.Apply();
+			}
+			requested += filter.GetStats().requested;
+			if (frame == 0)
+			{
+				firstFrameIssued = filter.GetStats().issued;
+				firstFrameCalls = sink.GetCalls();
+			}
+		}
+
+		// every frame binds what the first one did, nothing reaches the sink after it
+		unsigned repeatedCalls = sink.GetCalls() - firstFrameCalls;
+		printf("statefilter %-10s: %.2f calls requested/frame, %.2f issued/frame (%u in the first frame), %u slots bound, %s\n",
+			mode ? "instanced" : "perobject", double(requested) / frames, double(sink.GetCalls()) / frames,
+			firstFrameIssued, sink.GetSlots(), !repeatedCalls && firstFrameIssued == firstFrameCalls ?
+			"repeated frames issue nothing" : "REPEATED FRAMES ISSUE CALLS");
+		passed = passed && !repeatedCalls && firstFrameIssued == firstFrameCalls;
+	}
+
+	// slots set one by one in a row go out as one call over the span; a state set and set back before the draw, or
+	// bound again as it is, goes nowhere
+	{
+		static char otherShader, otherBuffer, otherView;
+		const void *otherBuffers[1] = { &otherBuffer };
+		const void *otherViews[1] = { &otherView };
+		const void *boundSpan[3] = { &cbApp, &cbFrame, &cbObject };
+		RecordingStateSink sink;
+		StateFilter filter(sink);
+		filter.SetShader(Stage_Vertex, &vs);
+		filter.SetShaderResources(Stage_Pixel, 0, 1, views);
+		filter.Apply();
+		unsigned before = sink.GetCalls();
+		filter.SetConstantBuffers(Stage_Vertex, 0, 1, appAndFrame);
+		filter.SetConstantBuffers(Stage_Vertex, 1, 1, appAndFrame + 1);
+		filter.SetConstantBuffers(Stage_Vertex, 2, 1, objectBuffer);
+		filter.Apply();
+		bool merged = sink.GetCalls() == before + 1 && sink.GetLastStart() == 0 && sink.GetLastCount() == 3;
+
+		before = sink.GetCalls();
+		filter.SetShader(Stage_Vertex, &otherShader);
+		filter.SetShader(Stage_Vertex, &vs);
+		filter.SetConstantBuffers(Stage_Vertex, 1, 1, otherBuffers);
+		filter.SetConstantBuffers(Stage_Vertex, 1, 1, appAndFrame + 1);
+		filter.SetShaderResources(Stage_Pixel, 0, 1, otherViews);
+		filter.SetShaderResources(Stage_Pixel, 0, 1, views);
+		filter.SetConstantBuffers(Stage_Vertex, 0, 3, boundSpan);
+		filter.Apply();
+		bool reverted = sink.GetCalls() == before;
+		printf("statefilter spans: adjacent slots %s; set and reverted before the draw: %s\n",
+			merged ? "bound in one call" : "NOT MERGED", reverted ? "nothing issued" : "CALLS ISSUED");
+		passed = passed && merged && reverted;
+	}
+	return passed;
+}
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// stands in for RecordObjects: the quad of every object of a chunk is transformed into that chunk's command stream
+void RecordChunk(const Mat4 &viewProj, size_t first, size_t last, std::vector<Vec4> &stream)
+{
+	static const Vec4 corners[6] = {
+		{ -1.0f, -1.0f, 0.0f, 1.0f }, { -1.0f, 1.0f, 0.0f, 1.0f }, { 1.0f, 1.0f, 0.0f, 1.0f },
+		{ 1.0f, 1.0f, 0.0f, 1.0f }, { 1.0f, -1.0f, 0.0f, 1.0f }, { -1.0f, -1.0f, 0.0f, 1.0f } };
+	Mat4 rotation = MatRotationAxis(Vec3{ 0.0f, 1.0f, 0.0f }, 0.3f);
+
+	stream.clear();
+	for (size_t i = first; i < last; i++)
+	{
+		Mat4 wvp = MatMultiply(GridInstanceMatrix(static_cast<int>(i) + 2, rotation), viewProj);
+		for (int v = 0; v < 6; v++)
+			stream.push_back(Vec4Transform(corners[v], wvp));
+	}
+}
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// FNV-1a over the streams in chunk order, equal to the serial result only if every chunk landed in its own slot
+uint64_t HashStreams(const std::vector<std::vector<Vec4>> &streams)
+{
+	uint64_t hash = 14695981039346656037ull;
+	for (size_t c = 0; c < streams.size(); c++)
+	{
+		const unsigned char *bytes = reinterpret_cast<const unsigned char*>(streams[c].data());
+		for (size_t i = 0; i < streams[c].size() * sizeof(Vec4); i++)
+		{
+			hash ^= bytes[i];
+			hash *= 1099511628211ull;
+		}
+	}
+	return hash;
+}
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// maxThreads 0 scales up to the hardware threads
+bool BenchJobs(int maxThreads)
+{
+	// RenderTickDeferred with 64 objects per command list; the nested pass splits every list again from inside a job
+	const size_t objectsCount = 100000;
+	const size_t objectsPerList = 64;
+	const size_t listsCount = (objectsCount + objectsPerList - 1) / objectsPerList;
+	const int iterations = 20;
+	if (maxThreads <= 0)
+		maxThreads = std::max(1, static_cast<int>(std::thread::hardware_concurrency()));
+
+	HeadlessScene scene;
+	if (!CreateScene(scene))
+		return false;
+	Mat4 viewProj = MatMultiply(scene.viewMat, scene.projMat);
+
+	std::vector<std::vector<Vec4>> streams(listsCount);
+	for (size_t c = 0; c < listsCount; c++)
+		RecordChunk(viewProj, c * objectsPerList, std::min((c + 1) * objectsPerList, objectsCount), streams[c]);
+	const uint64_t reference = HashStreams(streams);
+
+	bool passed = true;
+	for (int nested = 0; nested < 2; nested++)
+	{
+		double singleThreadMs = 0.0;
+		for (int threads = 1; threads <= maxThreads; threads = threads < maxThreads && threads * 2 > maxThreads ? maxThreads : threads * 2)
+		{
+			JobSystem jobs(threads);
+			for (size_t c = 0; c < listsCount; c++)
+				streams[c].clear();
+
+			auto recordLists = [&](size_t begin, size_t end)
+			{
+				for (size_t c = begin; c < end; c++)
+					RecordChunk(viewProj, c * objectsPerList, std::min((c + 1) * objectsPerList, objectsCount), streams[c]);
+			};
+			auto recordGroups = [&](size_t begin, size_t end)
+			{
+				// 16 lists per group, handed out again as single lists
+				size_t first = begin * 16;
+				size_t count = std::min(end * 16, listsCount) - first;
+				auto recordGroupLists = [&](size_t listBegin, size_t listEnd) { recordLists(first + listBegin, first + listEnd); };
+				jobs.ParallelFor(count, 1, recordGroupLists);
+			};
+
+			std::chrono::high_resolution_clock::time_point start = std::chrono::high_resolution_clock::now();
+			for (int it = 0; it < iterations; it++)
+			{
+				if (nested)
+					jobs.ParallelFor((listsCount + 15) / 16, 1, recordGroups);
+				else
+					jobs.ParallelFor(listsCount, 1, recordLists);
+			}
+			std::chrono::duration<double, std::milli> elapsed = std::chrono::high_resolution_clock::now() - start;
+
+			double msPerFrame = elapsed.count() / iterations;
+			if (threads == 1)
+				singleThreadMs = msPerFrame;
+
+			size_t stolen = 0;
+			size_t busiest = 0;
+			for (int t = 0; t < jobs.GetThreadsCount(); t++)
+			{
+				stolen += jobs.GetStolenJobs(t);
+				busiest = std::max(busiest, jobs.GetExecutedJobs(t));
+			}
+
+			bool deterministic = HashStreams(streams) == reference;
+			printf("jobs %-6s %2d threads: %.3f ms/frame, %.2fx, %zu stolen jobs/frame, busiest thread ran %.1f%% of the jobs, %s\n",
+				nested ? "nested" : "flat", threads, msPerFrame, singleThreadMs / msPerFrame, stolen / iterations,
+				100.0 * busiest / (iterations * (nested ? listsCount + (listsCount + 15) / 16 : listsCount)),
+				deterministic ? "output matches the serial recording" : "OUTPUT DIFFERS FROM THE SERIAL RECORDING");
+			passed = passed && deterministic;
+		}
+	}
+	return passed;
+}
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+bool BenchSimulation()
+{
+	bool passed = true;
+	// exchange: the writer stamps every element of a snapshot with its tick as fast as it can, the reader checks
+	// that each snapshot it gets is complete (one tick throughout) and never older than the previous one
+	{
+		const size_t elements = 4096;
+		const uint64_t publishes = 200000;
+		TripleBuffer<std::vector<uint64_t>> snapshots;
+		for (unsigned b = 0; b < 3; b++)
+			snapshots.GetBuffer(b).assign(elements, 0);
+
+		std::atomic<bool> done(false);
+		std::chrono::high_resolution_clock::time_point start = std::chrono::high_resolution_clock::now();
+		std::thread writer([&]()
+		{
+			for (uint64_t tick = 1; tick <= publishes; tick++)
+			{
+				std::vector<uint64_t> &snapshot = snapshots.GetWriteBuffer();
+				for (size_t i = 0; i < elements; i++)
+					snapshot[i] = tick;
+				snapshots.Publish();
+			}
+			done = true;
+		});
+
+		uint64_t reads = 0, fresh = 0, torn = 0, backwards = 0, lastTick = 0;
+		for (;;)
+		{
+			bool finished = done.load();
+			reads++;
+			if (snapshots.Update())
+			{
+				fresh++;
+				const std::vector<uint64_t> &snapshot = snapshots.GetReadBuffer();
+				for (size_t i = 1; i < elements; i++)
+					if (snapshot[i] != snapshot[0])
+					{
+						torn++;
+						break;
+					}
+				if (snapshot[0] < lastTick)
+					backwards++;
+				lastTick = snapshot[0];
+			}
+			else
+				std::this_thread::yield();
+			if (finished && !snapshots.Update())
+				break;
+		}
+		writer.join();
+		std::chrono::duration<double, std::milli> elapsed = std::chrono::high_resolution_clock::now() - start;
+
+		printf("triple buffer: %.1f ns/publish, %llu reads, %llu new snapshots, last tick %llu of %llu, %llu torn, %llu out of order\n",
+			elapsed.count() * 1e6 / publishes, static_cast<unsigned long long>(reads), static_cast<unsigned long long>(fresh),
+			static_cast<unsigned long long>(lastTick), static_cast<unsigned long long>(publishes),
+			static_cast<unsigned long long>(torn), static_cast<unsigned long long>(backwards));
+		passed = passed && !torn && !backwards && lastTick == publishes;
+	}
+
+	// render side cost: blending the two states into world matrices
+	const int counts[] = { 1000, 10000, 100000 };
+	for (int c = 0; c < 3; c++)
+	{
+		SteppedClock clock;
+		Simulation simulation(clock, counts[c], gSimulationStepMs);
+		simulation.Step();
+
+		TransformStore transforms;
+		const int iterations = 100;
+		std::chrono::high_resolution_clock::time_point start = std::chrono::high_resolution_clock::now();
+		for (int it = 0; it < iterations; it++)
+			simulation.Interpolate(simulation.GetStepMs() * (1.0 + double(it) / iterations), transforms);
+		std::chrono::duration<double, std::milli> elapsed = std::chrono::high_resolution_clock::now() - start;
+
+		start = std::chrono::high_resolution_clock::now();
+		for (int it = 0; it < iterations; it++)
+			simulation.Step();
+		std::chrono::duration<double, std::milli> stepElapsed = std::chrono::high_resolution_clock::now() - start;
+
+		printf("simulation %6d objects: interpolate %.3f ms (%.2f ns/object), step %.3f ms\n", counts[c],
+			elapsed.count() / iterations, elapsed.count() * 1e6 / (double(iterations) * counts[c]), stepElapsed.count() / iterations);
+	}
+
+	// real time: the thread paces itself on the clock while a render loop twice as fast interpolates
+	{
+		SteadyFrameClock clock;
+		Simulation simulation(clock, 10000, gSimulationStepMs);
+		TransformStore transforms;
+		const double durationMs = 1000.0;
+		const double frameMs = gSimulationStepMs / 2.0;
+
+		simulation.Start();
+		double start = clock.NowMs();
+		int frames = 0, clamped = 0;
+		uint64_t lastTick = 0, repeatedTicks = 0;
+		while (clock.NowMs() - start < durationMs)
+		{
+			float alpha = simulation.Interpolate(clock.NowMs(), transforms);
+			clamped += alpha >= 1.0f ? 1 : 0;
+			repeatedTicks += simulation.GetRenderedTick() == lastTick ? 1 : 0;
+			lastTick = simulation.GetRenderedTick();
+			frames++;
+			std::this_thread::sleep_for(std::chrono::duration<double, std::milli>(frameMs));
+		}
+		simulation.Stop();
+
+		double elapsedMs = clock.NowMs() - start;
+		printf("simulation thread: %llu steps in %.0f ms (%.1f Hz, %llu dropped), %d frames, %llu reused a snapshot, %d waited on a late step\n",
+			static_cast<unsigned long long>(simulation.GetTicks()), elapsedMs, simulation.GetTicks() * 1000.0 / elapsedMs,
+			static_cast<unsigned long long>(simulation.GetDroppedSteps()), frames, static_cast<unsigned long long>(repeatedTicks), clamped);
+	}
+	return passed;
+}
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+bool BenchTransforms()
+{
+	const int counts[] = { 100000, 250000, 500000, 1000000 };
+	const int iterations = 20;
+
+	HeadlessScene scene;
+	if (!CreateScene(scene))
+		return false;
+	Mat4 viewProj = MatMultiply(scene.viewMat, scene.projMat);
+
+	// the SIMD kernels against TransformStore::Compose one object at a time, within 1e-5 relative to the larger of
+	// 1 and the expected value
+	bool passed = true;
+	for (int c = 0; c < 4; c++)
+	{
+		// random axes, angles and scales so no lane can take a shortcut
+		TransformStore transforms;
+		transforms.Resize(counts[c]);
+		unsigned seed = 1;
+		for (int i = 0; i < counts[c]; i++)
+		{
+			float r[4];
+			for (int k = 0; k < 4; k++)
+			{
+				seed = seed * 1664525u + 1013904223u;
+				r[k] = static_cast<float>(seed >> 8) / 16777216.0f;
+			}
+			Vec3 axis = Vec3Normalize(Vec3{ r[0] - 0.5f, r[1] - 0.5f, r[2] - 0.5f });
+			transforms.Set(i, SceneGridPosition(i), QuatRotationAxis(axis, r[3] * 2.0f * kPi), Vec3{ 0.5f + r[0], 0.5f + r[1], 0.5f + r[2] });
+		}
+
+		std::vector<Mat4> referenceWorlds(counts[c]);
+		std::vector<Mat4> reference(counts[c]);
+		std::vector<Mat4> worlds(counts[c]);
+		std::vector<Mat4> matrices(counts[c]);
+		const float *component[TransformStore::NumComponents];
+		for (int k = 0; k < TransformStore::NumComponents; k++)
+			component[k] = transforms.GetComponent(static_cast<TransformStore::Component>(k));
+		auto compose = [&component](int i)
+		{
+			Vec3 position = { component[TransformStore::PositionX][i], component[TransformStore::PositionY][i], component[TransformStore::PositionZ][i] };
+			Vec4 rotation = { component[TransformStore::RotationX][i], component[TransformStore::RotationY][i],
+				component[TransformStore::RotationZ][i], component[TransformStore::RotationW][i] };
+			Vec3 scale = { component[TransformStore::ScaleX][i], component[TransformStore::ScaleY][i], component[TransformStore::ScaleZ][i] };
+			return TransformStore::Compose(position, rotation, scale);
+		};
+
+		// one object at a time, what UpdatePerObjectBuffer did before
+		std::chrono::high_resolution_clock::time_point start = std::chrono::high_resolution_clock::now();
+		for (int it = 0; it < iterations; it++)
+			for (int i = 0; i < counts[c]; i++)
+				reference[i] = MatMultiply(compose(i), viewProj);
+		std::chrono::duration<double, std::milli> scalarElapsed = std::chrono::high_resolution_clock::now() - start;
+		for (int i = 0; i < counts[c]; i++)
+			referenceWorlds[i] = compose(i);
+
+		start = std::chrono::high_resolution_clock::now();
+		for (int it = 0; it < iterations; it++)
+			transforms.ComputeWorlds(0, counts[c], worlds.data());
+		std::chrono::duration<double, std::milli> worldsElapsed = std::chrono::high_resolution_clock::now() - start;
+
+		start = std::chrono::high_resolution_clock::now();
+		for (int it = 0; it < iterations; it++)
+			transforms.ComputeWorldViewProj(0, counts[c], viewProj, matrices.data());
+		std::chrono::duration<double, std::milli> wvpElapsed = std::chrono::high_resolution_clock::now() - start;
+
+		// every third object, backwards, like a sorted visible list
+		std::vector<uint32_t> indices;
+		for (int i = counts[c] - 1; i >= 0; i -= 3)
+			indices.push_back(static_cast<uint32_t>(i));
+		std::vector<Mat4> indexed(indices.size());
+		transforms.ComputeWorldViewProjIndexed(indices.data(), indices.size(), viewProj, indexed.data());
+
+		auto relativeError = [](const Mat4 &m, const Mat4 &expected)
+		{
+			float maxError = 0.0f;
+			for (int k = 0; k < 16; k++)
+			{
+				float e = expected.m[k / 4][k % 4];
+				maxError = std::max(maxError, std::fabs(m.m[k / 4][k % 4] - e) / std::max(1.0f, std::fabs(e)));
+			}
+			return maxError;
+		};
+		float worldError = 0.0f, wvpError = 0.0f, indexedError = 0.0f;
+		for (int i = 0; i < counts[c]; i++)
+		{
+			worldError = std::max(worldError, relativeError(worlds[i], referenceWorlds[i]));
+			wvpError = std::max(wvpError, relativeError(matrices[i], reference[i]));
+		}
+		for (size_t i = 0; i < indices.size(); i++)
+			indexedError = std::max(indexedError, relativeError(indexed[i], reference[indices[i]]));
+		bool accurate = worldError <= 1e-5f && wvpError <= 1e-5f && indexedError <= 1e-5f;
+
+		double scalarMs = scalarElapsed.count() / iterations;
+		double wvpMs = wvpElapsed.count() / iterations;
+		printf("transforms %7d: scalar wvp %.3f ms, simd world %.3f ms, simd wvp %.3f ms (%.2f ns/transform, %.1fx), max rel error "
+			"world %.2g wvp %.2g indexed %.2g%s\n", counts[c], scalarMs, worldsElapsed.count() / iterations, wvpMs,
+			wvpMs * 1e6 / counts[c], scalarMs / wvpMs, worldError, wvpError, indexedError, accurate ? "" : ", INACCURATE");
+		passed = passed && accurate;
+	}
+	return passed;
+}
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+bool BenchCulling()
+{
+	const int counts[] = { 10000, 100000, 1000000 };
+	const int frames = 20;
+
+	HeadlessScene scene;
+	if (!CreateScene(scene))
+		return false;
+	Mat4 viewProj = MatMultiply(scene.viewMat, scene.projMat);
+	Frustum frustum = ExtractFrustum(viewProj);
+	const Vec3 up = { 0.0f, 1.0f, 0.0f };
+	const Vec3 scale = { 1.0f, 1.0f, 1.0f };
+
+	bool passed = true;
+	for (int c = 0; c < 3; c++)
+	{
+		// the scene grid spinning like the simulation, one object in 64 jumps to another cell every frame
+		TransformStore transforms;
+		transforms.Resize(counts[c]);
+
+		Bvh bvh;
+		std::vector<uint32_t> proxies, reference;
+		ArenaVector<uint32_t> visible;
+		std::vector<Aabb> bounds(counts[c]);
+		std::vector<Mat4> matrices;
+
+		double boundsMs = 0.0, updateMs = 0.0, cullMs = 0.0, bruteMs = 0.0, allMatricesMs = 0.0, visibleMatricesMs = 0.0;
+		size_t tested = 0, visibleCount = 0, missed = 0, extra = 0;
+		double buildMs = 0.0;
+		for (int frame = 0; frame <= frames; frame++)
+		{
+			float angle = frame * Simulation::kRadiansPerSecond * static_cast<float>(gSimulationStepMs / 1000.0);
+			for (int i = 0; i < counts[c]; i++)
+			{
+				int cell = frame > 0 && (i + frame) % 64 == 0 ? (i * 7 + frame * 4099) % counts[c] : i;
+				transforms.Set(i, SceneGridPosition(cell), QuatRotationAxis(up, angle), scale);
+			}
+
+			std::chrono::high_resolution_clock::time_point start = std::chrono::high_resolution_clock::now();
+			ComputeBounds(transforms, 0, counts[c], scene.bounds, bounds.data());
+			std::chrono::high_resolution_clock::time_point boundsDone = std::chrono::high_resolution_clock::now();
+
+			if (frame == 0)
+			{
+				for (int i = 0; i < counts[c]; i++)
+					proxies.push_back(bvh.Insert(bounds[i], i));
+				buildMs = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - boundsDone).count();
+				bvh.ResetCounters();
+				continue;
+			}
+
+			for (int i = 0; i < counts[c]; i++)
+				bvh.Move(proxies[i], bounds[i]);
+			bvh.Refit();
+			std::chrono::high_resolution_clock::time_point updateDone = std::chrono::high_resolution_clock::now();
+
+			visible.clear();
+			tested += bvh.Cull(frustum, visible);
+			std::sort(visible.begin(), visible.end());
+			std::chrono::high_resolution_clock::time_point cullDone = std::chrono::high_resolution_clock::now();
+
+			reference.clear();
+			CullBoxes(frustum, bounds.data(), bounds.size(), reference);
+			std::chrono::high_resolution_clock::time_point bruteDone = std::chrono::high_resolution_clock::now();
+
+			matrices.resize(counts[c]);
+			transforms.ComputeWorldViewProj(0, counts[c], viewProj, matrices.data());
+			std::chrono::high_resolution_clock::time_point allDone = std::chrono::high_resolution_clock::now();
+			transforms.ComputeWorldViewProjIndexed(visible.data(), visible.size(), viewProj, matrices.data());
+			std::chrono::high_resolution_clock::time_point visibleDone = std::chrono::high_resolution_clock::now();
+
+			boundsMs += std::chrono::duration<double, std::milli>(boundsDone - start).count();
+			updateMs += std::chrono::duration<double, std::milli>(updateDone - boundsDone).count();
+			cullMs += std::chrono::duration<double, std::milli>(cullDone - updateDone).count();
+			bruteMs += std::chrono::duration<double, std::milli>(bruteDone - cullDone).count();
+			allMatricesMs += std::chrono::duration<double, std::milli>(allDone - bruteDone).count();
+			visibleMatricesMs += std::chrono::duration<double, std::milli>(visibleDone - allDone).count();
+
+			// the tree tests fat boxes: it may keep a few extra objects but must never lose one
+			visibleCount += visible.size();
+			ArenaVector<uint32_t>::const_iterator it = visible.begin();
+			for (size_t r = 0; r < reference.size(); r++)
+			{
+				while (it != visible.end() && *it < reference[r])
+					++it;
+				if (it == visible.end() || *it != reference[r])
+					missed++;
+			}
+			extra += visible.size() - (reference.size() - missed);
+		}
+
+		printf("culling %7d objects: build %.1f ms, height %d, %zu nodes; per frame bounds %.3f ms, refit %.3f ms (%zu refit, %zu reinserted), "
+			"cull %.3f ms (%zu nodes tested), brute force %.3f ms\n", counts[c], buildMs, bvh.GetHeight(), bvh.GetNodesCount(),
+			boundsMs / frames, updateMs / frames, bvh.GetRefitLeaves() / frames, bvh.GetReinsertedLeaves() / frames,
+			cullMs / frames, tested / frames, bruteMs / frames);
+		printf("culling %7d objects: %.2f%% visible, %zu extra from the margin, %zu missed; matrices all %.3f ms, visible only %.3f ms\n",
+			counts[c], 100.0 * visibleCount / (double(frames) * counts[c]), extra / frames, missed, allMatricesMs / frames,
+			visibleMatricesMs / frames);
+		passed = passed && !missed;
+	}
+	return passed;
+}
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// UV sphere as an unindexed triangle list, triangles shuffled like an exporter that does not care about the cache
+void CreateSphereTriangles(int slices, int stacks, std::vector<MeshVertex> &triangles)
+{
+	std::vector<MeshVertex> grid;
+	for (int j = 0; j <= stacks; j++)
+		for (int i = 0; i <= slices; i++)
+		{
+			float u = static_cast<float>(i) / slices, v = static_cast<float>(j) / stacks;
+			float theta = u * 2.0f * kPi, phi = v * kPi;
+			MeshVertex vertex = { std::sin(phi) * std::cos(theta), std::cos(phi), std::sin(phi) * std::sin(theta), u, v };
+			grid.push_back(vertex);
+		}
+
+	std::vector<int> quads(slices * stacks);
+	for (size_t q = 0; q < quads.size(); q++)
+		quads[q] = static_cast<int>(q);
+	unsigned seed = 1;
+	for (size_t q = quads.size() - 1; q > 0; q--)
+	{
+		seed = seed * 1664525u + 1013904223u;
+		std::swap(quads[q], quads[(seed >> 8) % (q + 1)]);
+	}
+
+	triangles.clear();
+	for (size_t q = 0; q < quads.size(); q++)
+	{
+		int i = quads[q] % slices, j = quads[q] / slices;
+		const MeshVertex &a = grid[j * (slices + 1) + i], &b = grid[j * (slices + 1) + i + 1];
+		const MeshVertex &c = grid[(j + 1) * (slices + 1) + i], &d = grid[(j + 1) * (slices + 1) + i + 1];
+		const MeshVertex quad[6] = { a, b, c, c, b, d };
+		triangles.insert(triangles.end(), quad, quad + 6);
+	}
+}
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+bool BenchMesh()
+{
+	const int sizes[][2] = { { 64, 32 }, { 512, 256 } };
+	HeadlessScene scene;
+	if (!CreateScene(scene))
+		return false;
+
+	for (int s = 0; s < 2; s++)
+	{
+		std::vector<MeshVertex> triangles;
+		CreateSphereTriangles(sizes[s][0], sizes[s][1], triangles);
+		size_t trianglesCount = triangles.size() / 3;
+
+		std::chrono::high_resolution_clock::time_point start = std::chrono::high_resolution_clock::now();
+		MeshData mesh;
+		BuildIndexed(triangles.data(), triangles.size(), mesh);
+		std::chrono::high_resolution_clock::time_point indexed = std::chrono::high_resolution_clock::now();
+		float acmrInput = ComputeAcmr(mesh.indices.data(), mesh.indices.size(), mesh.vertices.size(), 16);
+		OptimizeVertexCache(mesh);
+		std::chrono::high_resolution_clock::time_point cacheDone = std::chrono::high_resolution_clock::now();
+		float acmrCache = ComputeAcmr(mesh.indices.data(), mesh.indices.size(), mesh.vertices.size(), 16);
+		OptimizeOverdraw(mesh);
+		std::chrono::high_resolution_clock::time_point overdrawDone = std::chrono::high_resolution_clock::now();
+		float acmrOverdraw = ComputeAcmr(mesh.indices.data(), mesh.indices.size(), mesh.vertices.size(), 16);
+		OptimizeVertexFetch(mesh);
+		std::chrono::high_resolution_clock::time_point fetchDone = std::chrono::high_resolution_clock::now();
+
+		printf("mesh %6zu triangles: %zu unique of %zu vertices, weld %.2f ms, cache %.2f ms, overdraw %.2f ms, fetch %.2f ms\n",
+			trianglesCount, mesh.vertices.size(), triangles.size(),
+			std::chrono::duration<double, std::milli>(indexed - start).count(),
+			std::chrono::duration<double, std::milli>(cacheDone - indexed).count(),
+			std::chrono::duration<double, std::milli>(overdrawDone - cacheDone).count(),
+			std::chrono::duration<double, std::milli>(fetchDone - overdrawDone).count());
+		printf("mesh %6zu triangles: ACMR (16 entry FIFO) input %.3f, cache optimized %.3f, after overdraw sort %.3f\n",
+			trianglesCount, acmrInput, acmrCache, acmrOverdraw);
+
+		const char *path = "MeshBench.dxmesh";
+		for (int format = 0; format < 2; format++)
+		{
+			MeshVertexFormat vertexFormat = static_cast<MeshVertexFormat>(format);
+			if (!SaveMesh(path, mesh, vertexFormat))
+			{
+				fprintf(stderr, "failed to write %s\n", path);
+				return false;
+			}
+
+			start = std::chrono::high_resolution_clock::now();
+			MeshFile file;
+			bool opened = file.Open(path);
+			double openMs = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+
+			std::vector<MeshVertex> vertices;
+			std::vector<uint32_t> indices;
+			if (!opened || !file.Decode(vertices, indices) || indices != mesh.indices)
+			{
+				fprintf(stderr, "%s does not read back\n", path);
+				return false;
+			}
+
+			float positionError = 0.0f, uvError = 0.0f;
+			for (size_t i = 0; i < vertices.size(); i++)
+			{
+				positionError = std::max(positionError, std::fabs(vertices[i].x - mesh.vertices[i].x));
+				positionError = std::max(positionError, std::fabs(vertices[i].y - mesh.vertices[i].y));
+				positionError = std::max(positionError, std::fabs(vertices[i].z - mesh.vertices[i].z));
+				uvError = std::max(uvError, std::fabs(vertices[i].u - mesh.vertices[i].u));
+				uvError = std::max(uvError, std::fabs(vertices[i].v - mesh.vertices[i].v));
+			}
+
+			size_t bytes = file.GetVerticesCount() * file.GetVertexStride() + file.GetIndicesCount() * file.GetIndexSize();
+			printf("mesh %6zu triangles: %-9s %zu byte vertices, %zu byte indices, %.1f KB vs %.1f KB unindexed (%.0f%%), "
+				"open %.3f ms, max error position %.2g uv %.2g\n", trianglesCount, format ? "quantized" : "float",
+				file.GetVertexStride(), file.GetIndexSize(), bytes / 1024.0, triangles.size() * sizeof(MeshVertex) / 1024.0,
+				100.0 * bytes / (triangles.size() * sizeof(MeshVertex)), openMs, positionError, uvError);
+		}
+		remove(path);
+
+		// CPU side of the draw: 3 transforms per triangle unindexed, one per vertex indexed
+		SoftRasterizer rasterizer(gWidth, gHeight, 1);
+		rasterizer.SetMatrices(scene.projMat, scene.viewMat);
+		SoftTexture tex = { 8, 8, &scene.checker[0] };
+		rasterizer.SetTexture(tex);
+		const int iterations = 10;
+		double drawMs[2];
+		for (int mode = 0; mode < 2; mode++)
+		{
+			start = std::chrono::high_resolution_clock::now();
+			for (int it = 0; it < iterations; it++)
+			{
+				if (mode)
+					rasterizer.DrawIndexed(reinterpret_cast<const SoftVertex*>(mesh.vertices.data()), mesh.vertices.size(),
+						mesh.indices.data(), mesh.indices.size(), MatIdentity());
+				else
+					rasterizer.Draw(reinterpret_cast<const SoftVertex*>(triangles.data()), triangles.size(), MatIdentity());
+				rasterizer.Flush();
+			}
+			drawMs[mode] = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count() / iterations;
+		}
+		printf("mesh %6zu triangles: software draw unindexed %.3f ms, indexed %.3f ms\n", trianglesCount, drawMs[0], drawMs[1]);
+	}
+	return true;
+}
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// smooth gradients, hard edges every 64 texels and some noise, alpha is a radial ramp
+void CreateTestImage(uint32_t width, uint32_t height, std::vector<uint32_t> &texels)
+{
+	texels.resize(size_t(width) * height);
+	uint32_t noise = 12345;
+	for (uint32_t y = 0; y < height; y++)
+		for (uint32_t x = 0; x < width; x++)
+		{
+			noise = noise * 1664525u + 1013904223u;
+			int jitter = static_cast<int>(noise >> 28) - 8;
+			bool edge = ((x / 64) + (y / 64)) % 2 != 0;
+			float dx = x - width * 0.5f, dy = y - height * 0.5f;
+			int r = static_cast<int>(255.0f * x / width) + jitter;
+			int g = edge ? 200 : static_cast<int>(255.0f * y / height);
+			int b = static_cast<int>(128.0f + 127.0f * std::sin(x * 0.05f) * std::cos(y * 0.03f)) + jitter;
+			int a = static_cast<int>(255.0f * std::min(1.0f, std::sqrt(dx * dx + dy * dy) / (width * 0.5f)));
+			r = std::min(255, std::max(0, r));
+			b = std::min(255, std::max(0, b));
+			texels[size_t(y) * width + x] = uint32_t(r) | uint32_t(g) << 8 | uint32_t(b) << 16 | uint32_t(a) << 24;
+		}
+}
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// peak signal to noise ratio of the first channels of two R8G8B8A8 images
+double ComputePsnr(const uint32_t *a, const uint32_t *b, size_t count, int firstChannel, int channels)
+{
+	double sum = 0.0;
+	for (size_t i = 0; i < count; i++)
+		for (int c = firstChannel; c < firstChannel + channels; c++)
+		{
+			double d = double(a[i] >> (c * 8) & 0xFF) - double(b[i] >> (c * 8) & 0xFF);
+			sum += d * d;
+		}
+	double mse = sum / (double(count) * channels);
+	return mse > 0.0 ? 10.0 * std::log10(255.0 * 255.0 / mse) : 99.0;
+}
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+bool BenchTexture(int maxThreads)
+{
+	const uint32_t size = 2048;
+	if (maxThreads <= 0)
+		maxThreads = std::max(1, static_cast<int>(std::thread::hardware_concurrency()));
+
+	std::vector<uint32_t> texels;
+	CreateTestImage(size, size, texels);
+
+	// mip chain, SIMD against the scalar reference
+	const int mipIterations = 10;
+	std::vector<TextureImage> levels, reference;
+	std::chrono::high_resolution_clock::time_point start = std::chrono::high_resolution_clock::now();
+	for (int it = 0; it < mipIterations; it++)
+		GenerateMips(texels.data(), size, size, levels);
+	double mipsMs = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count() / mipIterations;
+
+	reference.resize(levels.size());
+	reference[0] = levels[0];
+	start = std::chrono::high_resolution_clock::now();
+	for (int it = 0; it < mipIterations; it++)
+		for (size_t i = 1; i < levels.size(); i++)
+			DownsampleReference(reference[i - 1], reference[i]);
+	double referenceMs = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count() / mipIterations;
+
+	bool mipsMatch = true;
+	for (size_t i = 0; i < levels.size(); i++)
+		mipsMatch = mipsMatch && levels[i].texels == reference[i].texels;
+	printf("texture mips %ux%u, %zu levels: %.3f ms, scalar reference %.3f ms (%.2fx), %s\n", size, size, levels.size(), mipsMs,
+		referenceMs, referenceMs / mipsMs, mipsMatch ? "same texels" : "TEXELS DIFFER FROM THE REFERENCE");
+	bool passed = mipsMatch;
+
+	// block compression of the top level
+	const TextureFormat formats[] = { Texture_BC1, Texture_BC3, Texture_BC7 };
+	const char *formatNames[] = { "BC1", "BC3", "BC7" };
+	std::vector<uint32_t> decoded(texels.size());
+	for (int f = 0; f < 3; f++)
+	{
+		std::vector<unsigned char> blocks(GetLevelSize(formats[f], size, size));
+		double singleThreadMs = 0.0;
+		for (int threads = 1; threads <= maxThreads; threads = threads < maxThreads && threads * 2 > maxThreads ? maxThreads : threads * 2)
+		{
+			JobSystem jobs(threads);
+			start = std::chrono::high_resolution_clock::now();
+			CompressBlocks(texels.data(), size, size, formats[f], blocks.data(), &jobs);
+			double ms = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+			if (threads == 1)
+				singleThreadMs = ms;
+			printf("texture %s %2d threads: %.1f ms, %.1f Mtexels/s, %.2fx\n", formatNames[f], threads, ms,
+				size * size / (ms * 1000.0), singleThreadMs / ms);
+		}
+
+		if (!DecompressBlocks(blocks.data(), size, size, formats[f], decoded.data()))
+		{
+			fprintf(stderr, "%s blocks do not decode\n", formatNames[f]);
+			return false;
+		}
+		double rgbPsnr = ComputePsnr(texels.data(), decoded.data(), texels.size(), 0, 3);
+		if (formats[f] == Texture_BC1)
+			printf("texture %s PSNR rgb %.2f dB, %zu KB vs %zu KB RGBA8\n", formatNames[f], rgbPsnr, blocks.size() / 1024,
+				texels.size() * 4 / 1024);
+		else
+			printf("texture %s PSNR rgb %.2f dB, alpha %.2f dB, %zu KB vs %zu KB RGBA8\n", formatNames[f], rgbPsnr,
+				ComputePsnr(texels.data(), decoded.data(), texels.size(), 3, 1), blocks.size() / 1024, texels.size() * 4 / 1024);
+	}
+
+	// whole chain to DDS and back: the levels are used in place, nothing is read until they are touched
+	const char *path = "TextureBench.dds";
+	JobSystem jobs(maxThreads);
+	start = std::chrono::high_resolution_clock::now();
+	if (!SaveDds(path, levels, Texture_BC7, &jobs))
+	{
+		fprintf(stderr, "failed to write %s\n", path);
+		return false;
+	}
+	double saveMs = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+
+	start = std::chrono::high_resolution_clock::now();
+	DdsFile file;
+	bool opened = file.Open(path);
+	double openMs = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+
+	bool levelsMatch = opened && file.GetFormat() == Texture_BC7 && file.GetMipCount() == levels.size();
+	size_t fileBytes = 0, rgbaBytes = 0;
+	for (uint32_t i = 0; levelsMatch && i < file.GetMipCount(); i++)
+	{
+		const TextureLevel &level = file.GetLevel(i);
+		std::vector<unsigned char> blocks(GetLevelSize(Texture_BC7, levels[i].width, levels[i].height));
+		CompressBlocks(levels[i].texels.data(), levels[i].width, levels[i].height, Texture_BC7, blocks.data(), nullptr);
+		levelsMatch = level.width == levels[i].width && level.height == levels[i].height && level.size == blocks.size() &&
+			!memcmp(level.data, blocks.data(), blocks.size());
+		fileBytes += level.size;
+		rgbaBytes += levels[i].texels.size() * 4;
+	}
+	printf("texture dds BC7 %zu levels: %.1f KB vs %.1f KB RGBA8, save %.1f ms, open %.3f ms, %s\n", levels.size(),
+		fileBytes / 1024.0, rgbaBytes / 1024.0, saveMs, openMs, levelsMatch ? "levels match the encoder" : "LEVELS DO NOT READ BACK");
+	passed = passed && levelsMatch;
+	file.Close();
+
+	// the BC7 file is stale for a BC1 request, and that one for a request of the next level's size
+	bool rebuilt = OpenOrBuildTexture(file, path, texels.data(), size, size, Texture_BC1, &jobs) &&
+		file.GetFormat() == Texture_BC1 && file.GetWidth() == size && file.GetMipCount() == levels.size();
+	file.Close();
+	rebuilt = rebuilt && OpenOrBuildTexture(file, path, levels[1].texels.data(), levels[1].width, levels[1].height, Texture_BC1, &jobs) &&
+		file.GetFormat() == Texture_BC1 && file.GetWidth() == levels[1].width && file.GetMipCount() == levels.size() - 1;
+	file.Close();
+	printf("texture dds cached file of another format or size: %s\n", rebuilt ? "rebuilt" : "USED AS IT IS");
+	passed = passed && rebuilt;
+	remove(path);
+	return passed;
+}
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// keeps a copy of every uploaded level and charges a simulated copy cost to the clock, so the time budget is
+// exercised deterministically
+class FakeUploadDevice : public UploadDevice
+{
+public:
+	struct Texture
+	{
+		TextureFormat                           format;
+		uint32_t                                width, height;
+		std::vector<std::vector<unsigned char>> levels;
+	};
+
+	FakeUploadDevice(SteppedClock &clock, double msPerMB) : mClock(clock), mMsPerByte(msPerMB / (1024.0 * 1024.0)), mReleased(0) {}
+
+	void* CreateTexture(TextureFormat format, uint32_t width, uint32_t height, uint32_t mipCount) override
+	{
+		mTextures.push_back(std::unique_ptr<Texture>(new Texture{ format, width, height, std::vector<std::vector<unsigned char>>(mipCount) }));
+		return mTextures.back().get();
+	}
+
+	void UploadTextureLevel(void *texture, uint32_t level, const TextureLevel &data) override
+	{
+		const unsigned char *bytes = static_cast<const unsigned char*>(data.data);
+		static_cast<Texture*>(texture)->levels[level].assign(bytes, bytes + data.size);
+		mClock.Advance(data.size * mMsPerByte);
+	}
+
+	void ReleaseTexture(void *) override { mReleased++; }
+
+	size_t GetReleased() const { return mReleased; }
+
+private:
+	SteppedClock                          &mClock;
+	double                                mMsPerByte;
+	std::vector<std::unique_ptr<Texture>> mTextures;
+	size_t                                mReleased;
+};
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+bool BenchStreaming()
+{
+	// one source image saved in every format, single level RGBA8 files get their mips on the I/O threads
+	const uint32_t size = 1024;
+	std::vector<uint32_t> texels;
+	CreateTestImage(size, size, texels);
+	std::vector<TextureImage> levels;
+	GenerateMips(texels.data(), size, size, levels);
+	std::vector<TextureImage> topLevel(1, levels[0]);
+
+	struct StreamFile
+	{
+		const char                *path;
+		TextureFormat             format;
+		bool                      mips;
+		std::vector<TextureLevel> expected;
+	};
+	StreamFile files[] = {
+		{ "StreamBC1.dds", Texture_BC1, true, {} }, { "StreamBC3.dds", Texture_BC3, true, {} },
+		{ "StreamBC7.dds", Texture_BC7, true, {} }, { "StreamRGBA8.dds", Texture_RGBA8, true, {} },
+		{ "StreamRGBA8Top.dds", Texture_RGBA8, false, {} }, { "StreamMissing.dds", Texture_RGBA8, false, {} } };
+	const size_t filesCount = sizeof(files) / sizeof(files[0]);
+	const size_t missing = filesCount - 1;
+
+	// what the device should end up with: the file's levels, or the generated chain for the single level file
+	JobSystem jobs;
+	std::vector<std::unique_ptr<DdsFile>> expectedFiles;
+	for (size_t f = 0; f < missing; f++)
+	{
+		if (!SaveDds(files[f].path, files[f].mips ? levels : topLevel, files[f].format, &jobs))
+		{
+			fprintf(stderr, "failed to write %s\n", files[f].path);
+			return false;
+		}
+		expectedFiles.push_back(std::unique_ptr<DdsFile>(new DdsFile));
+		expectedFiles.back()->Open(files[f].path);
+		for (uint32_t i = 0; i < levels.size(); i++)
+		{
+			TextureLevel level = { levels[i].texels.data(), levels[i].width, levels[i].height, levels[i].width * 4u, levels[i].texels.size() * 4 };
+			files[f].expected.push_back(files[f].mips ? expectedFiles.back()->GetLevel(i) : level);
+		}
+	}
+	remove(files[missing].path);
+
+	// simulated copies at 4 GB/s, frames are 16.6 ms apart on the same clock
+	const double msPerMB = 0.25;
+	const StreamBudget budgets[] = { { SIZE_MAX, 1e9 }, { 1024 * 1024, 1.0 }, { 8 * 1024 * 1024, 0.5 } };
+	const char *budgetNames[] = { "unbudgeted", "1 MB / 1 ms", "8 MB / 0.5 ms" };
+	bool passed = true;
+	for (int b = 0; b < 3; b++)
+	{
+		SteppedClock clock;
+		FakeUploadDevice device(clock, msPerMB);
+		std::vector<AssetId> ids(filesCount);
+		{
+			// one I/O thread stages the files in request order
+			AssetStreamer streamer(device, clock, 1);
+
+			std::chrono::high_resolution_clock::time_point start = std::chrono::high_resolution_clock::now();
+			for (size_t f = 0; f < filesCount; f++)
+				ids[f] = streamer.RequestTexture(files[f].path);
+			double requestMs = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+
+			// the I/O phase runs in real time, the uploads only start once it is done so the frame counts do not depend on the disk
+			bool loading = true;
+			while (loading)
+			{
+				loading = false;
+				for (size_t f = 0; f < filesCount; f++)
+					loading = loading || streamer.GetState(ids[f]) < Asset_Staged;
+				if (loading)
+					std::this_thread::sleep_for(std::chrono::milliseconds(1));
+			}
+			double ioMs = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+
+			int frames = 0;
+			size_t maxBytes = 0;
+			double maxMs = 0.0;
+			while (!streamer.IsIdle())
+			{
+				streamer.Pump(budgets[b]);
+				StreamStats stats = streamer.GetStats();
+				maxBytes = std::max(maxBytes, stats.uploadedBytes);
+				maxMs = std::max(maxMs, stats.pumpMs);
+				clock.Advance(gSimulationStepMs);
+				frames++;
+			}
+
+			bool match = streamer.GetState(ids[missing]) == Asset_Failed;
+			for (size_t f = 0; f < missing; f++)
+			{
+				const FakeUploadDevice::Texture *texture = static_cast<const FakeUploadDevice::Texture*>(streamer.GetResource(ids[f]));
+				match = match && texture && texture->format == files[f].format && texture->levels.size() == files[f].expected.size();
+				for (size_t i = 0; match && i < texture->levels.size(); i++)
+					match = texture->levels[i].size() == files[f].expected[i].size &&
+						!memcmp(texture->levels[i].data(), files[f].expected[i].data, files[f].expected[i].size);
+			}
+
+			StreamStats stats = streamer.GetStats();
+			printf("streaming %-13s: %zu requests in %.3f ms, staged after %.1f ms, %d frames to upload, max %.2f MB and %.3f ms per frame, "
+				"%zu resident, %zu failed, %s\n", budgetNames[b], stats.requested, requestMs, ioMs, frames, maxBytes / (1024.0 * 1024.0),
+				maxMs, stats.resident, stats.failed, match ? "contents match" : "CONTENTS DIFFER");
+			passed = passed && match;
+		}
+		if (device.GetReleased() != missing)
+		{
+			passed = false;
+			printf("streaming %-13s: %zu of %zu textures released\n", budgetNames[b], device.GetReleased(), missing);
+		}
+	}
+
+	expectedFiles.clear();
+	for (size_t f = 0; f < missing; f++)
+		remove(files[f].path);
+	return passed;
+}
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// the InitRender graph, sleeping for typical step costs on a shader cache miss
+struct InitStep
+{
+	const char   *name;
+	TaskAffinity affinity;
+	double       ms;
+	int          dependencies[6]; // -1 terminated
+};
+const InitStep gInitSteps[] = {
+	{ "swapchain", Task_MainThread, 6.0, { -1 } },
+	{ "scene targets", Task_AnyThread, 1.5, { -1 } },
+	{ "geometry", Task_AnyThread, 3.0, { -1 } },
+	{ "vs compile", Task_AnyThread, 12.0, { -1 } },
+	{ "vs create", Task_AnyThread, 1.0, { 3, -1 } },
+	{ "input layout", Task_AnyThread, 1.0, { 2, 3, -1 } },
+	{ "cbuffer bind", Task_AnyThread, 0.0, { 3, -1 } },
+	{ "cbuffers", Task_AnyThread, 0.5, { -1 } },
+	{ "instance buffer", Task_AnyThread, 0.5, { -1 } },
+	{ "upload ring", Task_MainThread, 0.5, { -1 } },
+	{ "gpu timers", Task_AnyThread, 0.5, { -1 } },
+	{ "ps", Task_AnyThread, 6.0, { -1 } },
+	{ "texture", Task_AnyThread, 4.0, { -1 } },
+	{ "streamer", Task_MainThread, 0.5, { 12, -1 } },
+	{ "sampler", Task_AnyThread, 0.2, { -1 } },
+	{ "pipeline states", Task_AnyThread, 0.4, { -1 } },
+	{ "upscale", Task_AnyThread, 3.0, { -1 } },
+	{ "bind output", Task_MainThread, 0.1, { 0, 1, 15, 16, -1 } },
+	{ "record contexts", Task_AnyThread, 2.0, { 9, -1 } },
+	{ "frame pacer", Task_MainThread, 0.1, { 0, -1 } },
+};
+const int gInitStepsCount = sizeof(gInitSteps) / sizeof(gInitSteps[0]);
+
+// failing >= 0 makes that step return false
+void AddInitSteps(TaskGraph &graph, int failing)
+{
+	for (int i = 0; i < gInitStepsCount; i++)
+	{
+		const InitStep &step = gInitSteps[i];
+		auto function = [&step, i, failing]
+		{
+			std::this_thread::sleep_for(std::chrono::microseconds(static_cast<int>(step.ms * 1000.0)));
+			return i != failing;
+		};
+		TaskId id = graph.Add(step.name, step.affinity, function);
+		for (int d = 0; step.dependencies[d] >= 0; d++)
+			graph.AddDependency(id, step.dependencies[d]);
+	}
+}
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// every task started after all of its dependencies ended, main thread tasks ran on thread 0
+bool CheckTaskOrder(const TaskGraph &graph)
+{
+	for (TaskId id = 0; id < graph.GetTasksCount(); id++)
+	{
+		if (graph.GetState(id) == Task_Skipped)
+			continue;
+		const std::vector<TaskId> &dependencies = graph.GetDependencies(id);
+		for (size_t d = 0; d < dependencies.size(); d++)
+			if (graph.GetState(dependencies[d]) != Task_Done || graph.GetTiming(dependencies[d]).endMs > graph.GetTiming(id).startMs)
+				return false;
+	}
+	return true;
+}
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// maxThreads 0 scales up to 8 threads, the steps mostly sleep so they overlap even on fewer cores
+bool BenchTaskGraph(int maxThreads)
+{
+	if (maxThreads <= 0)
+		maxThreads = 8;
+
+	double serialMs = 0.0;
+	bool passed = true;
+	for (int threads = 1; threads <= maxThreads; threads = threads < maxThreads && threads * 2 > maxThreads ? maxThreads : threads * 2)
+	{
+		JobSystem jobs(threads);
+		TaskGraph graph(gFrameClock);
+		AddInitSteps(graph, -1);
+		bool succeeded = graph.Run(jobs);
+
+		bool affinity = true;
+		for (TaskId id = 0; id < graph.GetTasksCount(); id++)
+			affinity = affinity && (gInitSteps[id].affinity == Task_AnyThread || graph.GetTiming(id).thread == 0);
+		if (threads == 1)
+			serialMs = graph.GetWallMs();
+
+		std::vector<TaskId> path = graph.GetCriticalPath();
+		std::string names;
+		double pathMs = 0.0;
+		for (size_t i = 0; i < path.size(); i++)
+		{
+			names += std::string(i ? " > " : "") + graph.GetName(path[i]);
+			pathMs += graph.GetDurationMs(path[i]);
+		}
+		printf("taskgraph %d threads: %.1f ms for %.1f ms of steps, %.2fx, critical path %.1f ms (%s), %s\n", threads,
+			graph.GetWallMs(), graph.GetWorkMs(), serialMs / graph.GetWallMs(), pathMs, names.c_str(),
+			succeeded && CheckTaskOrder(graph) && affinity ? "order and affinity respected" : "ORDER OR AFFINITY VIOLATED");
+		passed = passed && succeeded && CheckTaskOrder(graph) && affinity;
+	}
+
+	// a failed texture skips the streamer only, everything else still gets created
+	{
+		JobSystem jobs(maxThreads);
+		TaskGraph graph(gFrameClock);
+		AddInitSteps(graph, 12);
+		bool succeeded = graph.Run(jobs);
+		int done = 0, failed = 0, skipped = 0;
+		for (TaskId id = 0; id < graph.GetTasksCount(); id++)
+		{
+			done += graph.GetState(id) == Task_Done;
+			failed += graph.GetState(id) == Task_Failed;
+			skipped += graph.GetState(id) == Task_Skipped;
+		}
+		bool expected = !succeeded && failed == 1 && skipped == 1 && graph.GetState(13) == Task_Skipped && CheckTaskOrder(graph);
+		printf("taskgraph failure: %d done, %d failed, %d skipped, %s\n", done, failed, skipped,
+			expected ? "dependents skipped" : "UNEXPECTED STATES");
+		passed = passed && expected;
+	}
+
+	// random graphs of empty tasks: every task runs exactly once, after its dependencies
+	const int graphs = 500;
+	const int tasksCount = 64;
+	uint32_t seed = 12345;
+	int violations = 0;
+	std::chrono::high_resolution_clock::time_point start = std::chrono::high_resolution_clock::now();
+	for (int g = 0; g < graphs; g++)
+	{
+		JobSystem jobs(1 + g % maxThreads);
+		TaskGraph graph(gFrameClock);
+		std::atomic<int> sequence(0);
+		std::vector<std::atomic<int>> order(tasksCount);
+		std::vector<std::atomic<int>> runs(tasksCount);
+		for (int i = 0; i < tasksCount; i++)
+		{
+			order[i] = -1;
+			runs[i] = 0;
+			auto function = [&sequence, &order, &runs, i]
+			{
+				runs[i]++;
+				order[i] = sequence++;
+				return true;
+			};
+			seed = seed * 1664525u + 1013904223u;
+			TaskId id = graph.Add("random", seed >> 31 ? Task_MainThread : Task_AnyThread, function);
+			for (int d = 0; d < i; d++)
+			{
+				seed = seed * 1664525u + 1013904223u;
+				if ((seed >> 24) < 16)
+					graph.AddDependency(id, d);
+			}
+		}
+		violations += !graph.Run(jobs);
+		for (int i = 0; i < tasksCount; i++)
+		{
+			violations += runs[i] != 1;
+			const std::vector<TaskId> &dependencies = graph.GetDependencies(i);
+			for (size_t d = 0; d < dependencies.size(); d++)
+				violations += order[dependencies[d]] >= order[i];
+		}
+	}
+	std::chrono::duration<double, std::milli> elapsed = std::chrono::high_resolution_clock::now() - start;
+	printf("taskgraph random: %d graphs of %d tasks, %.3f ms per graph, %d violations\n", graphs, tasksCount,
+		elapsed.count() / graphs, violations);
+	passed = passed && !violations;
+	return passed;
+}
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+struct PacingResult
+{
+	double avgLatencyMs; // frame start (input) to the vblank that shows it
+	double p99LatencyMs;
+	double fps;          // frames shown per second
+	size_t repeated;     // vblanks that showed the previous frame again
+	uint64_t late;       // frames that missed the pacer's target
+};
+
+// frames against a synthetic display with vblanks every refreshMs; the queue is modeled like DXGI's: VSync blocks in
+// Present while three frames wait, LowLatency blocks on the waitable object while one does, Uncapped shows at once
+PacingResult SimulatePacing(PresentMode mode, bool paced, double refreshMs, double guessMs, const std::vector<double> &work)
+{
+	const size_t queued = mode == Present_VSync ? 3 : 1;
+	SteppedClock clock;
+	FramePacer pacer(clock, mode, guessMs);
+	std::vector<double> shown(work.size());
+	std::vector<int64_t> shownVBlanks(work.size()); // index of the showing vblank, exact where sums of refreshMs are not
+	std::vector<double> latencies(work.size());
+	for (size_t i = 0; i < work.size(); i++)
+	{
+		if (mode == Present_LowLatency && i >= queued)
+			clock.Advance(std::max(0.0, shown[i - queued] - clock.NowMs()));
+
+		// what GetFrameStatistics reports: the latest vblank
+		pacer.OnVBlank(std::floor(clock.NowMs() / refreshMs) * refreshMs);
+		if (paced)
+			clock.Advance(std::max(0.0, pacer.ScheduleFrame() - clock.NowMs()));
+
+		double startMs = clock.NowMs();
+		pacer.BeginFrame();
+		clock.Advance(work[i]);
+		pacer.EndFrame();
+
+		double doneMs = clock.NowMs();
+		if (mode == Present_Uncapped)
+			shown[i] = doneMs;
+		else
+		{
+			shownVBlanks[i] = static_cast<int64_t>(std::ceil(doneMs / refreshMs - 1e-9));
+			if (i && shownVBlanks[i] <= shownVBlanks[i - 1])
+				shownVBlanks[i] = shownVBlanks[i - 1] + 1;
+			shown[i] = shownVBlanks[i] * refreshMs;
+			if (mode == Present_VSync && i >= queued)
+				clock.Advance(std::max(0.0, shown[i - queued] - clock.NowMs()));
+		}
+		latencies[i] = shown[i] - startMs;
+	}
+
+	// the first second settles the queue and the estimates
+	size_t first = std::min(work.size() - 1, static_cast<size_t>(1000.0 / refreshMs));
+	size_t count = work.size() - first;
+	PacingResult result;
+	result.avgLatencyMs = 0.0;
+	for (size_t i = first; i < work.size(); i++)
+		result.avgLatencyMs += latencies[i] / count;
+	std::vector<double> sorted(latencies.begin() + first, latencies.end());
+	std::sort(sorted.begin(), sorted.end());
+	result.p99LatencyMs = sorted[std::min(count - 1, static_cast<size_t>(std::ceil(0.99 * count)) - 1)];
+	double spanMs = shown.back() - shown[first];
+	result.fps = spanMs > 0.0 ? 1000.0 * (count - 1) / spanMs : 0.0;
+	result.repeated = mode == Present_Uncapped ? 0 : static_cast<size_t>(shownVBlanks.back() - shownVBlanks[first]) + 1 - count;
+	result.late = pacer.GetLateFrames();
+	return result;
+}
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+bool BenchPacing()
+{
+	// CPU work traces: steady light frames, heavy noisy frames, light frames with a 14 ms hitch every half second
+	const size_t frames = 3000;
+	const char *traceNames[] = { "light", "heavy", "hitches" };
+	std::vector<double> traces[3];
+	uint32_t seed = 7;
+	for (size_t i = 0; i < frames; i++)
+	{
+		seed = seed * 1664525u + 1013904223u;
+		double noise = (seed >> 8) / double(1 << 24); // [0, 1)
+		traces[0].push_back(3.0 + noise);
+		traces[1].push_back(10.0 + 4.0 * noise);
+		traces[2].push_back(i % 30 == 29 ? 14.0 : 3.0 + noise);
+	}
+
+	struct Display
+	{
+		const char *name;
+		double     refreshMs;
+		double     guessMs;
+	};
+	const Display displays[] = { { "60 Hz", 1000.0 / 60.0, 1000.0 / 60.0 }, { "144 Hz", 1000.0 / 144.0, 1000.0 / 60.0 } };
+	const PresentMode modes[] = { Present_VSync, Present_LowLatency, Present_Uncapped };
+	const char *modeNames[] = { "vsync", "lowlatency", "uncapped" };
+	// a hitch is one late frame, the rest is the first frames before the estimate settles
+	const uint64_t maxLateFrames = frames / 30 + 10;
+
+	bool passed = true;
+	for (int d = 0; d < 2; d++)
+		for (int t = 0; t < 3; t++)
+			for (int m = 0; m < 3; m++)
+				for (int paced = 0; paced < 2; paced++)
+				{
+					// uncapped ignores the schedule, one row is enough
+					if (modes[m] == Present_Uncapped && paced)
+						continue;
+					PacingResult result = SimulatePacing(modes[m], paced != 0, displays[d].refreshMs, displays[d].guessMs, traces[t]);
+
+					// paced light frames are shown at the first vblank after they start, every vblank gets a new one; a paced
+					// frame with a hitch misses its vblank but the ones after it do not
+					const char *check = "";
+					if (paced && t == 0)
+					{
+						double refreshFps = 1000.0 / displays[d].refreshMs;
+						bool ok = result.avgLatencyMs < displays[d].refreshMs + 2.0 && !result.repeated &&
+							std::fabs(result.fps - refreshFps) < 0.01 * refreshFps;
+						check = ok ? ", shown at the next vblank" : ", NOT PACED TO THE REFRESH";
+						passed = passed && ok;
+					}
+					else if (paced && t == 2)
+					{
+						bool ok = result.late <= maxLateFrames;
+						check = ok ? ", late frames bounded" : ", TOO MANY LATE FRAMES";
+						passed = passed && ok;
+					}
+					printf("pacing %-6s %-7s %-10s %-8s: latency avg %5.1f ms p99 %5.1f ms, %5.1f fps, %4zu repeated vblanks, %4llu late%s\n",
+						displays[d].name, traceNames[t], modeNames[m], paced ? "paced" : "unpaced", result.avgLatencyMs,
+						result.p99LatencyMs, result.fps, result.repeated, static_cast<unsigned long long>(result.late), check);
+				}
+	return passed;
+}
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+struct ResolutionResult
+{
+	double   avgMs;
+	double   overTarget; // fraction of frames over the budget
+	double   avgScale;
+	float    minScale;
+	float    maxScale;
+	uint64_t changes;
+};
+
+// replays full resolution GPU costs: a frame at scale s costs fixedShare of it plus the rest times s * s, and the
+// scaler sees it kFramesInFlight frames late like the timestamp queries in main.cpp
+ResolutionResult SimulateResolution(bool dynamic, double targetMs, const std::vector<double> &fullMs)
+{
+	const double fixedShare = 0.1;
+	const size_t latency = kFramesInFlight;
+	ResolutionSettings settings = DefaultResolutionSettings();
+	settings.targetMs = targetMs;
+	ResolutionScaler scaler(settings);
+
+	ResolutionResult result = { 0.0, 0.0, 0.0, 1.0f, 0.0f, 0 };
+	std::vector<double> measured(fullMs.size());
+	for (size_t i = 0; i < fullMs.size(); i++)
+	{
+		float scale = dynamic ? scaler.GetScale() : 1.0f;
+		measured[i] = fullMs[i] * (fixedShare + (1.0 - fixedShare) * scale * scale);
+		if (dynamic && i >= latency)
+			scaler.AddFrame(measured[i - latency]);
+
+		result.avgMs += measured[i] / fullMs.size();
+		result.overTarget += measured[i] > targetMs ? 1.0 / fullMs.size() : 0.0;
+		result.avgScale += double(scale) / fullMs.size();
+		result.minScale = std::min(result.minScale, scale);
+		result.maxScale = std::max(result.maxScale, scale);
+	}
+	result.changes = scaler.GetChanges();
+	return result;
+}
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// one full resolution frame time in ms per line, false if the file cannot be read or has none
+bool LoadFrameTrace(const char *path, std::vector<double> &trace)
+{
+	FILE *file = fopen(path, "r");
+	if (!file)
+		return false;
+	double ms;
+	while (fscanf(file, "%lf", &ms) == 1)
+		if (ms > 0.0)
+			trace.push_back(ms);
+	fclose(file);
+	return !trace.empty();
+}
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// frameTimesPath adds a recorded trace to the synthetic ones
+bool BenchResolution(const char *frameTimesPath)
+{
+	// full resolution costs at 60 Hz: steadily too heavy, a load ramping up and back down, light frames with heavy
+	// stretches of half a second, and light frames the scaler should leave alone
+	const size_t frames = 3600;
+	std::vector<std::string> traceNames = { "heavy", "ramp", "bursts", "light" };
+	std::vector<std::vector<double>> traces(traceNames.size());
+	uint32_t seed = 11;
+	for (size_t i = 0; i < frames; i++)
+	{
+		seed = seed * 1664525u + 1013904223u;
+		double noise = (seed >> 8) / double(1 << 24) - 0.5; // [-0.5, 0.5)
+		double ramp = i < frames / 2 ? double(i) / (frames / 2) : double(frames - i) / (frames / 2);
+		traces[0].push_back(22.0 + 2.0 * noise);
+		traces[1].push_back(8.0 + 22.0 * ramp + 2.0 * noise);
+		traces[2].push_back((i % 300 >= 240 ? 28.0 : 10.0) + 2.0 * noise);
+		traces[3].push_back(9.0 + 2.0 * noise);
+	}
+
+	if (frameTimesPath)
+	{
+		traceNames.push_back(frameTimesPath);
+		traces.push_back(std::vector<double>());
+		if (!LoadFrameTrace(frameTimesPath, traces.back()))
+		{
+			fprintf(stderr, "no frame times in %s\n", frameTimesPath);
+			return false;
+		}
+	}
+
+	// the steadily heavy trace is brought under the budget, the light one is left at full resolution, and no trace
+	// takes the scale out of the settings' range
+	const double targetMs = 1000.0 / 60.0;
+	const ResolutionSettings settings = DefaultResolutionSettings();
+	bool passed = true;
+	for (size_t t = 0; t < traces.size(); t++)
+		for (int dynamic = 0; dynamic < 2; dynamic++)
+		{
+			ResolutionResult result = SimulateResolution(dynamic != 0, targetMs, traces[t]);
+			bool ok = result.minScale >= settings.minScale && result.maxScale <= settings.maxScale;
+			if (dynamic && t == 0)
+				ok = ok && result.overTarget < 0.01;
+			else if (dynamic && t == 3)
+				ok = ok && result.minScale == 1.0f && !result.changes;
+			printf("resolution %-8s %-7s: %5.2f ms avg, %5.1f%% over %.1f ms, scale avg %.2f min %.2f, %4llu changes%s\n",
+				traceNames[t].c_str(), dynamic ? "dynamic" : "fixed", result.avgMs, 100.0 * result.overTarget, targetMs,
+				result.avgScale, result.minScale, static_cast<unsigned long long>(result.changes), ok ? "" : ", WRONG SCALE");
+			passed = passed && ok;
+		}
+	return passed;
+}
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+struct LoopResult
+{
+	double   visibleFps;
+	double   jitterMs;    // mean absolute difference between consecutive visible frame intervals
+	double   cpuPercent;  // of one core, over the whole run
+	double   hiddenCpuPercent;
+	double   slackMs;
+	uint64_t sleeps, spins;
+};
+
+// 10 s of a loop with frames of 3 to 4 ms CPU work on stepped wall and CPU clocks, hidden from 4 s to 7 s. A sleep wakes
+// on the timer's tick (0 for a high resolution timer) plus up to 0.3 ms of scheduling noise and costs 20 us of CPU,
+// a spin yields for 50 us of CPU. Hidden frames cost the same as visible ones: Present returns at once.
+LoopResult SimulateLoop(LoopMode mode, double capMs, double timerTickMs)
+{
+	const double durationMs = 10000.0, hideMs = 4000.0, showMs = 7000.0;
+	SteppedClock clock, cpuClock;
+	LoopScheduler scheduler(clock, cpuClock, mode, capMs);
+	std::vector<double> starts;
+	double hiddenCpuMs = 0.0;
+	uint32_t seed = 5;
+	while (clock.NowMs() < durationMs)
+	{
+		bool hidden = clock.NowMs() >= hideMs && clock.NowMs() < showMs;
+		scheduler.SetHidden(hidden);
+		double cpuBeforeMs = cpuClock.NowMs();
+		seed = seed * 1664525u + 1013904223u;
+		double noise = (seed >> 8) / double(1 << 24); // [0, 1)
+
+		switch (scheduler.Next())
+		{
+		case Loop_Render:
+		{
+			scheduler.BeginFrame();
+			if (!hidden)
+				starts.push_back(clock.NowMs());
+			double workMs = 3.0 + noise;
+			clock.Advance(workMs);
+			cpuClock.Advance(workMs);
+			scheduler.EndFrame();
+			break;
+		}
+		case Loop_Sleep:
+		case Loop_Idle:
+		{
+			double wakeMs = scheduler.GetWakeMs();
+			if (timerTickMs > 0.0)
+				wakeMs = std::ceil(wakeMs / timerTickMs) * timerTickMs;
+			clock.Advance(std::max(0.0, wakeMs - clock.NowMs()) + 0.3 * noise);
+			cpuClock.Advance(0.02);
+			break;
+		}
+		case Loop_Spin:
+			clock.Advance(0.05);
+			cpuClock.Advance(0.05);
+			break;
+		}
+		if (hidden)
+			hiddenCpuMs += cpuClock.NowMs() - cpuBeforeMs;
+	}
+
+	LoopStats stats = scheduler.GetStats();
+	LoopResult result;
+	double visibleMs = durationMs - (showMs - hideMs);
+	result.visibleFps = 1000.0 * starts.size() / visibleMs;
+	result.jitterMs = 0.0;
+	size_t intervals = 0;
+	for (size_t i = 2; i < starts.size(); i++)
+	{
+		// the jump over the hidden span is not an interval
+		if (starts[i - 2] < hideMs && starts[i] >= showMs)
+			continue;
+		result.jitterMs += std::fabs((starts[i] - starts[i - 1]) - (starts[i - 1] - starts[i - 2]));
+		intervals++;
+	}
+	result.jitterMs /= std::max<size_t>(intervals, 1);
+	result.cpuPercent = 100.0 * stats.cpuMs / stats.wallMs;
+	result.hiddenCpuPercent = 100.0 * hiddenCpuMs / (showMs - hideMs);
+	result.slackMs = scheduler.GetTimerSlackMs();
+	result.sleeps = stats.sleeps;
+	result.spins = stats.spins;
+	return result;
+}
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+bool BenchLoop()
+{
+	struct LoopCase
+	{
+		const char *name;
+		LoopMode   mode;
+		double     capMs;
+		double     timerTickMs;
+	};
+	const LoopCase cases[] = {
+		{ "fullspeed", Loop_FullSpeed, 0.0, 0.0 },
+		{ "idle when hidden", Loop_IdleWhenHidden, 0.0, 0.0 },
+		{ "capped 60 Hz", Loop_Capped, 1000.0 / 60.0, 0.0 },
+		{ "capped 144 Hz", Loop_Capped, 1000.0 / 144.0, 0.0 },
+		{ "capped 60 Hz, 15.6 ms tick", Loop_Capped, 1000.0 / 60.0, 15.625 },
+	};
+	// full speed keeps a core busy, idle when hidden gives it up while hidden, a cap is hit within 1 fps and, on a high
+	// resolution timer, spaces the frames within half a millisecond of each other
+	bool passed = true;
+	for (size_t i = 0; i < sizeof(cases) / sizeof(cases[0]); i++)
+	{
+		LoopResult result = SimulateLoop(cases[i].mode, cases[i].capMs, cases[i].timerTickMs);
+		bool ok = true;
+		if (cases[i].mode == Loop_FullSpeed)
+			ok = result.cpuPercent > 99.0;
+		else if (cases[i].mode == Loop_IdleWhenHidden)
+			ok = result.hiddenCpuPercent < 1.0;
+		else
+			ok = std::fabs(result.visibleFps - 1000.0 / cases[i].capMs) <= 1.0 && (cases[i].timerTickMs > 0.0 || result.jitterMs < 0.5);
+		printf("loop %-26s: %6.1f fps, jitter %5.2f ms, cpu %5.1f%% (hidden %5.1f%%), slack %.2f ms, %llu sleeps, %llu spins%s\n",
+			cases[i].name, result.visibleFps, result.jitterMs, result.cpuPercent, result.hiddenCpuPercent, result.slackMs,
+			static_cast<unsigned long long>(result.sleeps), static_cast<unsigned long long>(result.spins), ok ? "" : ", WRONG PACE");
+		passed = passed && ok;
+	}
+	return passed;
+}
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// resident set of the process, now and at its peak; 0 where the platform does not say
+void GetMemoryUse(size_t &currentBytes, size_t &peakBytes)
+{
+	currentBytes = 0;
+	peakBytes = 0;
+#if defined(_WIN32)
+	PROCESS_MEMORY_COUNTERS counters;
+	if (GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters)))
+	{
+		currentBytes = counters.WorkingSetSize;
+		peakBytes = counters.PeakWorkingSetSize;
+	}
+#else
+	rusage usage;
+	if (!getrusage(RUSAGE_SELF, &usage))
+		peakBytes = static_cast<size_t>(usage.ru_maxrss) * 1024; // KB on Linux
+	FILE *statm = fopen("/proc/self/statm", "r");
+	if (statm)
+	{
+		unsigned long pages, residentPages;
+		if (fscanf(statm, "%lu %lu", &pages, &residentPages) == 2)
+			currentBytes = static_cast<size_t>(residentPages) * sysconf(_SC_PAGESIZE);
+		fclose(statm);
+	}
+	// the two are read at different times
+	peakBytes = std::max(peakBytes, currentBytes);
+#endif
+}
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+struct TimeSummary
+{
+	double avgMs, p50Ms, p95Ms, p99Ms, maxMs;
+};
+
+// nearest rank like FrameStats, over every sample instead of its window
+TimeSummary SummarizeTimes(std::vector<double> samples)
+{
+	TimeSummary summary = { 0.0, 0.0, 0.0, 0.0, 0.0 };
+	if (samples.empty())
+		return summary;
+	std::sort(samples.begin(), samples.end());
+	for (size_t i = 0; i < samples.size(); i++)
+		summary.avgMs += samples[i] / samples.size();
+	auto percentile = [&samples](double p)
+	{
+		size_t rank = static_cast<size_t>(std::ceil(p * samples.size()));
+		return samples[std::min(samples.size(), std::max<size_t>(rank, 1)) - 1];
+	};
+	summary.p50Ms = percentile(0.50);
+	summary.p95Ms = percentile(0.95);
+	summary.p99Ms = percentile(0.99);
+	summary.maxMs = samples.back();
+	return summary;
+}
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+void WriteTimeSummary(FILE *file, const char *name, const TimeSummary &summary)
+{
+	fprintf(file, "  \"%s\": {\"avg\": %.4f, \"p50\": %.4f, \"p95\": %.4f, \"p99\": %.4f, \"max\": %.4f},\n", name,
+		summary.avgMs, summary.p50Ms, summary.p95Ms, summary.p99Ms, summary.maxMs);
+}
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// the regular headless frame loop, measured after warmup frames; the scene is deterministic, so image_hash only changes
+// when the rendering does. Writes one JSON object to jsonPath, stdout without one.
+bool BenchScene(int frames, int warmup, int threads, uint32_t textureSize, const char *jsonPath)
+{
+	HeadlessScene scene;
+	if (!CreateScene(scene, textureSize))
+		return false;
+
+	SoftRasterizer rasterizer(gWidth, gHeight, threads);
+	rasterizer.SetMatrices(MatIdentity(), MatIdentity());
+	InstanceBatcher batcher;
+	SoftInstanceBackend backend(rasterizer, scene, gMaxInstances);
+	Simulation simulation(gSimulationClock, gInstancesCount, gSimulationStepMs);
+
+	std::vector<double> frameMs, submitMs, flushMs;
+	uint64_t draws = 0, requested = 0, issued = 0;
+	uint64_t heapAllocations = 0, heapFrames = 0;
+	size_t triangles = 0;
+	uint64_t shadedPixels = 0;
+	for (int i = 0; i < warmup + frames; i++)
+	{
+		uint64_t drawsBefore = gDrawCalls;
+		size_t trianglesBefore = rasterizer.GetTrianglesCount();
+		uint64_t shadedBefore = rasterizer.GetShadedPixels();
+		uint64_t heapBefore = GetThreadHeapAllocations();
+		gFrameStats.BeginFrame();
+		RenderTick(rasterizer, scene, simulation, batcher, backend);
+		gFrameStats.EndPresent();
+		if (i < warmup)
+			continue;
+
+		// the render thread's, like the count main.cpp reports
+		uint64_t frameHeapAllocations = GetThreadHeapAllocations() - heapBefore;
+		heapAllocations += frameHeapAllocations;
+		heapFrames += frameHeapAllocations ? 1 : 0;
+
+		// the loop does nothing between frames, so the frame time is submit plus flush
+		FrameTimes times = gFrameStats.GetLastFrame();
+		frameMs.push_back(times.frameMs);
+		submitMs.push_back(times.cpuSubmitMs);
+		flushMs.push_back(times.presentWaitMs);
+		draws += gDrawCalls - drawsBefore;
+		triangles += rasterizer.GetTrianglesCount() - trianglesBefore;
+		shadedPixels += rasterizer.GetShadedPixels() - shadedBefore;
+		requested += gStateFilter.GetStats().requested;
+		issued += gStateFilter.GetStats().issued;
+	}
+
+	// FNV-1a of the last frame
+	uint64_t hash = 14695981039346656037ull;
+	const uint32_t *color = rasterizer.GetColorBuffer();
+	for (int y = 0; y < rasterizer.GetHeight(); y++)
+		for (int x = 0; x < rasterizer.GetWidth(); x++)
+			hash = (hash ^ color[y * rasterizer.GetPitch() + x]) * 1099511628211ull;
+
+	size_t currentBytes, peakBytes;
+	GetMemoryUse(currentBytes, peakBytes);
+	size_t textureBytes = scene.checker.size() * sizeof(uint32_t);
+	size_t framebufferBytes = size_t(rasterizer.GetPitch()) * rasterizer.GetHeight() * (sizeof(uint32_t) + sizeof(float));
+
+	FILE *file = jsonPath ? fopen(jsonPath, "w") : stdout;
+	if (!file)
+	{
+		fprintf(stderr, "failed to open %s\n", jsonPath);
+		return false;
+	}
+	double measured = frames > 0 ? frames : 1;
+	fprintf(file, "{\n  \"benchmark\": \"scene\",\n  \"objects\": %d,\n  \"draw\": \"%s\",\n  \"sort\": \"%s\",\n"
+		"  \"textures\": %d,\n  \"texture_size\": %u,\n  \"width\": %d,\n  \"height\": %d,\n  \"threads\": %d,\n  \"frames\": %d,\n  \"warmup\": %d,\n",
+		gInstancesCount, gUseInstancing ? "instanced" : "perobject", !gSortDraws ? "off" : gOpaqueOrder == Order_State ? "state" : "depth",
+		gTexturesCount, scene.checkerSize, gWidth, gHeight, rasterizer.GetThreadsCount(), frames, warmup);
+	WriteTimeSummary(file, "frame_ms", SummarizeTimes(frameMs));
+	WriteTimeSummary(file, "cpu_submit_ms", SummarizeTimes(submitMs));
+	WriteTimeSummary(file, "flush_ms", SummarizeTimes(flushMs));
+	fprintf(file, "  \"draws_per_frame\": %.2f,\n  \"triangles_per_frame\": %.2f,\n  \"shaded_pixels_per_frame\": %.1f,\n"
+		"  \"state_calls_requested_per_frame\": %.2f,\n  \"state_calls_issued_per_frame\": %.2f,\n", draws / measured,
+		triangles / measured, shadedPixels / measured, requested / measured, issued / measured);
+	// null without COUNT_HEAP_ALLOCATIONS
+	char heapPerFrame[32] = "null", heapFramesCount[32] = "null";
+	if (IsCountingHeapAllocations())
+	{
+		snprintf(heapPerFrame, sizeof(heapPerFrame), "%.2f", heapAllocations / measured);
+		snprintf(heapFramesCount, sizeof(heapFramesCount), "%llu", static_cast<unsigned long long>(heapFrames));
+	}
+	ArenaStats arena = GetFrameArenaStats();
+	fprintf(file, "  \"heap_allocations_per_frame\": %s,\n  \"frames_with_heap_allocations\": %s,\n"
+		"  \"frame_arena\": {\"peak_bytes\": %zu, \"reserved_bytes\": %zu, \"block_allocations\": %llu},\n",
+		heapPerFrame, heapFramesCount, arena.peakBytes, arena.reservedBytes, static_cast<unsigned long long>(arena.blockAllocations));
+	fprintf(file, "  \"memory\": {\"current_bytes\": %zu, \"peak_bytes\": %zu, \"texture_bytes\": %zu, \"framebuffer_bytes\": %zu},\n",
+		currentBytes, peakBytes, textureBytes, framebufferBytes);
+	fprintf(file, "  \"image_hash\": \"%016llx\"\n}\n", static_cast<unsigned long long>(hash));
+	if (jsonPath)
+		fclose(file);
+
+	// scratch has reached its peak in warmup, the render thread must not allocate in a steady frame
+	if (IsCountingHeapAllocations() && heapFrames > 0)
+	{
+		fprintf(stderr, "scene: HEAP ALLOCATIONS IN %llu STEADY FRAMES\n", static_cast<unsigned long long>(heapFrames));
+		return false;
+	}
+	return true;
+}
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// transient containers of one frame, built from alloc rebound to their element types. Every vector is dropped right
+// away, the heap's best case: it hands the same block back while it is still in the cache.
+template <class Alloc>
+uint64_t BuildVectors(const Alloc &alloc, size_t count, uint32_t seed)
+{
+	uint64_t sum = 0;
+	for (size_t i = 0; i < count; i++)
+	{
+		std::vector<uint32_t, Alloc> values(alloc);
+		size_t length = 16 + (i * 37 + seed) % 128;
+		values.reserve(length);
+		for (size_t j = 0; j < length; j++)
+			values.push_back(static_cast<uint32_t>(i + j));
+		sum += values[length / 2];
+	}
+	return sum;
+}
+
+template <class Alloc>
+uint64_t BuildMap(const Alloc &alloc, size_t count, uint32_t seed)
+{
+	typedef std::pair<const uint32_t, uint32_t> Entry;
+	typedef typename std::allocator_traits<Alloc>::template rebind_alloc<Entry> EntryAlloc;
+	std::map<uint32_t, uint32_t, std::less<uint32_t>, EntryAlloc> entries((EntryAlloc(alloc)));
+	uint32_t key = seed;
+	for (size_t i = 0; i < count; i++)
+	{
+		key = key * 1664525u + 1013904223u;
+		entries[key >> 12] += static_cast<uint32_t>(i);
+	}
+	return entries.size() + entries.begin()->second;
+}
+
+// count blocks of 16 to 256 bytes in blocks, all alive until the end of the frame
+uint64_t BuildBlocks(bool arena, size_t count, uint32_t seed, void **blocks)
+{
+	uint64_t sum = 0;
+	for (size_t i = 0; i < count; i++)
+	{
+		size_t size = 16 + (i * 53 + seed) % 241;
+		blocks[i] = arena ? GetFrameArena().Allocate(size, 16) : ::operator new(size);
+		static_cast<unsigned char*>(blocks[i])[0] = static_cast<unsigned char>(i);
+		sum += static_cast<unsigned char*>(blocks[i])[0];
+	}
+	if (!arena)
+		for (size_t i = 0; i < count; i++)
+			::operator delete(blocks[i]);
+	return sum;
+}
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+std::atomic<uint64_t> gJobHeapAllocations(0);
+
+struct ArenaResult
+{
+	TimeSummary times;
+	double      heapAllocations; // per frame, on every thread
+	uint64_t    check;
+};
+
+// work(arena, frame) returns a checksum, the frame arena is started before it when arena is set
+template <class Work>
+ArenaResult RunArenaFrames(bool arena, Work &work)
+{
+	const int warmup = 20, frames = 200;
+	ArenaResult result = { TimeSummary(), 0.0, 0 };
+	std::vector<double> times;
+	times.reserve(frames);
+	uint64_t heapAllocations = 0;
+	for (int i = 0; i < warmup + frames; i++)
+	{
+		uint64_t heapBefore = GetThreadHeapAllocations();
+		gJobHeapAllocations = 0;
+		std::chrono::high_resolution_clock::time_point start = std::chrono::high_resolution_clock::now();
+		if (arena)
+			BeginArenaFrame();
+		result.check += work(arena, i);
+		std::chrono::duration<double, std::milli> elapsed = std::chrono::high_resolution_clock::now() - start;
+		if (i < warmup)
+			continue;
+		times.push_back(elapsed.count());
+		heapAllocations += GetThreadHeapAllocations() - heapBefore + gJobHeapAllocations.load();
+	}
+	result.times = SummarizeTimes(times);
+	result.heapAllocations = double(heapAllocations) / frames;
+	return result;
+}
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// the same transient work per frame on the default allocator and on the frame arena; maxThreads 0 uses the hardware
+// threads for the job case
+bool BenchArena(int maxThreads)
+{
+	if (maxThreads <= 0)
+		maxThreads = std::max(1, static_cast<int>(std::thread::hardware_concurrency()));
+	JobSystem jobs(maxThreads);
+	if (!IsCountingHeapAllocations())
+		printf("arena: heap allocations are not counted, the build does not define COUNT_HEAP_ALLOCATIONS\n");
+
+	auto vectors = [](bool arena, int frame)
+	{
+		return arena ? BuildVectors(ArenaAllocator<uint32_t>(&GetFrameArena()), 2000, frame) :
+			BuildVectors(std::allocator<uint32_t>(), 2000, frame);
+	};
+	auto map = [](bool arena, int frame)
+	{
+		return arena ? BuildMap(ArenaAllocator<uint32_t>(&GetFrameArena()), 5000, frame) :
+			BuildMap(std::allocator<uint32_t>(), 5000, frame);
+	};
+	std::vector<void*> storage(64 * 1000);
+	auto blocks = [&storage](bool arena, int frame) { return BuildBlocks(arena, 20000, frame, storage.data()); };
+	auto threaded = [&jobs, &storage](bool arena, int frame)
+	{
+		// 64 jobs of 1000 blocks, every thread allocates from its own frame arena
+		std::atomic<uint64_t> sum(0);
+		auto build = [&jobs, &storage, &sum, arena, frame](size_t begin, size_t end)
+		{
+			uint64_t heapBefore = GetThreadHeapAllocations();
+			for (size_t i = begin; i < end; i++)
+				sum += BuildBlocks(arena, 1000, frame + uint32_t(i), &storage[i * 1000]);
+			if (jobs.GetThreadIndex() != 0)
+				gJobHeapAllocations += GetThreadHeapAllocations() - heapBefore;
+		};
+		jobs.ParallelFor(64, 1, build);
+		return sum.load();
+	};
+
+	bool passed = true;
+	for (int i = 0; i < 4; i++)
+	{
+		const char *names[] = { "vectors", "map", "blocks", "jobs" };
+		ArenaResult heap, arena;
+		switch (i)
+		{
+		case 0: heap = RunArenaFrames(false, vectors); arena = RunArenaFrames(true, vectors); break;
+		case 1: heap = RunArenaFrames(false, map); arena = RunArenaFrames(true, map); break;
+		case 2: heap = RunArenaFrames(false, blocks); arena = RunArenaFrames(true, blocks); break;
+		default: heap = RunArenaFrames(false, threaded); arena = RunArenaFrames(true, threaded); break;
+		}
+		printf("arena %-7s heap: %.3f ms/frame (p99 %.3f, max %.3f), %8.1f allocations/frame; arena: %.3f ms/frame "
+			"(p99 %.3f, max %.3f), %.1f allocations/frame; %.2fx, %s\n", names[i], heap.times.avgMs, heap.times.p99Ms,
+			heap.times.maxMs, heap.heapAllocations, arena.times.avgMs, arena.times.p99Ms, arena.times.maxMs,
+			arena.heapAllocations, heap.times.avgMs / arena.times.avgMs,
+			heap.check == arena.check ? "same results" : "RESULTS DIFFER");
+		passed = passed && heap.check == arena.check;
+		// the arena has grown to the frame's peak in warmup, so a steady frame must not touch the heap
+		if (IsCountingHeapAllocations() && arena.heapAllocations != 0.0)
+		{
+			printf("arena %-7s ARENA FRAMES ALLOCATE FROM THE HEAP\n", names[i]);
+			passed = false;
+		}
+	}
+
+	ArenaStats stats = GetFrameArenaStats();
+	printf("arena peak %zu bytes per thread and frame, %zu bytes reserved in %llu blocks over %d threads\n", stats.peakBytes,
+		stats.reservedBytes, static_cast<unsigned long long>(stats.blockAllocations), jobs.GetThreadsCount());
+	return passed;
+}
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// stands in for the D3D device: every object is a copy of its descriptor, a descriptor created twice is counted
+class CountingStateFactory : public StateFactory
+{
+public:
+	CountingStateFactory() : mCreated(0), mReleased(0), mDuplicates(0) {}
+
+	void* CreateState(StateKind kind, const void *desc) override
+	{
+		static const size_t sizes[NumStateKinds] = {
+			sizeof(DepthStencilDesc), sizeof(RasterizerDesc), sizeof(SamplerDesc), sizeof(BlendDesc), 0 };
+		std::string *state = new std::string(1, static_cast<char>(kind));
+		state->append(static_cast<const char*>(desc), sizes[kind]);
+
+		std::lock_guard<std::mutex> lock(mMutex);
+		mCreated++;
+		mDuplicates += !mSeen.insert(*state).second;
+		return state;
+	}
+
+	void ReleaseState(StateKind, void *state) override
+	{
+		std::lock_guard<std::mutex> lock(mMutex);
+		mReleased++;
+		delete static_cast<std::string*>(state);
+	}
+
+	uint32_t GetCreated() const { return mCreated; }
+	uint32_t GetReleased() const { return mReleased; }
+	uint32_t GetDuplicates() const { return mDuplicates; }
+
+private:
+	std::mutex            mMutex;
+	std::set<std::string> mSeen;
+	uint32_t              mCreated;
+	uint32_t              mReleased;
+	uint32_t              mDuplicates;
+};
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// descriptors as materials would write them: a few meaningful settings, and noise in the fields that do not count
+PipelineDesc RandomPipelineDesc(uint32_t &seed)
+{
+	auto next = [&seed](uint32_t range)
+	{
+		seed = seed * 1664525u + 1013904223u;
+		return (seed >> 8) % range;
+	};
+
+	PipelineDesc desc;
+	desc.depthStencil = DefaultDepthStencilDesc();
+	desc.depthStencil.depthEnable = next(4) ? 1 + next(2) : 0;
+	desc.depthStencil.depthWriteMask = next(2);
+	desc.depthStencil.depthFunc = 2 + 2 * next(2); // LESS or LESS_EQUAL
+	desc.depthStencil.stencilEnable = !next(8);
+	desc.depthStencil.stencilReadMask = static_cast<uint8_t>(next(256));
+	desc.depthStencil.stencilWriteMask = 0xFF;
+
+	desc.rasterizer = DefaultRasterizerDesc();
+	desc.rasterizer.cullMode = 1 + next(3);
+	desc.rasterizer.depthBias = next(4) ? 0 : 1;
+	desc.rasterizer.slopeScaledDepthBias = next(2) ? -0.0f : 0.0f;
+	desc.rasterizer.depthBiasClamp = next(2) ? 0.5f : 0.0f;
+
+	desc.blend = DefaultBlendDesc();
+	desc.blend.renderTarget[0].blendEnable = !next(4);
+	desc.blend.renderTarget[0].srcBlend = next(2) ? 5 : 2;   // SRC_ALPHA or ONE
+	desc.blend.renderTarget[0].destBlend = next(2) ? 6 : 2;  // INV_SRC_ALPHA or ONE
+	for (unsigned i = 1; i < BlendDesc::kMaxTargets; i++)
+		desc.blend.renderTarget[i].srcBlend = 1 + next(5); // ignored without independent blending
+	return desc;
+}
+
+SamplerDesc RandomSamplerDesc(uint32_t &seed)
+{
+	auto next = [&seed](uint32_t range)
+	{
+		seed = seed * 1664525u + 1013904223u;
+		return (seed >> 8) % range;
+	};
+	static const uint32_t filters[] = { 0x0, 0x15, 0x55, 0x95 }; // point, linear, anisotropic, comparison linear
+
+	SamplerDesc desc = DefaultSamplerDesc();
+	desc.filter = filters[next(4)];
+	desc.addressU = desc.addressV = desc.addressW = 1 + next(4);
+	desc.maxAnisotropy = 1 << next(5);
+	desc.comparisonFunc = 1 + next(8);
+	for (int c = 0; c < 4; c++)
+		desc.borderColor[c] = static_cast<float>(next(2));
+	return desc;
+}
+
+// the distinct canonical descriptors of each kind in a set of pipelines and samplers
+void CountUniqueStates(const std::vector<PipelineDesc> &pipelines, const std::vector<SamplerDesc> &samplers,
+	size_t unique[NumStateKinds])
+{
+	std::set<std::string> states[NumStateKinds];
+	for (size_t i = 0; i < pipelines.size(); i++)
+	{
+		DepthStencilDesc depthStencil = Canonicalize(pipelines[i].depthStencil);
+		RasterizerDesc rasterizer = Canonicalize(pipelines[i].rasterizer);
+		BlendDesc blend = Canonicalize(pipelines[i].blend);
+		std::string depthBytes(reinterpret_cast<const char*>(&depthStencil), sizeof(depthStencil));
+		std::string rasterBytes(reinterpret_cast<const char*>(&rasterizer), sizeof(rasterizer));
+		std::string blendBytes(reinterpret_cast<const char*>(&blend), sizeof(blend));
+		states[State_DepthStencil].insert(depthBytes);
+		states[State_Rasterizer].insert(rasterBytes);
+		states[State_Blend].insert(blendBytes);
+		states[State_Pipeline].insert(depthBytes + rasterBytes + blendBytes);
+	}
+	for (size_t i = 0; i < samplers.size(); i++)
+	{
+		SamplerDesc sampler = Canonicalize(samplers[i]);
+		states[State_Sampler].insert(std::string(reinterpret_cast<const char*>(&sampler), sizeof(sampler)));
+	}
+	for (int kind = 0; kind < NumStateKinds; kind++)
+		unique[kind] = states[kind].size();
+}
+
+// descriptors that only differ where the pipeline does not look share their object, the others do not
+bool CheckStateMerging()
+{
+	CountingStateFactory factory;
+	StateCache cache(factory);
+	bool merged = true;
+	bool distinct = true;
+
+	DepthStencilDesc depthA = DefaultDepthStencilDesc(), depthB = depthA;
+	depthA.depthEnable = 0;
+	depthB.depthEnable = 0;
+	depthB.depthFunc = 8;
+	depthB.depthWriteMask = 0;
+	depthB.stencilReadMask = 0x0F;
+	merged = merged && cache.GetDepthStencil(depthA) == cache.GetDepthStencil(depthB);
+	depthB = DefaultDepthStencilDesc();
+	depthB.depthEnable = 7; // any nonzero BOOL is TRUE
+	merged = merged && cache.GetDepthStencil(depthB) == cache.GetDepthStencil(DefaultDepthStencilDesc());
+	depthB.depthFunc = 4;
+	distinct = distinct && cache.GetDepthStencil(depthB) != cache.GetDepthStencil(DefaultDepthStencilDesc());
+
+	RasterizerDesc rasterA = DefaultRasterizerDesc(), rasterB = rasterA;
+	rasterB.slopeScaledDepthBias = -0.0f;
+	rasterB.depthBiasClamp = 0.25f;
+	merged = merged && cache.GetRasterizer(rasterA) == cache.GetRasterizer(rasterB);
+	rasterA.depthBias = rasterB.depthBias = 1;
+	distinct = distinct && cache.GetRasterizer(rasterA) != cache.GetRasterizer(rasterB);
+
+	SamplerDesc samplerA = DefaultSamplerDesc(), samplerB = samplerA;
+	samplerB.maxAnisotropy = 16;
+	samplerB.comparisonFunc = 4;
+	samplerB.borderColor[0] = 0.0f;
+	merged = merged && cache.GetSampler(samplerA) == cache.GetSampler(samplerB);
+	samplerA.addressU = samplerB.addressU = 4; // BORDER
+	distinct = distinct && cache.GetSampler(samplerA) != cache.GetSampler(samplerB);
+	samplerA = samplerB = DefaultSamplerDesc();
+	samplerA.filter = samplerB.filter = 0x55; // ANISOTROPIC
+	samplerB.maxAnisotropy = 8;
+	distinct = distinct && cache.GetSampler(samplerA) != cache.GetSampler(samplerB);
+
+	BlendDesc blendA = DefaultBlendDesc(), blendB = blendA;
+	blendB.renderTarget[0].srcBlend = 5;
+	blendB.renderTarget[3].blendEnable = 1;
+	merged = merged && cache.GetBlend(blendA) == cache.GetBlend(blendB);
+	blendA.renderTarget[0].blendEnable = blendB.renderTarget[0].blendEnable = 1;
+	distinct = distinct && cache.GetBlend(blendA) != cache.GetBlend(blendB);
+
+	// a bundle holds the same objects as the separate lookups
+	PipelineDesc pipeline = { depthA, rasterA, blendA };
+	const PipelineState *state = cache.GetPipeline(pipeline);
+	merged = merged && state && state == cache.GetPipeline(pipeline) && state->depthStencil == cache.GetDepthStencil(depthA) &&
+		state->rasterizer == cache.GetRasterizer(rasterA) && state->blend == cache.GetBlend(blendA);
+
+	StateCacheStats stats = cache.GetStats();
+	uint32_t objects = 0;
+	for (int kind = 0; kind < State_Pipeline; kind++)
+		objects += stats.objects[kind];
+	cache.Clear();
+	printf("statecache merging: %u objects for %llu lookups, %s, %s, %s\n", objects,
+		static_cast<unsigned long long>(stats.lookups[State_DepthStencil] + stats.lookups[State_Rasterizer] +
+			stats.lookups[State_Sampler] + stats.lookups[State_Blend]),
+		merged ? "equivalent descriptors merged" : "EQUIVALENT DESCRIPTORS NOT MERGED",
+		distinct ? "different ones kept apart" : "DIFFERENT DESCRIPTORS MERGED",
+		factory.GetCreated() == objects && factory.GetReleased() == objects ? "all released" : "LEAKED OBJECTS");
+	return merged && distinct;
+}
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// materials resolving their states from every thread: each distinct descriptor is created exactly once, later lookups
+// are lock-free hits. maxThreads 0 uses the hardware threads
+bool BenchStateCache(int maxThreads)
+{
+	if (maxThreads <= 0)
+		maxThreads = std::max(1, static_cast<int>(std::thread::hardware_concurrency()));
+	bool passed = CheckStateMerging();
+
+	const size_t pipelinesCount = 4096, samplersCount = 1024, lookupsCount = 1 << 20;
+	uint32_t seed = 12345;
+	std::vector<PipelineDesc> pipelines(pipelinesCount);
+	std::vector<SamplerDesc> samplers(samplersCount);
+	for (size_t i = 0; i < pipelinesCount; i++)
+		pipelines[i] = RandomPipelineDesc(seed);
+	for (size_t i = 0; i < samplersCount; i++)
+		samplers[i] = RandomSamplerDesc(seed);
+	size_t unique[NumStateKinds];
+	CountUniqueStates(pipelines, samplers, unique);
+
+	// lookups spread over every material, each job starts at a different one so the cold pass creates concurrently
+	JobSystem jobs(maxThreads);
+	CountingStateFactory factory;
+	StateCache cache(factory);
+	std::atomic<uint64_t> failed(0);
+	auto lookups = [&](size_t begin, size_t end)
+	{
+		uint64_t missing = 0;
+		for (size_t i = begin; i < end; i++)
+		{
+			size_t material = (i * 2654435761u) % pipelinesCount;
+			missing += !cache.GetPipeline(pipelines[material]);
+			missing += !cache.GetSampler(samplers[material % samplersCount]);
+		}
+		failed += missing;
+	};
+
+	for (int pass = 0; pass < 2; pass++)
+	{
+		StateCacheStats before = cache.GetStats();
+		std::chrono::high_resolution_clock::time_point start = std::chrono::high_resolution_clock::now();
+		jobs.ParallelFor(lookupsCount, lookupsCount / 64, lookups);
+		std::chrono::duration<double, std::nano> elapsed = std::chrono::high_resolution_clock::now() - start;
+		StateCacheStats stats = cache.GetStats();
+
+		uint64_t lookupsDone = 0, hits = 0;
+		for (int kind = 0; kind < NumStateKinds; kind++)
+		{
+			lookupsDone += stats.lookups[kind] - before.lookups[kind];
+			hits += stats.hits[kind] - before.hits[kind];
+		}
+		bool counts = true;
+		for (int kind = 0; kind < NumStateKinds; kind++)
+			counts = counts && stats.objects[kind] == unique[kind];
+		printf("statecache %s %d threads: %llu lookups, %.2f%% hits, %.1f ns per material (pipeline + sampler); "
+			"objects: %u depth, %u raster, %u sampler, %u blend, %u pipelines; %s\n", pass ? "warm" : "cold",
+			jobs.GetThreadsCount(), static_cast<unsigned long long>(lookupsDone), 100.0 * hits / lookupsDone,
+			elapsed.count() / lookupsCount, stats.objects[State_DepthStencil],
+			stats.objects[State_Rasterizer], stats.objects[State_Sampler], stats.objects[State_Blend],
+			stats.objects[State_Pipeline], counts && !factory.GetDuplicates() && !failed && !stats.failures ?
+			"each distinct state created once" : "DUPLICATE OR MISSING STATES");
+		passed = passed && counts && !factory.GetDuplicates() && !failed && !stats.failures;
+	}
+
+	// what canonicalizing saves: the objects the raw descriptors would have needed
+	std::set<std::string> raw;
+	for (size_t i = 0; i < pipelinesCount; i++)
+		raw.insert(std::string(reinterpret_cast<const char*>(&pipelines[i]), sizeof(PipelineDesc)));
+	printf("statecache %zu materials: %zu distinct as written, %zu after canonicalizing\n", pipelinesCount, raw.size(),
+		unique[State_Pipeline]);
+	return passed;
+}
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// a frame of draws from many materials: three passes, 64 shaders, 1024 textures, depths all over the view range
+struct TestDraw
+{
+	uint32_t pass, shader, texture;
+	float    depth;
+};
+
+void CreateTestDraws(size_t count, uint32_t seed, std::vector<TestDraw> &draws)
+{
+	draws.resize(count);
+	for (size_t i = 0; i < count; i++)
+	{
+		seed = seed * 1664525u + 1013904223u;
+		draws[i].pass = (seed >> 8) % 8 < 6 ? 0 : (seed >> 8) % 8 < 7 ? 1 : 2; // mostly opaque
+		seed = seed * 1664525u + 1013904223u;
+		draws[i].shader = (seed >> 8) % 64;
+		seed = seed * 1664525u + 1013904223u;
+		draws[i].texture = (seed >> 8) % 1024;
+		seed = seed * 1664525u + 1013904223u;
+		draws[i].depth = gNearZ + (gFarZ - gNearZ) * ((seed >> 8) / 16777216.0f);
+	}
+}
+
+// opaque by state, the second pass front to back, transparent back to front
+void FillRenderQueue(const std::vector<TestDraw> &draws, RenderQueue &queue)
+{
+	static const DrawOrder orders[3] = { Order_State, Order_FrontToBack, Order_BackToFront };
+	queue.Clear();
+	queue.Reserve(draws.size());
+	for (size_t i = 0; i < draws.size(); i++)
+	{
+		const TestDraw &draw = draws[i];
+		queue.Add(MakeSortKey(draw.pass, orders[draw.pass], draw.shader, draw.texture, QuantizeDepth(draw.depth, gNearZ, gFarZ)),
+			static_cast<uint32_t>(i));
+	}
+}
+
+// shader and texture binds a submission in this order needs
+void CountSwitches(const std::vector<TestDraw> &draws, const DrawItem *items, size_t count, size_t &shaders, size_t &textures)
+{
+	shaders = textures = 0;
+	for (size_t i = 0; i < count; i++)
+	{
+		const TestDraw &draw = draws[items[i].payload];
+		const TestDraw *previous = i ? &draws[items[i - 1].payload] : nullptr;
+		shaders += !previous || previous->shader != draw.shader;
+		textures += !previous || previous->texture != draw.texture;
+	}
+}
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// layers quads that each fill the view, one behind the other, drawn in the order of items
+struct OverdrawResult
+{
+	double   flushMs;
+	uint64_t shadedPixels;
+	uint64_t hash;
+};
+
+OverdrawResult RunOverdraw(const HeadlessScene &scene, const DrawItem *items, size_t layers)
+{
+	SoftRasterizer rasterizer(gWidth, gHeight, 0);
+	rasterizer.SetMatrices(MatIdentity(), MatIdentity());
+	SoftTexture tex = { scene.checkerSize, scene.checkerSize, &scene.checker[0] };
+	rasterizer.SetTexture(tex);
+	const float aliceBlue[4] = { 0.941176534f, 0.972549081f, 1.0f, 1.0f };
+	rasterizer.Clear(aliceBlue, 1.0f);
+
+	Mat4 viewProj = MatMultiply(scene.viewMat, scene.projMat);
+	for (size_t i = 0; i < layers; i++)
+	{
+		// the camera is at z = -5 and sees 0.41 units up and 0.55 across per unit of distance
+		float distance = 2.0f + 0.4f * items[i].payload;
+		Mat4 world = MatTranslation(0.0f, 0.0f, distance - 5.0f);
+		world.m[0][0] = world.m[1][1] = 0.6f * distance;
+		Mat4 wvp = MatMultiply(world, viewProj);
+		rasterizer.DrawIndexed(scene.vertices.data(), scene.vertices.size(), scene.indices.data(), scene.indices.size(), wvp);
+	}
+	std::chrono::high_resolution_clock::time_point start = std::chrono::high_resolution_clock::now();
+	rasterizer.Flush();
+	std::chrono::duration<double, std::milli> elapsed = std::chrono::high_resolution_clock::now() - start;
+
+	OverdrawResult result;
+	result.flushMs = elapsed.count();
+	result.shadedPixels = rasterizer.GetShadedPixels();
+	result.hash = 14695981039346656037ull;
+	const uint32_t *color = rasterizer.GetColorBuffer();
+	for (int y = 0; y < rasterizer.GetHeight(); y++)
+		for (int x = 0; x < rasterizer.GetWidth(); x++)
+			result.hash = (result.hash ^ color[y * rasterizer.GetPitch() + x]) * 1099511628211ull;
+	return result;
+}
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// building and sorting the queue against std::sort and std::stable_sort from 10k to 1M draws, the state switches the
+// sorted order saves, then the overdraw the depth orders save
+bool BenchRenderQueue()
+{
+	const size_t counts[] = { 10000, 100000, 1000000 };
+	bool passed = true;
+	for (size_t c = 0; c < sizeof(counts) / sizeof(counts[0]); c++)
+	{
+		const size_t count = counts[c];
+		const int runs = count >= 1000000 ? 5 : 20;
+		std::vector<TestDraw> draws;
+		CreateTestDraws(count, 12345, draws);
+
+		RenderQueue queue;
+		std::vector<DrawItem> reference;
+		double fillMs = 0.0, radixMs = 0.0, sortMs = 0.0, stableMs = 0.0;
+		for (int run = 0; run < runs; run++)
+		{
+			std::chrono::high_resolution_clock::time_point t0 = std::chrono::high_resolution_clock::now();
+			FillRenderQueue(draws, queue);
+			std::chrono::high_resolution_clock::time_point t1 = std::chrono::high_resolution_clock::now();
+			reference.assign(queue.GetItems(), queue.GetItems() + queue.GetCount());
+			std::chrono::high_resolution_clock::time_point t2 = std::chrono::high_resolution_clock::now();
+			queue.Sort();
+			std::chrono::high_resolution_clock::time_point t3 = std::chrono::high_resolution_clock::now();
+			std::vector<DrawItem> unstable = reference;
+			std::chrono::high_resolution_clock::time_point t4 = std::chrono::high_resolution_clock::now();
+			std::sort(unstable.begin(), unstable.end(), [](const DrawItem &a, const DrawItem &b) { return a.key < b.key; });
+			std::chrono::high_resolution_clock::time_point t5 = std::chrono::high_resolution_clock::now();
+			std::stable_sort(reference.begin(), reference.end(), [](const DrawItem &a, const DrawItem &b) { return a.key < b.key; });
+			std::chrono::high_resolution_clock::time_point t6 = std::chrono::high_resolution_clock::now();
+			fillMs += std::chrono::duration<double, std::milli>(t1 - t0).count();
+			radixMs += std::chrono::duration<double, std::milli>(t3 - t2).count();
+			sortMs += std::chrono::duration<double, std::milli>(t5 - t4).count();
+			stableMs += std::chrono::duration<double, std::milli>(t6 - t5).count();
+		}
+
+		// stable sorts of the same keys agree item for item
+		bool same = true;
+		for (size_t i = 0; i < count && same; i++)
+			same = queue[i].key == reference[i].key && queue[i].payload == reference[i].payload;
+
+		std::vector<DrawItem> unsorted(count);
+		FillRenderQueue(draws, queue);
+		unsorted.assign(queue.GetItems(), queue.GetItems() + count);
+		queue.Sort();
+		size_t shadersBefore, texturesBefore, shadersAfter, texturesAfter;
+		CountSwitches(draws, unsorted.data(), count, shadersBefore, texturesBefore);
+		CountSwitches(draws, queue.GetItems(), count, shadersAfter, texturesAfter);
+
+		printf("renderqueue %7zu draws: fill %.3f ms, radix sort %.3f ms (%u passes), std::sort %.3f ms (%.2fx), "
+			"std::stable_sort %.3f ms (%.2fx), %s; shader switches %zu -> %zu, texture switches %zu -> %zu\n", count,
+			fillMs / runs, radixMs / runs, queue.GetStats().radixPasses, sortMs / runs, sortMs / radixMs, stableMs / runs,
+			stableMs / radixMs, same ? "same order as std::stable_sort" : "ORDER DIFFERS", shadersBefore, shadersAfter,
+			texturesBefore, texturesAfter);
+		passed = passed && same;
+	}
+
+	// the layers submitted shuffled, then sorted by depth both ways: the same image, but front to back shades each
+	// pixel once and back to front once per layer
+	HeadlessScene scene;
+	if (!CreateScene(scene))
+		return false;
+	const size_t layers = 128;
+	std::vector<uint32_t> shuffled(layers);
+	uint32_t seed = 777;
+	for (size_t i = 0; i < layers; i++)
+		shuffled[i] = static_cast<uint32_t>(i);
+	for (size_t i = layers - 1; i > 0; i--)
+	{
+		seed = seed * 1664525u + 1013904223u;
+		std::swap(shuffled[i], shuffled[(seed >> 8) % (i + 1)]);
+	}
+
+	const char *names[3] = { "shuffled", "front to back", "back to front" };
+	OverdrawResult results[3];
+	RenderQueue queue;
+	for (int mode = 0; mode < 3; mode++)
+	{
+		queue.Clear();
+		for (size_t i = 0; i < layers; i++)
+		{
+			float distance = 2.0f + 0.4f * shuffled[i];
+			queue.Add(MakeSortKey(0, mode == 2 ? Order_BackToFront : Order_FrontToBack, 0, 0, QuantizeDepth(distance, gNearZ, gFarZ)),
+				shuffled[i]);
+		}
+		if (mode)
+			queue.Sort();
+		results[mode] = RunOverdraw(scene, queue.GetItems(), layers);
+	}
+	double pixels = double(gWidth) * gHeight;
+	for (int mode = 0; mode < 3; mode++)
+	{
+		printf("renderqueue overdraw %zu layers %-13s: %.2f shaded pixels per pixel, %.2f ms to rasterize, %s\n", layers,
+			names[mode], results[mode].shadedPixels / pixels, results[mode].flushMs,
+			results[mode].hash == results[0].hash ? "same image" : "IMAGE DIFFERS");
+		passed = passed && results[mode].hash == results[0].hash;
+	}
+	return passed;
+}
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+struct AtlasPlacement
+{
+	uint32_t  page;
+	AtlasRect rect;
+};
+
+// first fit over the pages in the order given, a new page when none has room; false for a texture larger than a page
+bool PackAtlasPages(const std::vector<AtlasRect> &textures, const std::vector<uint32_t> &order, uint32_t pageSize,
+	uint32_t alignment, std::vector<AtlasPacker> &pages, std::vector<AtlasPlacement> &placements)
+{
+	pages.clear();
+	placements.resize(textures.size());
+	for (size_t i = 0; i < order.size(); i++)
+	{
+		const AtlasRect &texture = textures[order[i]];
+		AtlasPlacement &placement = placements[order[i]];
+		size_t page = 0;
+		while (page < pages.size() && !pages[page].Insert(texture.width, texture.height, placement.rect))
+			page++;
+		if (page == pages.size())
+		{
+			pages.push_back(AtlasPacker(pageSize, pageSize, alignment));
+			if (!pages.back().Insert(texture.width, texture.height, placement.rect))
+				return false;
+		}
+		placement.page = static_cast<uint32_t>(page);
+	}
+	return true;
+}
+
+// every aligned rectangle inside its page and on cells no other one covers
+bool CheckAtlasPlacements(const std::vector<AtlasPlacement> &placements, const std::vector<AtlasPacker> &pages)
+{
+	for (size_t page = 0; page < pages.size(); page++)
+	{
+		uint32_t alignment = pages[page].GetAlignment();
+		uint32_t cells = pages[page].GetWidth() / alignment;
+		std::vector<char> used(size_t(cells) * (pages[page].GetHeight() / alignment), 0);
+		for (size_t i = 0; i < placements.size(); i++)
+		{
+			const AtlasRect &rect = placements[i].rect;
+			if (placements[i].page != page)
+				continue;
+			if (rect.x % alignment || rect.y % alignment || rect.x + rect.width > pages[page].GetWidth() ||
+				rect.y + rect.height > pages[page].GetHeight())
+				return false;
+			for (uint32_t y = rect.y / alignment; y < (rect.y + rect.height + alignment - 1) / alignment; y++)
+				for (uint32_t x = rect.x / alignment; x < (rect.x + rect.width + alignment - 1) / alignment; x++)
+				{
+					if (used[y * cells + x])
+						return false;
+					used[y * cells + x] = 1;
+				}
+		}
+	}
+	return true;
+}
+
+// texture binds a submission in this order needs when draw d binds bindIds[d]
+size_t CountBinds(const DrawItem *items, size_t count, const std::vector<uint32_t> &bindIds)
+{
+	size_t binds = 0;
+	for (size_t i = 0; i < count; i++)
+		binds += !i || bindIds[items[i].payload] != bindIds[items[i - 1].payload];
+	return binds;
+}
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// the skyline packer's fill ratio for power of two and arbitrary sizes, array slot allocation and reuse, then the
+// texture binds of a frame of state sorted draws with separate textures, texture arrays and atlas pages
+bool BenchAtlas()
+{
+	const size_t texturesCount = 2000;
+	const uint32_t pageSize = 2048;
+	std::vector<AtlasRect> sets[2];
+	uint32_t seed = 4242;
+	for (size_t i = 0; i < texturesCount; i++)
+	{
+		seed = seed * 1664525u + 1013904223u;
+		AtlasRect pow2 = { 0, 0, 16u << ((seed >> 8) % 5), 16u << ((seed >> 16) % 5) };
+		seed = seed * 1664525u + 1013904223u;
+		AtlasRect any = { 0, 0, 20 + (seed >> 8) % 281, 20 + (seed >> 20) % 281 };
+		sets[0].push_back(pow2);
+		sets[1].push_back(any);
+	}
+	bool passed = true;
+
+	const char *setNames[2] = { "pow2 16-256", "any 20-300" };
+	const uint32_t alignments[2] = { 4, 16 };
+	for (int set = 0; set < 2; set++)
+	{
+		const std::vector<AtlasRect> &textures = sets[set];
+		std::vector<uint32_t> arrival(texturesCount), tallest;
+		for (size_t i = 0; i < texturesCount; i++)
+			arrival[i] = static_cast<uint32_t>(i);
+		tallest = arrival;
+		std::stable_sort(tallest.begin(), tallest.end(), [&textures](uint32_t a, uint32_t b)
+		{
+			return textures[a].height > textures[b].height || (textures[a].height == textures[b].height && textures[a].width > textures[b].width);
+		});
+		uint64_t texels = 0;
+		for (size_t i = 0; i < texturesCount; i++)
+			texels += uint64_t(textures[i].width) * textures[i].height;
+
+		for (int a = 0; a < 2; a++)
+			for (int sorted = 0; sorted < 2; sorted++)
+			{
+				std::vector<AtlasPacker> pages;
+				std::vector<AtlasPlacement> placements;
+				std::chrono::high_resolution_clock::time_point start = std::chrono::high_resolution_clock::now();
+				bool packed = PackAtlasPages(textures, sorted ? tallest : arrival, pageSize, alignments[a], pages, placements);
+				std::chrono::duration<double, std::micro> elapsed = std::chrono::high_resolution_clock::now() - start;
+				bool valid = packed && CheckAtlasPlacements(placements, pages);
+				// the last page is partly empty whatever the packer does, the full ones show how well it packs
+				double fullFill = 0.0;
+				for (size_t p = 0; p + 1 < pages.size(); p++)
+					fullFill += pages[p].GetFillRatio();
+				fullFill = pages.size() > 1 ? fullFill / (pages.size() - 1) : 0.0;
+				printf("atlas %s align %2u %-13s: %zu pages of %u, fill %.1f%% (full pages %.1f%%), %.2f us/texture, %s\n",
+					setNames[set], alignments[a], sorted ? "tallest first" : "arrival order", pages.size(), pageSize,
+					100.0 * texels / (double(pages.size()) * pageSize * pageSize), 100.0 * fullFill,
+					elapsed.count() / texturesCount, valid ? "no overlaps" : "OVERLAP OR OUT OF PAGE");
+				passed = passed && valid;
+			}
+	}
+
+	// BC1/BC3/BC7 squares of 64 to 512 with full mip chains, 12 layouts
+	const TextureFormat formats[3] = { Texture_BC1, Texture_BC3, Texture_BC7 };
+	const size_t arrayTextures = 1024;
+	std::vector<TextureArrayDesc> layouts(arrayTextures);
+	std::vector<TextureSlot> slots(arrayTextures);
+	TextureArrayAllocator allocator;
+	bool allocated = true;
+	for (size_t i = 0; i < arrayTextures; i++)
+	{
+		seed = seed * 1664525u + 1013904223u;
+		uint32_t size = 64u << ((seed >> 8) % 4);
+		TextureArrayDesc layout = { formats[(seed >> 16) % 3], size, size, GetMipCount(size, size) };
+		layouts[i] = layout;
+		allocated = allocator.Allocate(layout, slots[i]) && allocated;
+	}
+	TextureArrayStats before = allocator.GetStats();
+
+	// half of them unloaded and as many loaded again: freed slices are reused, the arrays only grow for the layouts
+	// that now have more textures than before
+	for (size_t i = 0; i < arrayTextures; i += 2)
+		allocator.Free(slots[i]);
+	for (size_t i = 0; i < arrayTextures; i += 2)
+	{
+		seed = seed * 1664525u + 1013904223u;
+		uint32_t size = 64u << ((seed >> 8) % 4);
+		TextureArrayDesc layout = { formats[(seed >> 16) % 3], size, size, GetMipCount(size, size) };
+		layouts[i] = layout;
+		allocated = allocator.Allocate(layout, slots[i]) && allocated;
+	}
+	TextureArrayStats after = allocator.GetStats();
+	std::set<std::pair<uint32_t, uint32_t>> distinct;
+	bool layoutsMatch = true;
+	for (size_t i = 0; i < arrayTextures; i++)
+	{
+		distinct.insert(std::make_pair(slots[i].array, slots[i].slice));
+		const TextureArrayDesc &layout = allocator.GetArrayDesc(slots[i].array);
+		layoutsMatch = layoutsMatch && layout.format == layouts[i].format && layout.width == layouts[i].width &&
+			slots[i].slice < allocator.GetSliceCount(slots[i].array);
+	}
+	printf("atlas arrays %zu textures: %u arrays, %u slices; half replaced: %u slices in use, %u allocated, %s\n",
+		arrayTextures, before.arrays, before.allocatedSlices, after.slices, after.allocatedSlices,
+		allocated && layoutsMatch && distinct.size() == arrayTextures ? "one texture per slot" : "SLOTS SHARED OR WRONG LAYOUT");
+	passed = passed && allocated && layoutsMatch && distinct.size() == arrayTextures;
+
+	// the same textures packed per format into 4096 atlas pages; 4096 fits 64 textures of 512
+	const uint32_t atlasPageSize = 4096;
+	std::vector<uint32_t> atlasPages(arrayTextures);
+	uint32_t pagesCount = 0;
+	double atlasFill = 0.0;
+	for (int f = 0; f < 3; f++)
+	{
+		std::vector<AtlasRect> rects;
+		std::vector<uint32_t> order, indices;
+		for (size_t i = 0; i < arrayTextures; i++)
+			if (layouts[i].format == formats[f])
+			{
+				AtlasRect rect = { 0, 0, layouts[i].width, layouts[i].height };
+				order.push_back(static_cast<uint32_t>(rects.size()));
+				indices.push_back(static_cast<uint32_t>(i));
+				rects.push_back(rect);
+			}
+		std::stable_sort(order.begin(), order.end(), [&rects](uint32_t a, uint32_t b) { return rects[a].height > rects[b].height; });
+		std::vector<AtlasPacker> pages;
+		std::vector<AtlasPlacement> placements;
+		if (!PackAtlasPages(rects, order, atlasPageSize, 4, pages, placements))
+			return false;
+		for (size_t i = 0; i < rects.size(); i++)
+			atlasPages[indices[i]] = pagesCount + placements[i].page;
+		for (size_t p = 0; p < pages.size(); p++)
+			atlasFill += pages[p].GetFillRatio();
+		pagesCount += static_cast<uint32_t>(pages.size());
+	}
+
+	// one frame: 64 shaders, each draw one of the textures, sorted by state like the opaque pass; the texture field of
+	// the key is what the draw binds
+	const size_t drawsCount = 20000;
+	std::vector<uint32_t> shaders(drawsCount), textureIds(drawsCount), arrayIds(drawsCount), pageIds(drawsCount);
+	std::vector<float> depths(drawsCount);
+	for (size_t d = 0; d < drawsCount; d++)
+	{
+		seed = seed * 1664525u + 1013904223u;
+		shaders[d] = (seed >> 8) % 64;
+		seed = seed * 1664525u + 1013904223u;
+		textureIds[d] = (seed >> 8) % arrayTextures;
+		seed = seed * 1664525u + 1013904223u;
+		depths[d] = gNearZ + (gFarZ - gNearZ) * ((seed >> 8) / 16777216.0f);
+		arrayIds[d] = slots[textureIds[d]].array;
+		pageIds[d] = atlasPages[textureIds[d]];
+	}
+	const char *modeNames[3] = { "textures", "arrays", "atlas" };
+	const std::vector<uint32_t> *bindIds[3] = { &textureIds, &arrayIds, &pageIds };
+	size_t binds[3];
+	size_t unsortedBinds = 0;
+	RenderQueue queue;
+	for (int mode = 0; mode < 3; mode++)
+	{
+		queue.Clear();
+		for (size_t d = 0; d < drawsCount; d++)
+		{
+			// arrays sort by slice within the array, so the per-object fallback binds each slice view once
+			uint32_t texture = mode == 0 ? textureIds[d] : mode == 1 ? slots[textureIds[d]].array << 11 | slots[textureIds[d]].slice : pageIds[d];
+			queue.Add(MakeSortKey(0, Order_State, shaders[d], texture, QuantizeDepth(depths[d], gNearZ, gFarZ)), static_cast<uint32_t>(d));
+		}
+		if (!mode)
+			unsortedBinds = CountBinds(queue.GetItems(), drawsCount, textureIds);
+		queue.Sort();
+		binds[mode] = CountBinds(queue.GetItems(), drawsCount, *bindIds[mode]);
+	}
+	printf("atlas %zu draws, 64 shaders: texture binds unsorted %zu", drawsCount, unsortedBinds);
+	for (int mode = 0; mode < 3; mode++)
+		printf(", %s %zu", modeNames[mode], binds[mode]);
+	printf("; arrays save %zu binds (%.1fx fewer), atlas %zu (%.1fx fewer, %u pages of %u, fill %.1f%%)\n", binds[0] - binds[1],
+		double(binds[0]) / binds[1], binds[0] - binds[2], double(binds[0]) / binds[2], pagesCount, atlasPageSize,
+		100.0 * atlasFill / pagesCount);
+	return passed;
+}
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// the passes Execute ran, space separated, and the clears they were given
+class RecordingGraphBackend : public RenderGraphBackend
+{
+public:
+	RecordingGraphBackend() : mClears(0) {}
+
+	void BeginPass(const RenderGraph &graph, RenderPassId pass) override
+	{
+		mOrder += mOrder.empty() ? "" : " ";
+		mOrder += graph.GetPassName(pass);
+		mClears += graph.GetClears(pass).size();
+	}
+
+	void EndPass(const RenderGraph&, RenderPassId) override {}
+
+	const std::string& GetOrder() const { return mOrder; }
+	size_t GetClears() const { return mClears; }
+
+private:
+	std::string mOrder;
+	size_t      mClears;
+};
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// a deferred frame at width x height: gbuffer, ssao, lighting, a half resolution bloom chain, tonemap and fxaa to the
+// back buffer, and a debug view of the normals nothing reads; with debug it gets a readback and is kept
+void BuildDeferredGraph(RenderGraph &graph, uint32_t width, uint32_t height, bool debug)
+{
+	const unsigned rgba8 = 28, rgba16f = 10, r8 = 61, d24s8 = 45; // DXGI_FORMAT
+	uint32_t halfWidth = std::max(1u, width / 2), halfHeight = std::max(1u, height / 2);
+	RenderTargetDesc color8 = { width, height, rgba8, 4, false, {} };
+	RenderTargetDesc color16 = { width, height, rgba16f, 8, false, {} };
+	RenderTargetDesc ao = { width, height, r8, 1, false, { 1.0f } };
+	RenderTargetDesc depth = { width, height, d24s8, 4, true, { 1.0f, 0.0f } };
+	RenderTargetDesc half16 = { halfWidth, halfHeight, rgba16f, 8, false, {} };
+
+	graph.Clear();
+	RenderResourceId albedo = graph.CreateTarget("albedo", color8);
+	RenderResourceId normals = graph.CreateTarget("normals", color16);
+	RenderResourceId material = graph.CreateTarget("material", color8);
+	RenderResourceId sceneDepth = graph.CreateTarget("depth", depth);
+	RenderResourceId occlusion = graph.CreateTarget("ao", ao);
+	RenderResourceId hdr = graph.CreateTarget("hdr", color16);
+	RenderResourceId bright = graph.CreateTarget("bloom bright", half16);
+	RenderResourceId blurX = graph.CreateTarget("bloom blur x", half16);
+	RenderResourceId blurY = graph.CreateTarget("bloom blur y", half16);
+	RenderResourceId ldr = graph.CreateTarget("ldr", color8);
+	RenderResourceId debugView = graph.CreateTarget("debug", color8);
+	RenderResourceId backBuffer = graph.ImportTarget("back buffer", color8);
+
+	RenderPassId pass = graph.AddPass("gbuffer", nullptr);
+	graph.Write(pass, albedo);
+	graph.Write(pass, normals);
+	graph.Write(pass, material);
+	graph.Write(pass, sceneDepth);
+	pass = graph.AddPass("debug", nullptr);
+	graph.Read(pass, normals);
+	graph.Write(pass, debugView);
+	if (debug)
+		graph.SetSideEffects(pass);
+	pass = graph.AddPass("ssao", nullptr);
+	graph.Read(pass, sceneDepth);
+	graph.Read(pass, normals);
+	graph.Write(pass, occlusion);
+	pass = graph.AddPass("lighting", nullptr);
+	graph.Read(pass, albedo);
+	graph.Read(pass, normals);
+	graph.Read(pass, material);
+	graph.Read(pass, sceneDepth);
+	graph.Read(pass, occlusion);
+	graph.Write(pass, hdr);
+	pass = graph.AddPass("bright", nullptr);
+	graph.Read(pass, hdr);
+	graph.Write(pass, bright);
+	pass = graph.AddPass("blur x", nullptr);
+	graph.Read(pass, bright);
+	graph.Write(pass, blurX);
+	pass = graph.AddPass("blur y", nullptr);
+	graph.Read(pass, blurX);
+	graph.Write(pass, blurY);
+	pass = graph.AddPass("tonemap", nullptr);
+	graph.Read(pass, hdr);
+	graph.Read(pass, blurY);
+	graph.Write(pass, ldr);
+	pass = graph.AddPass("fxaa", nullptr);
+	graph.Read(pass, ldr);
+	graph.Write(pass, backBuffer);
+}
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// transients that share a physical target have the same layout and lifetimes that do not overlap
+bool CheckAliasing(const RenderGraph &graph)
+{
+	for (RenderResourceId a = 0; a < graph.GetResourcesCount(); a++)
+	{
+		uint32_t physical = graph.GetPhysical(a);
+		if (graph.IsImported(a) || physical == kNoRenderResource)
+			continue;
+		const RenderTargetDesc &desc = graph.GetDesc(a), &physicalDesc = graph.GetPhysicalDesc(physical);
+		if (desc.width != physicalDesc.width || desc.height != physicalDesc.height || desc.format != physicalDesc.format)
+			return false;
+		for (RenderResourceId b = a + 1; b < graph.GetResourcesCount(); b++)
+			if (graph.GetPhysical(b) == physical &&
+				!(graph.GetLastUse(a) < graph.GetFirstUse(b) || graph.GetLastUse(b) < graph.GetFirstUse(a)))
+				return false;
+	}
+	return true;
+}
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// the compile step on its own: culling, clears, the graphs it rejects, then a deferred frame's transient memory
+// before and after aliasing, the compile time and the targets the pool creates across rebuilds
+bool BenchRenderGraph()
+{
+	// culling: an unread pass goes, a side effect pass stays, a chain to the back buffer stays as a whole
+	RenderTargetDesc desc = { 256, 256, 28, 4, false, {} };
+	RenderGraph graph;
+	RenderResourceId shadow = graph.CreateTarget("shadow", desc);
+	RenderResourceId unused = graph.CreateTarget("unused", desc);
+	RenderResourceId query = graph.CreateTarget("query", desc);
+	RenderResourceId scene = graph.CreateTarget("scene", desc);
+	RenderResourceId back = graph.ImportTarget("back", desc);
+	RenderPassId pass = graph.AddPass("shadow", nullptr);
+	graph.Write(pass, shadow);
+	pass = graph.AddPass("unused", nullptr);
+	graph.Read(pass, shadow);
+	graph.Write(pass, unused);
+	pass = graph.AddPass("query", nullptr);
+	graph.Write(pass, query);
+	graph.SetSideEffects(pass);
+	pass = graph.AddPass("scene", nullptr);
+	graph.Read(pass, shadow);
+	graph.Write(pass, scene);
+	pass = graph.AddPass("overlay", nullptr);
+	graph.Write(pass, scene);
+	pass = graph.AddPass("present", nullptr);
+	graph.Read(pass, scene);
+	graph.Write(pass, back);
+	RecordingGraphBackend recording;
+	bool compiled = graph.Compile();
+	if (compiled)
+		graph.Execute(recording);
+	// shadow, query and scene are cleared by their first writer; overlay draws on top and the back buffer is not ours
+	bool culled = compiled && recording.GetOrder() == "shadow query scene overlay present" && recording.GetClears() == 3 &&
+		graph.GetClears(4).empty() && graph.GetPhysical(unused) == kNoRenderResource;
+	printf("rendergraph culling: ran \"%s\", %zu clears, %s\n", recording.GetOrder().c_str(), recording.GetClears(),
+		culled ? "as expected" : "WRONG PASSES OR CLEARS");
+	bool passed = culled;
+
+	// a transient read before anything wrote it, and a pass reading its own target
+	RenderGraph invalid;
+	RenderResourceId target = invalid.CreateTarget("target", desc);
+	pass = invalid.AddPass("read first", nullptr);
+	invalid.Read(pass, target);
+	bool readFirst = invalid.Compile();
+	invalid.Clear();
+	target = invalid.CreateTarget("target", desc);
+	pass = invalid.AddPass("write", nullptr);
+	invalid.Write(pass, target);
+	pass = invalid.AddPass("feedback", nullptr);
+	invalid.Read(pass, target);
+	invalid.Write(pass, target);
+	bool feedback = invalid.Compile();
+	printf("rendergraph validation: read before write %s, read and write in one pass %s\n",
+		readFirst ? "ACCEPTED" : "rejected", feedback ? "ACCEPTED" : "rejected");
+	passed = passed && !readFirst && !feedback;
+
+	const uint32_t sizes[2][2] = { { 1920, 1080 }, { 3840, 2160 } };
+	for (int s = 0; s < 2; s++)
+	{
+		BuildDeferredGraph(graph, sizes[s][0], sizes[s][1], false);
+		compiled = graph.Compile();
+		RenderGraphStats stats = graph.GetStats();
+		bool valid = compiled && CheckAliasing(graph) && graph.IsCulled(1);
+		printf("rendergraph deferred %ux%u: %u passes, %u culled; %u transients %.1f MB unaliased, %u textures %.1f MB "
+			"aliased (%.1f%% saved), peak live %.1f MB, %s\n", sizes[s][0], sizes[s][1], stats.passes, stats.culledPasses,
+			stats.transients, stats.transientBytes / (1024.0 * 1024.0), stats.physicals, stats.physicalBytes / (1024.0 * 1024.0),
+			100.0 * (1.0 - double(stats.physicalBytes) / stats.transientBytes), stats.peakLiveBytes / (1024.0 * 1024.0),
+			valid ? "no overlapping lifetimes" : "OVERLAP OR NOT CULLED");
+		passed = passed && valid;
+	}
+
+	// what a graph rebuilt every frame costs
+	const int compiles = 20000;
+	std::chrono::high_resolution_clock::time_point start = std::chrono::high_resolution_clock::now();
+	for (int i = 0; i < compiles; i++)
+		compiled = graph.Compile() && compiled;
+	std::chrono::duration<double, std::micro> compileTime = std::chrono::high_resolution_clock::now() - start;
+	start = std::chrono::high_resolution_clock::now();
+	for (int i = 0; i < compiles; i++)
+	{
+		BuildDeferredGraph(graph, 1920, 1080, false);
+		compiled = graph.Compile() && compiled;
+	}
+	std::chrono::duration<double, std::micro> buildTime = std::chrono::high_resolution_clock::now() - start;
+	printf("rendergraph compile: %.2f us, build and compile %.2f us per frame%s\n", compileTime.count() / compiles,
+		buildTime.count() / compiles, compiled ? "" : " FAILED");
+	passed = passed && compiled;
+
+	// the pool keeps what the next graph can use: the same graph creates nothing, the kept debug view one more
+	// target, a resize everything
+	StandInTargetFactory factory;
+	RenderTargetPool pool(factory);
+	const char *steps[4] = { "first", "rebuilt", "debug kept", "3840x2160" };
+	for (int step = 0; step < 4; step++)
+	{
+		BuildDeferredGraph(graph, step == 3 ? 3840 : 1920, step == 3 ? 2160 : 1080, step == 2);
+		uint64_t created = factory.GetCreatedCount();
+		bool realized = graph.Compile() && pool.Realize(graph);
+		printf("rendergraph pool %-10s: %zu textures, %llu created, %.1f MB live%s\n", steps[step],
+			graph.GetPhysicalsCount(), static_cast<unsigned long long>(factory.GetCreatedCount() - created),
+			factory.GetLiveBytes() / (1024.0 * 1024.0), realized ? "" : " FAILED");
+		passed = passed && realized;
+	}
+	return passed;
+}
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+#if TRACE_ENABLED
+// GpuTimestampBackend without a GPU: the GPU clock is the CPU's at 10 MHz, a frame is ready on the second ReadFrame
+// after it ended, and every fifth frame is disjoint
+class StubTimestampBackend : public GpuTimestampBackend
+{
+public:
+	explicit StubTimestampBackend(uint32_t framesInFlight) : mSlots(framesInFlight), mFrames(0) {}
+
+	void BeginFrame(uint32_t slot) override
+	{
+		mSlots[slot].disjoint = ++mFrames % 5 == 0;
+		mSlots[slot].polls = 0;
+		mSlots[slot].ended = false;
+	}
+
+	void EndFrame(uint32_t slot) override { mSlots[slot].ended = true; }
+
+	void WriteTimestamp(uint32_t slot, uint32_t index) override
+	{
+		std::vector<uint64_t> &timestamps = mSlots[slot].timestamps;
+		if (timestamps.size() <= index)
+			timestamps.resize(index + 1);
+		timestamps[index] = TraceNowNs() / 100;
+	}
+
+	bool ReadFrame(uint32_t slot, uint32_t count, uint64_t *timestamps, uint64_t &frequency) override
+	{
+		Slot &s = mSlots[slot];
+		if (!s.ended || ++s.polls < 2)
+			return false;
+		std::copy(s.timestamps.begin(), s.timestamps.begin() + count, timestamps);
+		frequency = s.disjoint ? 0 : 10000000;
+		return true;
+	}
+
+private:
+	struct Slot
+	{
+		std::vector<uint64_t> timestamps;
+		bool                  disjoint;
+		bool                  ended;
+		int                   polls;
+	};
+
+	std::vector<Slot> mSlots;
+	uint64_t          mFrames;
+};
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+struct TraceFileEvent
+{
+	std::string name;
+	unsigned    tid;
+	bool        gpu;
+	uint64_t    beginNs;
+	uint64_t    endNs;
+};
+
+// TraceExport writes one event per line; false if the brackets outside the strings do not balance
+bool LoadTraceFile(const char *path, std::vector<TraceFileEvent> &events, std::map<unsigned, std::string> &threads)
+{
+	FILE *file = fopen(path, "r");
+	if (!file)
+		return false;
+
+	int depth = 0;
+	bool balanced = true;
+	char line[512];
+	while (fgets(line, sizeof(line), file))
+	{
+		bool quoted = false;
+		for (const char *c = line; *c; c++)
+		{
+			if (quoted && *c == '\\' && c[1])
+				c++;
+			else if (*c == '"')
+				quoted = !quoted;
+			else if (!quoted && (*c == '{' || *c == '['))
+				depth++;
+			else if (!quoted && (*c == '}' || *c == ']'))
+				balanced = --depth >= 0 && balanced;
+		}
+
+		const char *name = strstr(line, "\"name\":\"");
+		const char *tid = strstr(line, "\"tid\":");
+		if (!name || !tid)
+			continue;
+		name += 8;
+		if (strstr(line, "\"ph\":\"M\"") && !strncmp(name, "thread_name", 11))
+		{
+			const char *threadName = strstr(line, "\"args\":{\"name\":\"");
+			if (threadName)
+			{
+				threadName += 16;
+				threads[static_cast<unsigned>(atoi(tid + 6))] = std::string(threadName, strchr(threadName, '"'));
+			}
+			continue;
+		}
+		const char *ts = strstr(line, "\"ts\":");
+		const char *dur = strstr(line, "\"dur\":");
+		if (!strstr(line, "\"ph\":\"X\"") || !ts || !dur)
+			continue;
+		TraceFileEvent event;
+		event.name.assign(name, strchr(name, '"'));
+		event.tid = static_cast<unsigned>(atoi(tid + 6));
+		event.gpu = strstr(line, "\"cat\":\"gpu\"") != nullptr;
+		event.beginNs = static_cast<uint64_t>(llround(strtod(ts + 5, nullptr) * 1000.0));
+		event.endNs = event.beginNs + static_cast<uint64_t>(llround(strtod(dur + 6, nullptr) * 1000.0));
+		events.push_back(event);
+	}
+	fclose(file);
+	return balanced && depth == 0;
+}
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// the spans of every track either nest or follow each other, as scopes on one thread must
+bool CheckTraceNesting(std::vector<TraceFileEvent> events)
+{
+	std::sort(events.begin(), events.end(), [](const TraceFileEvent &a, const TraceFileEvent &b)
+	{
+		if (a.tid != b.tid)
+			return a.tid < b.tid;
+		return a.beginNs != b.beginNs ? a.beginNs < b.beginNs : a.endNs > b.endNs;
+	});
+	std::vector<uint64_t> open;
+	for (size_t i = 0; i < events.size(); i++)
+	{
+		if (i && events[i].tid != events[i - 1].tid)
+			open.clear();
+		while (!open.empty() && open.back() <= events[i].beginNs)
+			open.pop_back();
+		if (!open.empty() && events[i].endNs > open.back())
+			return false;
+		open.push_back(events[i].endNs);
+	}
+	return true;
+}
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+volatile uint64_t gTraceSink = 0;
+
+// ns per iteration of a loop with a marker, less the same loop without one; the fastest of a few runs
+double MeasureMarkerNs(int markers, int runs)
+{
+	double best = 1e30;
+	for (int run = 0; run < runs; run++)
+	{
+		std::chrono::high_resolution_clock::time_point start = std::chrono::high_resolution_clock::now();
+		for (int i = 0; i < markers; i++)
+			gTraceSink = gTraceSink + i;
+		std::chrono::duration<double, std::nano> bare = std::chrono::high_resolution_clock::now() - start;
+		start = std::chrono::high_resolution_clock::now();
+		for (int i = 0; i < markers; i++)
+		{
+			TRACE_SCOPE("marker");
+			gTraceSink = gTraceSink + i;
+		}
+		std::chrono::duration<double, std::nano> traced = std::chrono::high_resolution_clock::now() - start;
+		best = std::min(best, (traced.count() - bare.count()) / markers);
+	}
+	return std::max(0.0, best);
+}
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+bool BenchTrace()
+{
+	const int markers = 50000;
+	const int runs = 5;
+	const size_t eventsPerThread = 256 * 1024;
+
+	// what the markers cost outside a session, and recording; the runs fit in the buffer
+	double inactiveNs = MeasureMarkerNs(markers, runs);
+	TRACE_THREAD_NAME("main", -1);
+	TraceBeginSession(eventsPerThread);
+	double recordingNs = MeasureMarkerNs(markers, runs);
+	double clockNs = 1e30;
+	for (int run = 0; run < runs; run++)
+	{
+		std::chrono::high_resolution_clock::time_point start = std::chrono::high_resolution_clock::now();
+		for (int i = 0; i < markers; i++)
+			gTraceSink = gTraceSink + TraceNowNs();
+		std::chrono::duration<double, std::nano> clockTime = std::chrono::high_resolution_clock::now() - start;
+		clockNs = std::min(clockNs, clockTime.count() / markers);
+	}
+	printf("trace marker: %.2f ns outside a session, %.2f ns recording, %.2f ns of it the two clock reads\n",
+		inactiveNs, recordingNs, 2.0 * clockNs);
+
+	// the threads record at once without a lock between them; one records past its buffer
+	const int threadsCount = 4;
+	const int threadMarkers = 50000;
+	std::vector<std::thread> threads;
+	std::chrono::high_resolution_clock::time_point start = std::chrono::high_resolution_clock::now();
+	for (int t = 0; t <= threadsCount; t++)
+		threads.push_back(std::thread([t, threadMarkers, eventsPerThread]
+		{
+			TRACE_THREAD_NAME(t < threadsCount ? "recorder" : "overflow", t);
+			if (t == threadsCount)
+			{
+				for (size_t i = 0; i < eventsPerThread + 1000; i++)
+				{
+					TRACE_SCOPE("overflow");
+				}
+				return;
+			}
+			// a sink of its own, a shared one would be the contention measured
+			volatile uint64_t sink = 0;
+			for (int batch = 0; batch < threadMarkers / 1000; batch++)
+			{
+				TRACE_SCOPE("batch");
+				for (int i = 0; i < 999; i++)
+				{
+					TRACE_SCOPE("marker");
+					sink = sink + i;
+				}
+			}
+		}));
+	for (size_t t = 0; t < threads.size(); t++)
+		threads[t].join();
+	std::chrono::duration<double, std::nano> threadsTime = std::chrono::high_resolution_clock::now() - start;
+	TraceStats stats = TraceGetStats();
+	size_t threadEvents = threadsCount * threadMarkers + eventsPerThread + 1000;
+	printf("trace %d threads and an overflowing one on %u cores: %.2f ns per marker over all of them, %llu events, "
+		"%llu dropped (%s)\n", threadsCount, std::max(1u, std::thread::hardware_concurrency()), threadsTime.count() / threadEvents,
+		static_cast<unsigned long long>(stats.events), static_cast<unsigned long long>(stats.dropped),
+		stats.dropped == 1000 ? "the overflow past its buffer" : "WRONG");
+	bool passed = stats.dropped == 1000;
+
+	// the init steps on the job system's threads
+	{
+		JobSystem jobs(4);
+		TaskGraph graph(gFrameClock);
+		AddInitSteps(graph, -1);
+		graph.Run(jobs);
+	}
+
+	// three spans fit in a frame of 8 timestamps with the frame's own, the other two are dropped
+	const int gpuFrames = 20;
+	StubTimestampBackend timestamps(3);
+	GpuTrace gpu(timestamps, "GPU", 3, 8);
+	for (int frame = 0; frame < gpuFrames; frame++)
+	{
+		gpu.BeginFrame();
+		{
+			TRACE_GPU_SCOPE(&gpu, "scene");
+			TRACE_GPU_SCOPE(&gpu, "draw instanced");
+		}
+		{
+			TRACE_GPU_SCOPE(&gpu, "upscale");
+			TRACE_GPU_SCOPE(&gpu, "dropped");
+			TRACE_GPU_SCOPE(&gpu, "dropped too");
+		}
+		gpu.EndFrame();
+	}
+	gpu.Flush();
+	const GpuTraceStats &gpuStats = gpu.GetStats();
+	int disjointFrames = gpuFrames / 5;
+	bool gpuExpected = gpuStats.frames == uint64_t(gpuFrames) && gpuStats.droppedFrames == uint64_t(disjointFrames) &&
+		gpuStats.spans == uint64_t(4 * (gpuFrames - disjointFrames)) && gpuStats.droppedSpans == uint64_t(2 * gpuFrames);
+	printf("trace gpu: %llu frames read back, %llu disjoint, %llu spans, %llu over the timestamps (%s)\n",
+		static_cast<unsigned long long>(gpuStats.frames), static_cast<unsigned long long>(gpuStats.droppedFrames),
+		static_cast<unsigned long long>(gpuStats.spans), static_cast<unsigned long long>(gpuStats.droppedSpans),
+		gpuExpected ? "as expected" : "WRONG");
+	passed = passed && gpuExpected;
+	TraceEndSession();
+
+	const char *path = "TraceBench.json";
+	stats = TraceGetStats();
+	start = std::chrono::high_resolution_clock::now();
+	bool exported = TraceExport(path);
+	std::chrono::duration<double, std::milli> exportTime = std::chrono::high_resolution_clock::now() - start;
+	std::vector<TraceFileEvent> events;
+	std::map<unsigned, std::string> trackNames;
+	bool balanced = exported && LoadTraceFile(path, events, trackNames);
+	std::set<std::string> steps;
+	size_t gpuEvents = 0;
+	for (size_t i = 0; i < events.size(); i++)
+	{
+		gpuEvents += events[i].gpu ? 1 : 0;
+		steps.insert(events[i].name);
+	}
+	int missingSteps = 0;
+	for (int i = 0; i < gInitStepsCount; i++)
+		missingSteps += steps.count(gInitSteps[i].name) ? 0 : 1;
+	bool valid = balanced && events.size() == stats.events && trackNames.size() == stats.tracks && !missingSteps &&
+		gpuEvents == gpuStats.spans && CheckTraceNesting(events);
+	printf("trace export: %llu events on %u tracks in %.1f ms, %s\n", static_cast<unsigned long long>(stats.events),
+		stats.tracks, exportTime.count(), valid ? "well formed, spans nest on every track, every init step present" : "INVALID");
+	remove(path);
+	passed = passed && valid;
+	return passed;
+}
+#else
+bool BenchTrace()
+{
+	printf("trace: compiled out, TRACE_ENABLED is 0 in NDEBUG builds\n");
+	return true;
+}
+#endif
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+int main(int argc, char **argv)
+{
+	int frames = -1; // 1, or 300 for -bench scene
+	int warmup = 30;
+	uint32_t textureSize = 8;
+	int threads = 0;
+	const char *outPath = nullptr;
+	const char *bench = nullptr;
+	const char *statsPath = nullptr;
+	const char *tracePath = nullptr;
+	const char *frameTimesPath = nullptr;
+	const char *jsonPath = nullptr;
+
+	for (int i = 1; i < argc; i++)
+	{
+		if (!strcmp(argv[i], "-frames") && i + 1 < argc)
+			frames = atoi(argv[++i]);
+		else if (!strcmp(argv[i], "-threads") && i + 1 < argc)
+			threads = atoi(argv[++i]);
+		else if (!strcmp(argv[i], "-out") && i + 1 < argc)
+			outPath = argv[++i];
+		else if (!strcmp(argv[i], "-instances") && i + 1 < argc)
+			gInstancesCount = std::max(2, atoi(argv[++i]));
+		else if (!strcmp(argv[i], "-textures") && i + 1 < argc)
+			gTexturesCount = std::min(std::max(1, atoi(argv[++i])), static_cast<int>(TextureArrayAllocator::kMaxSlices));
+		else if (!strcmp(argv[i], "-draw") && i + 1 < argc)
+			gUseInstancing = strcmp(argv[++i], "perobject") != 0;
+		else if (!strcmp(argv[i], "-sort") && i + 1 < argc)
+		{
+			i++;
+			gSortDraws = strcmp(argv[i], "off") != 0;
+			gOpaqueOrder = !strcmp(argv[i], "depth") ? Order_FrontToBack : Order_State;
+		}
+		else if (!strcmp(argv[i], "-bench") && i + 1 < argc)
+			bench = argv[++i];
+		else if (!strcmp(argv[i], "-stats") && i + 1 < argc)
+			statsPath = argv[++i];
+		else if (!strcmp(argv[i], "-trace") && i + 1 < argc)
+			tracePath = argv[++i];
+		else if (!strcmp(argv[i], "-frametimes") && i + 1 < argc)
+			frameTimesPath = argv[++i];
+		else if (!strcmp(argv[i], "-warmup") && i + 1 < argc)
+			warmup = std::max(0, atoi(argv[++i]));
+		else if (!strcmp(argv[i], "-texsize") && i + 1 < argc)
+			textureSize = static_cast<uint32_t>(std::max(8, atoi(argv[++i])));
+		else if (!strcmp(argv[i], "-json") && i + 1 < argc)
+			jsonPath = argv[++i];
+		else
+		{
+			fprintf(stderr, "usage: %s [-frames N] [-threads N] [-out file.ppm] [-instances N] [-draw instanced|perobject] [-sort state|depth|off] [-textures N] [-stats file.csv|file.json] [-warmup N] [-texsize N] [-json file.json] [-bench scene|instancing|ring|framestats|shadercache|permutations|statefilter|jobs|simulation|transforms|culling|mesh|texture|streaming|taskgraph|pacing|resolution|loop|arena|statecache|renderqueue|atlas|rendergraph|trace] [-trace file.json] [-frametimes frametimes.txt]\n", argv[0]);
+			return 1;
+		}
+	}
+
+	if (bench)
+	{
+		bool passed;
+		if (!strcmp(bench, "scene"))
+			return BenchScene(frames >= 0 ? frames : 300, warmup, threads, textureSize, jsonPath) ? 0 : 1;
+		else if (!strcmp(bench, "instancing"))
+			passed = BenchInstancing();
+		else if (!strcmp(bench, "ring"))
+			passed = BenchUploadRing();
+		else if (!strcmp(bench, "framestats"))
+			passed = BenchFrameStats();
+		else if (!strcmp(bench, "shadercache"))
+			passed = BenchShaderCache();
+		else if (!strcmp(bench, "permutations"))
+			passed = BenchPermutations();
+		else if (!strcmp(bench, "statefilter"))
+			passed = BenchStateFilter();
+		else if (!strcmp(bench, "jobs"))
+			passed = BenchJobs(threads);
+		else if (!strcmp(bench, "simulation"))
+			passed = BenchSimulation();
+		else if (!strcmp(bench, "transforms"))
+			passed = BenchTransforms();
+		else if (!strcmp(bench, "culling"))
+			passed = BenchCulling();
+		else if (!strcmp(bench, "mesh"))
+			passed = BenchMesh();
+		else if (!strcmp(bench, "texture"))
+			passed = BenchTexture(threads);
+		else if (!strcmp(bench, "streaming"))
+			passed = BenchStreaming();
+		else if (!strcmp(bench, "taskgraph"))
+			passed = BenchTaskGraph(threads);
+		else if (!strcmp(bench, "pacing"))
+			passed = BenchPacing();
+		else if (!strcmp(bench, "resolution"))
+			passed = BenchResolution(frameTimesPath);
+		else if (!strcmp(bench, "loop"))
+			passed = BenchLoop();
+		else if (!strcmp(bench, "arena"))
+			passed = BenchArena(threads);
+		else if (!strcmp(bench, "statecache"))
+			passed = BenchStateCache(threads);
+		else if (!strcmp(bench, "renderqueue"))
+			passed = BenchRenderQueue();
+		else if (!strcmp(bench, "atlas"))
+			passed = BenchAtlas();
+		else if (!strcmp(bench, "rendergraph"))
+			passed = BenchRenderGraph();
+		else if (!strcmp(bench, "trace"))
+			passed = BenchTrace();
+		else
+		{
+			fprintf(stderr, "unknown benchmark %s\n", bench);
+			return 1;
+		}
+		return passed ? 0 : 1;
+	}
+
+	if (frames < 0)
+		frames = 1;
+	// without a benchmark -trace records the run
+	TRACE_THREAD_NAME("main", -1);
+#if TRACE_ENABLED
+	if (tracePath)
+		TraceBeginSession();
+#endif
+	HeadlessScene scene;
+	if (!CreateScene(scene))
+		return 1;
+
+	SoftRasterizer rasterizer(gWidth, gHeight, threads);
+	rasterizer.SetMatrices(MatIdentity(), MatIdentity());
+
+	InstanceBatcher batcher;
+	SoftInstanceBackend backend(rasterizer, scene, gMaxInstances);
+	Simulation simulation(gSimulationClock, gInstancesCount, gSimulationStepMs);
+
+	if (statsPath)
+	{
+		size_t len = strlen(statsPath);
+		bool json = len >= 5 && !strcmp(statsPath + len - 5, ".json");
+		if (!gFrameStats.EnableExport(statsPath, json ? FrameStats_JSON : FrameStats_CSV, 1000.0))
+		{
+			fprintf(stderr, "failed to open %s\n", statsPath);
+			return 1;
+		}
+	}
+
+	std::chrono::high_resolution_clock::time_point start = std::chrono::high_resolution_clock::now();
+	for (int i = 0; i < frames; i++)
+	{
+		gFrameStats.BeginFrame();
+		RenderTick(rasterizer, scene, simulation, batcher, backend);
+		gFrameStats.EndPresent();
+	}
+	std::chrono::duration<double, std::milli> elapsed = std::chrono::high_resolution_clock::now() - start;
+
+	printf("%d frames, %d threads, %.3f ms/frame\n", frames, rasterizer.GetThreadsCount(), elapsed.count() / (frames > 0 ? frames : 1));
+
+	// last FrameStats::kWindowSize frames
+	FrameSummary summary = gFrameStats.Summarize();
+	printf("p50 %.3f  p95 %.3f  p99 %.3f  max %.3f  jitter %.3f ms, submit %.3f ms, flush %.3f ms\n", summary.p50Ms, summary.p95Ms,
+		summary.p99Ms, summary.maxMs, summary.jitterMs, summary.cpuSubmitMs, summary.presentWaitMs);
+
+	if (outPath && !rasterizer.SavePPM(outPath))
+	{
+		fprintf(stderr, "failed to write %s\n", outPath);
+		return 1;
+	}
+
+	if (tracePath)
+	{
+#if TRACE_ENABLED
+		TraceEndSession();
+		TraceStats stats = TraceGetStats();
+		if (!TraceExport(tracePath))
+		{
+			fprintf(stderr, "failed to write %s\n", tracePath);
+			return 1;
+		}
+		printf("trace: %llu events on %u tracks, %llu dropped, written to %s\n", static_cast<unsigned long long>(stats.events),
+			stats.tracks, static_cast<unsigned long long>(stats.dropped), tracePath);
+#else
+		printf("trace: compiled out, TRACE_ENABLED is 0 in NDEBUG builds\n");
+#endif
+	}
+	return 0;
+}
@@ -0,0 +1,27 @@
+#include "InstanceBatcher.h"
+
+#include <algorithm>
+#include <cstring>
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+bool InstanceBatcher::Submit(InstanceBackend &backend, size_t verticesCount)
+{
+	const size_t capacity = backend.GetInstanceCapacity();
+	if (!capacity)
+		return false;
+
+	for (size_t first = 0; first < mInstances.size(); first += capacity)
+	{
+		size_t count = std::min(capacity, mInstances.size() - first);
+		InstanceData *dst = backend.MapInstances(count);
+		if (!dst)
+			return false;
+
+		// Mat4 is stored row by row, Add copied it as it is
+		memcpy(dst, &mInstances[first], count * sizeof(InstanceData));
+		backend.UnmapInstances();
+
+		backend.DrawInstanced(verticesCount, count);
+		mBatchesCount++;
+	}
+	return true;
+}
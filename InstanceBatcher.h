@@ -0,0 +1,60 @@
+#pragma once
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Backend-agnostic instanced draw submission.
+// RenderTick adds one world matrix per object, Submit packs them into the backend's per-instance buffer
+// and issues one DrawInstanced per buffer-full instead of an UpdateSubresource + Draw per object.
+// The D3D11 backend lives in main.cpp (dynamic vertex buffer in input slot 1), the headless one in HeadlessMain.cpp.
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+#include "MathUtils.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+// per-instance vertex layout: rows of the world matrix, read as WORLD0..WORLD3 by SimpleVertexShaderInstanced, and
+// the slice of the bound texture array, read as TEXINDEX
+struct InstanceData
+{
+	float    world[4][4];
+	uint32_t texture;
+};
+
+class InstanceBackend
+{
+public:
+	virtual ~InstanceBackend() {}
+
+	// max instances per MapInstances call
+	virtual size_t GetInstanceCapacity() const = 0;
+	// previous contents may be discarded, returns nullptr on failure
+	virtual InstanceData* MapInstances(size_t count) = 0;
+	virtual void UnmapInstances() = 0;
+	// draws the bound geometry with the instances written by the last Map/Unmap
+	virtual void DrawInstanced(size_t verticesCount, size_t instanceCount) = 0;
+};
+
+class InstanceBatcher
+{
+public:
+	InstanceBatcher() : mBatchesCount(0) {}
+
+	void Begin() { mInstances.clear(); mBatchesCount = 0; }
+	void Add(const Mat4 &world, uint32_t texture = 0)
+	{
+		InstanceData instance;
+		memcpy(instance.world, world.m, sizeof(instance.world));
+		instance.texture = texture;
+		mInstances.push_back(instance);
+	}
+	// returns false if the backend failed to map its buffer, instances drawn so far stay drawn
+	bool Submit(InstanceBackend &backend, size_t verticesCount);
+
+	size_t GetInstancesCount() const { return mInstances.size(); }
+	// DrawInstanced calls issued by the last Submit
+	size_t GetBatchesCount() const { return mBatchesCount; }
+
+private:
+	std::vector<InstanceData> mInstances;
+	size_t                    mBatchesCount;
+};
@@ -0,0 +1,163 @@
+#include "JobSystem.h"
+#include "Trace.h"
+
+#include <algorithm>
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+namespace
+{
+	// which system and deque the current thread belongs to
+	thread_local const JobSystem *tJobSystem = nullptr;
+	thread_local int              tThreadIndex = -1;
+}
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+JobSystem::JobSystem(int numThreads)
+	: mQueued(0)
+	, mQuit(false)
+{
+	if (numThreads <= 0)
+		numThreads = std::max(1u, std::thread::hardware_concurrency());
+
+	for (int i = 0; i < numThreads; i++)
+		mQueues.push_back(std::unique_ptr<WorkerQueue>(new WorkerQueue()));
+
+	tJobSystem = this;
+	tThreadIndex = 0;
+	for (int i = 1; i < numThreads; i++)
+		mWorkers.push_back(std::thread(&JobSystem::WorkerLoop, this, i));
+}
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+JobSystem::~JobSystem()
+{
+	{
+		std::lock_guard<std::mutex> lock(mSleepMutex);
+		mQuit = true;
+	}
+	mWakeUp.notify_all();
+	for (size_t i = 0; i < mWorkers.size(); i++)
+		mWorkers[i].join();
+
+	if (tJobSystem == this)
+	{
+		tJobSystem = nullptr;
+		tThreadIndex = -1;
+	}
+}
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+int JobSystem::GetThreadIndex() const
+{
+	return tJobSystem == this ? tThreadIndex : -1;
+}
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+void JobSystem::Submit(const Job &job)
+{
+	job.counter->pending++;
+
+	// outside threads hand their jobs to the owner's deque, workers steal them from there
+	int self = std::max(0, GetThreadIndex());
+	{
+		std::lock_guard<std::mutex> lock(mQueues[self]->mutex);
+		mQueues[self]->jobs.push_back(job);
+	}
+
+	mQueued++;
+	{
+		// taking the lock orders the notify after a worker's check of mQueued
+		std::lock_guard<std::mutex> lock(mSleepMutex);
+	}
+	mWakeUp.notify_one();
+}
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+bool JobSystem::PopOrSteal(int self, Job &job)
+{
+	{
+		WorkerQueue &own = *mQueues[self];
+		std::lock_guard<std::mutex> lock(own.mutex);
+		if (own.front < own.jobs.size())
+		{
+			job = own.jobs.back();
+			own.jobs.pop_back();
+			own.Compact();
+			mQueued--;
+			return true;
+		}
+	}
+
+	const int count = static_cast<int>(mQueues.size());
+	for (int i = 1; i < count; i++)
+	{
+		WorkerQueue &victim = *mQueues[(self + i) % count];
+		std::lock_guard<std::mutex> lock(victim.mutex);
+		if (victim.front < victim.jobs.size())
+		{
+			job = victim.jobs[victim.front++];
+			victim.Compact();
+			mQueued--;
+			mQueues[self]->stolen++;
+			return true;
+		}
+	}
+	return false;
+}
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+void JobSystem::Execute(int self, const Job &job)
+{
+	job.function(job.data, job.begin, job.end);
+	mQueues[self]->executed++;
+	job.counter->pending--;
+}
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+void JobSystem::Wait(JobCounter &counter)
+{
+	int self = std::max(0, GetThreadIndex());
+	Job job;
+	while (counter.pending.load() > 0)
+	{
+		if (PopOrSteal(self, job))
+			Execute(self, job);
+		else
+			std::this_thread::yield(); // the remaining jobs are running on other threads
+	}
+}
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+bool JobSystem::TryRunJob()
+{
+	int self = std::max(0, GetThreadIndex());
+	Job job;
+	if (!PopOrSteal(self, job))
+		return false;
+	Execute(self, job);
+	return true;
+}
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+void JobSystem::WorkerLoop(int index)
+{
+	tJobSystem = this;
+	tThreadIndex = index;
+	TRACE_THREAD_NAME("job worker", index);
+
+	Job job;
+	for (;;)
+	{
+		if (PopOrSteal(index, job))
+		{
+			Execute(index, job);
+			continue;
+		}
+
+		std::unique_lock<std::mutex> lock(mSleepMutex);
+		while (!mQuit && mQueued.load() == 0)
+			mWakeUp.wait(lock);
+		if (mQuit)
+			return;
+	}
+}
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+void JobSystem::ResetCounters()
+{
+	for (size_t i = 0; i < mQueues.size(); i++)
+	{
+		std::lock_guard<std::mutex> lock(mQueues[i]->mutex);
+		mQueues[i]->executed = 0;
+		mQueues[i]->stolen = 0;
+	}
+}
@@ -0,0 +1,118 @@
+#pragma once
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Work-stealing job scheduler.
+// Every thread owns a deque: it pushes and pops its own jobs at the back (LIFO, cache friendly) while idle threads
+// steal from the front of the others (FIFO, the largest remaining pieces). The thread that created the system is
+// thread 0 and only runs jobs inside Wait, so it never sits idle while its jobs are pending.
+// Jobs are plain function pointers with an index range, submitting does not allocate per job.
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// pending jobs of one batch, Wait returns when it drops to zero
+struct JobCounter
+{
+	std::atomic<int> pending;
+	JobCounter() : pending(0) {}
+};
+
+typedef void (*JobFunction)(void *data, size_t begin, size_t end);
+
+struct Job
+{
+	JobFunction function;
+	void        *data;
+	size_t      begin, end;
+	JobCounter  *counter;
+};
+
+class JobSystem
+{
+public:
+	// numThreads counts the calling thread, 0 uses all hardware threads
+	explicit JobSystem(int numThreads = 0);
+	~JobSystem();
+
+	int GetThreadsCount() const { return static_cast<int>(mQueues.size()); }
+	// 0 for the owner thread, 1.. for workers, -1 for threads outside this system
+	int GetThreadIndex() const;
+
+	// from any thread of the system; job.counter is incremented here
+	void Submit(const Job &job);
+	// runs queued jobs until the counter reaches zero
+	void Wait(JobCounter &counter);
+	// runs one queued job on the calling thread, false if there was none to run or steal
+	bool TryRunJob();
+
+	// calls function(begin, end) on chunks of at most grain items and waits for all of them
+	template <class Function>
+	void ParallelFor(size_t count, size_t grain, Function &function);
+
+	// jobs executed by each thread since the last reset, shows how well the work was spread
+	size_t GetExecutedJobs(int thread) const { return mQueues[thread]->executed; }
+	size_t GetStolenJobs(int thread) const { return mQueues[thread]->stolen; }
+	void ResetCounters();
+
+private:
+	struct WorkerQueue
+	{
+		// a deque without per-block allocations: jobs[front..] are queued, the storage is reused once it runs empty
+		std::mutex       mutex;
+		std::vector<Job> jobs;
+		size_t           front;
+		size_t           executed;
+		size_t           stolen;
+		WorkerQueue() : front(0), executed(0), stolen(0) {}
+
+		void Compact()
+		{
+			if (front == jobs.size())
+			{
+				jobs.clear();
+				front = 0;
+			}
+		}
+	};
+
+	template <class Function>
+	static void RunRange(void *data, size_t begin, size_t end)
+	{
+		(*static_cast<Function*>(data))(begin, end);
+	}
+
+	JobSystem(const JobSystem&);
+	JobSystem& operator=(const JobSystem&);
+
+	bool PopOrSteal(int self, Job &job);
+	void Execute(int self, const Job &job);
+	void WorkerLoop(int index);
+
+	std::vector<std::unique_ptr<WorkerQueue>> mQueues;
+	std::vector<std::thread>                  mWorkers;
+
+	// sleeping workers wait for mQueued to become non zero
+	std::atomic<int>        mQueued;
+	std::mutex              mSleepMutex;
+	std::condition_variable mWakeUp;
+	bool                    mQuit;
+};
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+template <class Function>
+void JobSystem::ParallelFor(size_t count, size_t grain, Function &function)
+{
+	if (!grain)
+		grain = 1;
+
+	JobCounter counter;
+	for (size_t begin = 0; begin < count; begin += grain)
+	{
+		Job job = { &RunRange<Function>, &function, begin, begin + grain < count ? begin + grain : count, &counter };
+		Submit(job);
+	}
+	Wait(counter);
+}
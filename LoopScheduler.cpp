@@ -0,0 +1,134 @@
+#include "LoopScheduler.h"
+
+#include <algorithm>
+
+#if defined(_WIN32)
+#include <windows.h>
+#else
+#include <time.h>
+#endif
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Windows counts thread time in scheduler ticks, the totals are right but single frames are not
+double ThreadCpuClock::NowMs() const
+{
+#if defined(_WIN32)
+	FILETIME creation, exit, kernel, user;
+	if (!GetThreadTimes(GetCurrentThread(), &creation, &exit, &kernel, &user))
+		return 0.0;
+	ULARGE_INTEGER kernelTime, userTime;
+	kernelTime.LowPart = kernel.dwLowDateTime;
+	kernelTime.HighPart = kernel.dwHighDateTime;
+	userTime.LowPart = user.dwLowDateTime;
+	userTime.HighPart = user.dwHighDateTime;
+	return (kernelTime.QuadPart + userTime.QuadPart) / 10000.0; // 100 ns units
+#else
+	timespec now;
+	clock_gettime(CLOCK_THREAD_CPUTIME_ID, &now);
+	return now.tv_sec * 1000.0 + now.tv_nsec / 1000000.0;
+#endif
+}
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+LoopScheduler::LoopScheduler(const FrameClock &clock, const FrameClock &cpuClock, LoopMode mode, double capMs, double pollMs)
+	: mClock(clock)
+	, mCpuClock(cpuClock)
+	, mMode(mode)
+	, mCapMs(capMs)
+	, mPollMs(pollMs)
+	, mHidden(false)
+	, mDeadlineMs(clock.NowMs())
+	, mWakeMs(mDeadlineMs)
+	, mSlackMs(0.5)
+	, mLast(Loop_Render)
+	, mLastMs(mDeadlineMs)
+	, mStartMs(mDeadlineMs)
+	, mStartCpuMs(cpuClock.NowMs())
+{
+	mStats.frames = 0;
+	mStats.sleeps = 0;
+	mStats.spins = 0;
+	mStats.idles = 0;
+	mStats.wallMs = 0.0;
+	mStats.renderMs = 0.0;
+	mStats.sleepMs = 0.0;
+	mStats.spinMs = 0.0;
+	mStats.idleMs = 0.0;
+	mStats.cpuMs = 0.0;
+}
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+void LoopScheduler::Book(double nowMs)
+{
+	double ms = nowMs - mLastMs;
+	switch (mLast)
+	{
+	case Loop_Render: mStats.renderMs += ms; break;
+	case Loop_Sleep:  mStats.sleepMs += ms; break;
+	case Loop_Spin:   mStats.spinMs += ms; break;
+	case Loop_Idle:   mStats.idleMs += ms; break;
+	}
+	mLastMs = nowMs;
+}
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+LoopAction LoopScheduler::Next()
+{
+	double nowMs = mClock.NowMs();
+	// the message handling since the last step goes with it
+	if (mLast == Loop_Sleep)
+	{
+		// woken by the timer: the lateness refines the slack, kept between 0.1 ms and a quarter of the interval.
+		// A message wakes up early and says nothing about the timer.
+		double lateMs = nowMs - mWakeMs;
+		if (lateMs >= 0.0)
+			mSlackMs = std::min(std::max(mSlackMs + (2.0 * lateMs - mSlackMs) * 0.125, 0.1), 0.25 * mCapMs);
+	}
+	Book(nowMs);
+
+	if (mMode == Loop_IdleWhenHidden && mHidden)
+	{
+		mLast = Loop_Idle;
+		mWakeMs = nowMs + mPollMs;
+		mStats.idles++;
+		return mLast;
+	}
+
+	if (mMode != Loop_Capped || nowMs >= mDeadlineMs)
+		mLast = Loop_Render;
+	else if (mDeadlineMs - nowMs > mSlackMs)
+	{
+		mLast = Loop_Sleep;
+		mWakeMs = mDeadlineMs - mSlackMs;
+		mStats.sleeps++;
+	}
+	else
+	{
+		mLast = Loop_Spin;
+		mWakeMs = mDeadlineMs;
+		mStats.spins++;
+	}
+	return mLast;
+}
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+void LoopScheduler::BeginFrame()
+{
+	double nowMs = mClock.NowMs();
+	Book(nowMs);
+	mLast = Loop_Render;
+
+	// a frame that starts late keeps the cadence; one a whole interval late does not make the next ones catch up
+	mDeadlineMs += mCapMs;
+	if (mDeadlineMs <= nowMs)
+		mDeadlineMs = nowMs + mCapMs;
+}
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+void LoopScheduler::EndFrame()
+{
+	Book(mClock.NowMs());
+	mStats.frames++;
+}
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+LoopStats LoopScheduler::GetStats() const
+{
+	LoopStats stats = mStats;
+	stats.wallMs = mClock.NowMs() - mStartMs;
+	stats.cpuMs = mCpuClock.NowMs() - mStartCpuMs;
+	return stats;
+}
@@ -0,0 +1,92 @@
+#pragma once
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Main loop scheduling.
+// Between messages the loop asks Next what to do: render a frame, sleep until a deadline, spin out the last fraction
+// of a millisecond the sleep cannot be trusted with, or idle on the message queue while the window is hidden.
+// Capped frames start on a fixed cadence; the sleep is cut short by the timer's measured lateness so it does not
+// overshoot, and only the rest is spun. Time between calls is booked under the step that was returned, and the loop
+// thread's CPU time is read from a second clock, so the counters show where the loop's core goes.
+// Nothing here knows about Win32: main.cpp blocks in MsgWaitForMultipleObjects, HeadlessMain.cpp on stepped clocks.
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+#include "FrameStats.h"
+
+#include <cstdint>
+
+enum LoopMode
+{
+	Loop_FullSpeed,      // a frame whenever the message queue is empty, hidden or not
+	Loop_Capped,         // frames start at most once per cap interval, the loop sleeps in between
+	Loop_IdleWhenHidden, // full speed while visible, no frames while minimized or occluded
+};
+
+enum LoopAction
+{
+	Loop_Render,
+	Loop_Sleep, // block until GetWakeMs, a message may end it earlier
+	Loop_Spin,  // yield once and ask again, the deadline is closer than the timer's lateness
+	Loop_Idle,  // block on messages until GetWakeMs at the latest, then check the visibility again
+};
+
+// CPU time used by the calling thread
+class ThreadCpuClock : public FrameClock
+{
+public:
+	double NowMs() const override;
+};
+
+struct LoopStats
+{
+	uint64_t frames;
+	uint64_t sleeps;
+	uint64_t spins;
+	uint64_t idles;
+	// wall time since the scheduler was created, split by the step that was returned
+	double wallMs;
+	double renderMs;
+	double sleepMs;
+	double spinMs;
+	double idleMs;
+	double cpuMs; // CPU time of the loop thread in the same span
+};
+
+class LoopScheduler
+{
+public:
+	// capMs is the capped frame interval, pollMs how often a hidden window checks whether it is visible again
+	LoopScheduler(const FrameClock &clock, const FrameClock &cpuClock, LoopMode mode, double capMs, double pollMs = 100.0);
+
+	LoopMode GetMode() const { return mMode; }
+	// minimized or occluded
+	void SetHidden(bool hidden) { mHidden = hidden; }
+	bool IsHidden() const { return mHidden; }
+
+	// from the loop thread whenever the message queue is empty; Loop_Render is followed by BeginFrame and EndFrame
+	LoopAction Next();
+	double GetWakeMs() const { return mWakeMs; }
+	void BeginFrame();
+	void EndFrame();
+
+	// how late sleeps wake up on average, what Loop_Spin covers
+	double GetTimerSlackMs() const { return mSlackMs; }
+	LoopStats GetStats() const;
+
+private:
+	void Book(double nowMs);
+
+	const FrameClock &mClock;
+	const FrameClock &mCpuClock;
+	LoopMode         mMode;
+	double           mCapMs;
+	double           mPollMs;
+	bool             mHidden;
+
+	double     mDeadlineMs; // start of the next capped frame
+	double     mWakeMs;
+	double     mSlackMs;
+	LoopAction mLast;       // what the time since mLastMs is booked under
+	double     mLastMs;
+
+	double    mStartMs;
+	double    mStartCpuMs;
+	LoopStats mStats;
+};
@@ -0,0 +1,134 @@
+#include "MappedFile.h"
+
+#include <cstdio>
+#include <functional>
+#include <thread>
+
+#if defined(_WIN32)
+#include <windows.h>
+#include <process.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+MappedFile::MappedFile()
+	: mData(nullptr)
+	, mSize(0)
+#if defined(_WIN32)
+	, mFile(INVALID_HANDLE_VALUE)
+	, mMapping(nullptr)
+#else
+	, mFd(-1)
+#endif
+{
+}
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+MappedFile::~MappedFile()
+{
+	Close();
+}
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+#if defined(_WIN32)
+bool MappedFile::Open(const char *path)
+{
+	Close();
+
+	mFile = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+	if (mFile == INVALID_HANDLE_VALUE)
+		return false;
+
+	LARGE_INTEGER size;
+	if (!GetFileSizeEx(mFile, &size) || size.QuadPart == 0)
+	{
+		Close();
+		return false;
+	}
+
+	mMapping = CreateFileMappingA(mFile, nullptr, PAGE_READONLY, 0, 0, nullptr);
+	if (!mMapping)
+	{
+		Close();
+		return false;
+	}
+
+	mData = static_cast<const unsigned char*>(MapViewOfFile(mMapping, FILE_MAP_READ, 0, 0, 0));
+	if (!mData)
+	{
+		Close();
+		return false;
+	}
+	mSize = static_cast<size_t>(size.QuadPart);
+	return true;
+}
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+void MappedFile::Close()
+{
+	if (mData)
+		UnmapViewOfFile(mData);
+	if (mMapping)
+		CloseHandle(mMapping);
+	if (mFile != INVALID_HANDLE_VALUE)
+		CloseHandle(mFile);
+
+	mData = nullptr;
+	mSize = 0;
+	mMapping = nullptr;
+	mFile = INVALID_HANDLE_VALUE;
+}
+#else
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+bool MappedFile::Open(const char *path)
+{
+	Close();
+
+	mFd = open(path, O_RDONLY);
+	if (mFd < 0)
+		return false;
+
+	struct stat st;
+	if (fstat(mFd, &st) != 0 || st.st_size == 0)
+	{
+		Close();
+		return false;
+	}
+
+	void *data = mmap(nullptr, static_cast<size_t>(st.st_size), PROT_READ, MAP_PRIVATE, mFd, 0);
+	if (data == MAP_FAILED)
+	{
+		Close();
+		return false;
+	}
+
+	mData = static_cast<const unsigned char*>(data);
+	mSize = static_cast<size_t>(st.st_size);
+	return true;
+}
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+void MappedFile::Close()
+{
+	if (mData)
+		munmap(const_cast<unsigned char*>(mData), mSize);
+	if (mFd >= 0)
+		close(mFd);
+
+	mData = nullptr;
+	mSize = 0;
+	mFd = -1;
+}
+#endif
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+std::string GetTempSuffix()
+{
+#if defined(_WIN32)
+	unsigned long long process = static_cast<unsigned long long>(_getpid());
+#else
+	unsigned long long process = static_cast<unsigned long long>(getpid());
+#endif
+	unsigned long long thread = static_cast<unsigned long long>(std::hash<std::thread::id>()(std::this_thread::get_id()));
+	char suffix[48];
+	snprintf(suffix, sizeof(suffix), ".%llu.%llx.tmp", process, thread);
+	return suffix;
+}
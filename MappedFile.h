@@ -0,0 +1,39 @@
+#pragma once
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Read-only memory mapped file (CreateFileMapping on Windows, mmap elsewhere).
+// Loaders hand pointers into the mapping straight to the device, so the data is never copied into a heap buffer.
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+#include <cstddef>
+#include <string>
+
+class MappedFile
+{
+public:
+	MappedFile();
+	~MappedFile();
+
+	// closes the previous mapping, empty files cannot be mapped
+	bool Open(const char *path);
+	void Close();
+
+	bool IsOpen() const { return mData != nullptr; }
+	const unsigned char* GetData() const { return mData; }
+	size_t GetSize() const { return mSize; }
+
+private:
+	MappedFile(const MappedFile&);
+	MappedFile& operator=(const MappedFile&);
+
+	const unsigned char *mData;
+	size_t               mSize;
+#if defined(_WIN32)
+	void *mFile;
+	void *mMapping;
+#else
+	int   mFd;
+#endif
+};
+
+// unique to the writing process and thread, for the temporary name a file is written under before it is renamed into
+// place: processes sharing a directory may store the same file at once
+std::string GetTempSuffix();
@@ -0,0 +1,121 @@
+#pragma once
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Minimal portable math for the CPU side of the renderer (DirectXMath is not available on Linux).
+// Conventions match DirectXMath: row-major storage, row vectors, v' = v * M.
+// With HLSL's default column_major packing this is exactly what mul(matrix, vector) does in SimpleVertexShader.
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+#include <cmath>
+
+const float kPi = 3.141592654f;
+const float kPiDiv2 = 1.570796327f;
+
+struct Vec3
+{
+	float x, y, z;
+};
+
+struct Vec4
+{
+	float x, y, z, w;
+};
+
+struct Mat4
+{
+	float m[4][4];
+};
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+inline Vec3 Vec3Sub(const Vec3 &a, const Vec3 &b) { Vec3 r = { a.x - b.x, a.y - b.y, a.z - b.z }; return r; }
+inline float Vec3Dot(const Vec3 &a, const Vec3 &b) { return a.x * b.x + a.y * b.y + a.z * b.z; }
+inline Vec3 Vec3Cross(const Vec3 &a, const Vec3 &b)
+{
+	Vec3 r = { a.y * b.z - a.z * b.y, a.z * b.x - a.x * b.z, a.x * b.y - a.y * b.x };
+	return r;
+}
+inline Vec3 Vec3Normalize(const Vec3 &a)
+{
+	float len = std::sqrt(Vec3Dot(a, a));
+	float inv = len > 0.0f ? 1.0f / len : 0.0f;
+	Vec3 r = { a.x * inv, a.y * inv, a.z * inv };
+	return r;
+}
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+inline Mat4 MatIdentity()
+{
+	Mat4 r = { { { 1, 0, 0, 0 }, { 0, 1, 0, 0 }, { 0, 0, 1, 0 }, { 0, 0, 0, 1 } } };
+	return r;
+}
+
+inline Mat4 MatMultiply(const Mat4 &a, const Mat4 &b)
+{
+	Mat4 r;
+	for (int i = 0; i < 4; i++)
+		for (int j = 0; j < 4; j++)
+			r.m[i][j] = a.m[i][0] * b.m[0][j] + a.m[i][1] * b.m[1][j] + a.m[i][2] * b.m[2][j] + a.m[i][3] * b.m[3][j];
+	return r;
+}
+
+inline Mat4 MatTranspose(const Mat4 &a)
+{
+	Mat4 r;
+	for (int i = 0; i < 4; i++)
+		for (int j = 0; j < 4; j++)
+			r.m[i][j] = a.m[j][i];
+	return r;
+}
+
+inline Vec4 Vec4Transform(const Vec4 &v, const Mat4 &m)
+{
+	Vec4 r;
+	r.x = v.x * m.m[0][0] + v.y * m.m[1][0] + v.z * m.m[2][0] + v.w * m.m[3][0];
+	r.y = v.x * m.m[0][1] + v.y * m.m[1][1] + v.z * m.m[2][1] + v.w * m.m[3][1];
+	r.z = v.x * m.m[0][2] + v.y * m.m[1][2] + v.z * m.m[2][2] + v.w * m.m[3][2];
+	r.w = v.x * m.m[0][3] + v.y * m.m[1][3] + v.z * m.m[2][3] + v.w * m.m[3][3];
+	return r;
+}
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// same results as XMMatrixRotationAxis / XMMatrixTranslation / XMMatrixPerspectiveFovLH / XMMatrixLookAtLH
+inline Mat4 MatRotationAxis(const Vec3 &axis, float angle)
+{
+	Vec3 n = Vec3Normalize(axis);
+	float s = std::sin(angle);
+	float c = std::cos(angle);
+	float t = 1.0f - c;
+
+	Mat4 r = MatIdentity();
+	r.m[0][0] = t * n.x * n.x + c;       r.m[0][1] = t * n.x * n.y + s * n.z; r.m[0][2] = t * n.x * n.z - s * n.y;
+	r.m[1][0] = t * n.x * n.y - s * n.z; r.m[1][1] = t * n.y * n.y + c;       r.m[1][2] = t * n.y * n.z + s * n.x;
+	r.m[2][0] = t * n.x * n.z + s * n.y; r.m[2][1] = t * n.y * n.z - s * n.x; r.m[2][2] = t * n.z * n.z + c;
+	return r;
+}
+
+inline Mat4 MatTranslation(float x, float y, float z)
+{
+	Mat4 r = MatIdentity();
+	r.m[3][0] = x; r.m[3][1] = y; r.m[3][2] = z;
+	return r;
+}
+
+inline Mat4 MatPerspectiveFovLH(float fovY, float aspect, float zNear, float zFar)
+{
+	float h = 1.0f / std::tan(fovY * 0.5f);
+	float w = h / aspect;
+	float range = zFar / (zFar - zNear);
+
+	Mat4 r = { { { w, 0, 0, 0 }, { 0, h, 0, 0 }, { 0, 0, range, 1 }, { 0, 0, -range * zNear, 0 } } };
+	return r;
+}
+
+inline Mat4 MatLookAtLH(const Vec3 &eye, const Vec3 &target, const Vec3 &up)
+{
+	Vec3 zAxis = Vec3Normalize(Vec3Sub(target, eye));
+	Vec3 xAxis = Vec3Normalize(Vec3Cross(up, zAxis));
+	Vec3 yAxis = Vec3Cross(zAxis, xAxis);
+
+	Mat4 r = { { { xAxis.x, yAxis.x, zAxis.x, 0 },
+	             { xAxis.y, yAxis.y, zAxis.y, 0 },
+	             { xAxis.z, yAxis.z, zAxis.z, 0 },
+	             { -Vec3Dot(xAxis, eye), -Vec3Dot(yAxis, eye), -Vec3Dot(zAxis, eye), 1 } } };
+	return r;
+}
+
+inline float ToRadians(float degrees) { return degrees * (kPi / 180.0f); }
@@ -0,0 +1,606 @@
+#include "Mesh.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <unordered_map>
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+namespace
+{
+	const uint32_t kMeshMagic = 0x534D5844; // 'DXMS'
+	const uint32_t kMeshVersion = 1;
+	const size_t kDataAlignment = 16;
+
+	// file layout: header, vertices at verticesOffset, indices at indicesOffset, both 16 byte aligned
+	struct MeshFileHeader
+	{
+		uint32_t magic;
+		uint32_t version;
+		uint32_t vertexFormat;
+		uint32_t vertexStride;
+		uint32_t verticesCount;
+		uint32_t indicesCount;
+		uint32_t indexSize;
+		uint32_t verticesOffset;
+		uint32_t indicesOffset;
+		float    boundsMin[3];
+		float    boundsMax[3];
+		uint32_t padding;
+	};
+
+	size_t AlignUp(size_t value, size_t alignment)
+	{
+		return (value + alignment - 1) / alignment * alignment;
+	}
+
+	struct VertexHash
+	{
+		size_t operator()(const MeshVertex &v) const
+		{
+			// FNV-1a over the bits, equal floats with different bits (0 and -0) just stay two vertices
+			uint64_t hash = 14695981039346656037ull;
+			const unsigned char *bytes = reinterpret_cast<const unsigned char*>(&v);
+			for (size_t i = 0; i < sizeof(MeshVertex); i++)
+			{
+				hash ^= bytes[i];
+				hash *= 1099511628211ull;
+			}
+			return static_cast<size_t>(hash);
+		}
+	};
+
+	struct VertexEqual
+	{
+		bool operator()(const MeshVertex &a, const MeshVertex &b) const { return !memcmp(&a, &b, sizeof(MeshVertex)); }
+	};
+
+	// Forsyth, "Linear-Speed Vertex Cache Optimisation": LRU cache of kCacheSize, the last triangle's vertices get a
+	// flat score so the next one does not just continue a strip, and vertices with few triangles left get a boost
+	const int kCacheSize = 32;
+
+	float VertexScore(int cachePosition, uint32_t remaining)
+	{
+		if (!remaining)
+			return -1.0f;
+
+		float score = 0.0f;
+		if (cachePosition >= 0)
+		{
+			if (cachePosition < 3)
+				score = 0.75f;
+			else
+				score = std::pow(1.0f - (cachePosition - 3) * (1.0f / (kCacheSize - 3)), 1.5f);
+		}
+		return score + 2.0f / std::sqrt(static_cast<float>(remaining));
+	}
+}
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+void BuildIndexed(const MeshVertex *triangles, size_t verticesCount, MeshData &mesh)
+{
+	mesh.vertices.clear();
+	mesh.indices.clear();
+	mesh.indices.reserve(verticesCount);
+
+	std::unordered_map<MeshVertex, uint32_t, VertexHash, VertexEqual> unique;
+	unique.reserve(verticesCount);
+	for (size_t i = 0; i < verticesCount; i++)
+	{
+		std::pair<std::unordered_map<MeshVertex, uint32_t, VertexHash, VertexEqual>::iterator, bool> inserted =
+			unique.insert(std::make_pair(triangles[i], static_cast<uint32_t>(mesh.vertices.size())));
+		if (inserted.second)
+			mesh.vertices.push_back(triangles[i]);
+		mesh.indices.push_back(inserted.first->second);
+	}
+}
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+void OptimizeVertexCache(MeshData &mesh)
+{
+	const uint32_t kNone = 0xFFFFFFFF;
+	size_t trianglesCount = mesh.indices.size() / 3;
+	size_t verticesCount = mesh.vertices.size();
+	const uint32_t *indices = mesh.indices.data();
+
+	// triangles of every vertex; the first remaining[v] of them are the ones not emitted yet
+	std::vector<uint32_t> offsets(verticesCount + 1, 0);
+	for (size_t i = 0; i < trianglesCount * 3; i++)
+		offsets[indices[i] + 1]++;
+	for (size_t v = 0; v < verticesCount; v++)
+		offsets[v + 1] += offsets[v];
+
+	std::vector<uint32_t> remaining(verticesCount, 0);
+	std::vector<uint32_t> adjacency(trianglesCount * 3);
+	for (size_t t = 0; t < trianglesCount; t++)
+		for (int k = 0; k < 3; k++)
+		{
+			uint32_t v = indices[t * 3 + k];
+			adjacency[offsets[v] + remaining[v]++] = static_cast<uint32_t>(t);
+		}
+
+	std::vector<int> cachePosition(verticesCount, -1);
+	std::vector<float> vertexScore(verticesCount);
+	for (size_t v = 0; v < verticesCount; v++)
+		vertexScore[v] = VertexScore(-1, remaining[v]);
+
+	std::vector<bool> emitted(trianglesCount, false);
+
+	std::vector<uint32_t> output;
+	output.reserve(trianglesCount * 3);
+
+	uint32_t cache[kCacheSize + 3];
+	int cacheCount = 0;
+	uint32_t best = kNone;
+	size_t scanCursor = 0;
+	for (size_t n = 0; n < trianglesCount; n++)
+	{
+		// nothing left around the cache: continue with the next triangle in input order
+		if (best == kNone)
+		{
+			while (emitted[scanCursor])
+				scanCursor++;
+			best = static_cast<uint32_t>(scanCursor);
+		}
+
+		const uint32_t *triangle = &indices[best * 3];
+		output.insert(output.end(), triangle, triangle + 3);
+		emitted[best] = true;
+
+		for (int k = 0; k < 3; k++)
+		{
+			uint32_t v = triangle[k];
+			uint32_t *list = &adjacency[offsets[v]];
+			uint32_t last = --remaining[v];
+			for (uint32_t i = 0; i <= last; i++)
+				if (list[i] == best)
+				{
+					std::swap(list[i], list[last]);
+					break;
+				}
+		}
+
+		// the triangle's vertices move to the front, everything past kCacheSize falls out
+		uint32_t newCache[kCacheSize + 3];
+		int newCount = 0;
+		for (int k = 0; k < 3; k++)
+			newCache[newCount++] = triangle[k];
+		for (int i = 0; i < cacheCount; i++)
+			if (cache[i] != triangle[0] && cache[i] != triangle[1] && cache[i] != triangle[2])
+				newCache[newCount++] = cache[i];
+
+		for (int i = 0; i < newCount; i++)
+		{
+			uint32_t v = newCache[i];
+			cachePosition[v] = i < kCacheSize ? i : -1;
+			vertexScore[v] = VertexScore(cachePosition[v], remaining[v]);
+		}
+
+		best = kNone;
+		float bestScore = -1.0f;
+		for (int i = 0; i < newCount; i++)
+		{
+			uint32_t v = newCache[i];
+			for (uint32_t a = 0; a < remaining[v]; a++)
+			{
+				uint32_t t = adjacency[offsets[v] + a];
+				const uint32_t *other = &indices[t * 3];
+				float score = vertexScore[other[0]] + vertexScore[other[1]] + vertexScore[other[2]];
+				if (score > bestScore)
+				{
+					bestScore = score;
+					best = t;
+				}
+			}
+		}
+
+		cacheCount = newCount < kCacheSize ? newCount : kCacheSize;
+		memcpy(cache, newCache, cacheCount * sizeof(uint32_t));
+	}
+
+	mesh.indices.swap(output);
+}
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+void OptimizeOverdraw(MeshData &mesh, float threshold)
+{
+	// Sander, Nehab, Barczak, "Fast Triangle Reordering for Vertex Locality and Reduced Overdraw": the cache order is
+	// cut into clusters where the cache is cold anyway, or where the cluster so far is good enough, and the clusters
+	// are sorted so the ones facing away from the mesh center are drawn first and occlude the rest
+	const unsigned cacheSize = 16;
+	const size_t kMinClusterTriangles = 128; // every cut costs a cold cache once the clusters are reordered
+	size_t trianglesCount = mesh.indices.size() / 3;
+	if (trianglesCount < 2)
+		return;
+
+	std::vector<uint32_t> clusters;
+	{
+		std::vector<uint32_t> cachedAt(mesh.vertices.size(), 0);
+		uint32_t time = cacheSize + 1;
+		uint32_t clusterStart = 0, clusterMisses = 0;
+		float totalAcmr = ComputeAcmr(mesh.indices.data(), mesh.indices.size(), mesh.vertices.size(), cacheSize);
+		for (size_t t = 0; t < trianglesCount; t++)
+		{
+			unsigned misses = 0;
+			for (int k = 0; k < 3; k++)
+			{
+				uint32_t v = mesh.indices[t * 3 + k];
+				if (time - cachedAt[v] > cacheSize)
+				{
+					cachedAt[v] = time++;
+					misses++;
+				}
+			}
+
+			// hard boundary: no vertex was cached; soft boundary: the cluster so far is already within threshold
+			size_t clusterTriangles = t - clusterStart;
+			bool cut = t == 0 || misses == 3 || (clusterTriangles >= kMinClusterTriangles &&
+				static_cast<float>(clusterMisses) / clusterTriangles <= totalAcmr * threshold);
+			if (cut)
+			{
+				clusters.push_back(static_cast<uint32_t>(t));
+				clusterStart = static_cast<uint32_t>(t);
+				clusterMisses = 0;
+			}
+			clusterMisses += misses;
+		}
+	}
+	if (clusters.size() < 2)
+		return;
+
+	Vec3 meshCenter = { 0.0f, 0.0f, 0.0f };
+	for (size_t v = 0; v < mesh.vertices.size(); v++)
+	{
+		meshCenter.x += mesh.vertices[v].x;
+		meshCenter.y += mesh.vertices[v].y;
+		meshCenter.z += mesh.vertices[v].z;
+	}
+	float inv = 1.0f / mesh.vertices.size();
+	meshCenter = Vec3{ meshCenter.x * inv, meshCenter.y * inv, meshCenter.z * inv };
+
+	// area weighted center and normal of every cluster, the sort key is how much it faces away from the center
+	std::vector<std::pair<float, uint32_t>> order(clusters.size());
+	for (size_t c = 0; c < clusters.size(); c++)
+	{
+		size_t end = c + 1 < clusters.size() ? clusters[c + 1] : trianglesCount;
+		Vec3 center = { 0.0f, 0.0f, 0.0f }, normal = { 0.0f, 0.0f, 0.0f };
+		float area = 0.0f;
+		for (size_t t = clusters[c]; t < end; t++)
+		{
+			const MeshVertex &a = mesh.vertices[mesh.indices[t * 3]];
+			const MeshVertex &b = mesh.vertices[mesh.indices[t * 3 + 1]];
+			const MeshVertex &c2 = mesh.vertices[mesh.indices[t * 3 + 2]];
+			Vec3 n = Vec3Cross(Vec3{ b.x - a.x, b.y - a.y, b.z - a.z }, Vec3{ c2.x - a.x, c2.y - a.y, c2.z - a.z });
+			float triangleArea = std::sqrt(Vec3Dot(n, n));
+			center.x += (a.x + b.x + c2.x) * triangleArea;
+			center.y += (a.y + b.y + c2.y) * triangleArea;
+			center.z += (a.z + b.z + c2.z) * triangleArea;
+			normal = Vec3{ normal.x + n.x, normal.y + n.y, normal.z + n.z };
+			area += triangleArea;
+		}
+
+		float key = 0.0f;
+		if (area > 0.0f)
+		{
+			float scale = 1.0f / (3.0f * area);
+			center = Vec3{ center.x * scale, center.y * scale, center.z * scale };
+			key = Vec3Dot(Vec3Sub(center, meshCenter), Vec3Normalize(normal));
+		}
+		order[c] = std::make_pair(-key, static_cast<uint32_t>(c));
+	}
+	std::stable_sort(order.begin(), order.end());
+
+	std::vector<uint32_t> output;
+	output.reserve(mesh.indices.size());
+	for (size_t i = 0; i < order.size(); i++)
+	{
+		uint32_t c = order[i].second;
+		size_t end = c + 1 < clusters.size() ? clusters[c + 1] : trianglesCount;
+		output.insert(output.end(), mesh.indices.begin() + clusters[c] * 3, mesh.indices.begin() + end * 3);
+	}
+	mesh.indices.swap(output);
+}
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+void OptimizeVertexFetch(MeshData &mesh)
+{
+	const uint32_t kNone = 0xFFFFFFFF;
+	std::vector<uint32_t> remap(mesh.vertices.size(), kNone);
+	std::vector<MeshVertex> vertices;
+	vertices.reserve(mesh.vertices.size());
+
+	for (size_t i = 0; i < mesh.indices.size(); i++)
+	{
+		uint32_t &index = mesh.indices[i];
+		if (remap[index] == kNone)
+		{
+			remap[index] = static_cast<uint32_t>(vertices.size());
+			vertices.push_back(mesh.vertices[index]);
+		}
+		index = remap[index];
+	}
+	mesh.vertices.swap(vertices);
+}
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+float ComputeAcmr(const uint32_t *indices, size_t indicesCount, size_t verticesCount, unsigned cacheSize)
+{
+	if (indicesCount < 3)
+		return 0.0f;
+
+	// a vertex is in the FIFO while fewer than cacheSize misses happened since it was loaded
+	std::vector<uint32_t> cachedAt(verticesCount, 0);
+	uint32_t time = cacheSize + 1;
+	size_t misses = 0;
+	for (size_t i = 0; i < indicesCount; i++)
+	{
+		uint32_t v = indices[i];
+		if (time - cachedAt[v] > cacheSize)
+		{
+			cachedAt[v] = time++;
+			misses++;
+		}
+	}
+	return static_cast<float>(misses) / (indicesCount / 3);
+}
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+uint16_t FloatToHalf(float value)
+{
+	uint32_t bits;
+	memcpy(&bits, &value, sizeof(bits));
+	uint32_t sign = (bits >> 16) & 0x8000;
+	uint32_t abs = bits & 0x7FFFFFFF;
+
+	if (abs >= 0x7F800000)
+		return static_cast<uint16_t>(sign | 0x7C00 | (abs > 0x7F800000 ? 0x200 : 0)); // infinity, quiet NaN
+	if (abs >= 0x47800000)
+		return static_cast<uint16_t>(sign | 0x7C00); // 65536 and up
+	if (abs < 0x33000000)
+		return static_cast<uint16_t>(sign); // below half the smallest subnormal
+
+	uint32_t result, rest, halfway;
+	if (abs < 0x38800000)
+	{
+		// subnormal half: the mantissa with its implicit bit in units of 2^-24
+		uint32_t shift = 126 - (abs >> 23);
+		uint32_t mantissa = (abs & 0x7FFFFF) | 0x800000;
+		result = mantissa >> shift;
+		rest = mantissa & ((1u << shift) - 1);
+		halfway = 1u << (shift - 1);
+	}
+	else
+	{
+		// rebias the exponent from 127 to 15, a carry out of the mantissa correctly bumps it (up to infinity)
+		result = (abs - 0x38000000) >> 13;
+		rest = abs & 0x1FFF;
+		halfway = 0x1000;
+	}
+	if (rest > halfway || (rest == halfway && (result & 1)))
+		result++;
+	return static_cast<uint16_t>(sign | result);
+}
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+float HalfToFloat(uint16_t value)
+{
+	uint32_t sign = static_cast<uint32_t>(value & 0x8000) << 16;
+	uint32_t exponent = (value >> 10) & 0x1F;
+	uint32_t mantissa = value & 0x3FF;
+
+	uint32_t bits;
+	if (exponent == 0)
+	{
+		float magnitude = mantissa * (1.0f / 16777216.0f);
+		return sign ? -magnitude : magnitude;
+	}
+	else if (exponent == 31)
+		bits = sign | 0x7F800000 | (mantissa << 13);
+	else
+		bits = sign | ((exponent + 112) << 23) | (mantissa << 13);
+
+	float result;
+	memcpy(&result, &bits, sizeof(result));
+	return result;
+}
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+bool CanQuantize(const MeshData &mesh)
+{
+	for (size_t i = 0; i < mesh.vertices.size(); i++)
+	{
+		const MeshVertex &v = mesh.vertices[i];
+		if (!(v.u >= 0.0f && v.u <= 1.0f && v.v >= 0.0f && v.v <= 1.0f))
+			return false;
+	}
+	return true;
+}
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+bool SaveMesh(const char *path, const MeshData &mesh, MeshVertexFormat format)
+{
+	if (format == MeshVertex_Quantized && !CanQuantize(mesh))
+		return false;
+
+	MeshFileHeader header;
+	memset(&header, 0, sizeof(header));
+	header.magic = kMeshMagic;
+	header.version = kMeshVersion;
+	header.vertexFormat = format;
+	header.vertexStride = format == MeshVertex_Quantized ? sizeof(MeshVertexQuantized) : sizeof(MeshVertex);
+	header.verticesCount = static_cast<uint32_t>(mesh.vertices.size());
+	header.indicesCount = static_cast<uint32_t>(mesh.indices.size());
+	header.indexSize = mesh.vertices.size() <= 0x10000 ? 2 : 4;
+	header.verticesOffset = static_cast<uint32_t>(AlignUp(sizeof(header), kDataAlignment));
+	header.indicesOffset = static_cast<uint32_t>(AlignUp(header.verticesOffset + header.verticesCount * header.vertexStride, kDataAlignment));
+
+	for (int k = 0; k < 3; k++)
+	{
+		header.boundsMin[k] = mesh.vertices.empty() ? 0.0f : 3.4e38f;
+		header.boundsMax[k] = mesh.vertices.empty() ? 0.0f : -3.4e38f;
+	}
+	for (size_t i = 0; i < mesh.vertices.size(); i++)
+	{
+		const float *position = &mesh.vertices[i].x;
+		for (int k = 0; k < 3; k++)
+		{
+			header.boundsMin[k] = std::min(header.boundsMin[k], position[k]);
+			header.boundsMax[k] = std::max(header.boundsMax[k], position[k]);
+		}
+	}
+
+	// the whole file is assembled in memory, the loader maps it back without any conversion
+	std::vector<unsigned char> data(header.indicesOffset + header.indicesCount * header.indexSize, 0);
+	memcpy(&data[0], &header, sizeof(header));
+
+	unsigned char *vertices = &data[header.verticesOffset];
+	for (size_t i = 0; i < mesh.vertices.size(); i++)
+	{
+		const MeshVertex &v = mesh.vertices[i];
+		if (format == MeshVertex_Quantized)
+		{
+			MeshVertexQuantized q;
+			q.x = FloatToHalf(v.x);
+			q.y = FloatToHalf(v.y);
+			q.z = FloatToHalf(v.z);
+			q.w = FloatToHalf(1.0f);
+			q.u = static_cast<uint16_t>(v.u * 65535.0f + 0.5f);
+			q.v = static_cast<uint16_t>(v.v * 65535.0f + 0.5f);
+			memcpy(vertices + i * sizeof(q), &q, sizeof(q));
+		}
+		else
+			memcpy(vertices + i * sizeof(v), &v, sizeof(v));
+	}
+
+	unsigned char *indices = &data[header.indicesOffset];
+	for (size_t i = 0; i < mesh.indices.size(); i++)
+	{
+		if (header.indexSize == 2)
+		{
+			uint16_t index = static_cast<uint16_t>(mesh.indices[i]);
+			memcpy(indices + i * 2, &index, 2);
+		}
+		else
+			memcpy(indices + i * 4, &mesh.indices[i], 4);
+	}
+
+	// written under a temporary name so a crash never leaves half a mesh behind
+	std::string tmpPath = std::string(path) + GetTempSuffix();
+	FILE *file = fopen(tmpPath.c_str(), "wb");
+	if (!file)
+		return false;
+
+	bool ok = fwrite(&data[0], 1, data.size(), file) == data.size();
+	ok = fclose(file) == 0 && ok;
+	if (ok)
+	{
+		remove(path);
+		ok = rename(tmpPath.c_str(), path) == 0;
+	}
+	if (!ok)
+		remove(tmpPath.c_str());
+	return ok;
+}
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+MeshFile::MeshFile()
+{
+	Close();
+}
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+bool MeshFile::Open(const char *path)
+{
+	Close();
+	if (!mFile.Open(path))
+		return false;
+
+	const unsigned char *data = mFile.GetData();
+	size_t size = mFile.GetSize();
+
+	MeshFileHeader header;
+	if (size < sizeof(header))
+	{
+		Close();
+		return false;
+	}
+	memcpy(&header, data, sizeof(header));
+
+	size_t expectedStride = header.vertexFormat == MeshVertex_Quantized ? sizeof(MeshVertexQuantized) : sizeof(MeshVertex);
+	uint64_t verticesEnd = header.verticesOffset + uint64_t(header.verticesCount) * header.vertexStride;
+	uint64_t indicesEnd = header.indicesOffset + uint64_t(header.indicesCount) * header.indexSize;
+	if (header.magic != kMeshMagic || header.version != kMeshVersion || header.vertexFormat > MeshVertex_Quantized ||
+		header.vertexStride != expectedStride || (header.indexSize != 2 && header.indexSize != 4) ||
+		header.indicesCount % 3 || header.verticesOffset < sizeof(header) || header.verticesOffset % kDataAlignment ||
+		header.indicesOffset % kDataAlignment || header.indicesOffset < verticesEnd || indicesEnd > size)
+	{
+		Close();
+		return false;
+	}
+
+	mVertexFormat = static_cast<MeshVertexFormat>(header.vertexFormat);
+	mVertices = data + header.verticesOffset;
+	mVerticesCount = header.verticesCount;
+	mVertexStride = header.vertexStride;
+	mIndices = data + header.indicesOffset;
+	mIndicesCount = header.indicesCount;
+	mIndexSize = header.indexSize;
+	mBoundsMin = Vec3{ header.boundsMin[0], header.boundsMin[1], header.boundsMin[2] };
+	mBoundsMax = Vec3{ header.boundsMax[0], header.boundsMax[1], header.boundsMax[2] };
+	return true;
+}
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+void MeshFile::Close()
+{
+	mFile.Close();
+	mVertexFormat = MeshVertex_Float;
+	mVertices = nullptr;
+	mVerticesCount = 0;
+	mVertexStride = 0;
+	mIndices = nullptr;
+	mIndicesCount = 0;
+	mIndexSize = 0;
+	mBoundsMin = mBoundsMax = Vec3{ 0.0f, 0.0f, 0.0f };
+}
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+bool MeshFile::Decode(std::vector<MeshVertex> &vertices, std::vector<uint32_t> &indices) const
+{
+	vertices.resize(mVerticesCount);
+	const unsigned char *src = static_cast<const unsigned char*>(mVertices);
+	for (size_t i = 0; i < mVerticesCount; i++)
+	{
+		if (mVertexFormat == MeshVertex_Quantized)
+		{
+			MeshVertexQuantized q;
+			memcpy(&q, src + i * sizeof(q), sizeof(q));
+			MeshVertex &v = vertices[i];
+			v.x = HalfToFloat(q.x);
+			v.y = HalfToFloat(q.y);
+			v.z = HalfToFloat(q.z);
+			v.u = q.u * (1.0f / 65535.0f);
+			v.v = q.v * (1.0f / 65535.0f);
+		}
+		else
+			memcpy(&vertices[i], src + i * sizeof(MeshVertex), sizeof(MeshVertex));
+	}
+
+	indices.resize(mIndicesCount);
+	const unsigned char *indexData = static_cast<const unsigned char*>(mIndices);
+	for (size_t i = 0; i < mIndicesCount; i++)
+	{
+		if (mIndexSize == 2)
+		{
+			uint16_t index;
+			memcpy(&index, indexData + i * 2, 2);
+			indices[i] = index;
+		}
+		else
+			memcpy(&indices[i], indexData + i * 4, 4);
+		if (indices[i] >= mVerticesCount)
+			return false;
+	}
+	return true;
+}
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+bool OpenOrBuildMesh(MeshFile &file, const char *path, const MeshVertex *triangles, size_t verticesCount)
+{
+	if (file.Open(path))
+		return true;
+
+	MeshData mesh;
+	BuildIndexed(triangles, verticesCount, mesh);
+	OptimizeVertexCache(mesh);
+	OptimizeOverdraw(mesh);
+	OptimizeVertexFetch(mesh);
+	return SaveMesh(path, mesh, CanQuantize(mesh) ? MeshVertex_Quantized : MeshVertex_Float) && file.Open(path);
+}
@@ -0,0 +1,108 @@
+#pragma once
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Indexed mesh pipeline: offline processing on the CPU, memory mapped loading at run time.
+// BuildIndexed welds a triangle list into unique vertices and indices. OptimizeVertexCache orders the triangles for
+// the post-transform vertex cache (Forsyth's linear-speed algorithm), OptimizeOverdraw then sorts clusters of them so
+// outward facing ones come first while keeping most of the cache gain, and OptimizeVertexFetch renumbers the vertices
+// in first-use order. SaveMesh writes a .dxmesh file with 16 bit indices whenever they fit and float or quantized
+// vertices (half positions, UNORM16 texture coordinates); MeshFile maps it and hands out pointers that go to
+// D3D11_SUBRESOURCE_DATA as they are.
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+#include "MappedFile.h"
+#include "MathUtils.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// same layout as SoftVertex
+struct MeshVertex
+{
+	float x, y, z;
+	float u, v;
+};
+
+// DXGI_FORMAT_R16G16B16A16_FLOAT position with w = 1, DXGI_FORMAT_R16G16_UNORM texCoord
+struct MeshVertexQuantized
+{
+	uint16_t x, y, z, w;
+	uint16_t u, v;
+};
+
+enum MeshVertexFormat
+{
+	MeshVertex_Float,     // MeshVertex, 20 bytes
+	MeshVertex_Quantized, // MeshVertexQuantized, 12 bytes
+};
+
+struct MeshData
+{
+	std::vector<MeshVertex> vertices;
+	std::vector<uint32_t>   indices; // triangle list
+};
+
+// exact duplicates are merged, triangle order is kept
+void BuildIndexed(const MeshVertex *triangles, size_t verticesCount, MeshData &mesh);
+void OptimizeVertexCache(MeshData &mesh);
+// a cluster may end early once its own miss rate is within threshold of the whole mesh (1.05 = 5% above)
+void OptimizeOverdraw(MeshData &mesh, float threshold = 1.05f);
+// drops unreferenced vertices
+void OptimizeVertexFetch(MeshData &mesh);
+
+// average cache misses per triangle with a FIFO post-transform cache, 3 is the worst, about 0.5 the best
+float ComputeAcmr(const uint32_t *indices, size_t indicesCount, size_t verticesCount, unsigned cacheSize);
+
+// round to nearest even, overflow goes to infinity
+uint16_t FloatToHalf(float value);
+float HalfToFloat(uint16_t value);
+
+// UNORM16 only holds texture coordinates in [0, 1]
+bool CanQuantize(const MeshData &mesh);
+bool SaveMesh(const char *path, const MeshData &mesh, MeshVertexFormat format);
+
+class MeshFile
+{
+public:
+	MeshFile();
+
+	// checks the header and the sizes, not the index values: D3D11 reads 0 for an index out of range
+	bool Open(const char *path);
+	void Close();
+
+	bool IsOpen() const { return mFile.IsOpen(); }
+	MeshVertexFormat GetVertexFormat() const { return mVertexFormat; }
+
+	// into the mapping, valid until Close
+	const void* GetVertices() const { return mVertices; }
+	size_t GetVerticesCount() const { return mVerticesCount; }
+	size_t GetVertexStride() const { return mVertexStride; }
+	const void* GetIndices() const { return mIndices; }
+	size_t GetIndicesCount() const { return mIndicesCount; }
+	size_t GetIndexSize() const { return mIndexSize; } // 2 or 4
+
+	// local bounds of the vertices, before quantization
+	const Vec3& GetBoundsMin() const { return mBoundsMin; }
+	const Vec3& GetBoundsMax() const { return mBoundsMax; }
+
+	// float copy for the software rasterizer, false if an index is out of range
+	bool Decode(std::vector<MeshVertex> &vertices, std::vector<uint32_t> &indices) const;
+
+private:
+	MeshFile(const MeshFile&);
+	MeshFile& operator=(const MeshFile&);
+
+	MappedFile       mFile;
+	MeshVertexFormat mVertexFormat;
+	const void       *mVertices;
+	size_t           mVerticesCount;
+	size_t           mVertexStride;
+	const void       *mIndices;
+	size_t           mIndicesCount;
+	size_t           mIndexSize;
+	Vec3             mBoundsMin;
+	Vec3             mBoundsMax;
+};
+
+// maps path, building it from the triangle list first when it is missing or from an older version:
+// welded, all three optimizations, quantized when the texture coordinates allow it
+bool OpenOrBuildMesh(MeshFile &file, const char *path, const MeshVertex *triangles, size_t verticesCount);
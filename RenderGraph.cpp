@@ -0,0 +1,328 @@
+#include "RenderGraph.h"
+
+#include <algorithm>
+#include <cassert>
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+namespace
+{
+	const uint32_t kNoPass = UINT32_MAX;
+	const uint32_t kUnused = UINT32_MAX;
+
+	bool SameLayout(const RenderTargetDesc &a, const RenderTargetDesc &b)
+	{
+		return a.width == b.width && a.height == b.height && a.format == b.format && a.depth == b.depth;
+	}
+
+	uint64_t GetBytes(const RenderTargetDesc &desc)
+	{
+		return uint64_t(desc.width) * desc.height * desc.bytesPerTexel;
+	}
+}
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+RenderResourceId RenderGraph::CreateTarget(const char *name, const RenderTargetDesc &desc)
+{
+	Resource resource = { name, desc, false, 0, kUnused, kUnused, kNoRenderResource };
+	mResources.push_back(resource);
+	mCompiled = false;
+	return static_cast<RenderResourceId>(mResources.size() - 1);
+}
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+RenderResourceId RenderGraph::ImportTarget(const char *name, const RenderTargetDesc &desc)
+{
+	RenderResourceId id = CreateTarget(name, desc);
+	mResources[id].imported = true;
+	return id;
+}
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+RenderPassId RenderGraph::AddPass(const char *name, std::function<void()> execute)
+{
+	Pass pass;
+	pass.name = name;
+	pass.execute = std::move(execute);
+	pass.depth = kNoRenderResource;
+	pass.sideEffects = false;
+	pass.culled = false;
+	mPasses.push_back(std::move(pass));
+	mCompiled = false;
+	return static_cast<RenderPassId>(mPasses.size() - 1);
+}
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+void RenderGraph::Read(RenderPassId pass, RenderResourceId resource)
+{
+	assert(pass < mPasses.size() && resource < mResources.size());
+	mPasses[pass].reads.push_back(resource);
+	mCompiled = false;
+}
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+void RenderGraph::Write(RenderPassId pass, RenderResourceId resource)
+{
+	assert(pass < mPasses.size() && resource < mResources.size());
+	Pass &p = mPasses[pass];
+	if (mResources[resource].desc.depth)
+	{
+		assert(p.depth == kNoRenderResource);
+		p.depth = resource;
+	}
+	else
+	{
+		assert(p.targets.size() < kMaxTargets);
+		p.targets.push_back(resource);
+	}
+	mCompiled = false;
+}
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+void RenderGraph::SetSideEffects(RenderPassId pass)
+{
+	mPasses[pass].sideEffects = true;
+	mCompiled = false;
+}
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+bool RenderGraph::Writes(const Pass &pass, RenderResourceId resource) const
+{
+	return pass.depth == resource || std::find(pass.targets.begin(), pass.targets.end(), resource) != pass.targets.end();
+}
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// a read uses the last write before it, and so does a write: it draws on top unless it is the first
+bool RenderGraph::FindDependencies()
+{
+	std::vector<RenderPassId> lastWriter(mResources.size(), kNoPass);
+	for (size_t p = 0; p < mPasses.size(); p++)
+	{
+		Pass &pass = mPasses[p];
+		pass.dependencies.clear();
+		for (size_t i = 0; i < pass.reads.size(); i++)
+		{
+			RenderResourceId resource = pass.reads[i];
+			if (Writes(pass, resource))
+				return false;
+			if (lastWriter[resource] == kNoPass)
+			{
+				if (!mResources[resource].imported)
+					return false;
+				continue;
+			}
+			pass.dependencies.push_back(lastWriter[resource]);
+		}
+
+		RenderResourceId depth[1] = { pass.depth };
+		const RenderResourceId *writes[2] = { pass.targets.data(), depth };
+		size_t writesCount[2] = { pass.targets.size(), pass.depth != kNoRenderResource ? 1u : 0u };
+		for (int list = 0; list < 2; list++)
+			for (size_t i = 0; i < writesCount[list]; i++)
+			{
+				RenderResourceId resource = writes[list][i];
+				if (lastWriter[resource] != kNoPass)
+					pass.dependencies.push_back(lastWriter[resource]);
+				lastWriter[resource] = static_cast<RenderPassId>(p);
+			}
+	}
+	return true;
+}
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// dependencies point to earlier passes, one walk from the last pass back marks everything the kept passes use
+void RenderGraph::CullPasses()
+{
+	std::vector<char> needed(mPasses.size(), 0);
+	for (size_t p = mPasses.size(); p-- > 0;)
+	{
+		Pass &pass = mPasses[p];
+		if (pass.sideEffects || (pass.depth != kNoRenderResource && mResources[pass.depth].imported))
+			needed[p] = 1;
+		for (size_t i = 0; i < pass.targets.size() && !needed[p]; i++)
+			needed[p] = mResources[pass.targets[i]].imported;
+
+		pass.culled = !needed[p];
+		if (pass.culled)
+			continue;
+		for (size_t i = 0; i < pass.dependencies.size(); i++)
+			needed[pass.dependencies[i]] = 1;
+	}
+}
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// transients by first use, each into the first physical target of its layout that is free by then
+void RenderGraph::AssignPhysicals()
+{
+	std::vector<RenderResourceId> transients;
+	for (size_t r = 0; r < mResources.size(); r++)
+		if (!mResources[r].imported && mResources[r].first != kUnused)
+			transients.push_back(static_cast<RenderResourceId>(r));
+	std::stable_sort(transients.begin(), transients.end(), [this](RenderResourceId a, RenderResourceId b)
+	{
+		return mResources[a].first < mResources[b].first;
+	});
+
+	mPhysicals.clear();
+	for (size_t i = 0; i < transients.size(); i++)
+	{
+		Resource &resource = mResources[transients[i]];
+		size_t physical = 0;
+		while (physical < mPhysicals.size() &&
+			!(SameLayout(mPhysicals[physical].desc, resource.desc) && mPhysicals[physical].last < resource.first))
+			physical++;
+		if (physical == mPhysicals.size())
+		{
+			Physical created = { resource.desc, 0, 0 };
+			mPhysicals.push_back(created);
+		}
+		mPhysicals[physical].usage |= resource.usage;
+		mPhysicals[physical].last = resource.last;
+		resource.physical = static_cast<uint32_t>(physical);
+	}
+}
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+bool RenderGraph::Compile()
+{
+	mCompiled = false;
+	mOrder.clear();
+	mPhysicals.clear();
+	for (size_t r = 0; r < mResources.size(); r++)
+	{
+		Resource &resource = mResources[r];
+		resource.usage = 0;
+		resource.first = resource.last = kUnused;
+		resource.physical = kNoRenderResource;
+	}
+	if (!FindDependencies())
+		return false;
+	CullPasses();
+
+	// the order passes were added in is valid, dependencies only point back
+	for (size_t p = 0; p < mPasses.size(); p++)
+	{
+		Pass &pass = mPasses[p];
+		pass.clears.clear();
+		if (pass.culled)
+			continue;
+
+		uint32_t position = static_cast<uint32_t>(mOrder.size());
+		mOrder.push_back(static_cast<RenderPassId>(p));
+		for (size_t i = 0; i < pass.reads.size(); i++)
+		{
+			Resource &resource = mResources[pass.reads[i]];
+			resource.usage |= Usage_Read;
+			resource.last = position;
+		}
+		for (size_t i = 0; i <= pass.targets.size(); i++)
+		{
+			RenderResourceId id = i < pass.targets.size() ? pass.targets[i] : pass.depth;
+			if (id == kNoRenderResource)
+				continue;
+			Resource &resource = mResources[id];
+			resource.usage |= resource.desc.depth ? Usage_Depth : Usage_Target;
+			if (resource.first == kUnused)
+			{
+				resource.first = position;
+				if (!resource.imported)
+					pass.clears.push_back(id);
+			}
+			resource.last = position;
+		}
+	}
+
+	AssignPhysicals();
+	mCompiled = true;
+	return true;
+}
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+void RenderGraph::Execute(RenderGraphBackend &backend) const
+{
+	assert(mCompiled);
+	for (size_t i = 0; i < mOrder.size(); i++)
+	{
+		const Pass &pass = mPasses[mOrder[i]];
+		backend.BeginPass(*this, mOrder[i]);
+		if (pass.execute)
+			pass.execute();
+		backend.EndPass(*this, mOrder[i]);
+	}
+}
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+void RenderGraph::Clear()
+{
+	mResources.clear();
+	mPasses.clear();
+	mOrder.clear();
+	mPhysicals.clear();
+	mCompiled = false;
+}
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+RenderGraphStats RenderGraph::GetStats() const
+{
+	RenderGraphStats stats = {};
+	stats.passes = static_cast<uint32_t>(mPasses.size());
+	stats.culledPasses = stats.passes - static_cast<uint32_t>(mOrder.size());
+	stats.physicals = static_cast<uint32_t>(mPhysicals.size());
+	for (size_t i = 0; i < mPhysicals.size(); i++)
+		stats.physicalBytes += GetBytes(mPhysicals[i].desc);
+
+	std::vector<uint64_t> live(mOrder.size(), 0);
+	for (size_t r = 0; r < mResources.size(); r++)
+	{
+		const Resource &resource = mResources[r];
+		if (resource.imported || resource.first == kUnused)
+			continue;
+		stats.transients++;
+		stats.transientBytes += GetBytes(resource.desc);
+		for (uint32_t position = resource.first; position <= resource.last; position++)
+			live[position] += GetBytes(resource.desc);
+	}
+	for (size_t i = 0; i < live.size(); i++)
+		stats.peakLiveBytes = std::max(stats.peakLiveBytes, live[i]);
+	return stats;
+}
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+bool RenderTargetPool::Realize(const RenderGraph &graph)
+{
+	std::vector<Target> previous;
+	previous.swap(mTargets);
+
+	bool succeeded = true;
+	mTargets.resize(graph.GetPhysicalsCount());
+	for (size_t i = 0; i < mTargets.size(); i++)
+	{
+		Target &target = mTargets[i];
+		target.desc = graph.GetPhysicalDesc(static_cast<uint32_t>(i));
+		target.usage = graph.GetPhysicalUsage(static_cast<uint32_t>(i));
+		target.object = nullptr;
+		for (size_t j = 0; j < previous.size(); j++)
+			if (previous[j].object && SameLayout(previous[j].desc, target.desc) && previous[j].usage == target.usage)
+			{
+				target.object = previous[j].object;
+				previous[j].object = nullptr;
+				break;
+			}
+		if (!target.object)
+		{
+			target.object = mFactory.CreateTarget(target.desc, target.usage);
+			mCreated++;
+			succeeded = succeeded && target.object;
+		}
+	}
+
+	for (size_t j = 0; j < previous.size(); j++)
+		if (previous[j].object)
+			mFactory.ReleaseTarget(previous[j].object);
+	return succeeded;
+}
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+void* RenderTargetPool::GetTargetOf(const RenderGraph &graph, RenderResourceId resource) const
+{
+	uint32_t physical = graph.GetPhysical(resource);
+	return physical < mTargets.size() ? mTargets[physical].object : nullptr;
+}
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+void RenderTargetPool::Clear()
+{
+	for (size_t i = 0; i < mTargets.size(); i++)
+		if (mTargets[i].object)
+			mFactory.ReleaseTarget(mTargets[i].object);
+	mTargets.clear();
+}
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+size_t RenderTargetPool::GetBytes() const
+{
+	size_t bytes = 0;
+	for (size_t i = 0; i < mTargets.size(); i++)
+		bytes += static_cast<size_t>(::GetBytes(mTargets[i].desc));
+	return bytes;
+}
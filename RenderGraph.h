@@ -0,0 +1,213 @@
+#pragma once
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Frame graph of render passes and the targets they read and write.
+// Passes are added in the order they run and declare what they read (bound as shader resources) and write (bound as
+// render or depth targets); a pass only depends on earlier ones, so the graph is acyclic by construction. Compile is
+// backend independent:
+//   - passes nothing needs are culled: a pass is kept when it writes an imported target (the back buffer) or has side
+//     effects, or when a kept pass reads or writes on top of what it wrote
+//   - the first kept writer of a transient target clears it, later writers draw on top
+//   - transient targets only live from their first to their last use, and targets of the same size and format whose
+//     lifetimes do not overlap share one physical target. D3D11 has no placed resources, so aliasing means handing the
+//     same texture to both rather than overlapping memory.
+// RenderTargetPool turns the physical targets into backend objects and keeps them across compiles, a graph rebuilt
+// with the same targets (after a resize back, or with a pass toggled) creates nothing.
+// Execute runs the kept passes in order between the backend's BeginPass, which binds and clears, and EndPass.
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <vector>
+
+typedef uint32_t RenderPassId;
+typedef uint32_t RenderResourceId;
+
+const uint32_t kNoRenderResource = UINT32_MAX;
+
+struct RenderTargetDesc
+{
+	uint32_t width;
+	uint32_t height;
+	unsigned format;        // DXGI_FORMAT
+	uint32_t bytesPerTexel;
+	bool     depth;         // a depth-stencil target
+	float    clear[4];      // the color, or depth and stencil
+};
+
+// how the kept passes use a target; the backend creates it with the matching bind flags
+enum RenderTargetUsage
+{
+	Usage_Target = 1, // D3D11_BIND_RENDER_TARGET
+	Usage_Depth = 2,  // D3D11_BIND_DEPTH_STENCIL
+	Usage_Read = 4,   // D3D11_BIND_SHADER_RESOURCE
+};
+
+struct RenderGraphStats
+{
+	uint32_t passes;
+	uint32_t culledPasses;
+	uint32_t transients;     // used by the kept passes
+	uint32_t physicals;
+	uint64_t transientBytes; // every transient in its own texture, what fixed targets cost
+	uint64_t physicalBytes;  // after aliasing
+	uint64_t peakLiveBytes;  // the most that is alive at one pass, the least aliasing could reach
+};
+
+class RenderGraph;
+
+class RenderGraphBackend
+{
+public:
+	virtual ~RenderGraphBackend() {}
+
+	// binds the pass's targets and reads and applies its clears
+	virtual void BeginPass(const RenderGraph &graph, RenderPassId pass) = 0;
+	// unbinds the reads, a later pass may write them
+	virtual void EndPass(const RenderGraph &graph, RenderPassId pass) = 0;
+};
+
+class RenderGraph
+{
+public:
+	static const size_t kMaxTargets = 8;
+
+	RenderGraph() : mCompiled(false) {}
+
+	// a target the graph allocates and may alias
+	RenderResourceId CreateTarget(const char *name, const RenderTargetDesc &desc);
+	// a target that lives outside the graph, the back buffer; writing it keeps a pass
+	RenderResourceId ImportTarget(const char *name, const RenderTargetDesc &desc);
+
+	// execute may be empty, the backend's BeginPass and EndPass still run
+	RenderPassId AddPass(const char *name, std::function<void()> execute);
+	void Read(RenderPassId pass, RenderResourceId resource);
+	// a color target, or the depth target for a depth desc; one depth target and kMaxTargets colors per pass
+	void Write(RenderPassId pass, RenderResourceId resource);
+	// kept even when nothing reads what it writes: queries, readbacks
+	void SetSideEffects(RenderPassId pass);
+
+	// false when a pass reads a transient no earlier pass wrote, or reads and writes the same target
+	bool Compile();
+	// the kept passes in order; Compile first
+	void Execute(RenderGraphBackend &backend) const;
+	// forgets every pass and target
+	void Clear();
+
+	size_t GetPassesCount() const { return mPasses.size(); }
+	size_t GetResourcesCount() const { return mResources.size(); }
+	const char* GetPassName(RenderPassId pass) const { return mPasses[pass].name.c_str(); }
+	const char* GetResourceName(RenderResourceId resource) const { return mResources[resource].name.c_str(); }
+	const RenderTargetDesc& GetDesc(RenderResourceId resource) const { return mResources[resource].desc; }
+	bool IsImported(RenderResourceId resource) const { return mResources[resource].imported; }
+
+	// after Compile
+	const std::vector<RenderPassId>& GetExecutionOrder() const { return mOrder; }
+	bool IsCulled(RenderPassId pass) const { return mPasses[pass].culled; }
+	const std::vector<RenderResourceId>& GetTargets(RenderPassId pass) const { return mPasses[pass].targets; }
+	RenderResourceId GetDepthTarget(RenderPassId pass) const { return mPasses[pass].depth; }
+	const std::vector<RenderResourceId>& GetReads(RenderPassId pass) const { return mPasses[pass].reads; }
+	const std::vector<RenderResourceId>& GetClears(RenderPassId pass) const { return mPasses[pass].clears; }
+	// positions in GetExecutionOrder of a transient's first and last use
+	uint32_t GetFirstUse(RenderResourceId resource) const { return mResources[resource].first; }
+	uint32_t GetLastUse(RenderResourceId resource) const { return mResources[resource].last; }
+	// kNoRenderResource for imported targets and transients no kept pass uses
+	uint32_t GetPhysical(RenderResourceId resource) const { return mResources[resource].physical; }
+	size_t GetPhysicalsCount() const { return mPhysicals.size(); }
+	// the desc of the first transient placed in it, the others only differ in their clear values
+	const RenderTargetDesc& GetPhysicalDesc(uint32_t physical) const { return mPhysicals[physical].desc; }
+	// RenderTargetUsage flags of every transient placed in it
+	unsigned GetPhysicalUsage(uint32_t physical) const { return mPhysicals[physical].usage; }
+
+	RenderGraphStats GetStats() const;
+
+private:
+	struct Resource
+	{
+		std::string      name;
+		RenderTargetDesc desc;
+		bool             imported;
+		// after Compile
+		unsigned         usage;
+		uint32_t         first;
+		uint32_t         last;
+		uint32_t         physical;
+	};
+
+	struct Pass
+	{
+		std::string                   name;
+		std::function<void()>         execute;
+		std::vector<RenderResourceId> reads;
+		std::vector<RenderResourceId> targets;
+		RenderResourceId              depth;
+		bool                          sideEffects;
+		// after Compile
+		std::vector<RenderPassId>     dependencies; // the earlier passes whose output it uses
+		std::vector<RenderResourceId> clears;
+		bool                          culled;
+	};
+
+	struct Physical
+	{
+		RenderTargetDesc desc;
+		unsigned         usage;
+		uint32_t         last; // the last use of the transient placed in it last
+	};
+
+	bool Writes(const Pass &pass, RenderResourceId resource) const;
+	bool FindDependencies();
+	void CullPasses();
+	void AssignPhysicals();
+
+	std::vector<Resource>     mResources;
+	std::vector<Pass>         mPasses;
+	std::vector<RenderPassId> mOrder;
+	std::vector<Physical>     mPhysicals;
+	bool                      mCompiled;
+};
+
+class RenderTargetFactory
+{
+public:
+	virtual ~RenderTargetFactory() {}
+
+	// null on failure
+	virtual void* CreateTarget(const RenderTargetDesc &desc, unsigned usage) = 0;
+	virtual void ReleaseTarget(void *target) = 0;
+};
+
+class RenderTargetPool
+{
+public:
+	explicit RenderTargetPool(RenderTargetFactory &factory) : mFactory(factory), mCreated(0) {}
+	~RenderTargetPool() { Clear(); }
+
+	// an object for every physical target of a compiled graph; those of the last Realize with the same size, format
+	// and usage are kept, the others released. False if the factory failed.
+	bool Realize(const RenderGraph &graph);
+	// by the graph's physical index
+	void* GetTarget(uint32_t physical) const { return mTargets[physical].object; }
+	// the object of a transient, null for imported targets
+	void* GetTargetOf(const RenderGraph &graph, RenderResourceId resource) const;
+	void Clear();
+
+	size_t GetBytes() const;
+	// CreateTarget calls so far
+	uint64_t GetCreatedCount() const { return mCreated; }
+
+private:
+	struct Target
+	{
+		RenderTargetDesc desc;
+		unsigned         usage;
+		void             *object;
+	};
+
+	RenderTargetPool(const RenderTargetPool&);
+	RenderTargetPool& operator=(const RenderTargetPool&);
+
+	RenderTargetFactory &mFactory;
+	std::vector<Target> mTargets;
+	uint64_t            mCreated;
+};
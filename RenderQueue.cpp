@@ -0,0 +1,135 @@
+#include "RenderQueue.h"
+
+#include <algorithm>
+#include <cassert>
+#include <cstring>
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+namespace
+{
+	// six passes over 64-bit keys; 8 bit digits need eight and were slower even with their smaller histograms
+	const unsigned kRadixBits = 11;
+	const unsigned kRadixDigits = (64 + kRadixBits - 1) / kRadixBits;
+	const size_t   kRadixBuckets = size_t(1) << kRadixBits;
+	// below this an insertion sort beats the histogram pass
+	const size_t   kInsertionSortMax = 64;
+
+	uint64_t Field(uint32_t value, unsigned bits)
+	{
+		return value & ((uint64_t(1) << bits) - 1);
+	}
+
+	void InsertionSort(DrawItem *items, size_t count)
+	{
+		for (size_t i = 1; i < count; i++)
+		{
+			DrawItem item = items[i];
+			size_t j = i;
+			for (; j > 0 && items[j - 1].key > item.key; j--)
+				items[j] = items[j - 1];
+			items[j] = item;
+		}
+	}
+}
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+uint64_t MakeSortKey(uint32_t pass, DrawOrder order, uint32_t shader, uint32_t texture, uint32_t depth)
+{
+	static_assert(kSortPassBits + kSortShaderBits + kSortTextureBits + kSortDepthBits == 64, "the key fields fill 64 bits");
+
+	uint64_t state = Field(shader, kSortShaderBits) << kSortTextureBits | Field(texture, kSortTextureBits);
+	uint64_t key = Field(pass, kSortPassBits) << (64 - kSortPassBits);
+	switch (order)
+	{
+	case Order_State:
+		return key | state << kSortDepthBits | Field(depth, kSortDepthBits);
+	case Order_FrontToBack:
+		return key | Field(depth, kSortDepthBits) << (kSortShaderBits + kSortTextureBits) | state;
+	default:
+		return key | Field(~depth, kSortDepthBits) << (kSortShaderBits + kSortTextureBits) | state;
+	}
+}
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+uint32_t GetSortKeyPass(uint64_t key)
+{
+	return static_cast<uint32_t>(key >> (64 - kSortPassBits));
+}
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+uint32_t QuantizeDepth(float viewDepth, float nearZ, float farZ)
+{
+	const uint32_t maxDepth = (1u << kSortDepthBits) - 1;
+	float t = (viewDepth - nearZ) / (farZ - nearZ);
+	// also catches NaN
+	if (!(t > 0.0f))
+		return 0;
+	if (t >= 1.0f)
+		return maxDepth;
+	return static_cast<uint32_t>(t * maxDepth);
+}
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// all digit histograms come from one read of the keys; a digit with a single bucket would only copy the items
+DrawItem* RadixSortDrawItems(DrawItem *items, DrawItem *scratch, size_t count, unsigned *passes)
+{
+	if (passes)
+		*passes = 0;
+	if (count <= kInsertionSortMax)
+	{
+		InsertionSort(items, count);
+		return items;
+	}
+
+	assert(count <= UINT32_MAX);
+	uint32_t histograms[kRadixDigits][kRadixBuckets];
+	memset(histograms, 0, sizeof(histograms));
+	for (size_t i = 0; i < count; i++)
+	{
+		uint64_t key = items[i].key;
+		for (unsigned d = 0; d < kRadixDigits; d++)
+			histograms[d][(key >> (d * kRadixBits)) & (kRadixBuckets - 1)]++;
+	}
+
+	DrawItem *source = items;
+	DrawItem *target = scratch;
+	for (unsigned d = 0; d < kRadixDigits; d++)
+	{
+		uint32_t *histogram = histograms[d];
+		unsigned shift = d * kRadixBits;
+		if (histogram[(source[0].key >> shift) & (kRadixBuckets - 1)] == count)
+			continue;
+
+		// bucket starts
+		uint32_t offset = 0;
+		for (size_t b = 0; b < kRadixBuckets; b++)
+		{
+			uint32_t bucketCount = histogram[b];
+			histogram[b] = offset;
+			offset += bucketCount;
+		}
+		for (size_t i = 0; i < count; i++)
+			target[histogram[(source[i].key >> shift) & (kRadixBuckets - 1)]++] = source[i];
+		std::swap(source, target);
+		if (passes)
+			(*passes)++;
+	}
+	return source;
+}
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+void RenderQueue::Sort()
+{
+	if (mScratch.size() < mItems.size())
+		mScratch.resize(mItems.size());
+	DrawItem *sorted = RadixSortDrawItems(mItems.data(), mScratch.data(), mItems.size(), &mRadixPasses);
+	if (sorted == mItems.data())
+		return;
+
+	// an odd number of passes ends in the scratch buffer, which becomes the queue
+	size_t count = mItems.size();
+	mItems.swap(mScratch);
+	mItems.resize(count);
+}
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+RenderQueueStats RenderQueue::GetStats() const
+{
+	RenderQueueStats stats;
+	stats.items = mItems.size();
+	stats.radixPasses = mRadixPasses;
+	return stats;
+}
@@ -0,0 +1,83 @@
+#pragma once
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Draw submission order.
+// Every draw is recorded as a 64-bit sort key and a 32-bit payload (what the draw is, an object index for RenderTick).
+// The key holds the pass in its top bits, then the shader, texture and a quantized view depth in the order the pass
+// wants: state first keeps pipeline and texture switches to one per distinct state and draws front to back within
+// each, depth first draws opaque geometry strictly front to back so the depth test rejects what is hidden, and
+// inverted depth draws transparent geometry back to front.
+// Sort is an LSD radix sort over the keys, 11 bits per pass, stable so equal keys keep the order they were added in.
+// Digits every key shares are detected in the histogram pass and skipped: a frame with one pass and one shader only
+// pays for the bytes that differ.
+// A queue given a MemoryResource takes its items and sort scratch from it: RenderTick makes its queue on the frame
+// arena every frame.
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+#include "FrameArena.h"
+
+#include <cstddef>
+#include <cstdint>
+
+enum DrawOrder
+{
+	Order_State,       // shader, texture, then front to back
+	Order_FrontToBack, // depth, then shader and texture
+	Order_BackToFront, // inverted depth, then shader and texture
+};
+
+struct DrawItem
+{
+	uint64_t key;
+	uint32_t payload;
+};
+
+// bits of each key field; the ids are assigned by the caller and truncated to their field
+const unsigned kSortPassBits = 4;
+const unsigned kSortShaderBits = 12;
+const unsigned kSortTextureBits = 24;
+const unsigned kSortDepthBits = 24;
+
+uint64_t MakeSortKey(uint32_t pass, DrawOrder order, uint32_t shader, uint32_t texture, uint32_t depth);
+uint32_t GetSortKeyPass(uint64_t key);
+
+// view depth between nearZ and farZ to kSortDepthBits, linear; closer than nearZ is 0, farther than farZ the maximum
+uint32_t QuantizeDepth(float viewDepth, float nearZ, float farZ);
+
+// sorts count items by key, stable; scratch holds count items. Returns where the result is, items or scratch, and
+// the radix passes that ran in passes when it is set.
+DrawItem* RadixSortDrawItems(DrawItem *items, DrawItem *scratch, size_t count, unsigned *passes = nullptr);
+
+struct RenderQueueStats
+{
+	size_t   items;
+	unsigned radixPasses; // of the 6 possible, the others were skipped
+};
+
+class RenderQueue
+{
+public:
+	RenderQueue() : mRadixPasses(0) {}
+	explicit RenderQueue(MemoryResource *resource) : mItems(resource), mScratch(resource), mRadixPasses(0) {}
+
+	// keeps the storage, a queue refilled every frame stops allocating once it has seen the largest frame
+	void Clear() { mItems.clear(); }
+	void Reserve(size_t count) { mItems.reserve(count); }
+	void Add(uint64_t key, uint32_t payload)
+	{
+		DrawItem item = { key, payload };
+		mItems.push_back(item);
+	}
+
+	void Sort();
+
+	// sorted after Sort, in the order they were added before
+	size_t GetCount() const { return mItems.size(); }
+	const DrawItem* GetItems() const { return mItems.data(); }
+	const DrawItem& operator[](size_t index) const { return mItems[index]; }
+
+	RenderQueueStats GetStats() const;
+
+private:
+	ArenaVector<DrawItem> mItems;
+	ArenaVector<DrawItem> mScratch;
+	unsigned              mRadixPasses;
+};
@@ -0,0 +1,74 @@
+#include "ResolutionScaler.h"
+
+#include <algorithm>
+#include <cmath>
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+ResolutionSettings DefaultResolutionSettings()
+{
+	ResolutionSettings settings;
+	settings.minScale = 0.5f;
+	settings.maxScale = 1.0f;
+	settings.step = 0.05f;
+	settings.targetMs = 1000.0 / 60.0;
+	settings.headroom = 0.9;
+	settings.settleFrames = 4;
+	return settings;
+}
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+ResolutionScaler::ResolutionScaler(const ResolutionSettings &settings)
+	: mSettings(settings)
+	, mScale(settings.maxScale)
+	, mFilteredMs(-1.0)
+	, mSettling(0)
+	, mChanges(0)
+{
+}
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+void ResolutionScaler::Reset(float scale)
+{
+	mScale = Quantize(scale);
+	mFilteredMs = -1.0;
+	// the frames in flight were measured before
+	mSettling = mSettings.settleFrames;
+}
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+float ResolutionScaler::Quantize(double scale) const
+{
+	// rounded down: a step up needs room for the whole step, which is the hysteresis against flickering
+	double quantized = std::floor(scale / mSettings.step + 1e-4) * mSettings.step;
+	return static_cast<float>(std::min<double>(std::max<double>(quantized, mSettings.minScale), mSettings.maxScale));
+}
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+bool ResolutionScaler::AddFrame(double ms)
+{
+	// frames in flight when the size changed report the old cost
+	if (mSettling > 0)
+	{
+		mSettling--;
+		return false;
+	}
+
+	// fast when the cost rises, a slow frame is late already; slow when it falls, so noise does not raise the size
+	if (mFilteredMs < 0.0)
+		mFilteredMs = ms;
+	else
+		mFilteredMs += (ms - mFilteredMs) * (ms > mFilteredMs ? 0.5 : 0.05);
+
+	double goalMs = mSettings.targetMs * mSettings.headroom;
+	float scale = Quantize(mScale * std::sqrt(goalMs / std::max(mFilteredMs, 0.001)));
+	if (scale == mScale)
+		return false;
+
+	// the filter continues from the cost predicted at the new size, the frames measured there correct it
+	mFilteredMs *= double(scale) * scale / (double(mScale) * mScale);
+	mScale = scale;
+	mSettling = mSettings.settleFrames;
+	mChanges++;
+	return true;
+}
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+void ResolutionScaler::GetRenderSize(uint32_t outputWidth, uint32_t outputHeight, uint32_t &width, uint32_t &height) const
+{
+	width = std::max(1u, static_cast<uint32_t>(outputWidth * mScale + 0.5f));
+	height = std::max(1u, static_cast<uint32_t>(outputHeight * mScale + 0.5f));
+}
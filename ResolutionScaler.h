@@ -0,0 +1,58 @@
+#pragma once
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Dynamic resolution controller.
+// The scene renders at a scale of the output size and the result is stretched to it. AddFrame takes the measured
+// frame time (the GPU span in main.cpp), smooths it and, assuming the cost grows with the pixel count, picks the scale
+// that brings it to a fraction of the target: scale * sqrt(target * headroom / filtered). Scales are quantized to
+// steps and, after each change, held for a few frames while timings of the old size drain, so the size does not
+// flicker with noise. Spikes lower the scale within a frame or two, room to grow raises it slowly.
+// Nothing here knows about D3D; HeadlessMain.cpp replays synthetic and recorded traces through it.
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+#include <cstdint>
+
+// frames main.cpp has in flight: a frame's GPU time is read back, and reaches AddFrame, this many frames later
+const uint32_t kFramesInFlight = 3;
+
+struct ResolutionSettings
+{
+	float  minScale;     // per axis, of the output size
+	float  maxScale;
+	float  step;         // scales are multiples of it, within minScale..maxScale
+	double targetMs;     // frame time budget
+	double headroom;     // the filtered time is steered to targetMs * headroom
+	int    settleFrames; // frames ignored after a change, at least the frames in flight of the timing source
+};
+
+// 50% to 100% in 5% steps, steering to 90% of a 60 Hz frame
+ResolutionSettings DefaultResolutionSettings();
+
+class ResolutionScaler
+{
+public:
+	explicit ResolutionScaler(const ResolutionSettings &settings);
+
+	const ResolutionSettings& GetSettings() const { return mSettings; }
+	// the display rate can change at run time, the scale is kept
+	void SetTargetMs(double ms) { mSettings.targetMs = ms; }
+
+	// one measured frame, returns true if the scale changed
+	bool AddFrame(double ms);
+	// forgets the filtered time and starts again from scale after the settle frames, when the cost per pixel changed
+	void Reset(float scale);
+
+	float GetScale() const { return mScale; }
+	// outputWidth * scale rounded, never 0
+	void GetRenderSize(uint32_t outputWidth, uint32_t outputHeight, uint32_t &width, uint32_t &height) const;
+
+	double   GetFilteredMs() const { return mFilteredMs; }
+	uint64_t GetChanges() const { return mChanges; }
+
+private:
+	float Quantize(double scale) const;
+
+	ResolutionSettings mSettings;
+	float              mScale;
+	double             mFilteredMs; // negative until the first frame after a change or a reset
+	int                mSettling;
+	uint64_t           mChanges;
+};
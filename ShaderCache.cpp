@@ -0,0 +1,216 @@
+#include "ShaderCache.h"
+
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+
+#if defined(_WIN32)
+#include <direct.h>
+#else
+#include <sys/stat.h>
+#endif
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+namespace
+{
+	const uint32_t kCacheMagic = 0x43535844; // 'DXSC'
+	const uint32_t kCacheVersion = 1;
+
+	// file layout: header, cbufferCount ShaderCBufferBinding, bytecodeSize bytes of bytecode
+	struct CacheHeader
+	{
+		uint32_t magic;
+		uint32_t version;
+		uint64_t key;
+		float    compileMs;
+		uint32_t cbufferCount;
+		uint32_t bytecodeSize;
+		uint32_t padding;
+	};
+
+	// FNV-1a, every field is terminated so "ab" + "c" and "a" + "bc" hash differently
+	uint64_t HashBytes(uint64_t hash, const void *data, size_t size)
+	{
+		const unsigned char *bytes = static_cast<const unsigned char*>(data);
+		for (size_t i = 0; i < size; i++)
+		{
+			hash ^= bytes[i];
+			hash *= 1099511628211ull;
+		}
+		return hash;
+	}
+
+	uint64_t HashString(uint64_t hash, const char *str)
+	{
+		const unsigned char terminator = 0;
+		hash = HashBytes(hash, str, strlen(str));
+		return HashBytes(hash, &terminator, 1);
+	}
+
+	double ElapsedMs(std::chrono::high_resolution_clock::time_point start)
+	{
+		std::chrono::duration<double, std::milli> elapsed = std::chrono::high_resolution_clock::now() - start;
+		return elapsed.count();
+	}
+}
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+int ShaderReflection::FindCBuffer(const char *name) const
+{
+	for (size_t i = 0; i < cbuffers.size(); i++)
+		if (!strcmp(cbuffers[i].name, name))
+			return static_cast<int>(cbuffers[i].bindPoint);
+	return -1;
+}
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+ShaderCache::ShaderCache(const char *directory)
+	: mDirectory(directory)
+{
+	memset(&mStats, 0, sizeof(mStats));
+}
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+uint64_t ShaderCache::ComputeKey(const ShaderSource &source, const ShaderCompiler &compiler)
+{
+	uint64_t hash = 14695981039346656037ull;
+	hash = HashBytes(hash, source.code, source.codeSize);
+	hash = HashString(hash, source.entryPoint);
+	hash = HashString(hash, source.target);
+	for (size_t i = 0; i < source.defines.size(); i++)
+	{
+		hash = HashString(hash, source.defines[i].name.c_str());
+		hash = HashString(hash, source.defines[i].value.c_str());
+	}
+	return HashString(hash, compiler.GetVersion());
+}
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+std::string ShaderCache::GetPath(uint64_t key) const
+{
+	char name[32];
+	snprintf(name, sizeof(name), "/%016llx.dxsc", static_cast<unsigned long long>(key));
+	return mDirectory + name;
+}
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+bool ShaderCache::Load(const ShaderSource &source, ShaderCompiler &compiler, ShaderBlob &blob)
+{
+	uint64_t key = ComputeKey(source, compiler);
+
+	std::chrono::high_resolution_clock::time_point start = std::chrono::high_resolution_clock::now();
+	float recordedCompileMs = 0.0f;
+	if (LoadEntry(key, blob, recordedCompileMs))
+	{
+		double loadMs = ElapsedMs(start);
+		std::lock_guard<std::mutex> lock(mStatsMutex);
+		mStats.hits++;
+		mStats.loadMs += loadMs;
+		mStats.savedMs += recordedCompileMs - loadMs;
+		return true;
+	}
+
+	start = std::chrono::high_resolution_clock::now();
+	blob.mFile.Close();
+	blob.mOwned.clear();
+	blob.mReflection.cbuffers.clear();
+	bool compiled = compiler.Compile(source, blob.mOwned, blob.mReflection);
+	double compileMs = ElapsedMs(start);
+	{
+		std::lock_guard<std::mutex> lock(mStatsMutex);
+		mStats.misses++;
+		mStats.compileMs += compileMs;
+		if (!compiled)
+			mStats.failures++;
+	}
+	if (!compiled)
+		return false;
+
+	StoreEntry(key, blob.mOwned, blob.mReflection, static_cast<float>(compileMs));
+	blob.mBytecode = blob.mOwned.empty() ? nullptr : &blob.mOwned[0];
+	blob.mBytecodeSize = blob.mOwned.size();
+	blob.mFromCache = false;
+	return true;
+}
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+bool ShaderCache::LoadEntry(uint64_t key, ShaderBlob &blob, float &compileMs)
+{
+	if (!blob.mFile.Open(GetPath(key).c_str()))
+		return false;
+
+	const unsigned char *data = blob.mFile.GetData();
+	size_t size = blob.mFile.GetSize();
+
+	CacheHeader header;
+	if (size < sizeof(header))
+	{
+		blob.mFile.Close();
+		return false;
+	}
+	memcpy(&header, data, sizeof(header));
+
+	// the counts are checked against the bytes that follow before they are multiplied, a truncated or corrupt file
+	// cannot wrap the size around
+	size_t payload = size - sizeof(header);
+	if (header.magic != kCacheMagic || header.version != kCacheVersion || header.key != key ||
+		header.cbufferCount > payload / sizeof(ShaderCBufferBinding) ||
+		header.bytecodeSize != payload - header.cbufferCount * sizeof(ShaderCBufferBinding))
+	{
+		blob.mFile.Close();
+		return false;
+	}
+	size_t cbuffersSize = header.cbufferCount * sizeof(ShaderCBufferBinding);
+
+	blob.mReflection.cbuffers.resize(header.cbufferCount);
+	if (header.cbufferCount)
+		memcpy(&blob.mReflection.cbuffers[0], data + sizeof(header), cbuffersSize);
+	for (size_t i = 0; i < blob.mReflection.cbuffers.size(); i++)
+		blob.mReflection.cbuffers[i].name[sizeof(blob.mReflection.cbuffers[i].name) - 1] = 0;
+	blob.mOwned.clear();
+	blob.mBytecode = data + sizeof(header) + cbuffersSize;
+	blob.mBytecodeSize = header.bytecodeSize;
+	blob.mFromCache = true;
+	compileMs = header.compileMs;
+	return true;
+}
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+void ShaderCache::StoreEntry(uint64_t key, const std::vector<unsigned char> &bytecode, const ShaderReflection &reflection, float compileMs)
+{
+#if defined(_WIN32)
+	_mkdir(mDirectory.c_str());
+#else
+	mkdir(mDirectory.c_str(), 0755);
+#endif
+
+	CacheHeader header;
+	header.magic = kCacheMagic;
+	header.version = kCacheVersion;
+	header.key = key;
+	header.compileMs = compileMs;
+	header.cbufferCount = static_cast<uint32_t>(reflection.cbuffers.size());
+	header.bytecodeSize = static_cast<uint32_t>(bytecode.size());
+	header.padding = 0;
+
+	// written under a temporary name of its own so a crash, a concurrent reader or another writer never sees half an
+	// entry; the last rename wins, every writer stores the same bytes
+	std::string path = GetPath(key);
+	std::string tmpPath = path + GetTempSuffix();
+	FILE *file = fopen(tmpPath.c_str(), "wb");
+	if (!file)
+		return;
+
+	bool ok = fwrite(&header, sizeof(header), 1, file) == 1;
+	if (ok && header.cbufferCount)
+		ok = fwrite(&reflection.cbuffers[0], sizeof(ShaderCBufferBinding), header.cbufferCount, file) == header.cbufferCount;
+	if (ok && header.bytecodeSize)
+		ok = fwrite(&bytecode[0], 1, bytecode.size(), file) == bytecode.size();
+	ok = fclose(file) == 0 && ok;
+
+	if (ok)
+	{
+		remove(path.c_str());
+		ok = rename(tmpPath.c_str(), path.c_str()) == 0;
+	}
+	if (!ok)
+		remove(tmpPath.c_str());
+}
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+ShaderCacheStats ShaderCache::GetStats() const
+{
+	std::lock_guard<std::mutex> lock(mStatsMutex);
+	return mStats;
+}
@@ -0,0 +1,113 @@
+#pragma once
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// On-disk shader bytecode cache.
+// Entries are keyed by a 64 bit hash of source, entry point, target profile, defines and compiler version, and
+// store the bytecode together with the constant buffer bindings the renderer used to reflect at every start.
+// Hits are memory mapped and handed to Create*Shader without a copy. The compiler is an interface: main.cpp
+// wraps D3DCompile + D3DReflect, anything else (a stub on Linux) works the same way.
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+#include "MappedFile.h"
+
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <vector>
+
+struct ShaderDefine
+{
+	std::string name;
+	std::string value;
+};
+
+struct ShaderSource
+{
+	const char               *name; // for error messages only, not part of the key
+	const char               *code;
+	size_t                   codeSize;
+	const char               *entryPoint;
+	const char               *target;
+	std::vector<ShaderDefine> defines;
+};
+
+struct ShaderCBufferBinding
+{
+	char     name[32];
+	uint32_t bindPoint;
+	uint32_t size;
+};
+
+struct ShaderReflection
+{
+	std::vector<ShaderCBufferBinding> cbuffers;
+
+	// -1 if the shader has no such constant buffer
+	int FindCBuffer(const char *name) const;
+};
+
+class ShaderCompiler
+{
+public:
+	virtual ~ShaderCompiler() {}
+
+	// part of the cache key, a compiler update invalidates every entry
+	virtual const char* GetVersion() const = 0;
+	virtual bool Compile(const ShaderSource &source, std::vector<unsigned char> &bytecode, ShaderReflection &reflection) = 0;
+};
+
+// bytecode mapped from the cache, or owned when the cache could not be written
+class ShaderBlob
+{
+public:
+	ShaderBlob() : mBytecode(nullptr), mBytecodeSize(0), mFromCache(false) {}
+
+	const void* GetBytecode() const { return mBytecode; }
+	size_t GetBytecodeSize() const { return mBytecodeSize; }
+	const ShaderReflection& GetReflection() const { return mReflection; }
+	bool IsFromCache() const { return mFromCache; }
+
+private:
+	friend class ShaderCache;
+
+	ShaderBlob(const ShaderBlob&);
+	ShaderBlob& operator=(const ShaderBlob&);
+
+	MappedFile                 mFile;
+	std::vector<unsigned char> mOwned;
+	const void                 *mBytecode;
+	size_t                     mBytecodeSize;
+	ShaderReflection           mReflection;
+	bool                       mFromCache;
+};
+
+struct ShaderCacheStats
+{
+	unsigned hits;
+	unsigned misses;
+	unsigned failures;  // compile errors
+	double   compileMs; // spent compiling misses
+	double   loadMs;    // spent loading hits
+	double   savedMs;   // recorded compile time of the hits minus loadMs
+};
+
+class ShaderCache
+{
+public:
+	// directory is created on the first store
+	explicit ShaderCache(const char *directory);
+
+	// thread safe; compiles and stores on a miss, returns false only if compilation failed
+	bool Load(const ShaderSource &source, ShaderCompiler &compiler, ShaderBlob &blob);
+
+	static uint64_t ComputeKey(const ShaderSource &source, const ShaderCompiler &compiler);
+
+	ShaderCacheStats GetStats() const;
+
+private:
+	std::string GetPath(uint64_t key) const;
+	bool LoadEntry(uint64_t key, ShaderBlob &blob, float &compileMs);
+	void StoreEntry(uint64_t key, const std::vector<unsigned char> &bytecode, const ShaderReflection &reflection, float compileMs);
+
+	std::string        mDirectory;
+	mutable std::mutex mStatsMutex;
+	ShaderCacheStats   mStats;
+};
@@ -0,0 +1,243 @@
+#include "ShaderPermutations.h"
+
+#include <cassert>
+#include <chrono>
+#include <cstring>
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+namespace
+{
+	// FNV-1a, like the cache keys
+	uint64_t HashBytecode(const void *data, size_t size)
+	{
+		const unsigned char *bytes = static_cast<const unsigned char*>(data);
+		uint64_t hash = 14695981039346656037ull;
+		for (size_t i = 0; i < size; i++)
+		{
+			hash ^= bytes[i];
+			hash *= 1099511628211ull;
+		}
+		return hash;
+	}
+}
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+void GetVariantDefines(const ShaderProgramDesc &program, ShaderVariantKey key, std::vector<ShaderDefine> &defines)
+{
+	defines.clear();
+	for (uint32_t i = 0; i < program.featuresCount; i++)
+	{
+		ShaderDefine define = { program.features[i], key.Has(ShaderFeature(i)) ? "1" : "0" };
+		defines.push_back(define);
+	}
+}
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+ShaderPermutations::ShaderPermutations(ShaderCache &cache, ShaderCompiler &compiler, ShaderObjectFactory &factory,
+	int compileThreads)
+	: mCache(cache)
+	, mCompiler(compiler)
+	, mFactory(factory)
+	, mPending(0)
+	, mQuit(false)
+{
+	memset(&mStats, 0, sizeof(mStats));
+
+	// a variant is needed the frame it is first drawn, two threads keep one slow compile from holding up the rest
+	if (compileThreads <= 0)
+		compileThreads = 2;
+	for (int i = 0; i < compileThreads; i++)
+		mThreads.push_back(std::thread(&ShaderPermutations::CompileLoop, this));
+}
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+ShaderPermutations::~ShaderPermutations()
+{
+	{
+		// a compile thread only sees mQuit between two variants, the one it holds is finished
+		std::lock_guard<std::mutex> lock(mMutex);
+		mQuit = true;
+		for (size_t i = 0; i < mQueue.size(); i++)
+			mQueue[i]->state.store(Variant_Unknown, std::memory_order_relaxed);
+		mPending -= mQueue.size();
+		mQueue.clear();
+	}
+	mWakeUp.notify_all();
+	for (size_t i = 0; i < mThreads.size(); i++)
+		mThreads[i].join();
+	assert(!mPending);
+
+	for (size_t i = 0; i < mShaders.size(); i++)
+		if (mShaders[i].object)
+			mFactory.ReleaseShader(mShaders[i].object);
+}
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+bool ShaderPermutations::AddProgram(const ShaderProgramDesc &desc, ShaderProgramId &id)
+{
+	assert(desc.featuresCount <= kMaxShaderFeatures);
+	std::unique_ptr<Program> program(new Program);
+	program->code.assign(desc.code, desc.codeSize);
+	for (uint32_t i = 0; i < desc.featuresCount; i++)
+		program->featureNames.push_back(desc.features[i]);
+	for (uint32_t i = 0; i < desc.featuresCount; i++)
+		program->features.push_back(program->featureNames[i].c_str());
+	program->desc = desc;
+	program->desc.code = program->code.data();
+	program->desc.features = program->features.data();
+	program->desc.fallback = desc.fallback & AllShaderFeatures(desc.featuresCount);
+
+	double compileMs = 0.0;
+	program->fallback = Compile(*program, program->desc.fallback, compileMs);
+	if (!program->fallback)
+		return false;
+
+	std::unique_ptr<Variant> fallback(new Variant(program.get(), program->desc.fallback));
+	fallback->shader = program->fallback;
+	fallback->state.store(Variant_Ready, std::memory_order_release);
+
+	std::lock_guard<std::mutex> lock(mMutex);
+	id = static_cast<ShaderProgramId>(mPrograms.size());
+	mVariants.push_back(std::map<uint32_t, std::unique_ptr<Variant>>());
+	mVariants.back()[fallback->key.bits] = std::move(fallback);
+	mPrograms.push_back(std::move(program));
+	mStats.programs++;
+	mStats.variants++;
+	mStats.compiled++;
+	mStats.compileMs += compileMs;
+	return true;
+}
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+ShaderVariantKey ShaderPermutations::GetVariantKey(ShaderProgramId program, ShaderVariantKey key) const
+{
+	std::lock_guard<std::mutex> lock(mMutex);
+	return key & AllShaderFeatures(mPrograms[program]->desc.featuresCount);
+}
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// under mMutex
+ShaderPermutations::Variant* ShaderPermutations::FindOrQueue(ShaderProgramId program, ShaderVariantKey key)
+{
+	key = key & AllShaderFeatures(mPrograms[program]->desc.featuresCount);
+	std::unique_ptr<Variant> &variant = mVariants[program][key.bits];
+	if (variant)
+		return variant.get();
+
+	variant.reset(new Variant(mPrograms[program].get(), key));
+	mQueue.push_back(variant.get());
+	mPending++;
+	mStats.variants++;
+	mWakeUp.notify_one();
+	return variant.get();
+}
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+void* ShaderPermutations::GetShader(ShaderProgramId program, ShaderVariantKey key)
+{
+	std::lock_guard<std::mutex> lock(mMutex);
+	Variant *variant = FindOrQueue(program, key);
+	if (variant->state.load(std::memory_order_acquire) == Variant_Ready)
+		return variant->shader;
+	mStats.fallbackServed++;
+	return mPrograms[program]->fallback;
+}
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+void ShaderPermutations::Prefetch(ShaderProgramId program, ShaderVariantKey key)
+{
+	std::lock_guard<std::mutex> lock(mMutex);
+	FindOrQueue(program, key);
+}
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+ShaderVariantState ShaderPermutations::GetState(ShaderProgramId program, ShaderVariantKey key) const
+{
+	std::lock_guard<std::mutex> lock(mMutex);
+	key = key & AllShaderFeatures(mPrograms[program]->desc.featuresCount);
+	std::map<uint32_t, std::unique_ptr<Variant>>::const_iterator found = mVariants[program].find(key.bits);
+	if (found == mVariants[program].end())
+		return Variant_Unknown;
+	return static_cast<ShaderVariantState>(found->second->state.load(std::memory_order_acquire));
+}
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+bool ShaderPermutations::IsIdle() const
+{
+	std::lock_guard<std::mutex> lock(mMutex);
+	return !mPending;
+}
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+void ShaderPermutations::WaitIdle()
+{
+	std::unique_lock<std::mutex> lock(mMutex);
+	mIdle.wait(lock, [this] { return !mPending; });
+}
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+ShaderPermutationStats ShaderPermutations::GetStats() const
+{
+	ShaderPermutationStats stats;
+	{
+		std::lock_guard<std::mutex> lock(mMutex);
+		stats = mStats;
+	}
+	std::lock_guard<std::mutex> lock(mShadersMutex);
+	stats.shaders = static_cast<uint32_t>(mShaders.size());
+	return stats;
+}
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+void* ShaderPermutations::Compile(const Program &program, ShaderVariantKey key, double &compileMs)
+{
+	std::chrono::high_resolution_clock::time_point start = std::chrono::high_resolution_clock::now();
+	const ShaderProgramDesc &desc = program.desc;
+	ShaderSource source = { desc.name, desc.code, desc.codeSize, desc.entryPoint, desc.target, {} };
+	GetVariantDefines(desc, key, source.defines);
+	ShaderBlob blob;
+	bool compiled = mCache.Load(source, mCompiler, blob);
+	std::chrono::duration<double, std::milli> elapsed = std::chrono::high_resolution_clock::now() - start;
+	compileMs = elapsed.count();
+	if (!compiled)
+		return nullptr;
+
+	// the object is created under the lock, so two variants finishing with the same bytecode never make two
+	const unsigned char *bytecode = static_cast<const unsigned char*>(blob.GetBytecode());
+	uint64_t hash = HashBytecode(bytecode, blob.GetBytecodeSize());
+	std::lock_guard<std::mutex> lock(mShadersMutex);
+	typedef std::unordered_multimap<uint64_t, size_t>::const_iterator Iterator;
+	std::pair<Iterator, Iterator> range = mShaderIndex.equal_range(hash);
+	for (Iterator it = range.first; it != range.second; ++it)
+	{
+		const Shader &shader = mShaders[it->second];
+		if (shader.bytecode.size() == blob.GetBytecodeSize() &&
+			!memcmp(shader.bytecode.data(), bytecode, shader.bytecode.size()))
+			return shader.object;
+	}
+
+	void *object = mFactory.CreateShader(desc, blob);
+	if (!object)
+		return nullptr;
+	Shader shader = { hash, std::vector<unsigned char>(bytecode, bytecode + blob.GetBytecodeSize()), object };
+	mShaderIndex.insert(std::make_pair(hash, mShaders.size()));
+	mShaders.push_back(std::move(shader));
+	return object;
+}
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+void ShaderPermutations::CompileLoop()
+{
+	for (;;)
+	{
+		Variant *variant = nullptr;
+		{
+			std::unique_lock<std::mutex> lock(mMutex);
+			mWakeUp.wait(lock, [this] { return mQuit || !mQueue.empty(); });
+			if (mQuit)
+				return;
+			variant = mQueue.front();
+			mQueue.pop_front();
+		}
+
+		variant->state.store(Variant_Compiling, std::memory_order_relaxed);
+		double compileMs = 0.0;
+		void *shader = Compile(*variant->program, variant->key, compileMs);
+		variant->shader = shader;
+		variant->state.store(shader ? Variant_Ready : Variant_Failed, std::memory_order_release);
+
+		std::lock_guard<std::mutex> lock(mMutex);
+		mStats.compileMs += compileMs;
+		if (shader)
+			mStats.compiled++;
+		else
+			mStats.failed++;
+		if (!--mPending)
+			mIdle.notify_all();
+	}
+}
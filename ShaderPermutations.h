@@ -0,0 +1,183 @@
+#pragma once
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Shader permutations: one source compiled per combination of feature toggles.
+// A program lists its features in bit order and every feature is a define, 0 or 1, so the source switches with #if.
+// A ShaderVariantKey is the set of feature bits; keys are constexpr, built from the program's feature enum at compile
+// time, and masked to the features the program has so bits it does not know never make a variant of their own.
+// GetShader returns at once: a variant that is not ready yet is queued for the compile threads (through the
+// ShaderCache, a variant compiled by an earlier run is only a load) and the program's fallback variant, compiled by
+// AddProgram, is drawn until it is. Compiled bytecode is hashed, variants whose bytecode is the same (features the
+// entry point does not read) share one shader object.
+// The device is an interface: D3D11 in main.cpp, a stub in HeadlessMain.cpp.
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+#include "ShaderCache.h"
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+struct ShaderVariantKey
+{
+	uint32_t bits;
+
+	constexpr ShaderVariantKey operator|(ShaderVariantKey other) const { return ShaderVariantKey{ bits | other.bits }; }
+	constexpr ShaderVariantKey operator&(ShaderVariantKey other) const { return ShaderVariantKey{ bits & other.bits }; }
+	constexpr ShaderVariantKey operator^(ShaderVariantKey other) const { return ShaderVariantKey{ bits ^ other.bits }; }
+	constexpr bool operator==(ShaderVariantKey other) const { return bits == other.bits; }
+	constexpr bool operator!=(ShaderVariantKey other) const { return bits != other.bits; }
+	constexpr bool Has(ShaderVariantKey features) const { return (bits & features.bits) == features.bits; }
+};
+
+const uint32_t kMaxShaderFeatures = 32;
+
+// the key with one feature of a program, its index in ShaderProgramDesc::features
+constexpr ShaderVariantKey ShaderFeature(uint32_t index)
+{
+	return ShaderVariantKey{ 1u << index };
+}
+
+// every feature of a program with featuresCount features
+constexpr ShaderVariantKey AllShaderFeatures(uint32_t featuresCount)
+{
+	return ShaderVariantKey{ featuresCount >= kMaxShaderFeatures ? ~0u : (1u << featuresCount) - 1 };
+}
+
+struct ShaderProgramDesc
+{
+	const char        *name;          // name, entryPoint and target are kept as they are, literals
+	const char        *code;          // copied by AddProgram
+	size_t            codeSize;
+	const char        *entryPoint;
+	const char        *target;
+	const char *const *features;      // define names, bit i of a key is features[i]; copied by AddProgram
+	uint32_t          featuresCount;
+	ShaderVariantKey  fallback;       // compiled by AddProgram, drawn while the others compile
+};
+
+// the defines of a variant: every feature of the program, "1" when its bit is set and "0" when not
+void GetVariantDefines(const ShaderProgramDesc &program, ShaderVariantKey key, std::vector<ShaderDefine> &defines);
+
+class ShaderObjectFactory
+{
+public:
+	virtual ~ShaderObjectFactory() {}
+
+	// on a compile thread (or AddProgram's); the program's target tells the stage. Null on failure.
+	virtual void* CreateShader(const ShaderProgramDesc &program, const ShaderBlob &blob) = 0;
+	virtual void ReleaseShader(void *shader) = 0;
+};
+
+enum ShaderVariantState
+{
+	Variant_Unknown,   // never asked for
+	Variant_Queued,    // waiting for a compile thread
+	Variant_Compiling,
+	Variant_Ready,     // GetShader returns its own object
+	Variant_Failed,    // compile error, the fallback is kept
+};
+
+struct ShaderPermutationStats
+{
+	uint32_t programs;
+	uint32_t variants;       // asked for, fallbacks included
+	uint32_t compiled;       // ready, fallbacks included
+	uint32_t failed;
+	uint32_t shaders;        // distinct bytecode, the objects created
+	uint64_t fallbackServed; // GetShader calls that returned the fallback
+	double   compileMs;      // on the compile threads, cache loads included
+};
+
+typedef uint32_t ShaderProgramId;
+
+class ShaderPermutations
+{
+public:
+	// compileThreads 0 picks 2
+	ShaderPermutations(ShaderCache &cache, ShaderCompiler &compiler, ShaderObjectFactory &factory, int compileThreads = 0);
+	// the queued variants are dropped and the ones compiling finish before the compile threads are joined, nothing is
+	// pending after it; releases every shader through the factory
+	~ShaderPermutations();
+
+	// compiles the fallback variant on the calling thread; false if it does not compile
+	bool AddProgram(const ShaderProgramDesc &desc, ShaderProgramId &id);
+
+	// the variant's shader when it is ready, the fallback's otherwise; the first call for a key queues it
+	void* GetShader(ShaderProgramId program, ShaderVariantKey key);
+	// queues the variant without returning a shader, for the ones known to be needed soon
+	void Prefetch(ShaderProgramId program, ShaderVariantKey key);
+	ShaderVariantState GetState(ShaderProgramId program, ShaderVariantKey key) const;
+	// the key a variant is stored under: masked to the program's features
+	ShaderVariantKey GetVariantKey(ShaderProgramId program, ShaderVariantKey key) const;
+
+	// true when nothing is queued or compiling
+	bool IsIdle() const;
+	void WaitIdle();
+
+	ShaderPermutationStats GetStats() const;
+
+private:
+	struct Program
+	{
+		ShaderProgramDesc        desc; // points into code and the feature names
+		std::string              code;
+		std::vector<std::string> featureNames;
+		std::vector<const char*> features;
+		void                     *fallback;
+	};
+
+	struct Variant
+	{
+		const Program    *program;
+		ShaderVariantKey key;
+		std::atomic<int> state;
+		void             *shader; // written before Variant_Ready
+
+		Variant(const Program *variantProgram, ShaderVariantKey variantKey)
+			: program(variantProgram), key(variantKey), state(Variant_Queued), shader(nullptr) {}
+	};
+
+	// one object per distinct bytecode
+	struct Shader
+	{
+		uint64_t                   hash;
+		std::vector<unsigned char> bytecode;
+		void                       *object;
+	};
+
+	ShaderPermutations(const ShaderPermutations&);
+	ShaderPermutations& operator=(const ShaderPermutations&);
+
+	Variant* FindOrQueue(ShaderProgramId program, ShaderVariantKey key);
+	// compiles and creates or shares the object; null on failure
+	void* Compile(const Program &program, ShaderVariantKey key, double &compileMs);
+	void CompileLoop();
+
+	ShaderCache         &mCache;
+	ShaderCompiler      &mCompiler;
+	ShaderObjectFactory &mFactory;
+
+	// a Program does not move once added, the compile threads read it through their variant without the lock
+	std::vector<std::unique_ptr<Program>>                     mPrograms;    // under mMutex
+	std::vector<std::map<uint32_t, std::unique_ptr<Variant>>> mVariants;    // under mMutex, by program
+	std::unordered_multimap<uint64_t, size_t>                 mShaderIndex; // under mShadersMutex, hash to mShaders
+	std::vector<Shader>                                       mShaders;     // under mShadersMutex
+
+	std::vector<std::thread> mThreads;
+	mutable std::mutex       mMutex;
+	std::condition_variable  mWakeUp;
+	std::condition_variable  mIdle;
+	std::deque<Variant*>     mQueue;   // under mMutex
+	size_t                   mPending; // queued or compiling, under mMutex
+	bool                     mQuit;
+	mutable std::mutex       mShadersMutex;
+	ShaderPermutationStats   mStats;   // under mMutex
+};
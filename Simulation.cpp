@@ -0,0 +1,156 @@
+#include "Simulation.h"
+
+#include <chrono>
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+const float Simulation::kRadiansPerSecond = 3.0f;
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+Vec3 SceneGridPosition(int object)
+{
+	if (object < 2)
+		return Vec3{ 0.0f, 0.0f, 0.0f };
+
+	// 64 columns per layer, each layer further away so copies stay visible through the depth test
+	int cell = object - 2;
+	Vec3 position;
+	position.x = static_cast<float>(cell % 64 - 32) * 2.5f;
+	position.y = static_cast<float>(cell / 64 % 64 - 32) * 2.5f;
+	position.z = 10.0f + static_cast<float>(cell / (64 * 64)) * 2.0f;
+	return position;
+}
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+Simulation::Simulation(const FrameClock &clock, size_t objectsCount, double stepMs)
+	: mClock(clock)
+	, mStepMs(stepMs)
+	, mObjects(objectsCount)
+	, mAngle(0.0f)
+	, mStartMs(clock.NowMs())
+	, mTicks(0)
+	, mDroppedSteps(0)
+	, mQuit(false)
+{
+	for (size_t i = 0; i < mObjects.size(); i++)
+	{
+		mObjects[i].position = SceneGridPosition(static_cast<int>(i));
+		mObjects[i].angle = i == 0 ? mAngle - kPiDiv2 : mAngle;
+	}
+
+	// every buffer starts as the tick 0 snapshot, the vectors keep their capacity from here on
+	for (unsigned b = 0; b < 3; b++)
+	{
+		SimSnapshot &snapshot = mSnapshots.GetBuffer(b);
+		snapshot.tick = 0;
+		snapshot.timeMs = mStartMs;
+		snapshot.previous = mObjects;
+		snapshot.current = mObjects;
+	}
+}
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+Simulation::~Simulation()
+{
+	Stop();
+}
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+void Simulation::Start()
+{
+	if (mThread.joinable())
+		return;
+
+	mQuit = false;
+	mStartMs = mClock.NowMs() - GetTicks() * mStepMs;
+	mThread = std::thread(&Simulation::ThreadLoop, this);
+}
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+void Simulation::Stop()
+{
+	if (!mThread.joinable())
+		return;
+
+	{
+		std::lock_guard<std::mutex> lock(mMutex);
+		mQuit = true;
+	}
+	mWakeUp.notify_all();
+	mThread.join();
+}
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+void Simulation::Step()
+{
+	SimSnapshot &snapshot = mSnapshots.GetWriteBuffer();
+	snapshot.previous = mObjects;
+
+	mAngle += kRadiansPerSecond * static_cast<float>(mStepMs / 1000.0);
+	if (mAngle > 2.0f * kPi)
+		mAngle -= 2.0f * kPi;
+	for (size_t i = 0; i < mObjects.size(); i++)
+		mObjects[i].angle = i == 0 ? mAngle - kPiDiv2 : mAngle;
+
+	uint64_t tick = GetTicks() + 1;
+	snapshot.tick = tick;
+	snapshot.timeMs = mStartMs + tick * mStepMs;
+	snapshot.current = mObjects;
+	mSnapshots.Publish();
+	mTicks.store(tick, std::memory_order_relaxed);
+}
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+float Simulation::Interpolate(double nowMs, TransformStore &transforms)
+{
+	mSnapshots.Update();
+	const SimSnapshot &snapshot = mSnapshots.GetReadBuffer();
+
+	// the picture runs one step behind: previous is shown when nowMs reaches timeMs, current one step later
+	float alpha = static_cast<float>((nowMs - snapshot.timeMs) / mStepMs);
+	alpha = alpha < 0.0f ? 0.0f : (alpha > 1.0f ? 1.0f : alpha);
+
+	const Vec3 up = { 0.0f, 1.0f, 0.0f };
+	const Vec3 scale = { 1.0f, 1.0f, 1.0f };
+	transforms.Resize(snapshot.current.size());
+	for (size_t i = 0; i < snapshot.current.size(); i++)
+	{
+		const SimTransform &a = snapshot.previous[i];
+		const SimTransform &b = snapshot.current[i];
+
+		// shortest way around when the angle wrapped between the two states
+		float delta = b.angle - a.angle;
+		if (delta > kPi)
+			delta -= 2.0f * kPi;
+		else if (delta < -kPi)
+			delta += 2.0f * kPi;
+
+		Vec3 position;
+		position.x = a.position.x + (b.position.x - a.position.x) * alpha;
+		position.y = a.position.y + (b.position.y - a.position.y) * alpha;
+		position.z = a.position.z + (b.position.z - a.position.z) * alpha;
+		transforms.Set(i, position, QuatRotationAxis(up, a.angle + delta * alpha), scale);
+	}
+	return alpha;
+}
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+void Simulation::ThreadLoop()
+{
+	for (;;)
+	{
+		double nowMs = mClock.NowMs();
+		int steps = 0;
+		while (mStartMs + (GetTicks() + 1) * mStepMs <= nowMs && steps < kMaxCatchUpSteps)
+		{
+			Step();
+			steps++;
+		}
+
+		// still behind after a stall: skip the missed steps instead of spiralling
+		double behindMs = nowMs - (mStartMs + (GetTicks() + 1) * mStepMs);
+		if (behindMs >= 0.0)
+		{
+			uint64_t dropped = static_cast<uint64_t>(behindMs / mStepMs) + 1;
+			mStartMs += dropped * mStepMs;
+			mDroppedSteps.fetch_add(dropped, std::memory_order_relaxed);
+		}
+
+		double waitMs = mStartMs + (GetTicks() + 1) * mStepMs - mClock.NowMs();
+		std::unique_lock<std::mutex> lock(mMutex);
+		if (mQuit)
+			return;
+		if (waitMs > 0.0)
+			mWakeUp.wait_for(lock, std::chrono::duration<double, std::milli>(waitMs));
+	}
+}
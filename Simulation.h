@@ -0,0 +1,91 @@
+#pragma once
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Fixed-timestep scene simulation, decoupled from rendering.
+// Step advances the object transforms by exactly one step and publishes the previous and the new state through a
+// triple buffer. The render thread calls Interpolate with its own clock: it picks up the newest snapshot and blends
+// the two states, so motion is smooth at any frame rate and one step behind the simulation.
+// Start runs Step on a dedicated thread paced by the clock; without Start, Step can be driven by hand.
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+#include "FrameStats.h"
+#include "MathUtils.h"
+#include "TransformStore.h"
+#include "TripleBuffer.h"
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// rotation about +Y, then translation
+struct SimTransform
+{
+	Vec3  position;
+	float angle;
+};
+
+struct SimSnapshot
+{
+	uint64_t tick;   // steps taken, 0 for the initial state
+	double   timeMs; // clock time of current
+	std::vector<SimTransform> previous;
+	std::vector<SimTransform> current;
+};
+
+// the two main.cpp quads sit at the origin, object 2 and up fill a grid behind them
+Vec3 SceneGridPosition(int object);
+
+class Simulation
+{
+public:
+	// 3 radians per second, the former 0.05 per frame at 60 Hz
+	static const float kRadiansPerSecond;
+	// steps the thread may run back to back after a stall before the simulation clock is allowed to slip
+	static const int kMaxCatchUpSteps = 5;
+
+	Simulation(const FrameClock &clock, size_t objectsCount, double stepMs);
+	~Simulation();
+
+	void Start();
+	void Stop();
+
+	// simulation thread (or the caller when not started)
+	void Step();
+
+	// render thread: fills one transform per object for nowMs, returns the blend factor between the two states
+	float Interpolate(double nowMs, TransformStore &transforms);
+	// render thread: tick of the snapshot used by the last Interpolate
+	uint64_t GetRenderedTick() const { return mSnapshots.GetReadBuffer().tick; }
+
+	double GetStepMs() const { return mStepMs; }
+	size_t GetObjectsCount() const { return mObjects.size(); }
+	// any thread
+	uint64_t GetTicks() const { return mTicks.load(std::memory_order_relaxed); }
+	uint64_t GetDroppedSteps() const { return mDroppedSteps.load(std::memory_order_relaxed); }
+
+private:
+	Simulation(const Simulation&);
+	Simulation& operator=(const Simulation&);
+
+	void ThreadLoop();
+
+	const FrameClock &mClock;
+	const double     mStepMs;
+
+	// simulation side
+	std::vector<SimTransform> mObjects;
+	float                     mAngle;
+	double                    mStartMs; // time of tick 0, moves forward when steps are dropped
+
+	TripleBuffer<SimSnapshot> mSnapshots;
+
+	std::atomic<uint64_t> mTicks;
+	std::atomic<uint64_t> mDroppedSteps;
+
+	std::thread             mThread;
+	std::mutex              mMutex;
+	std::condition_variable mWakeUp;
+	bool                    mQuit;
+};
@@ -0,0 +1,533 @@
+#include "SoftRasterizer.h"
+
+#include <algorithm>
+#include <cstdio>
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#else
+#include <emmintrin.h>
+#endif
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// SIMD lanes: AVX2 processes 8 pixels of a row at once, SSE2 processes 4
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+#if defined(__AVX2__)
+typedef __m256  VFloat;
+typedef __m256i VInt;
+const int kLanes = 8;
+
+inline VFloat VSet(float a) { return _mm256_set1_ps(a); }
+inline VFloat VLaneOffsets() { return _mm256_setr_ps(0.5f, 1.5f, 2.5f, 3.5f, 4.5f, 5.5f, 6.5f, 7.5f); }
+inline VFloat VAdd(VFloat a, VFloat b) { return _mm256_add_ps(a, b); }
+inline VFloat VSub(VFloat a, VFloat b) { return _mm256_sub_ps(a, b); }
+inline VFloat VMul(VFloat a, VFloat b) { return _mm256_mul_ps(a, b); }
+inline VFloat VDiv(VFloat a, VFloat b) { return _mm256_div_ps(a, b); }
+inline VFloat VAnd(VFloat a, VFloat b) { return _mm256_and_ps(a, b); }
+inline VFloat VOr(VFloat a, VFloat b) { return _mm256_or_ps(a, b); }
+inline VFloat VCmpGt(VFloat a, VFloat b) { return _mm256_cmp_ps(a, b, _CMP_GT_OQ); }
+inline VFloat VCmpGe(VFloat a, VFloat b) { return _mm256_cmp_ps(a, b, _CMP_GE_OQ); }
+inline VFloat VCmpLt(VFloat a, VFloat b) { return _mm256_cmp_ps(a, b, _CMP_LT_OQ); }
+inline VFloat VCmpLe(VFloat a, VFloat b) { return _mm256_cmp_ps(a, b, _CMP_LE_OQ); }
+inline VFloat VSelect(VFloat mask, VFloat a, VFloat b) { return _mm256_blendv_ps(b, a, mask); }
+inline int    VMoveMask(VFloat a) { return _mm256_movemask_ps(a); }
+inline VFloat VFloor(VFloat a) { return _mm256_floor_ps(a); }
+inline VInt   VToInt(VFloat a) { return _mm256_cvttps_epi32(a); }
+inline VFloat VLoad(const float *p) { return _mm256_loadu_ps(p); }
+inline void   VStore(float *p, VFloat a) { _mm256_storeu_ps(p, a); }
+
+inline VInt VTexelIndex(VInt x, VInt y, int width) { return _mm256_add_epi32(_mm256_mullo_epi32(y, _mm256_set1_epi32(width)), x); }
+inline VInt VGather(const uint32_t *base, VInt index) { return _mm256_i32gather_epi32(reinterpret_cast<const int*>(base), index, 4); }
+inline void VStoreColor(uint32_t *p, VFloat mask, VInt color)
+{
+	_mm256_maskstore_epi32(reinterpret_cast<int*>(p), _mm256_castps_si256(mask), color);
+}
+#else
+typedef __m128  VFloat;
+typedef __m128i VInt;
+const int kLanes = 4;
+
+inline VFloat VSet(float a) { return _mm_set1_ps(a); }
+inline VFloat VLaneOffsets() { return _mm_setr_ps(0.5f, 1.5f, 2.5f, 3.5f); }
+inline VFloat VAdd(VFloat a, VFloat b) { return _mm_add_ps(a, b); }
+inline VFloat VSub(VFloat a, VFloat b) { return _mm_sub_ps(a, b); }
+inline VFloat VMul(VFloat a, VFloat b) { return _mm_mul_ps(a, b); }
+inline VFloat VDiv(VFloat a, VFloat b) { return _mm_div_ps(a, b); }
+inline VFloat VAnd(VFloat a, VFloat b) { return _mm_and_ps(a, b); }
+inline VFloat VOr(VFloat a, VFloat b) { return _mm_or_ps(a, b); }
+inline VFloat VCmpGt(VFloat a, VFloat b) { return _mm_cmpgt_ps(a, b); }
+inline VFloat VCmpGe(VFloat a, VFloat b) { return _mm_cmpge_ps(a, b); }
+inline VFloat VCmpLt(VFloat a, VFloat b) { return _mm_cmplt_ps(a, b); }
+inline VFloat VCmpLe(VFloat a, VFloat b) { return _mm_cmple_ps(a, b); }
+inline VFloat VSelect(VFloat mask, VFloat a, VFloat b) { return _mm_or_ps(_mm_and_ps(mask, a), _mm_andnot_ps(mask, b)); }
+inline int    VMoveMask(VFloat a) { return _mm_movemask_ps(a); }
+inline VInt   VToInt(VFloat a) { return _mm_cvttps_epi32(a); }
+inline VFloat VLoad(const float *p) { return _mm_loadu_ps(p); }
+inline void   VStore(float *p, VFloat a) { _mm_storeu_ps(p, a); }
+
+inline VFloat VFloor(VFloat a)
+{
+	// SSE2 has no round instruction: truncate and step down for negative fractions
+	VFloat t = _mm_cvtepi32_ps(_mm_cvttps_epi32(a));
+	return _mm_sub_ps(t, _mm_and_ps(_mm_cmpgt_ps(t, a), _mm_set1_ps(1.0f)));
+}
+
+inline VInt VTexelIndex(VInt x, VInt y, int width)
+{
+	// no 32 bit mullo in SSE2, texture sizes are small enough for 16 bit multiply
+	return _mm_add_epi32(_mm_madd_epi16(y, _mm_set1_epi32(width)), x);
+}
+
+inline VInt VGather(const uint32_t *base, VInt index)
+{
+	alignas(16) int32_t idx[4];
+	_mm_store_si128(reinterpret_cast<__m128i*>(idx), index);
+	return _mm_setr_epi32(base[idx[0]], base[idx[1]], base[idx[2]], base[idx[3]]);
+}
+
+inline void VStoreColor(uint32_t *p, VFloat mask, VInt color)
+{
+	__m128i m = _mm_castps_si128(mask);
+	__m128i old = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+	_mm_storeu_si128(reinterpret_cast<__m128i*>(p), _mm_or_si128(_mm_and_si128(m, color), _mm_andnot_si128(m, old)));
+}
+#endif
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+static uint32_t PackColor(const float color[4])
+{
+	uint32_t packed = 0;
+	for (int i = 0; i < 4; i++)
+	{
+		float c = std::min(std::max(color[i], 0.0f), 1.0f);
+		packed |= static_cast<uint32_t>(c * 255.0f + 0.5f) << (i * 8);
+	}
+	return packed;
+}
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+SoftRasterizer::SoftRasterizer(int width, int height, int numThreads)
+	: mWidth(width)
+	, mHeight(height)
+	, mPitch((width + kLanes - 1) / kLanes * kLanes)
+	, mTilesX((width + kTileSize - 1) / kTileSize)
+	, mTilesY((height + kTileSize - 1) / kTileSize)
+	, mClearColor(0)
+	, mClearDepth(1.0f)
+	, mClearPending(false)
+	, mViewProj(MatIdentity())
+	, mTrianglesDrawn(0)
+	, mShadedPixels(0)
+	, mGeneration(0)
+	, mBusyWorkers(0)
+	, mQuit(false)
+	, mNextTile(0)
+{
+	mBoundTexture.width = 0;
+	mBoundTexture.height = 0;
+	mBoundTexture.texels = nullptr;
+
+	mColor.resize(mPitch * mHeight, 0);
+	mDepth.resize(mPitch * mHeight, 1.0f);
+	mTileBins.resize(mTilesX * mTilesY);
+
+	if (numThreads <= 0)
+		numThreads = std::max(1u, std::thread::hardware_concurrency());
+	for (int i = 1; i < numThreads; i++)
+		mWorkers.push_back(std::thread(&SoftRasterizer::WorkerLoop, this));
+}
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+SoftRasterizer::~SoftRasterizer()
+{
+	{
+		std::lock_guard<std::mutex> lock(mMutex);
+		mQuit = true;
+	}
+	mWakeUp.notify_all();
+	for (size_t i = 0; i < mWorkers.size(); i++)
+		mWorkers[i].join();
+}
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+void SoftRasterizer::Clear(const float color[4], float depth)
+{
+	// binned triangles would be overwritten anyway
+	mTriangles.clear();
+	mTextures.clear();
+	ClearBins();
+
+	mClearColor = PackColor(color);
+	mClearDepth = depth;
+	mClearPending = true;
+}
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+void SoftRasterizer::SetMatrices(const Mat4 &projection, const Mat4 &view)
+{
+	mViewProj = MatMultiply(view, projection);
+}
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+void SoftRasterizer::SetTexture(const SoftTexture &texture)
+{
+	mBoundTexture = texture;
+}
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+bool SoftRasterizer::BeginDraw()
+{
+	if (!mBoundTexture.texels)
+		return false; // nothing bound to t0
+
+	// triangles reference a snapshot of the binding they were drawn with
+	if (mTextures.empty() || mTextures.back().texels != mBoundTexture.texels)
+		mTextures.push_back(mBoundTexture);
+	return true;
+}
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+void SoftRasterizer::Draw(const SoftVertex *vertices, size_t verticesCount, const Mat4 &world)
+{
+	if (!BeginDraw())
+		return;
+
+	Mat4 wvp = MatMultiply(world, mViewProj);
+
+	for (size_t i = 0; i + 2 < verticesCount; i += 3)
+	{
+		ClipVertex in[3];
+		for (int k = 0; k < 3; k++)
+			in[k] = TransformVertex(vertices[i + k], wvp);
+		ClipTriangle(in);
+	}
+}
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+void SoftRasterizer::DrawIndexed(const SoftVertex *vertices, size_t verticesCount, const uint32_t *indices, size_t indicesCount,
+	const Mat4 &world)
+{
+	if (!BeginDraw())
+		return;
+
+	// every vertex is transformed once and shared by its triangles, like the post-transform cache
+	Mat4 wvp = MatMultiply(world, mViewProj);
+	mTransformed.resize(verticesCount);
+	for (size_t i = 0; i < verticesCount; i++)
+		mTransformed[i] = TransformVertex(vertices[i], wvp);
+
+	for (size_t i = 0; i + 2 < indicesCount; i += 3)
+	{
+		if (indices[i] >= verticesCount || indices[i + 1] >= verticesCount || indices[i + 2] >= verticesCount)
+			continue;
+		ClipVertex in[3] = { mTransformed[indices[i]], mTransformed[indices[i + 1]], mTransformed[indices[i + 2]] };
+		ClipTriangle(in);
+	}
+}
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+SoftRasterizer::ClipVertex SoftRasterizer::TransformVertex(const SoftVertex &vertex, const Mat4 &wvp)
+{
+	ClipVertex out;
+	Vec4 pos = { vertex.x, vertex.y, vertex.z, 1.0f };
+	out.pos = Vec4Transform(pos, wvp);
+	out.u = vertex.u;
+	out.v = vertex.v;
+	return out;
+}
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+void SoftRasterizer::ClipTriangle(const ClipVertex in[3])
+{
+	// clip against the near plane (z >= 0 in D3D clip space), other planes are handled by the screen bounds
+	ClipVertex out[4];
+	int outCount = 0;
+	for (int k = 0; k < 3; k++)
+	{
+		const ClipVertex &a = in[k];
+		const ClipVertex &b = in[(k + 1) % 3];
+		bool aInside = a.pos.z >= 0.0f;
+		bool bInside = b.pos.z >= 0.0f;
+		if (aInside)
+			out[outCount++] = a;
+		if (aInside != bInside)
+		{
+			float t = a.pos.z / (a.pos.z - b.pos.z);
+			ClipVertex &c = out[outCount++];
+			c.pos.x = a.pos.x + (b.pos.x - a.pos.x) * t;
+			c.pos.y = a.pos.y + (b.pos.y - a.pos.y) * t;
+			c.pos.z = a.pos.z + (b.pos.z - a.pos.z) * t;
+			c.pos.w = a.pos.w + (b.pos.w - a.pos.w) * t;
+			c.u = a.u + (b.u - a.u) * t;
+			c.v = a.v + (b.v - a.v) * t;
+		}
+	}
+
+	for (int k = 2; k < outCount; k++)
+		SetupTriangle(out[0], out[k - 1], out[k]);
+}
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+void SoftRasterizer::SetupTriangle(const ClipVertex &v0, const ClipVertex &v1, const ClipVertex &v2)
+{
+	const ClipVertex *cv[3] = { &v0, &v1, &v2 };
+	float sx[3], sy[3], sz[3], invW[3], u[3], v[3];
+	for (int k = 0; k < 3; k++)
+	{
+		const Vec4 &p = cv[k]->pos;
+		if (p.w <= 0.0f)
+			return;
+		invW[k] = 1.0f / p.w;
+		// viewport transform, same as SetupViewport (MinDepth 0, MaxDepth 1)
+		sx[k] = (p.x * invW[k] * 0.5f + 0.5f) * mWidth;
+		sy[k] = (0.5f - p.y * invW[k] * 0.5f) * mHeight;
+		sz[k] = p.z * invW[k];
+		u[k] = cv[k]->u * invW[k];
+		v[k] = cv[k]->v * invW[k];
+	}
+
+	float area = (sx[1] - sx[0]) * (sy[2] - sy[0]) - (sy[1] - sy[0]) * (sx[2] - sx[0]);
+	if (area == 0.0f)
+		return;
+
+	Triangle tri;
+	// edge k is opposite to vertex k, so its function is the unnormalized barycentric of vertex k
+	for (int k = 0; k < 3; k++)
+	{
+		int a = (k + 1) % 3;
+		int b = (k + 2) % 3;
+		float sign = area > 0.0f ? 1.0f : -1.0f; // CULL_NONE: flip back facing triangles
+		tri.edgeA[k] = (sy[a] - sy[b]) * sign;
+		tri.edgeB[k] = (sx[b] - sx[a]) * sign;
+		tri.edgeC[k] = (sx[a] * sy[b] - sx[b] * sy[a]) * sign;
+		// inside is on the right of a left edge, or below a horizontal top edge (y goes down)
+		tri.topLeft[k] = tri.edgeA[k] > 0.0f || (tri.edgeA[k] == 0.0f && tri.edgeB[k] > 0.0f);
+	}
+	float invArea = 1.0f / std::fabs(area);
+
+	const float *attribs[4] = { sz, invW, u, v };
+	float *planes[4] = { tri.zPlane, tri.invWPlane, tri.uPlane, tri.vPlane };
+	for (int i = 0; i < 4; i++)
+	{
+		const float *at = attribs[i];
+		for (int c = 0; c < 3; c++)
+		{
+			const float *edge = c == 0 ? tri.edgeA : (c == 1 ? tri.edgeB : tri.edgeC);
+			planes[i][c] = (at[0] * edge[0] + at[1] * edge[1] + at[2] * edge[2]) * invArea;
+		}
+	}
+
+	float minX = std::min(sx[0], std::min(sx[1], sx[2]));
+	float maxX = std::max(sx[0], std::max(sx[1], sx[2]));
+	float minY = std::min(sy[0], std::min(sy[1], sy[2]));
+	float maxY = std::max(sy[0], std::max(sy[1], sy[2]));
+	if (maxX < 0.0f || maxY < 0.0f || minX >= mWidth || minY >= mHeight)
+		return;
+	tri.minX = std::max(0, static_cast<int>(std::floor(minX)));
+	tri.minY = std::max(0, static_cast<int>(std::floor(minY)));
+	tri.maxX = std::min(mWidth - 1, static_cast<int>(std::ceil(maxX)));
+	tri.maxY = std::min(mHeight - 1, static_cast<int>(std::ceil(maxY)));
+	tri.texture = static_cast<int>(mTextures.size()) - 1;
+
+	uint32_t index = static_cast<uint32_t>(mTriangles.size());
+	mTriangles.push_back(tri);
+	mTrianglesDrawn++;
+
+	// bins keep submission order, so the result does not depend on which worker takes which tile
+	for (int ty = tri.minY / kTileSize; ty <= tri.maxY / kTileSize; ty++)
+		for (int tx = tri.minX / kTileSize; tx <= tri.maxX / kTileSize; tx++)
+			mTileBins[ty * mTilesX + tx].push_back(index);
+}
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+void SoftRasterizer::Flush()
+{
+	mNextTile = 0;
+	{
+		std::lock_guard<std::mutex> lock(mMutex);
+		mGeneration++;
+		mBusyWorkers = static_cast<int>(mWorkers.size());
+	}
+	mWakeUp.notify_all();
+
+	ProcessTiles();
+
+	{
+		std::unique_lock<std::mutex> lock(mMutex);
+		while (mBusyWorkers > 0)
+			mDone.wait(lock);
+	}
+
+	mTriangles.clear();
+	mTextures.clear();
+	ClearBins();
+	mClearPending = false;
+}
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+void SoftRasterizer::ClearBins()
+{
+	// every bin keeps room for half again the fullest one, so objects moving into a tile do not grow its bin in
+	// steady frames
+	size_t fullest = 0;
+	for (size_t i = 0; i < mTileBins.size(); i++)
+		fullest = std::max(fullest, mTileBins[i].size());
+	for (size_t i = 0; i < mTileBins.size(); i++)
+	{
+		mTileBins[i].clear();
+		if (mTileBins[i].capacity() < fullest)
+			mTileBins[i].reserve(fullest + fullest / 2);
+	}
+}
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+void SoftRasterizer::WorkerLoop()
+{
+	unsigned seenGeneration = 0;
+	for (;;)
+	{
+		{
+			std::unique_lock<std::mutex> lock(mMutex);
+			while (!mQuit && mGeneration == seenGeneration)
+				mWakeUp.wait(lock);
+			if (mQuit)
+				return;
+			seenGeneration = mGeneration;
+		}
+
+		ProcessTiles();
+
+		{
+			std::lock_guard<std::mutex> lock(mMutex);
+			mBusyWorkers--;
+		}
+		mDone.notify_one();
+	}
+}
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+void SoftRasterizer::ProcessTiles()
+{
+	const int tilesCount = mTilesX * mTilesY;
+	for (int tile = mNextTile++; tile < tilesCount; tile = mNextTile++)
+		RasterizeTile(tile);
+}
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+void SoftRasterizer::RasterizeTile(int tile)
+{
+	int tileMinX = (tile % mTilesX) * kTileSize;
+	int tileMinY = (tile / mTilesX) * kTileSize;
+	int tileMaxX = std::min(tileMinX + kTileSize, mWidth) - 1;
+	int tileMaxY = std::min(tileMinY + kTileSize, mHeight) - 1;
+
+	if (mClearPending)
+	{
+		for (int y = tileMinY; y <= tileMaxY; y++)
+		{
+			std::fill(&mColor[y * mPitch + tileMinX], &mColor[y * mPitch + tileMaxX] + 1, mClearColor);
+			std::fill(&mDepth[y * mPitch + tileMinX], &mDepth[y * mPitch + tileMaxX] + 1, mClearDepth);
+		}
+	}
+
+	const std::vector<uint32_t> &bin = mTileBins[tile];
+	uint64_t shaded = 0;
+	for (size_t i = 0; i < bin.size(); i++)
+		shaded += RasterizeTriangle(mTriangles[bin[i]], tileMinX, tileMinY, tileMaxX, tileMaxY);
+	mShadedPixels.fetch_add(shaded, std::memory_order_relaxed);
+}
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+uint32_t SoftRasterizer::RasterizeTriangle(const Triangle &tri, int tileMinX, int tileMinY, int tileMaxX, int tileMaxY)
+{
+	// tiles are a multiple of the lane count and rows are padded, so aligned spans never leave the buffer
+	int minX = std::max(tri.minX, tileMinX) / kLanes * kLanes;
+	int maxX = std::min(tri.maxX, tileMaxX);
+	int minY = std::max(tri.minY, tileMinY);
+	int maxY = std::min(tri.maxY, tileMaxY);
+	if (minX > maxX || minY > maxY)
+		return 0;
+
+	const SoftTexture &tex = mTextures[tri.texture];
+	const VFloat texW = VSet(static_cast<float>(tex.width));
+	const VFloat texH = VSet(static_cast<float>(tex.height));
+	const VFloat texMaxX = VSet(static_cast<float>(tex.width - 1));
+	const VFloat texMaxY = VSet(static_cast<float>(tex.height - 1));
+	const VFloat zero = VSet(0.0f);
+	const VFloat one = VSet(1.0f);
+	const VFloat laneOffsets = VLaneOffsets();
+
+	VFloat edgeStepX[3];
+	for (int k = 0; k < 3; k++)
+		edgeStepX[k] = VSet(tri.edgeA[k] * kLanes);
+
+	uint32_t shaded = 0;
+	for (int y = minY; y <= maxY; y++)
+	{
+		const float py = y + 0.5f;
+		const VFloat px = VAdd(VSet(static_cast<float>(minX)), laneOffsets);
+
+		VFloat edge[3];
+		for (int k = 0; k < 3; k++)
+			edge[k] = VAdd(VMul(VSet(tri.edgeA[k]), px), VSet(tri.edgeB[k] * py + tri.edgeC[k]));
+
+		VFloat z = VAdd(VMul(VSet(tri.zPlane[0]), px), VSet(tri.zPlane[1] * py + tri.zPlane[2]));
+		VFloat invW = VAdd(VMul(VSet(tri.invWPlane[0]), px), VSet(tri.invWPlane[1] * py + tri.invWPlane[2]));
+		VFloat uw = VAdd(VMul(VSet(tri.uPlane[0]), px), VSet(tri.uPlane[1] * py + tri.uPlane[2]));
+		VFloat vw = VAdd(VMul(VSet(tri.vPlane[0]), px), VSet(tri.vPlane[1] * py + tri.vPlane[2]));
+		const VFloat zStep = VSet(tri.zPlane[0] * kLanes);
+		const VFloat invWStep = VSet(tri.invWPlane[0] * kLanes);
+		const VFloat uwStep = VSet(tri.uPlane[0] * kLanes);
+		const VFloat vwStep = VSet(tri.vPlane[0] * kLanes);
+
+		float *depthRow = &mDepth[y * mPitch];
+		uint32_t *colorRow = &mColor[y * mPitch];
+
+		for (int x = minX; x <= maxX; x += kLanes)
+		{
+			VFloat mask = tri.topLeft[0] ? VCmpGe(edge[0], zero) : VCmpGt(edge[0], zero);
+			for (int k = 1; k < 3; k++)
+				mask = VAnd(mask, tri.topLeft[k] ? VCmpGe(edge[k], zero) : VCmpGt(edge[k], zero));
+
+			if (VMoveMask(mask))
+			{
+				// depth test LESS against [0, 1]
+				VFloat oldDepth = VLoad(depthRow + x);
+				mask = VAnd(mask, VAnd(VCmpLt(z, oldDepth), VAnd(VCmpGe(z, zero), VCmpLe(z, one))));
+
+				int shadedLanes = VMoveMask(mask);
+				if (shadedLanes)
+				{
+					for (; shadedLanes; shadedLanes &= shadedLanes - 1)
+						shaded++;
+					VStore(depthRow + x, VSelect(mask, z, oldDepth));
+
+					// perspective correct texCoord, point sampled with WRAP addressing
+					VFloat w = VDiv(one, invW);
+					VFloat u = VMul(uw, w);
+					VFloat v = VMul(vw, w);
+					u = VMul(VSub(u, VFloor(u)), texW);
+					v = VMul(VSub(v, VFloor(v)), texH);
+					VFloat tu = VSelect(VCmpGt(u, texMaxX), texMaxX, u);
+					VFloat tv = VSelect(VCmpGt(v, texMaxY), texMaxY, v);
+
+					VInt texel = VGather(tex.texels, VTexelIndex(VToInt(tu), VToInt(tv), tex.width));
+					VStoreColor(colorRow + x, mask, texel);
+				}
+			}
+
+			for (int k = 0; k < 3; k++)
+				edge[k] = VAdd(edge[k], edgeStepX[k]);
+			z = VAdd(z, zStep);
+			invW = VAdd(invW, invWStep);
+			uw = VAdd(uw, uwStep);
+			vw = VAdd(vw, vwStep);
+		}
+	}
+	return shaded;
+}
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+bool SoftRasterizer::SavePPM(const char *path) const
+{
+	FILE *file = fopen(path, "wb");
+	if (!file)
+		return false;
+
+	fprintf(file, "P6\n%d %d\n255\n", mWidth, mHeight);
+	std::vector<unsigned char> row(mWidth * 3);
+	bool ok = true;
+	for (int y = 0; y < mHeight && ok; y++)
+	{
+		for (int x = 0; x < mWidth; x++)
+		{
+			uint32_t c = mColor[y * mPitch + x];
+			row[x * 3 + 0] = static_cast<unsigned char>(c);
+			row[x * 3 + 1] = static_cast<unsigned char>(c >> 8);
+			row[x * 3 + 2] = static_cast<unsigned char>(c >> 16);
+		}
+		ok = fwrite(&row[0], 1, row.size(), file) == row.size();
+	}
+	fclose(file);
+	return ok;
+}
@@ -0,0 +1,138 @@
+#pragma once
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// CPU backend of the RenderTick pipeline, used on machines without a GPU (Linux CI, profiling, image diffs).
+// It mirrors the D3D11 setup in main.cpp:
+//   - SimpleVertexShader: world -> view -> projection transform, texCoord passthrough
+//   - triangle lists, CULL_NONE, depth test LESS with depth writes
+//   - SimplePixelShader: point sampled (MIN_MAG_MIP_POINT), WRAP addressed R8G8B8A8 texture
+// Triangles are binned into screen tiles on Draw and rasterized on Flush with SIMD edge functions
+// (AVX2 when compiled with it, SSE2 otherwise), one tile per worker at a time.
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+#include "MathUtils.h"
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// same layout as MeshVertex
+struct SoftVertex
+{
+	float x, y, z;
+	float u, v;
+};
+
+// R8G8B8A8 texels, single mip
+struct SoftTexture
+{
+	uint32_t        width;
+	uint32_t        height;
+	const uint32_t *texels;
+};
+
+class SoftRasterizer
+{
+public:
+	// numThreads == 0 uses all hardware threads
+	SoftRasterizer(int width, int height, int numThreads = 0);
+	~SoftRasterizer();
+
+	// ClearRenderTargetView + ClearDepthStencilView, applied on the next Flush
+	void Clear(const float color[4], float depth);
+
+	// CB_Appliation and CB_Frame
+	void SetMatrices(const Mat4 &projection, const Mat4 &view);
+	// PSSetShaderResources, stays bound across frames like in D3D; texels must stay alive until Flush
+	void SetTexture(const SoftTexture &texture);
+
+	// transforms, clips and bins a triangle list, nothing is written until Flush
+	void Draw(const SoftVertex *vertices, size_t verticesCount, const Mat4 &world);
+	// indexed triangle list, triangles with an index out of range are skipped
+	void DrawIndexed(const SoftVertex *vertices, size_t verticesCount, const uint32_t *indices, size_t indicesCount, const Mat4 &world);
+	// rasterizes everything binned since the last Flush
+	void Flush();
+
+	int GetWidth() const { return mWidth; }
+	int GetHeight() const { return mHeight; }
+	int GetThreadsCount() const { return static_cast<int>(mWorkers.size()) + 1; }
+	size_t GetTrianglesCount() const { return mTrianglesDrawn; }
+	// pixels that passed the depth test and ran the pixel shader, overdraw included; counted by Flush
+	uint64_t GetShadedPixels() const { return mShadedPixels.load(std::memory_order_relaxed); }
+
+	// R8G8B8A8 rows of GetPitch() texels
+	const uint32_t* GetColorBuffer() const { return &mColor[0]; }
+	const float* GetDepthBuffer() const { return &mDepth[0]; }
+	int GetPitch() const { return mPitch; }
+
+	// binary PPM (P6), alpha is dropped
+	bool SavePPM(const char *path) const;
+
+private:
+	struct Triangle
+	{
+		// edge functions, inside when all three are positive (or zero on a top-left edge)
+		float edgeA[3], edgeB[3], edgeC[3];
+		bool  topLeft[3];
+		// screen space planes (a * x + b * y + c) of z, 1/w, u/w, v/w
+		float zPlane[3], invWPlane[3], uPlane[3], vPlane[3];
+		int   minX, minY, maxX, maxY;
+		int   texture;
+	};
+
+	struct ClipVertex
+	{
+		Vec4  pos;
+		float u, v;
+	};
+
+	SoftRasterizer(const SoftRasterizer&);
+	SoftRasterizer& operator=(const SoftRasterizer&);
+
+	bool BeginDraw();
+	static ClipVertex TransformVertex(const SoftVertex &vertex, const Mat4 &wvp);
+	void ClipTriangle(const ClipVertex in[3]);
+	void SetupTriangle(const ClipVertex &v0, const ClipVertex &v1, const ClipVertex &v2);
+	void RasterizeTile(int tile);
+	void ClearBins();
+	// returns the pixels shaded
+	uint32_t RasterizeTriangle(const Triangle &tri, int tileMinX, int tileMinY, int tileMaxX, int tileMaxY);
+	void ProcessTiles();
+	void WorkerLoop();
+
+	static const int kTileSize = 64;
+
+	int mWidth;
+	int mHeight;
+	int mPitch; // padded to the SIMD width
+	int mTilesX;
+	int mTilesY;
+
+	std::vector<uint32_t> mColor;
+	std::vector<float>    mDepth;
+
+	uint32_t mClearColor;
+	float    mClearDepth;
+	bool     mClearPending;
+
+	Mat4                     mViewProj;
+	SoftTexture              mBoundTexture;
+	std::vector<SoftTexture> mTextures;
+
+	std::vector<ClipVertex>            mTransformed; // DrawIndexed scratch
+	std::vector<Triangle>              mTriangles;
+	std::vector<std::vector<uint32_t>> mTileBins;
+	size_t                             mTrianglesDrawn;
+	std::atomic<uint64_t>              mShadedPixels;
+
+	// worker pool, Flush wakes it up and also rasterizes tiles on the calling thread
+	std::vector<std::thread> mWorkers;
+	std::mutex               mMutex;
+	std::condition_variable  mWakeUp;
+	std::condition_variable  mDone;
+	unsigned                 mGeneration;
+	int                      mBusyWorkers;
+	bool                     mQuit;
+	std::atomic<int>         mNextTile;
+};
@@ -0,0 +1,411 @@
+#include "StateCache.h"
+
+#include <cassert>
+#include <cfloat>
+#include <cstring>
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+namespace
+{
+	// the D3D11 enum values the defaults and the canonical forms need
+	const uint32_t kDepthWriteMaskAll = 1;         // D3D11_DEPTH_WRITE_MASK_ALL
+	const uint32_t kComparisonNever = 1;           // D3D11_COMPARISON_NEVER
+	const uint32_t kComparisonLess = 2;            // D3D11_COMPARISON_LESS
+	const uint32_t kComparisonAlways = 8;          // D3D11_COMPARISON_ALWAYS
+	const uint32_t kStencilOpKeep = 1;             // D3D11_STENCIL_OP_KEEP
+	const uint32_t kFillSolid = 3;                 // D3D11_FILL_SOLID
+	const uint32_t kCullBack = 3;                  // D3D11_CULL_BACK
+	const uint32_t kFilterMinMagMipLinear = 0x15;  // D3D11_FILTER_MIN_MAG_MIP_LINEAR
+	const uint32_t kFilterAnisotropic = 0x55;      // D3D11_FILTER_ANISOTROPIC, without the reduction bits
+	const uint32_t kFilterReductionMask = 0x180;   // comparison, minimum and maximum filters
+	const uint32_t kFilterReductionCompare = 0x80; // D3D11_FILTER_COMPARISON_*
+	const uint32_t kAddressClamp = 3;              // D3D11_TEXTURE_ADDRESS_CLAMP
+	const uint32_t kAddressBorder = 4;             // D3D11_TEXTURE_ADDRESS_BORDER
+	const uint32_t kBlendZero = 1;                 // D3D11_BLEND_ZERO
+	const uint32_t kBlendOne = 2;                  // D3D11_BLEND_ONE
+	const uint32_t kBlendOpAdd = 1;                // D3D11_BLEND_OP_ADD
+	const uint8_t  kColorWriteAll = 0xF;           // D3D11_COLOR_WRITE_ENABLE_ALL
+
+	int32_t CanonicalBool(int32_t value)
+	{
+		return value ? 1 : 0;
+	}
+
+	// -0.0f has other bytes than 0.0f
+	float CanonicalFloat(float value)
+	{
+		return value == 0.0f ? 0.0f : value;
+	}
+
+	StencilOpDesc DefaultStencilOp()
+	{
+		StencilOpDesc op;
+		op.stencilFailOp = kStencilOpKeep;
+		op.stencilDepthFailOp = kStencilOpKeep;
+		op.stencilPassOp = kStencilOpKeep;
+		op.stencilFunc = kComparisonAlways;
+		return op;
+	}
+
+	TargetBlendDesc DefaultTarget()
+	{
+		TargetBlendDesc target;
+		memset(&target, 0, sizeof(target));
+		target.srcBlend = kBlendOne;
+		target.destBlend = kBlendZero;
+		target.blendOp = kBlendOpAdd;
+		target.srcBlendAlpha = kBlendOne;
+		target.destBlendAlpha = kBlendZero;
+		target.blendOpAlpha = kBlendOpAdd;
+		target.renderTargetWriteMask = kColorWriteAll;
+		return target;
+	}
+
+	TargetBlendDesc CanonicalTarget(const TargetBlendDesc &desc)
+	{
+		TargetBlendDesc target = DefaultTarget();
+		target.renderTargetWriteMask = desc.renderTargetWriteMask & kColorWriteAll;
+		if (desc.blendEnable)
+		{
+			target.blendEnable = 1;
+			target.srcBlend = desc.srcBlend;
+			target.destBlend = desc.destBlend;
+			target.blendOp = desc.blendOp;
+			target.srcBlendAlpha = desc.srcBlendAlpha;
+			target.destBlendAlpha = desc.destBlendAlpha;
+			target.blendOpAlpha = desc.blendOpAlpha;
+		}
+		return target;
+	}
+}
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+DepthStencilDesc DefaultDepthStencilDesc()
+{
+	DepthStencilDesc desc;
+	memset(&desc, 0, sizeof(desc));
+	desc.depthEnable = 1;
+	desc.depthWriteMask = kDepthWriteMaskAll;
+	desc.depthFunc = kComparisonLess;
+	desc.stencilEnable = 0;
+	desc.stencilReadMask = 0xFF;
+	desc.stencilWriteMask = 0xFF;
+	desc.frontFace = DefaultStencilOp();
+	desc.backFace = DefaultStencilOp();
+	return desc;
+}
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+RasterizerDesc DefaultRasterizerDesc()
+{
+	RasterizerDesc desc;
+	memset(&desc, 0, sizeof(desc));
+	desc.fillMode = kFillSolid;
+	desc.cullMode = kCullBack;
+	desc.depthClipEnable = 1;
+	return desc;
+}
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+SamplerDesc DefaultSamplerDesc()
+{
+	SamplerDesc desc;
+	memset(&desc, 0, sizeof(desc));
+	desc.filter = kFilterMinMagMipLinear;
+	desc.addressU = kAddressClamp;
+	desc.addressV = kAddressClamp;
+	desc.addressW = kAddressClamp;
+	desc.maxAnisotropy = 1;
+	desc.comparisonFunc = kComparisonNever;
+	for (int i = 0; i < 4; i++)
+		desc.borderColor[i] = 1.0f;
+	desc.minLOD = -FLT_MAX;
+	desc.maxLOD = FLT_MAX;
+	return desc;
+}
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+BlendDesc DefaultBlendDesc()
+{
+	BlendDesc desc;
+	desc.alphaToCoverageEnable = 0;
+	desc.independentBlendEnable = 0;
+	for (unsigned i = 0; i < BlendDesc::kMaxTargets; i++)
+		desc.renderTarget[i] = DefaultTarget();
+	return desc;
+}
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// the depth test is off: no writes or function matter; the stencil test is off: no masks or ops matter
+DepthStencilDesc Canonicalize(const DepthStencilDesc &desc)
+{
+	DepthStencilDesc canonical = DefaultDepthStencilDesc();
+	canonical.depthEnable = CanonicalBool(desc.depthEnable);
+	if (desc.depthEnable)
+	{
+		canonical.depthWriteMask = desc.depthWriteMask;
+		canonical.depthFunc = desc.depthFunc;
+	}
+	canonical.stencilEnable = CanonicalBool(desc.stencilEnable);
+	if (desc.stencilEnable)
+	{
+		canonical.stencilReadMask = desc.stencilReadMask;
+		canonical.stencilWriteMask = desc.stencilWriteMask;
+		canonical.frontFace = desc.frontFace;
+		canonical.backFace = desc.backFace;
+	}
+	return canonical;
+}
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// the clamp only limits a bias, without one it does nothing
+RasterizerDesc Canonicalize(const RasterizerDesc &desc)
+{
+	RasterizerDesc canonical = DefaultRasterizerDesc();
+	canonical.fillMode = desc.fillMode;
+	canonical.cullMode = desc.cullMode;
+	canonical.frontCounterClockwise = CanonicalBool(desc.frontCounterClockwise);
+	canonical.depthBias = desc.depthBias;
+	canonical.slopeScaledDepthBias = CanonicalFloat(desc.slopeScaledDepthBias);
+	if (canonical.depthBias || canonical.slopeScaledDepthBias != 0.0f)
+		canonical.depthBiasClamp = CanonicalFloat(desc.depthBiasClamp);
+	canonical.depthClipEnable = CanonicalBool(desc.depthClipEnable);
+	canonical.scissorEnable = CanonicalBool(desc.scissorEnable);
+	canonical.multisampleEnable = CanonicalBool(desc.multisampleEnable);
+	canonical.antialiasedLineEnable = CanonicalBool(desc.antialiasedLineEnable);
+	return canonical;
+}
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// the anisotropy only counts for anisotropic filters, the function for comparison filters, the color for borders
+SamplerDesc Canonicalize(const SamplerDesc &desc)
+{
+	SamplerDesc canonical = DefaultSamplerDesc();
+	canonical.filter = desc.filter;
+	canonical.addressU = desc.addressU;
+	canonical.addressV = desc.addressV;
+	canonical.addressW = desc.addressW;
+	canonical.mipLODBias = CanonicalFloat(desc.mipLODBias);
+	if ((desc.filter & ~kFilterReductionMask) == kFilterAnisotropic)
+		canonical.maxAnisotropy = desc.maxAnisotropy;
+	if ((desc.filter & kFilterReductionMask) == kFilterReductionCompare)
+		canonical.comparisonFunc = desc.comparisonFunc;
+	if (desc.addressU == kAddressBorder || desc.addressV == kAddressBorder || desc.addressW == kAddressBorder)
+	{
+		for (int i = 0; i < 4; i++)
+			canonical.borderColor[i] = CanonicalFloat(desc.borderColor[i]);
+	}
+	canonical.minLOD = CanonicalFloat(desc.minLOD);
+	canonical.maxLOD = CanonicalFloat(desc.maxLOD);
+	return canonical;
+}
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// without independent blending every target uses the first one's settings; disabled blending ignores its factors
+BlendDesc Canonicalize(const BlendDesc &desc)
+{
+	BlendDesc canonical;
+	canonical.alphaToCoverageEnable = CanonicalBool(desc.alphaToCoverageEnable);
+	canonical.independentBlendEnable = CanonicalBool(desc.independentBlendEnable);
+	canonical.renderTarget[0] = CanonicalTarget(desc.renderTarget[0]);
+	for (unsigned i = 1; i < BlendDesc::kMaxTargets; i++)
+		canonical.renderTarget[i] = desc.independentBlendEnable ? CanonicalTarget(desc.renderTarget[i]) : canonical.renderTarget[0];
+	return canonical;
+}
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// a byte at a time the bundle's 356 bytes would take longer than the rest of the lookup
+uint64_t HashState(StateKind kind, const void *canonical, size_t size)
+{
+	uint64_t hash = 14695981039346656037ull;
+	hash = (hash ^ static_cast<uint64_t>(kind)) * 1099511628211ull;
+	const unsigned char *bytes = static_cast<const unsigned char*>(canonical);
+	size_t i = 0;
+	for (; i + sizeof(uint64_t) <= size; i += sizeof(uint64_t))
+	{
+		uint64_t word;
+		memcpy(&word, bytes + i, sizeof(word));
+		hash = (hash ^ word) * 1099511628211ull;
+		hash ^= hash >> 29;
+	}
+	for (; i < size; i++)
+		hash = (hash ^ bytes[i]) * 1099511628211ull;
+	// the probe uses the low bits, which the multiplications only fill from below
+	hash ^= hash >> 32;
+	hash *= 0xD6E8FEB86659FD93ull;
+	hash ^= hash >> 32;
+	return hash;
+}
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+StateCache::StateCache(StateFactory &factory)
+	: mFactory(factory)
+	, mSlots(new std::atomic<Entry*>[kSlotsCount])
+	, mFailures(0)
+{
+	for (size_t i = 0; i < kSlotsCount; i++)
+		mSlots[i].store(nullptr, std::memory_order_relaxed);
+	for (int kind = 0; kind < NumStateKinds; kind++)
+	{
+		mLookups[kind].store(0, std::memory_order_relaxed);
+		mHits[kind].store(0, std::memory_order_relaxed);
+		mObjects[kind].store(0, std::memory_order_relaxed);
+	}
+}
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+StateCache::~StateCache()
+{
+	Clear();
+}
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+void* StateCache::GetDepthStencil(const DepthStencilDesc &desc)
+{
+	DepthStencilDesc canonical = Canonicalize(desc);
+	return Get(State_DepthStencil, &canonical, sizeof(canonical));
+}
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+void* StateCache::GetRasterizer(const RasterizerDesc &desc)
+{
+	RasterizerDesc canonical = Canonicalize(desc);
+	return Get(State_Rasterizer, &canonical, sizeof(canonical));
+}
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+void* StateCache::GetSampler(const SamplerDesc &desc)
+{
+	SamplerDesc canonical = Canonicalize(desc);
+	return Get(State_Sampler, &canonical, sizeof(canonical));
+}
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+void* StateCache::GetBlend(const BlendDesc &desc)
+{
+	BlendDesc canonical = Canonicalize(desc);
+	return Get(State_Blend, &canonical, sizeof(canonical));
+}
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+const PipelineState* StateCache::GetPipeline(const PipelineDesc &desc)
+{
+	PipelineKey key;
+	key.depthStencil = Canonicalize(desc.depthStencil);
+	key.rasterizer = Canonicalize(desc.rasterizer);
+	key.blend = Canonicalize(desc.blend);
+	static_assert(sizeof(PipelineKey) == sizeof(DepthStencilDesc) + sizeof(RasterizerDesc) + sizeof(BlendDesc),
+		"the bundle key must not have padding");
+
+	uint64_t hash = HashState(State_Pipeline, &key, sizeof(key));
+	mLookups[State_Pipeline].fetch_add(1, std::memory_order_relaxed);
+	if (Entry *entry = Find(State_Pipeline, hash, &key, sizeof(key)))
+	{
+		mHits[State_Pipeline].fetch_add(1, std::memory_order_relaxed);
+		return &entry->pipeline;
+	}
+
+	// the parts are looked up before taking the lock, they take it themselves when they are new
+	PipelineState pipeline;
+	pipeline.depthStencil = Get(State_DepthStencil, &key.depthStencil, sizeof(key.depthStencil));
+	pipeline.rasterizer = Get(State_Rasterizer, &key.rasterizer, sizeof(key.rasterizer));
+	pipeline.blend = Get(State_Blend, &key.blend, sizeof(key.blend));
+	if (!pipeline.depthStencil || !pipeline.rasterizer || !pipeline.blend)
+		return nullptr;
+
+	std::lock_guard<std::mutex> lock(mMutex);
+	if (Entry *entry = Find(State_Pipeline, hash, &key, sizeof(key)))
+		return &entry->pipeline;
+	Entry *entry = NewEntry(State_Pipeline, hash, &key, sizeof(key));
+	if (!entry)
+		return nullptr;
+	entry->pipeline = pipeline;
+	entry->object = &entry->pipeline;
+	Publish(entry);
+	return &entry->pipeline;
+}
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+void* StateCache::Get(StateKind kind, const void *canonical, size_t size)
+{
+	uint64_t hash = HashState(kind, canonical, size);
+	mLookups[kind].fetch_add(1, std::memory_order_relaxed);
+	if (Entry *entry = Find(kind, hash, canonical, size))
+	{
+		mHits[kind].fetch_add(1, std::memory_order_relaxed);
+		return entry->object;
+	}
+
+	// another thread may have created it since the first look, the lock makes sure only one of them does
+	std::lock_guard<std::mutex> lock(mMutex);
+	if (Entry *entry = Find(kind, hash, canonical, size))
+		return entry->object;
+	Entry *entry = NewEntry(kind, hash, canonical, size);
+	if (!entry)
+		return nullptr;
+	entry->object = mFactory.CreateState(kind, canonical);
+	if (!entry->object)
+	{
+		mEntries.pop_back();
+		mFailures.fetch_add(1, std::memory_order_relaxed);
+		return nullptr;
+	}
+	Publish(entry);
+	return entry->object;
+}
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// linear probing; slots are never emptied while lookups run, so the first empty one ends the search
+StateCache::Entry* StateCache::Find(StateKind kind, uint64_t hash, const void *canonical, size_t size) const
+{
+	for (size_t slot = hash & (kSlotsCount - 1);; slot = (slot + 1) & (kSlotsCount - 1))
+	{
+		Entry *entry = mSlots[slot].load(std::memory_order_acquire);
+		if (!entry)
+			return nullptr;
+		if (entry->hash == hash && entry->kind == kind && entry->size == size && !memcmp(entry->key, canonical, size))
+			return entry;
+	}
+}
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+StateCache::Entry* StateCache::NewEntry(StateKind kind, uint64_t hash, const void *canonical, size_t size)
+{
+	static_assert(!(kSlotsCount & (kSlotsCount - 1)), "the slot count must be a power of two");
+	assert(size <= sizeof(PipelineKey));
+
+	uint32_t limit = kind == State_Pipeline ? kMaxEntries : kMaxObjectsPerKind;
+	if (mEntries.size() >= kMaxEntries || mObjects[kind].load(std::memory_order_relaxed) >= limit)
+	{
+		mFailures.fetch_add(1, std::memory_order_relaxed);
+		return nullptr;
+	}
+
+	std::unique_ptr<Entry> entry(new Entry);
+	entry->hash = hash;
+	entry->kind = kind;
+	entry->size = size;
+	entry->object = nullptr;
+	memset(&entry->pipeline, 0, sizeof(entry->pipeline));
+	memcpy(entry->key, canonical, size);
+	mEntries.push_back(std::move(entry));
+	return mEntries.back().get();
+}
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// the release store makes the finished entry visible to the acquire loads in Find
+void StateCache::Publish(Entry *entry)
+{
+	size_t slot = entry->hash & (kSlotsCount - 1);
+	while (mSlots[slot].load(std::memory_order_relaxed))
+		slot = (slot + 1) & (kSlotsCount - 1);
+	mSlots[slot].store(entry, std::memory_order_release);
+	mObjects[entry->kind].fetch_add(1, std::memory_order_relaxed);
+}
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+void StateCache::Clear()
+{
+	std::lock_guard<std::mutex> lock(mMutex);
+	for (size_t i = 0; i < kSlotsCount; i++)
+		mSlots[i].store(nullptr, std::memory_order_relaxed);
+	for (const std::unique_ptr<Entry> &entry : mEntries)
+	{
+		if (entry->kind != State_Pipeline)
+			mFactory.ReleaseState(entry->kind, entry->object);
+	}
+	mEntries.clear();
+	for (int kind = 0; kind < NumStateKinds; kind++)
+		mObjects[kind].store(0, std::memory_order_relaxed);
+}
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+StateCacheStats StateCache::GetStats() const
+{
+	StateCacheStats stats;
+	for (int kind = 0; kind < NumStateKinds; kind++)
+	{
+		stats.lookups[kind] = mLookups[kind].load(std::memory_order_relaxed);
+		stats.hits[kind] = mHits[kind].load(std::memory_order_relaxed);
+		stats.objects[kind] = mObjects[kind].load(std::memory_order_relaxed);
+	}
+	stats.failures = mFailures.load(std::memory_order_relaxed);
+	return stats;
+}
@@ -0,0 +1,220 @@
+#pragma once
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Cache of immutable pipeline state objects: depth-stencil, rasterizer, sampler and blend states.
+// Descriptors are canonicalized first (fields the pipeline ignores get fixed values, BOOLs become 0 or 1, -0.0f
+// becomes 0.0f), so descriptors that only differ where it does not matter share one object. The canonical bytes are
+// hashed into an open addressing table whose slots are only ever filled: lookups are lock-free and can run on the
+// recording threads, a miss creates the object under a lock. Pipeline bundles (depth-stencil + rasterizer + blend)
+// are cached the same way, so a material resolves its whole state with one lookup and can be prebuilt at load time.
+// The descriptors have the layout of their D3D11_*_DESC and hold D3D11 enum values; main.cpp creates the objects
+// through a StateFactory, HeadlessMain.cpp through a counting stand-in.
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+enum StateKind
+{
+	State_DepthStencil,
+	State_Rasterizer,
+	State_Sampler,
+	State_Blend,
+	State_Pipeline,
+	NumStateKinds
+};
+
+// D3D11_DEPTH_STENCILOP_DESC
+struct StencilOpDesc
+{
+	uint32_t stencilFailOp;
+	uint32_t stencilDepthFailOp;
+	uint32_t stencilPassOp;
+	uint32_t stencilFunc;
+};
+
+// D3D11_DEPTH_STENCIL_DESC
+struct DepthStencilDesc
+{
+	int32_t       depthEnable;
+	uint32_t      depthWriteMask;
+	uint32_t      depthFunc;
+	int32_t       stencilEnable;
+	uint8_t       stencilReadMask;
+	uint8_t       stencilWriteMask;
+	uint8_t       padding[2]; // implicit in D3D11, zero in canonical descriptors
+	StencilOpDesc frontFace;
+	StencilOpDesc backFace;
+};
+
+// D3D11_RASTERIZER_DESC
+struct RasterizerDesc
+{
+	uint32_t fillMode;
+	uint32_t cullMode;
+	int32_t  frontCounterClockwise;
+	int32_t  depthBias;
+	float    depthBiasClamp;
+	float    slopeScaledDepthBias;
+	int32_t  depthClipEnable;
+	int32_t  scissorEnable;
+	int32_t  multisampleEnable;
+	int32_t  antialiasedLineEnable;
+};
+
+// D3D11_SAMPLER_DESC
+struct SamplerDesc
+{
+	uint32_t filter;
+	uint32_t addressU;
+	uint32_t addressV;
+	uint32_t addressW;
+	float    mipLODBias;
+	uint32_t maxAnisotropy;
+	uint32_t comparisonFunc;
+	float    borderColor[4];
+	float    minLOD;
+	float    maxLOD;
+};
+
+// D3D11_RENDER_TARGET_BLEND_DESC
+struct TargetBlendDesc
+{
+	int32_t  blendEnable;
+	uint32_t srcBlend;
+	uint32_t destBlend;
+	uint32_t blendOp;
+	uint32_t srcBlendAlpha;
+	uint32_t destBlendAlpha;
+	uint32_t blendOpAlpha;
+	uint8_t  renderTargetWriteMask;
+	uint8_t  padding[3]; // implicit in D3D11, zero in canonical descriptors
+};
+
+// D3D11_BLEND_DESC
+struct BlendDesc
+{
+	static const unsigned kMaxTargets = 8;
+
+	int32_t         alphaToCoverageEnable;
+	int32_t         independentBlendEnable;
+	TargetBlendDesc renderTarget[kMaxTargets];
+};
+
+// what a material binds with OMSetDepthStencilState, RSSetState and OMSetBlendState
+struct PipelineDesc
+{
+	DepthStencilDesc depthStencil;
+	RasterizerDesc   rasterizer;
+	BlendDesc        blend;
+};
+
+// objects are opaque: ID3D11*State pointers in main.cpp, owned by the cache
+struct PipelineState
+{
+	void *depthStencil;
+	void *rasterizer;
+	void *blend;
+};
+
+// the D3D11 defaults, the starting point of every descriptor
+DepthStencilDesc DefaultDepthStencilDesc();
+RasterizerDesc   DefaultRasterizerDesc();
+SamplerDesc      DefaultSamplerDesc();
+BlendDesc        DefaultBlendDesc();
+
+// copies with every ignored field set to its default and the padding zeroed; equal behavior, equal bytes
+DepthStencilDesc Canonicalize(const DepthStencilDesc &desc);
+RasterizerDesc   Canonicalize(const RasterizerDesc &desc);
+SamplerDesc      Canonicalize(const SamplerDesc &desc);
+BlendDesc        Canonicalize(const BlendDesc &desc);
+
+// FNV-1a over the canonical bytes 8 at a time, then mixed down into the low bits; the kind is part of the hash
+uint64_t HashState(StateKind kind, const void *canonical, size_t size);
+
+class StateFactory
+{
+public:
+	virtual ~StateFactory() {}
+
+	// desc is the canonical DepthStencilDesc, RasterizerDesc, SamplerDesc or BlendDesc for kind; null on failure.
+	// Called from any thread, one call at a time.
+	virtual void* CreateState(StateKind kind, const void *desc) = 0;
+	virtual void ReleaseState(StateKind kind, void *state) = 0;
+};
+
+struct StateCacheStats
+{
+	uint64_t lookups[NumStateKinds];
+	uint64_t hits[NumStateKinds];    // found without taking the lock
+	uint32_t objects[NumStateKinds]; // distinct objects created, bundles for State_Pipeline
+	uint32_t failures;               // the factory failed or the kind was full
+};
+
+class StateCache
+{
+public:
+	// D3D11 allows 4096 distinct objects of each state kind per device
+	static const uint32_t kMaxObjectsPerKind = 4096;
+	// all kinds together, the table is never more than half full
+	static const size_t kMaxEntries = 8192;
+
+	explicit StateCache(StateFactory &factory);
+	~StateCache();
+
+	// any thread; lock-free when the object exists, null if it could not be created
+	void* GetDepthStencil(const DepthStencilDesc &desc);
+	void* GetRasterizer(const RasterizerDesc &desc);
+	void* GetSampler(const SamplerDesc &desc);
+	void* GetBlend(const BlendDesc &desc);
+	// the bundle and its three objects, created on the first request; null if one of them could not be
+	const PipelineState* GetPipeline(const PipelineDesc &desc);
+
+	// releases every object; no other thread may use the cache or its objects any more
+	void Clear();
+
+	StateCacheStats GetStats() const;
+
+private:
+	// canonical bytes of the largest descriptor, the bundle
+	struct PipelineKey
+	{
+		DepthStencilDesc depthStencil;
+		RasterizerDesc   rasterizer;
+		BlendDesc        blend;
+	};
+
+	struct Entry
+	{
+		uint64_t      hash;
+		StateKind     kind;
+		size_t        size;
+		void          *object; // a PipelineState for State_Pipeline
+		PipelineState pipeline;
+		unsigned char key[sizeof(PipelineKey)];
+	};
+
+	static const size_t kSlotsCount = 2 * kMaxEntries;
+
+	StateCache(const StateCache&);
+	StateCache& operator=(const StateCache&);
+
+	void*  Get(StateKind kind, const void *canonical, size_t size);
+	Entry* Find(StateKind kind, uint64_t hash, const void *canonical, size_t size) const;
+	// under mMutex: the entry is not visible to lookups until Publish
+	Entry* NewEntry(StateKind kind, uint64_t hash, const void *canonical, size_t size);
+	void   Publish(Entry *entry);
+
+	StateFactory &mFactory;
+
+	std::unique_ptr<std::atomic<Entry*>[]> mSlots;
+	std::vector<std::unique_ptr<Entry>>    mEntries; // owns what the slots point to, only touched under mMutex
+	std::mutex                             mMutex;
+
+	std::atomic<uint64_t> mLookups[NumStateKinds];
+	std::atomic<uint64_t> mHits[NumStateKinds];
+	std::atomic<uint32_t> mObjects[NumStateKinds];
+	std::atomic<uint32_t> mFailures;
+};
@@ -0,0 +1,274 @@
+#include "StateFilter.h"
+
+#include <algorithm>
+#include <cassert>
+#include <cstring>
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+template <class Slot>
+void StateFilter::SlotTable<Slot>::Reset()
+{
+	memset(wanted, 0, sizeof(wanted));
+	memset(bound, 0, sizeof(bound));
+	for (unsigned i = 0; i < kMaxSlots; i++)
+		known[i] = false;
+	dirtyBegin = kMaxSlots;
+	dirtyEnd = 0;
+}
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+template <class Slot>
+void StateFilter::SlotTable<Slot>::Set(unsigned slot, const Slot &value)
+{
+	wanted[slot] = value;
+	if (!known[slot] || value != bound[slot])
+	{
+		dirtyBegin = std::min(dirtyBegin, slot);
+		dirtyEnd = std::max(dirtyEnd, slot + 1);
+	}
+}
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+template <class Slot>
+bool StateFilter::SlotTable<Slot>::GetChangedSpan(unsigned &begin, unsigned &end) const
+{
+	// a slot set to A and back to the bound value before Apply is not a change
+	begin = kMaxSlots;
+	end = 0;
+	for (unsigned i = dirtyBegin; i < dirtyEnd; i++)
+		if (!known[i] || wanted[i] != bound[i])
+		{
+			begin = std::min(begin, i);
+			end = i + 1;
+		}
+	return begin < end;
+}
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+template <class Slot>
+void StateFilter::SlotTable<Slot>::Commit(unsigned begin, unsigned end)
+{
+	for (unsigned i = begin; i < end; i++)
+	{
+		bound[i] = wanted[i];
+		known[i] = true;
+	}
+	dirtyBegin = kMaxSlots;
+	dirtyEnd = 0;
+}
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+StateFilter::StateFilter(StateSink &sink)
+	: mSink(sink)
+{
+	for (int s = 0; s < NumShaderStages; s++)
+	{
+		mShaders[s].wanted = nullptr;
+		mConstantBuffers[s].Reset();
+		mSamplers[s].Reset();
+		mShaderResources[s].Reset();
+	}
+	mInputLayout.wanted = nullptr;
+	mTopology.wanted = 0;
+	mIndexBuffer.wanted.buffer = nullptr;
+	mIndexBuffer.wanted.format = 0;
+	mIndexBuffer.wanted.offset = 0;
+	mVertexBuffers.Reset();
+
+	Invalidate();
+	ResetStats();
+}
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+void StateFilter::Invalidate()
+{
+	for (int s = 0; s < NumShaderStages; s++)
+	{
+		mShaders[s].known = false;
+		SlotTable<ConstantBufferSlot> &cb = mConstantBuffers[s];
+		SlotTable<ObjectSlot> &samplers = mSamplers[s];
+		SlotTable<ObjectSlot> &views = mShaderResources[s];
+		for (unsigned i = 0; i < kMaxSlots; i++)
+			cb.known[i] = samplers.known[i] = views.known[i] = false;
+		// only slots that hold something are worth resending
+		cb.dirtyBegin = samplers.dirtyBegin = views.dirtyBegin = kMaxSlots;
+		cb.dirtyEnd = samplers.dirtyEnd = views.dirtyEnd = 0;
+		for (unsigned i = 0; i < kMaxSlots; i++)
+		{
+			if (cb.wanted[i].buffer)
+				cb.Set(i, cb.wanted[i]);
+			if (samplers.wanted[i].object)
+				samplers.Set(i, samplers.wanted[i]);
+			if (views.wanted[i].object)
+				views.Set(i, views.wanted[i]);
+		}
+	}
+	mInputLayout.known = false;
+	mTopology.known = false;
+	mIndexBuffer.known = false;
+
+	mVertexBuffers.dirtyBegin = kMaxSlots;
+	mVertexBuffers.dirtyEnd = 0;
+	for (unsigned i = 0; i < kMaxSlots; i++)
+	{
+		mVertexBuffers.known[i] = false;
+		if (mVertexBuffers.wanted[i].buffer)
+			mVertexBuffers.Set(i, mVertexBuffers.wanted[i]);
+	}
+}
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+void StateFilter::SetShader(ShaderStage stage, const void *shader)
+{
+	mStats.requested++;
+	mShaders[stage].wanted = shader;
+}
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+void StateFilter::SetInputLayout(const void *layout)
+{
+	mStats.requested++;
+	mInputLayout.wanted = layout;
+}
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+void StateFilter::SetPrimitiveTopology(unsigned topology)
+{
+	mStats.requested++;
+	mTopology.wanted = topology;
+}
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+void StateFilter::SetVertexBuffers(unsigned startSlot, unsigned count, const void *const *buffers, const unsigned *strides, const unsigned *offsets)
+{
+	assert(startSlot + count <= kMaxSlots);
+	mStats.requested++;
+	for (unsigned i = 0; i < count && startSlot + i < kMaxSlots; i++)
+	{
+		VertexBufferSlot slot = { buffers[i], strides[i], offsets[i] };
+		mVertexBuffers.Set(startSlot + i, slot);
+	}
+}
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+void StateFilter::SetIndexBuffer(const void *buffer, unsigned format, unsigned offset)
+{
+	mStats.requested++;
+	IndexBufferSlot slot = { buffer, format, offset };
+	mIndexBuffer.wanted = slot;
+}
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+void StateFilter::SetConstantBuffers(ShaderStage stage, unsigned startSlot, unsigned count, const void *const *buffers,
+	const unsigned *firstConstants, const unsigned *numConstants)
+{
+	assert(startSlot + count <= kMaxSlots);
+	mStats.requested++;
+	for (unsigned i = 0; i < count && startSlot + i < kMaxSlots; i++)
+	{
+		ConstantBufferSlot slot = { buffers[i], firstConstants ? firstConstants[i] : 0, numConstants ? numConstants[i] : 0 };
+		mConstantBuffers[stage].Set(startSlot + i, slot);
+	}
+}
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+void StateFilter::SetSamplers(ShaderStage stage, unsigned startSlot, unsigned count, const void *const *samplers)
+{
+	assert(startSlot + count <= kMaxSlots);
+	mStats.requested++;
+	for (unsigned i = 0; i < count && startSlot + i < kMaxSlots; i++)
+	{
+		ObjectSlot slot = { samplers[i] };
+		mSamplers[stage].Set(startSlot + i, slot);
+	}
+}
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+void StateFilter::SetShaderResources(ShaderStage stage, unsigned startSlot, unsigned count, const void *const *views)
+{
+	assert(startSlot + count <= kMaxSlots);
+	mStats.requested++;
+	for (unsigned i = 0; i < count && startSlot + i < kMaxSlots; i++)
+	{
+		ObjectSlot slot = { views[i] };
+		mShaderResources[stage].Set(startSlot + i, slot);
+	}
+}
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+void StateFilter::Apply()
+{
+	unsigned begin, end;
+
+	if (!mInputLayout.known || mInputLayout.wanted != mInputLayout.bound)
+	{
+		mSink.SetInputLayout(mInputLayout.wanted);
+		mInputLayout.bound = mInputLayout.wanted;
+		mInputLayout.known = true;
+		mStats.issued++;
+	}
+
+	if (!mTopology.known || mTopology.wanted != mTopology.bound)
+	{
+		mSink.SetPrimitiveTopology(mTopology.wanted);
+		mTopology.bound = mTopology.wanted;
+		mTopology.known = true;
+		mStats.issued++;
+	}
+
+	if (!mIndexBuffer.known || mIndexBuffer.wanted != mIndexBuffer.bound)
+	{
+		mSink.SetIndexBuffer(mIndexBuffer.wanted.buffer, mIndexBuffer.wanted.format, mIndexBuffer.wanted.offset);
+		mIndexBuffer.bound = mIndexBuffer.wanted;
+		mIndexBuffer.known = true;
+		mStats.issued++;
+	}
+
+	if (mVertexBuffers.GetChangedSpan(begin, end))
+	{
+		const void *buffers[kMaxSlots];
+		unsigned strides[kMaxSlots], offsets[kMaxSlots];
+		for (unsigned i = begin; i < end; i++)
+		{
+			buffers[i - begin] = mVertexBuffers.wanted[i].buffer;
+			strides[i - begin] = mVertexBuffers.wanted[i].stride;
+			offsets[i - begin] = mVertexBuffers.wanted[i].offset;
+		}
+		mSink.SetVertexBuffers(begin, end - begin, buffers, strides, offsets);
+		mStats.issued++;
+	}
+	mVertexBuffers.Commit(begin, end);
+
+	for (int s = 0; s < NumShaderStages; s++)
+	{
+		ShaderStage stage = static_cast<ShaderStage>(s);
+
+		SingleState<const void*> &shader = mShaders[s];
+		if (!shader.known || shader.wanted != shader.bound)
+		{
+			mSink.SetShader(stage, shader.wanted);
+			shader.bound = shader.wanted;
+			shader.known = true;
+			mStats.issued++;
+		}
+
+		SlotTable<ConstantBufferSlot> &cb = mConstantBuffers[s];
+		if (cb.GetChangedSpan(begin, end))
+		{
+			const void *buffers[kMaxSlots];
+			unsigned firstConstants[kMaxSlots], numConstants[kMaxSlots];
+			for (unsigned i = begin; i < end; i++)
+			{
+				buffers[i - begin] = cb.wanted[i].buffer;
+				firstConstants[i - begin] = cb.wanted[i].firstConstant;
+				numConstants[i - begin] = cb.wanted[i].numConstants;
+			}
+			mSink.SetConstantBuffers(stage, begin, end - begin, buffers, firstConstants, numConstants);
+			mStats.issued++;
+		}
+		cb.Commit(begin, end);
+
+		SlotTable<ObjectSlot> *objectTables[2] = { &mSamplers[s], &mShaderResources[s] };
+		for (int t = 0; t < 2; t++)
+		{
+			SlotTable<ObjectSlot> &table = *objectTables[t];
+			if (table.GetChangedSpan(begin, end))
+			{
+				const void *objects[kMaxSlots];
+				for (unsigned i = begin; i < end; i++)
+					objects[i - begin] = table.wanted[i].object;
+				if (t == 0)
+					mSink.SetSamplers(stage, begin, end - begin, objects);
+				else
+					mSink.SetShaderResources(stage, begin, end - begin, objects);
+				mStats.issued++;
+			}
+			table.Commit(begin, end);
+		}
+	}
+}
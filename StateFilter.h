@@ -0,0 +1,145 @@
+#pragma once
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Redundant-state filter in front of the device context.
+// Set* calls only record the wanted pipeline state. Apply (right before a draw) compares it with a shadow copy of
+// what is actually bound and forwards only the differences to a StateSink: one call per changed shader, input
+// layout, topology or index buffer, and one call per stage and slot type covering the span of changed slots.
+// main.cpp implements the sink on ID3D11DeviceContext, anything recording the calls works the same way.
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+#include <cstddef>
+
+enum ShaderStage
+{
+	Stage_Vertex,
+	Stage_Pixel,
+	NumShaderStages
+};
+
+// objects are opaque: ID3D11* pointers in main.cpp
+class StateSink
+{
+public:
+	virtual ~StateSink() {}
+
+	virtual void SetShader(ShaderStage stage, const void *shader) = 0;
+	virtual void SetInputLayout(const void *layout) = 0;
+	virtual void SetPrimitiveTopology(unsigned topology) = 0;
+	virtual void SetVertexBuffers(unsigned startSlot, unsigned count, const void *const *buffers, const unsigned *strides, const unsigned *offsets) = 0;
+	// format is a DXGI_FORMAT in main.cpp
+	virtual void SetIndexBuffer(const void *buffer, unsigned format, unsigned offset) = 0;
+	// numConstants[i] == 0 binds the whole buffer, otherwise a window like VSSetConstantBuffers1
+	virtual void SetConstantBuffers(ShaderStage stage, unsigned startSlot, unsigned count, const void *const *buffers,
+		const unsigned *firstConstants, const unsigned *numConstants) = 0;
+	virtual void SetSamplers(ShaderStage stage, unsigned startSlot, unsigned count, const void *const *samplers) = 0;
+	virtual void SetShaderResources(ShaderStage stage, unsigned startSlot, unsigned count, const void *const *views) = 0;
+};
+
+// ID3D11Buffer** and friends to the opaque slot arrays the filter takes
+template <class T>
+inline const void *const *AsObjects(T *const *objects)
+{
+	return reinterpret_cast<const void *const *>(objects);
+}
+
+struct StateFilterStats
+{
+	unsigned requested; // Set* calls made on the filter
+	unsigned issued;    // calls forwarded to the sink
+};
+
+class StateFilter
+{
+public:
+	static const unsigned kMaxSlots = 16;
+
+	explicit StateFilter(StateSink &sink);
+
+	void SetShader(ShaderStage stage, const void *shader);
+	void SetInputLayout(const void *layout);
+	void SetPrimitiveTopology(unsigned topology);
+	void SetVertexBuffers(unsigned startSlot, unsigned count, const void *const *buffers, const unsigned *strides, const unsigned *offsets);
+	void SetIndexBuffer(const void *buffer, unsigned format, unsigned offset);
+	// firstConstants / numConstants may be null for whole buffers
+	void SetConstantBuffers(ShaderStage stage, unsigned startSlot, unsigned count, const void *const *buffers,
+		const unsigned *firstConstants = nullptr, const unsigned *numConstants = nullptr);
+	void SetSamplers(ShaderStage stage, unsigned startSlot, unsigned count, const void *const *samplers);
+	void SetShaderResources(ShaderStage stage, unsigned startSlot, unsigned count, const void *const *views);
+
+	// forwards the differences to the sink, call before every draw
+	void Apply();
+	// the sink state is unknown again (ClearState, another component used the context...), next Apply resends everything
+	void Invalidate();
+
+	const StateFilterStats& GetStats() const { return mStats; }
+	unsigned GetElidedCount() const { return mStats.requested > mStats.issued ? mStats.requested - mStats.issued : 0; }
+	void ResetStats() { mStats.requested = 0; mStats.issued = 0; }
+
+private:
+	struct VertexBufferSlot
+	{
+		const void *buffer;
+		unsigned   stride, offset;
+		bool operator!=(const VertexBufferSlot &o) const { return buffer != o.buffer || stride != o.stride || offset != o.offset; }
+	};
+
+	struct IndexBufferSlot
+	{
+		const void *buffer;
+		unsigned   format, offset;
+		bool operator!=(const IndexBufferSlot &o) const { return buffer != o.buffer || format != o.format || offset != o.offset; }
+	};
+
+	struct ConstantBufferSlot
+	{
+		const void *buffer;
+		unsigned   firstConstant, numConstants;
+		bool operator!=(const ConstantBufferSlot &o) const { return buffer != o.buffer || firstConstant != o.firstConstant || numConstants != o.numConstants; }
+	};
+
+	struct ObjectSlot
+	{
+		const void *object;
+		bool operator!=(const ObjectSlot &o) const { return object != o.object; }
+	};
+
+	// wanted vs bound values of one slot array, dirtyBegin..dirtyEnd bounds the slots touched since the last Apply
+	template <class Slot>
+	struct SlotTable
+	{
+		Slot     wanted[kMaxSlots];
+		Slot     bound[kMaxSlots];
+		bool     known[kMaxSlots];
+		unsigned dirtyBegin, dirtyEnd;
+
+		void Reset();
+		void Set(unsigned slot, const Slot &value);
+		// narrows the dirty span to slots that really differ, false if none
+		bool GetChangedSpan(unsigned &begin, unsigned &end) const;
+		void Commit(unsigned begin, unsigned end);
+	};
+
+	template <class Value>
+	struct SingleState
+	{
+		Value wanted;
+		Value bound;
+		bool  known;
+	};
+
+	StateFilter(const StateFilter&);
+	StateFilter& operator=(const StateFilter&);
+
+	StateSink &mSink;
+
+	SingleState<const void*>     mShaders[NumShaderStages];
+	SingleState<const void*>     mInputLayout;
+	SingleState<unsigned>        mTopology;
+	SingleState<IndexBufferSlot> mIndexBuffer;
+
+	SlotTable<VertexBufferSlot>   mVertexBuffers;
+	SlotTable<ConstantBufferSlot> mConstantBuffers[NumShaderStages];
+	SlotTable<ObjectSlot>         mSamplers[NumShaderStages];
+	SlotTable<ObjectSlot>         mShaderResources[NumShaderStages];
+
+	StateFilterStats mStats;
+};
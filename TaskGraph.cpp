@@ -0,0 +1,190 @@
+#include "TaskGraph.h"
+#include "Trace.h"
+
+#include <algorithm>
+#include <cassert>
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+TaskGraph::TaskGraph(const FrameClock &clock)
+	: mClock(clock)
+	, mJobs(nullptr)
+	, mStartMs(0.0)
+	, mWallMs(0.0)
+	, mFinished(0)
+	, mEvents(0)
+	, mFailed(false)
+{
+}
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+TaskId TaskGraph::Add(const char *name, TaskAffinity affinity, std::function<bool()> function,
+	std::initializer_list<TaskId> dependencies)
+{
+	TaskId id = static_cast<TaskId>(mTasks.size());
+	mTasks.push_back(std::unique_ptr<Task>(new Task));
+	Task &task = *mTasks.back();
+	task.name = name;
+	task.affinity = affinity;
+	task.function = function;
+	for (TaskId dependency : dependencies)
+		AddDependency(id, dependency);
+	return id;
+}
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+void TaskGraph::AddDependency(TaskId id, TaskId dependency)
+{
+	// only on earlier tasks, so there can be no cycle
+	assert(dependency < id);
+	mTasks[id]->dependencies.push_back(dependency);
+	mTasks[dependency]->dependents.push_back(id);
+}
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+bool TaskGraph::Run(JobSystem &jobs)
+{
+	mJobs = &jobs;
+	mMainReady.clear();
+	mFinished = 0;
+	mEvents = 0;
+	mFailed = false;
+	for (size_t i = 0; i < mTasks.size(); i++)
+	{
+		Task &task = *mTasks[i];
+		task.remaining.store(static_cast<int>(task.dependencies.size()));
+		task.skip.store(false);
+		task.state = Task_Pending;
+		task.timing.startMs = 0.0;
+		task.timing.endMs = 0.0;
+		task.timing.thread = -1;
+	}
+
+	// every count is set before the first task can finish and release its dependents
+	mStartMs = mClock.NowMs();
+	for (size_t i = 0; i < mTasks.size(); i++)
+		if (mTasks[i]->dependencies.empty())
+			Dispatch(static_cast<TaskId>(i));
+
+	// this thread runs its own tasks and helps with the others, it only sleeps while all of them are on workers
+	std::unique_lock<std::mutex> lock(mMutex);
+	while (mFinished < mTasks.size())
+	{
+		if (!mMainReady.empty())
+		{
+			TaskId id = mMainReady.front();
+			mMainReady.erase(mMainReady.begin());
+			lock.unlock();
+			Execute(id);
+			lock.lock();
+			continue;
+		}
+
+		uint64_t events = mEvents;
+		lock.unlock();
+		bool ran = jobs.TryRunJob();
+		lock.lock();
+		if (!ran)
+			mWakeUp.wait(lock, [this, events] { return mEvents != events; });
+	}
+	lock.unlock();
+
+	// the last jobs may still be returning through the job system, which decrements mCounter after Finish
+	jobs.Wait(mCounter);
+	mWallMs = mClock.NowMs() - mStartMs;
+	mJobs = nullptr;
+	return !mFailed;
+}
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+void TaskGraph::RunTaskJob(void *data, size_t begin, size_t)
+{
+	static_cast<TaskGraph*>(data)->Execute(static_cast<TaskId>(begin));
+}
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+void TaskGraph::Dispatch(TaskId id)
+{
+	if (mTasks[id]->affinity == Task_AnyThread)
+	{
+		Job job = { &RunTaskJob, this, id, id + 1, &mCounter };
+		mJobs->Submit(job);
+		return;
+	}
+
+	std::lock_guard<std::mutex> lock(mMutex);
+	mMainReady.push_back(id);
+	mEvents++;
+	mWakeUp.notify_all();
+}
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+void TaskGraph::Execute(TaskId id)
+{
+	Task &task = *mTasks[id];
+	task.timing.thread = mJobs->GetThreadIndex();
+	task.timing.startMs = mClock.NowMs() - mStartMs;
+	bool succeeded;
+	{
+		TRACE_SCOPE_DYNAMIC(task.name.c_str());
+		succeeded = task.function();
+	}
+	task.timing.endMs = mClock.NowMs() - mStartMs;
+	Finish(id, succeeded ? Task_Done : Task_Failed);
+}
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+void TaskGraph::Finish(TaskId id, TaskState state)
+{
+	Task &task = *mTasks[id];
+	task.state = state;
+	for (size_t i = 0; i < task.dependents.size(); i++)
+	{
+		TaskId dependentId = task.dependents[i];
+		Task &dependent = *mTasks[dependentId];
+		if (state != Task_Done)
+			dependent.skip.store(true);
+		if (dependent.remaining.fetch_sub(1) == 1)
+		{
+			if (dependent.skip.load())
+				Finish(dependentId, Task_Skipped);
+			else
+				Dispatch(dependentId);
+		}
+	}
+
+	// last: Run may return as soon as the count is complete, the graph is not touched after the unlock
+	std::lock_guard<std::mutex> lock(mMutex);
+	mFinished++;
+	mFailed = mFailed || state == Task_Failed;
+	mEvents++;
+	mWakeUp.notify_all();
+}
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+double TaskGraph::GetWorkMs() const
+{
+	double ms = 0.0;
+	for (size_t i = 0; i < mTasks.size(); i++)
+		ms += mTasks[i]->timing.endMs - mTasks[i]->timing.startMs;
+	return ms;
+}
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+std::vector<TaskId> TaskGraph::GetCriticalPath() const
+{
+	// dependencies come first in id order, so one pass finds the longest chain ending at every task
+	std::vector<double> chainMs(mTasks.size());
+	std::vector<int> previous(mTasks.size(), -1);
+	int last = -1;
+	for (size_t i = 0; i < mTasks.size(); i++)
+	{
+		const Task &task = *mTasks[i];
+		double longestMs = 0.0;
+		for (size_t d = 0; d < task.dependencies.size(); d++)
+			if (previous[i] < 0 || chainMs[task.dependencies[d]] > longestMs)
+			{
+				longestMs = chainMs[task.dependencies[d]];
+				previous[i] = task.dependencies[d];
+			}
+		// skipped tasks never ran and add nothing
+		chainMs[i] = longestMs + task.timing.endMs - task.timing.startMs;
+		if (last < 0 || chainMs[i] > chainMs[last])
+			last = static_cast<int>(i);
+	}
+
+	std::vector<TaskId> path;
+	for (int i = last; i >= 0; i = previous[i])
+		path.push_back(static_cast<TaskId>(i));
+	std::reverse(path.begin(), path.end());
+	return path;
+}
@@ -0,0 +1,114 @@
+#pragma once
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// One-shot dependency graph of tasks, used for renderer initialization.
+// Tasks are added with the tasks they wait for, so the graph is acyclic by construction. Run submits a task to the
+// job system as soon as its last dependency is done: independent steps overlap and each one waits only for what it
+// needs. Main thread tasks (immediate context calls, window work) run on the thread that called Run, which executes
+// jobs in between. A task that fails skips everything that depends on it, unrelated tasks still run.
+// Every task records its start, end and thread. GetCriticalPath is the dependency chain with the longest measured
+// duration: no number of threads starts up faster, and shortening anything else does not help.
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+#include "FrameStats.h"
+#include "JobSystem.h"
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <initializer_list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+typedef uint32_t TaskId;
+
+enum TaskAffinity
+{
+	Task_AnyThread,
+	Task_MainThread, // the thread that calls Run
+};
+
+enum TaskState
+{
+	Task_Pending,
+	Task_Done,
+	Task_Failed,
+	Task_Skipped, // a dependency failed or was skipped
+};
+
+struct TaskTiming
+{
+	double startMs; // by the graph's clock, relative to the start of Run
+	double endMs;
+	int    thread;  // job system thread index, 0 is the main thread
+};
+
+class TaskGraph
+{
+public:
+	explicit TaskGraph(const FrameClock &clock);
+
+	// dependencies are ids returned by earlier calls; the function returns false on failure
+	TaskId Add(const char *name, TaskAffinity affinity, std::function<bool()> function,
+		std::initializer_list<TaskId> dependencies = {});
+	// for dependencies only known at run time, before Run
+	void AddDependency(TaskId id, TaskId dependency);
+
+	// from the job system's owner thread, returns when every task is done, failed or skipped; true if none failed.
+	// Run once per graph.
+	bool Run(JobSystem &jobs);
+
+	size_t GetTasksCount() const { return mTasks.size(); }
+	const char* GetName(TaskId id) const { return mTasks[id]->name.c_str(); }
+	TaskState GetState(TaskId id) const { return mTasks[id]->state; }
+	const TaskTiming& GetTiming(TaskId id) const { return mTasks[id]->timing; }
+	const std::vector<TaskId>& GetDependencies(TaskId id) const { return mTasks[id]->dependencies; }
+
+	// Run's duration, and the sum of the task durations (what running them one after another would cost)
+	double GetWallMs() const { return mWallMs; }
+	double GetWorkMs() const;
+	// first to last, by the durations of the last Run
+	std::vector<TaskId> GetCriticalPath() const;
+	double GetDurationMs(TaskId id) const { return mTasks[id]->timing.endMs - mTasks[id]->timing.startMs; }
+
+private:
+	struct Task
+	{
+		std::string           name;
+		TaskAffinity          affinity;
+		std::function<bool()> function;
+		std::vector<TaskId>   dependencies;
+		std::vector<TaskId>   dependents;
+
+		// during Run
+		std::atomic<int>      remaining; // dependencies not finished yet
+		std::atomic<bool>     skip;      // set by a failed or skipped dependency
+		TaskState             state;
+		TaskTiming            timing;
+	};
+
+	TaskGraph(const TaskGraph&);
+	TaskGraph& operator=(const TaskGraph&);
+
+	static void RunTaskJob(void *data, size_t begin, size_t end);
+	void Dispatch(TaskId id);
+	void Execute(TaskId id);
+	void Finish(TaskId id, TaskState state);
+
+	const FrameClock                   &mClock;
+	std::vector<std::unique_ptr<Task>> mTasks;
+
+	// during Run
+	JobSystem               *mJobs;
+	JobCounter              mCounter;
+	double                  mStartMs;
+	double                  mWallMs;
+	std::mutex              mMutex;
+	std::condition_variable mWakeUp;
+	std::vector<TaskId>     mMainReady; // under mMutex
+	size_t                  mFinished;  // under mMutex
+	uint64_t                mEvents;    // under mMutex, bumped on every change the main thread may wait for
+	bool                    mFailed;    // under mMutex
+};
@@ -0,0 +1,952 @@
+#include "Texture.h"
+#include "JobSystem.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <string>
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#else
+#include <emmintrin.h>
+#endif
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+namespace
+{
+	const unsigned kDxgiRGBA8 = 28; // DXGI_FORMAT_R8G8B8A8_UNORM
+	const unsigned kDxgiBC1 = 71;   // DXGI_FORMAT_BC1_UNORM
+	const unsigned kDxgiBC3 = 77;   // DXGI_FORMAT_BC3_UNORM
+	const unsigned kDxgiBC7 = 98;   // DXGI_FORMAT_BC7_UNORM
+
+	inline uint32_t MakeFourCC(char a, char b, char c, char d)
+	{
+		return uint32_t(uint8_t(a)) | uint32_t(uint8_t(b)) << 8 | uint32_t(uint8_t(c)) << 16 | uint32_t(uint8_t(d)) << 24;
+	}
+
+	const uint32_t kDdsMagic = 0x20534444; // 'DDS '
+
+	// DDS_HEADER flags, DDS_PIXELFORMAT flags and caps from the DirectX documentation
+	const uint32_t kDdsdCaps = 0x1, kDdsdHeight = 0x2, kDdsdWidth = 0x4, kDdsdPitch = 0x8, kDdsdPixelFormat = 0x1000;
+	const uint32_t kDdsdMipMapCount = 0x20000, kDdsdLinearSize = 0x80000;
+	const uint32_t kDdpfAlphaPixels = 0x1, kDdpfFourCC = 0x4, kDdpfRGB = 0x40;
+	const uint32_t kDdsCapsComplex = 0x8, kDdsCapsTexture = 0x1000, kDdsCapsMipMap = 0x400000;
+	const uint32_t kDdsCaps2CubeMap = 0x200, kDdsCaps2Volume = 0x200000;
+	const uint32_t kDimensionTexture2D = 3; // D3D10_RESOURCE_DIMENSION_TEXTURE2D
+	const uint32_t kMiscTextureCube = 0x4;
+
+	struct DdsPixelFormat
+	{
+		uint32_t size;
+		uint32_t flags;
+		uint32_t fourCC;
+		uint32_t rgbBitCount;
+		uint32_t rMask, gMask, bMask, aMask;
+	};
+
+	struct DdsHeader
+	{
+		uint32_t       size;
+		uint32_t       flags;
+		uint32_t       height;
+		uint32_t       width;
+		uint32_t       pitchOrLinearSize;
+		uint32_t       depth;
+		uint32_t       mipMapCount;
+		uint32_t       reserved1[11];
+		DdsPixelFormat pixelFormat;
+		uint32_t       caps, caps2, caps3, caps4;
+		uint32_t       reserved2;
+	};
+
+	struct DdsHeaderDx10
+	{
+		uint32_t dxgiFormat;
+		uint32_t resourceDimension;
+		uint32_t miscFlag;
+		uint32_t arraySize;
+		uint32_t miscFlags2;
+	};
+
+	inline uint32_t AverageTexel(const uint32_t *row0, const uint32_t *row1, uint32_t x0, uint32_t x1)
+	{
+		uint32_t result = 0;
+		for (int shift = 0; shift < 32; shift += 8)
+		{
+			uint32_t sum = (row0[x0] >> shift & 0xFF) + (row0[x1] >> shift & 0xFF) + (row1[x0] >> shift & 0xFF) + (row1[x1] >> shift & 0xFF);
+			result |= (sum + 2) >> 2 << shift;
+		}
+		return result;
+	}
+
+#if defined(__AVX2__)
+	const uint32_t kMipLanes = 8;
+
+	// 16 texels of two source rows -> 8 averaged texels, channels widened to 16 bits
+	inline void AverageTexels(const uint32_t *row0, const uint32_t *row1, uint32_t *out)
+	{
+		const __m256i zero = _mm256_setzero_si256();
+		__m256i a0 = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(row0));
+		__m256i a1 = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(row0 + 8));
+		__m256i b0 = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(row1));
+		__m256i b1 = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(row1 + 8));
+
+		// per 128 bit lane: texels 0,1 | 4,5 and 2,3 | 6,7 summed vertically, then the pairs horizontally
+		__m256i lo = _mm256_add_epi16(_mm256_unpacklo_epi8(a0, zero), _mm256_unpacklo_epi8(b0, zero));
+		__m256i hi = _mm256_add_epi16(_mm256_unpackhi_epi8(a0, zero), _mm256_unpackhi_epi8(b0, zero));
+		__m256i sum0 = _mm256_add_epi16(_mm256_unpacklo_epi64(lo, hi), _mm256_unpackhi_epi64(lo, hi));
+		lo = _mm256_add_epi16(_mm256_unpacklo_epi8(a1, zero), _mm256_unpacklo_epi8(b1, zero));
+		hi = _mm256_add_epi16(_mm256_unpackhi_epi8(a1, zero), _mm256_unpackhi_epi8(b1, zero));
+		__m256i sum1 = _mm256_add_epi16(_mm256_unpacklo_epi64(lo, hi), _mm256_unpackhi_epi64(lo, hi));
+
+		const __m256i round = _mm256_set1_epi16(2);
+		sum0 = _mm256_srli_epi16(_mm256_add_epi16(sum0, round), 2);
+		sum1 = _mm256_srli_epi16(_mm256_add_epi16(sum1, round), 2);
+		// packs to 0,1,4,5 | 2,3,6,7
+		__m256i packed = _mm256_packus_epi16(sum0, sum1);
+		_mm256_storeu_si256(reinterpret_cast<__m256i*>(out), _mm256_permute4x64_epi64(packed, _MM_SHUFFLE(3, 1, 2, 0)));
+	}
+#else
+	const uint32_t kMipLanes = 4;
+
+	// 8 texels of two source rows -> 4 averaged texels, channels widened to 16 bits
+	inline void AverageTexels(const uint32_t *row0, const uint32_t *row1, uint32_t *out)
+	{
+		const __m128i zero = _mm_setzero_si128();
+		__m128i a0 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(row0));
+		__m128i a1 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(row0 + 4));
+		__m128i b0 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(row1));
+		__m128i b1 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(row1 + 4));
+
+		// texels 0,1 and 2,3 summed vertically, then the pairs horizontally
+		__m128i lo = _mm_add_epi16(_mm_unpacklo_epi8(a0, zero), _mm_unpacklo_epi8(b0, zero));
+		__m128i hi = _mm_add_epi16(_mm_unpackhi_epi8(a0, zero), _mm_unpackhi_epi8(b0, zero));
+		__m128i sum0 = _mm_add_epi16(_mm_unpacklo_epi64(lo, hi), _mm_unpackhi_epi64(lo, hi));
+		lo = _mm_add_epi16(_mm_unpacklo_epi8(a1, zero), _mm_unpacklo_epi8(b1, zero));
+		hi = _mm_add_epi16(_mm_unpackhi_epi8(a1, zero), _mm_unpackhi_epi8(b1, zero));
+		__m128i sum1 = _mm_add_epi16(_mm_unpacklo_epi64(lo, hi), _mm_unpackhi_epi64(lo, hi));
+
+		const __m128i round = _mm_set1_epi16(2);
+		sum0 = _mm_srli_epi16(_mm_add_epi16(sum0, round), 2);
+		sum1 = _mm_srli_epi16(_mm_add_epi16(sum1, round), 2);
+		_mm_storeu_si128(reinterpret_cast<__m128i*>(out), _mm_packus_epi16(sum0, sum1));
+	}
+#endif
+
+	// 4x4 texels as floats, rgba
+	typedef float Block[16][4];
+
+	void LoadBlock(const uint32_t *texels, uint32_t width, uint32_t height, uint32_t bx, uint32_t by, Block &block)
+	{
+		for (uint32_t y = 0; y < 4; y++)
+		{
+			const uint32_t *row = texels + size_t(std::min(by * 4 + y, height - 1)) * width;
+			for (uint32_t x = 0; x < 4; x++)
+			{
+				uint32_t texel = row[std::min(bx * 4 + x, width - 1)];
+				for (int c = 0; c < 4; c++)
+					block[y * 4 + x][c] = static_cast<float>(texel >> (c * 8) & 0xFF);
+			}
+		}
+	}
+
+	inline int ClampByte(float value)
+	{
+		return value <= 0.0f ? 0 : value >= 255.0f ? 255 : static_cast<int>(value + 0.5f);
+	}
+
+	inline uint32_t PackTexel(const int rgba[4])
+	{
+		return uint32_t(rgba[0]) | uint32_t(rgba[1]) << 8 | uint32_t(rgba[2]) << 16 | uint32_t(rgba[3]) << 24;
+	}
+
+	// endpoints on the principal axis of the block (a few power iterations on the covariance)
+	void FitLine(const Block &block, int channels, float e0[4], float e1[4])
+	{
+		float mean[4] = { 0.0f, 0.0f, 0.0f, 0.0f };
+		for (int i = 0; i < 16; i++)
+			for (int c = 0; c < channels; c++)
+				mean[c] += block[i][c] * (1.0f / 16.0f);
+
+		float cov[4][4] = {};
+		for (int i = 0; i < 16; i++)
+			for (int r = 0; r < channels; r++)
+				for (int c = 0; c < channels; c++)
+					cov[r][c] += (block[i][r] - mean[r]) * (block[i][c] - mean[c]);
+
+		// start from the row with the largest variance, it is never orthogonal to the principal axis
+		int start = 0;
+		for (int c = 1; c < channels; c++)
+			if (cov[c][c] > cov[start][start])
+				start = c;
+		float axis[4] = { 0.0f, 0.0f, 0.0f, 0.0f };
+		for (int c = 0; c < channels; c++)
+			axis[c] = cov[start][c];
+
+		for (int it = 0; it < 8; it++)
+		{
+			float next[4] = { 0.0f, 0.0f, 0.0f, 0.0f };
+			float length = 0.0f;
+			for (int r = 0; r < channels; r++)
+			{
+				for (int c = 0; c < channels; c++)
+					next[r] += cov[r][c] * axis[c];
+				length = std::max(length, std::fabs(next[r]));
+			}
+			if (length < 1e-6f)
+				break;
+			for (int c = 0; c < channels; c++)
+				axis[c] = next[c] / length;
+		}
+
+		float length = 0.0f;
+		for (int c = 0; c < channels; c++)
+			length += axis[c] * axis[c];
+		if (length < 1e-12f)
+		{
+			// flat block
+			for (int c = 0; c < channels; c++)
+				e0[c] = e1[c] = mean[c];
+			return;
+		}
+		for (int c = 0; c < channels; c++)
+			axis[c] /= std::sqrt(length);
+
+		float tMin = 1e30f, tMax = -1e30f;
+		for (int i = 0; i < 16; i++)
+		{
+			float t = 0.0f;
+			for (int c = 0; c < channels; c++)
+				t += (block[i][c] - mean[c]) * axis[c];
+			tMin = std::min(tMin, t);
+			tMax = std::max(tMax, t);
+		}
+		for (int c = 0; c < channels; c++)
+		{
+			e0[c] = std::min(255.0f, std::max(0.0f, mean[c] + axis[c] * tMax));
+			e1[c] = std::min(255.0f, std::max(0.0f, mean[c] + axis[c] * tMin));
+		}
+	}
+
+	// least squares endpoints for fixed indices, weights[i] is how much of e1 texel i gets; false if degenerate
+	bool SolveEndpoints(const Block &block, int channels, const float *weights, float e0[4], float e1[4])
+	{
+		float aa = 0.0f, ab = 0.0f, bb = 0.0f;
+		float x0[4] = { 0.0f, 0.0f, 0.0f, 0.0f }, x1[4] = { 0.0f, 0.0f, 0.0f, 0.0f };
+		for (int i = 0; i < 16; i++)
+		{
+			float b = weights[i], a = 1.0f - b;
+			aa += a * a;
+			ab += a * b;
+			bb += b * b;
+			for (int c = 0; c < channels; c++)
+			{
+				x0[c] += a * block[i][c];
+				x1[c] += b * block[i][c];
+			}
+		}
+		float det = aa * bb - ab * ab;
+		if (std::fabs(det) < 1e-6f)
+			return false;
+		for (int c = 0; c < channels; c++)
+		{
+			e0[c] = std::min(255.0f, std::max(0.0f, (bb * x0[c] - ab * x1[c]) / det));
+			e1[c] = std::min(255.0f, std::max(0.0f, (aa * x1[c] - ab * x0[c]) / det));
+		}
+		return true;
+	}
+
+	// nearest palette entry for every texel, returns the squared error
+	float FitIndices(const Block &block, int channels, int (*palette)[4], int paletteSize, int *indices)
+	{
+		float total = 0.0f;
+		for (int i = 0; i < 16; i++)
+		{
+			float best = 1e30f;
+			for (int p = 0; p < paletteSize; p++)
+			{
+				float error = 0.0f;
+				for (int c = 0; c < channels; c++)
+				{
+					float d = block[i][c] - palette[p][c];
+					error += d * d;
+				}
+				if (error < best)
+				{
+					best = error;
+					indices[i] = p;
+				}
+			}
+			total += best;
+		}
+		return total;
+	}
+
+	// BC1 color block ///////////////////////////////////////////////////////////////////////////////////////////////
+
+	inline uint16_t To565(const float rgb[3])
+	{
+		int r = ClampByte(rgb[0]) * 31 + 127;
+		int g = ClampByte(rgb[1]) * 63 + 127;
+		int b = ClampByte(rgb[2]) * 31 + 127;
+		return static_cast<uint16_t>((r / 255) << 11 | (g / 255) << 5 | (b / 255));
+	}
+
+	inline void From565(uint16_t color, int rgba[4])
+	{
+		int r = color >> 11, g = color >> 5 & 63, b = color & 31;
+		rgba[0] = r << 3 | r >> 2;
+		rgba[1] = g << 2 | g >> 4;
+		rgba[2] = b << 3 | b >> 2;
+		rgba[3] = 255;
+	}
+
+	// four color mode when c0 > c1 (always in BC3), otherwise three colors and transparent black
+	void ColorPalette(uint16_t c0, uint16_t c1, bool fourColors, int palette[4][4])
+	{
+		From565(c0, palette[0]);
+		From565(c1, palette[1]);
+		for (int c = 0; c < 3; c++)
+		{
+			if (fourColors)
+			{
+				palette[2][c] = (2 * palette[0][c] + palette[1][c] + 1) / 3;
+				palette[3][c] = (palette[0][c] + 2 * palette[1][c] + 1) / 3;
+			}
+			else
+			{
+				palette[2][c] = (palette[0][c] + palette[1][c]) / 2;
+				palette[3][c] = 0;
+			}
+		}
+		palette[2][3] = 255;
+		palette[3][3] = fourColors ? 255 : 0;
+	}
+
+	// e1 weight of each four color index
+	const float kColorWeights[4] = { 0.0f, 1.0f, 1.0f / 3.0f, 2.0f / 3.0f };
+
+	float EncodeColorEndpoints(const Block &block, const float e0[3], const float e1[3], uint16_t &c0, uint16_t &c1, int *indices)
+	{
+		c0 = To565(e0);
+		c1 = To565(e1);
+		int palette[4][4];
+		ColorPalette(c0, c1, true, palette);
+		return FitIndices(block, 3, palette, 4, indices);
+	}
+
+	void EncodeColorBlock(const Block &block, unsigned char *out)
+	{
+		float e0[4], e1[4];
+		FitLine(block, 3, e0, e1);
+
+		uint16_t c0, c1;
+		int indices[16];
+		float error = EncodeColorEndpoints(block, e0, e1, c0, c1, indices);
+
+		// one least squares pass on the chosen indices, kept if it helps
+		float weights[16];
+		for (int i = 0; i < 16; i++)
+			weights[i] = kColorWeights[indices[i]];
+		if (error > 0.0f && SolveEndpoints(block, 3, weights, e0, e1))
+		{
+			uint16_t r0, r1;
+			int refined[16];
+			if (EncodeColorEndpoints(block, e0, e1, r0, r1, refined) < error)
+			{
+				c0 = r0;
+				c1 = r1;
+				memcpy(indices, refined, sizeof(refined));
+			}
+		}
+
+		// c0 > c1 selects the four color mode, equal endpoints only need index 0
+		if (c0 < c1)
+		{
+			std::swap(c0, c1);
+			for (int i = 0; i < 16; i++)
+				indices[i] ^= 1;
+		}
+		else if (c0 == c1)
+			memset(indices, 0, sizeof(indices));
+
+		uint32_t bits = 0;
+		for (int i = 0; i < 16; i++)
+			bits |= uint32_t(indices[i]) << (i * 2);
+		memcpy(out, &c0, 2);
+		memcpy(out + 2, &c1, 2);
+		memcpy(out + 4, &bits, 4);
+	}
+
+	void DecodeColorBlock(const unsigned char *in, bool forceFourColors, int texels[16][4])
+	{
+		uint16_t c0, c1;
+		uint32_t bits;
+		memcpy(&c0, in, 2);
+		memcpy(&c1, in + 2, 2);
+		memcpy(&bits, in + 4, 4);
+
+		int palette[4][4];
+		ColorPalette(c0, c1, forceFourColors || c0 > c1, palette);
+		for (int i = 0; i < 16; i++)
+			memcpy(texels[i], palette[bits >> (i * 2) & 3], sizeof(texels[i]));
+	}
+
+	// BC3 alpha block ///////////////////////////////////////////////////////////////////////////////////////////////
+
+	// eight values when a0 > a1, otherwise six and 0, 255
+	void AlphaPalette(int a0, int a1, int palette[8])
+	{
+		palette[0] = a0;
+		palette[1] = a1;
+		if (a0 > a1)
+			for (int i = 2; i < 8; i++)
+				palette[i] = ((8 - i) * a0 + (i - 1) * a1 + 3) / 7;
+		else
+		{
+			for (int i = 2; i < 6; i++)
+				palette[i] = ((6 - i) * a0 + (i - 1) * a1 + 2) / 5;
+			palette[6] = 0;
+			palette[7] = 255;
+		}
+	}
+
+	void EncodeAlphaBlock(const Block &block, unsigned char *out)
+	{
+		int aMin = 255, aMax = 0;
+		for (int i = 0; i < 16; i++)
+		{
+			aMin = std::min(aMin, ClampByte(block[i][3]));
+			aMax = std::max(aMax, ClampByte(block[i][3]));
+		}
+
+		int palette[8];
+		AlphaPalette(aMax, aMin, palette);
+		uint64_t bits = 0;
+		for (int i = 0; i < 16; i++)
+		{
+			int alpha = ClampByte(block[i][3]);
+			int best = 0;
+			for (int p = 1; p < 8 && aMax != aMin; p++)
+				if (std::abs(palette[p] - alpha) < std::abs(palette[best] - alpha))
+					best = p;
+			bits |= uint64_t(best) << (i * 3);
+		}
+		out[0] = static_cast<unsigned char>(aMax);
+		out[1] = static_cast<unsigned char>(aMin);
+		for (int i = 0; i < 6; i++)
+			out[2 + i] = static_cast<unsigned char>(bits >> (i * 8));
+	}
+
+	void DecodeAlphaBlock(const unsigned char *in, int texels[16][4])
+	{
+		int palette[8];
+		AlphaPalette(in[0], in[1], palette);
+		uint64_t bits = 0;
+		for (int i = 0; i < 6; i++)
+			bits |= uint64_t(in[2 + i]) << (i * 8);
+		for (int i = 0; i < 16; i++)
+			texels[i][3] = palette[bits >> (i * 3) & 7];
+	}
+
+	// BC7 mode 6 ////////////////////////////////////////////////////////////////////////////////////////////////////
+
+	const int kBC7Weights[16] = { 0, 4, 9, 13, 17, 21, 26, 30, 34, 38, 43, 47, 51, 55, 60, 64 };
+
+	struct BitWriter
+	{
+		uint64_t bits[2];
+		unsigned position;
+
+		BitWriter() : position(0) { bits[0] = bits[1] = 0; }
+		void Write(uint32_t value, unsigned count)
+		{
+			for (unsigned i = 0; i < count; i++, position++)
+				bits[position >> 6] |= uint64_t(value >> i & 1) << (position & 63);
+		}
+	};
+
+	struct BitReader
+	{
+		uint64_t bits[2];
+		unsigned position;
+
+		explicit BitReader(const unsigned char *in) : position(0) { memcpy(bits, in, 16); }
+		uint32_t Read(unsigned count)
+		{
+			uint32_t value = 0;
+			for (unsigned i = 0; i < count; i++, position++)
+				value |= uint32_t(bits[position >> 6] >> (position & 63) & 1) << i;
+			return value;
+		}
+	};
+
+	// 7 bits per channel and a shared low bit per endpoint, the p-bit with the smaller error wins
+	void QuantizeEndpoint(const float e[4], int quantized[4], int &pbit)
+	{
+		float bestError = 1e30f;
+		for (int p = 0; p < 2; p++)
+		{
+			int q[4];
+			float error = 0.0f;
+			for (int c = 0; c < 4; c++)
+			{
+				q[c] = std::min(127, std::max(0, static_cast<int>(std::floor((e[c] - p) * 0.5f + 0.5f))));
+				float d = float(q[c] * 2 + p) - e[c];
+				error += d * d;
+			}
+			if (error < bestError)
+			{
+				bestError = error;
+				pbit = p;
+				memcpy(quantized, q, sizeof(q));
+			}
+		}
+	}
+
+	void BC7Palette(const int q0[4], int p0, const int q1[4], int p1, int palette[16][4])
+	{
+		for (int c = 0; c < 4; c++)
+		{
+			int v0 = q0[c] * 2 + p0, v1 = q1[c] * 2 + p1;
+			for (int i = 0; i < 16; i++)
+				palette[i][c] = ((64 - kBC7Weights[i]) * v0 + kBC7Weights[i] * v1 + 32) >> 6;
+		}
+	}
+
+	float EncodeBC7Endpoints(const Block &block, const float e0[4], const float e1[4], int q0[4], int &p0, int q1[4], int &p1, int *indices)
+	{
+		QuantizeEndpoint(e0, q0, p0);
+		QuantizeEndpoint(e1, q1, p1);
+		int palette[16][4];
+		BC7Palette(q0, p0, q1, p1, palette);
+		return FitIndices(block, 4, palette, 16, indices);
+	}
+
+	void EncodeBC7Block(const Block &block, unsigned char *out)
+	{
+		float e0[4], e1[4];
+		FitLine(block, 4, e0, e1);
+
+		int q0[4], q1[4], p0, p1, indices[16];
+		float error = EncodeBC7Endpoints(block, e0, e1, q0, p0, q1, p1, indices);
+
+		float weights[16];
+		for (int i = 0; i < 16; i++)
+			weights[i] = kBC7Weights[indices[i]] / 64.0f;
+		if (error > 0.0f && SolveEndpoints(block, 4, weights, e0, e1))
+		{
+			int r0[4], r1[4], rp0, rp1, refined[16];
+			if (EncodeBC7Endpoints(block, e0, e1, r0, rp0, r1, rp1, refined) < error)
+			{
+				memcpy(q0, r0, sizeof(q0));
+				memcpy(q1, r1, sizeof(q1));
+				p0 = rp0;
+				p1 = rp1;
+				memcpy(indices, refined, sizeof(refined));
+			}
+		}
+
+		// the anchor texel 0 stores 3 bits, its index must be below 8; the weights are symmetric so a swap is exact
+		if (indices[0] >= 8)
+		{
+			for (int c = 0; c < 4; c++)
+				std::swap(q0[c], q1[c]);
+			std::swap(p0, p1);
+			for (int i = 0; i < 16; i++)
+				indices[i] = 15 - indices[i];
+		}
+
+		BitWriter writer;
+		writer.Write(1 << 6, 7); // mode 6
+		for (int c = 0; c < 4; c++)
+		{
+			writer.Write(q0[c], 7);
+			writer.Write(q1[c], 7);
+		}
+		writer.Write(p0, 1);
+		writer.Write(p1, 1);
+		for (int i = 0; i < 16; i++)
+			writer.Write(indices[i], i ? 4 : 3);
+		memcpy(out, writer.bits, 16);
+	}
+
+	bool DecodeBC7Block(const unsigned char *in, int texels[16][4])
+	{
+		BitReader reader(in);
+		if (reader.Read(7) != 1 << 6)
+			return false;
+
+		int q0[4], q1[4];
+		for (int c = 0; c < 4; c++)
+		{
+			q0[c] = reader.Read(7);
+			q1[c] = reader.Read(7);
+		}
+		int p0 = reader.Read(1);
+		int p1 = reader.Read(1);
+
+		int palette[16][4];
+		BC7Palette(q0, p0, q1, p1, palette);
+		for (int i = 0; i < 16; i++)
+			memcpy(texels[i], palette[reader.Read(i ? 4 : 3)], sizeof(texels[i]));
+		return true;
+	}
+
+	size_t GetBlockSize(TextureFormat format)
+	{
+		return format == Texture_BC1 ? 8 : 16;
+	}
+
+	bool WriteFile(const char *path, const std::vector<unsigned char> &data)
+	{
+		// written under a temporary name so a crash never leaves half a texture behind
+		std::string tmpPath = std::string(path) + GetTempSuffix();
+		FILE *file = fopen(tmpPath.c_str(), "wb");
+		if (!file)
+			return false;
+
+		bool ok = fwrite(&data[0], 1, data.size(), file) == data.size();
+		ok = fclose(file) == 0 && ok;
+		if (ok)
+		{
+			remove(path);
+			ok = rename(tmpPath.c_str(), path) == 0;
+		}
+		if (!ok)
+			remove(tmpPath.c_str());
+		return ok;
+	}
+}
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+unsigned GetDxgiFormat(TextureFormat format)
+{
+	switch (format)
+	{
+	case Texture_BC1: return kDxgiBC1;
+	case Texture_BC3: return kDxgiBC3;
+	case Texture_BC7: return kDxgiBC7;
+	default:          return kDxgiRGBA8;
+	}
+}
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+bool IsBlockCompressed(TextureFormat format)
+{
+	return format != Texture_RGBA8;
+}
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+size_t GetRowPitch(TextureFormat format, uint32_t width)
+{
+	if (!IsBlockCompressed(format))
+		return size_t(width) * 4;
+	return size_t(std::max(1u, (width + 3) / 4)) * GetBlockSize(format);
+}
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+size_t GetLevelSize(TextureFormat format, uint32_t width, uint32_t height)
+{
+	uint32_t rows = IsBlockCompressed(format) ? std::max(1u, (height + 3) / 4) : height;
+	return GetRowPitch(format, width) * rows;
+}
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+uint32_t GetMipCount(uint32_t width, uint32_t height)
+{
+	uint32_t count = 1;
+	for (uint32_t size = std::max(width, height); size > 1; size /= 2)
+		count++;
+	return count;
+}
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+void Downsample(const TextureImage &src, TextureImage &dst)
+{
+	dst.width = std::max(1u, src.width / 2);
+	dst.height = std::max(1u, src.height / 2);
+	dst.texels.resize(size_t(dst.width) * dst.height);
+
+	for (uint32_t y = 0; y < dst.height; y++)
+	{
+		const uint32_t *row0 = &src.texels[size_t(y * 2) * src.width];
+		const uint32_t *row1 = &src.texels[size_t(std::min(y * 2 + 1, src.height - 1)) * src.width];
+		uint32_t *out = &dst.texels[size_t(y) * dst.width];
+
+		// x + kMipLanes <= src.width / 2 keeps the loads inside the row
+		uint32_t x = 0;
+		for (; x + kMipLanes <= dst.width; x += kMipLanes)
+			AverageTexels(row0 + x * 2, row1 + x * 2, out + x);
+		for (; x < dst.width; x++)
+			out[x] = AverageTexel(row0, row1, x * 2, std::min(x * 2 + 1, src.width - 1));
+	}
+}
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+void DownsampleReference(const TextureImage &src, TextureImage &dst)
+{
+	dst.width = std::max(1u, src.width / 2);
+	dst.height = std::max(1u, src.height / 2);
+	dst.texels.resize(size_t(dst.width) * dst.height);
+
+	for (uint32_t y = 0; y < dst.height; y++)
+	{
+		const uint32_t *row0 = &src.texels[size_t(y * 2) * src.width];
+		const uint32_t *row1 = &src.texels[size_t(std::min(y * 2 + 1, src.height - 1)) * src.width];
+		for (uint32_t x = 0; x < dst.width; x++)
+			dst.texels[size_t(y) * dst.width + x] = AverageTexel(row0, row1, x * 2, std::min(x * 2 + 1, src.width - 1));
+	}
+}
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+void GenerateMips(const uint32_t *texels, uint32_t width, uint32_t height, std::vector<TextureImage> &levels)
+{
+	uint32_t count = std::min(GetMipCount(width, height), kMaxMipLevels);
+	levels.resize(count);
+	levels[0].width = width;
+	levels[0].height = height;
+	levels[0].texels.assign(texels, texels + size_t(width) * height);
+	for (uint32_t i = 1; i < count; i++)
+		Downsample(levels[i - 1], levels[i]);
+}
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+void CompressBlocks(const uint32_t *texels, uint32_t width, uint32_t height, TextureFormat format, unsigned char *blocks, JobSystem *jobs)
+{
+	if (!IsBlockCompressed(format))
+	{
+		memcpy(blocks, texels, GetLevelSize(format, width, height));
+		return;
+	}
+
+	const uint32_t blocksX = std::max(1u, (width + 3) / 4);
+	const uint32_t blocksY = std::max(1u, (height + 3) / 4);
+	const size_t blockSize = GetBlockSize(format);
+	auto encodeRows = [&](size_t begin, size_t end)
+	{
+		Block block;
+		for (size_t by = begin; by < end; by++)
+			for (uint32_t bx = 0; bx < blocksX; bx++)
+			{
+				LoadBlock(texels, width, height, bx, static_cast<uint32_t>(by), block);
+				unsigned char *out = blocks + (by * blocksX + bx) * blockSize;
+				if (format == Texture_BC1)
+					EncodeColorBlock(block, out);
+				else if (format == Texture_BC3)
+				{
+					EncodeAlphaBlock(block, out);
+					EncodeColorBlock(block, out + 8);
+				}
+				else
+					EncodeBC7Block(block, out);
+			}
+	};
+
+	// about 256 blocks per job, rows never share a block so the jobs write disjoint memory
+	if (jobs)
+		jobs->ParallelFor(blocksY, std::max(1u, 256 / blocksX), encodeRows);
+	else
+		encodeRows(0, blocksY);
+}
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+bool DecompressBlocks(const unsigned char *blocks, uint32_t width, uint32_t height, TextureFormat format, uint32_t *texels)
+{
+	if (!IsBlockCompressed(format))
+	{
+		memcpy(texels, blocks, GetLevelSize(format, width, height));
+		return true;
+	}
+
+	const uint32_t blocksX = std::max(1u, (width + 3) / 4);
+	const uint32_t blocksY = std::max(1u, (height + 3) / 4);
+	const size_t blockSize = GetBlockSize(format);
+	for (uint32_t by = 0; by < blocksY; by++)
+		for (uint32_t bx = 0; bx < blocksX; bx++)
+		{
+			const unsigned char *in = blocks + (size_t(by) * blocksX + bx) * blockSize;
+			int decoded[16][4];
+			if (format == Texture_BC1)
+				DecodeColorBlock(in, false, decoded);
+			else if (format == Texture_BC3)
+			{
+				DecodeColorBlock(in + 8, true, decoded);
+				DecodeAlphaBlock(in, decoded);
+			}
+			else if (!DecodeBC7Block(in, decoded))
+				return false;
+
+			for (uint32_t y = 0; y < 4 && by * 4 + y < height; y++)
+				for (uint32_t x = 0; x < 4 && bx * 4 + x < width; x++)
+					texels[size_t(by * 4 + y) * width + bx * 4 + x] = PackTexel(decoded[y * 4 + x]);
+		}
+	return true;
+}
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+bool SaveDds(const char *path, const std::vector<TextureImage> &levels, TextureFormat format, JobSystem *jobs)
+{
+	if (levels.empty() || levels.size() > kMaxMipLevels)
+		return false;
+	const uint32_t width = levels[0].width, height = levels[0].height;
+	if (IsBlockCompressed(format) && (width % 4 || height % 4))
+		return false;
+
+	DdsHeader header;
+	memset(&header, 0, sizeof(header));
+	header.size = sizeof(header);
+	header.flags = kDdsdCaps | kDdsdHeight | kDdsdWidth | kDdsdPixelFormat | kDdsdMipMapCount;
+	header.flags |= IsBlockCompressed(format) ? kDdsdLinearSize : kDdsdPitch;
+	header.height = height;
+	header.width = width;
+	header.pitchOrLinearSize = static_cast<uint32_t>(IsBlockCompressed(format) ? GetLevelSize(format, width, height) : GetRowPitch(format, width));
+	header.mipMapCount = static_cast<uint32_t>(levels.size());
+	header.pixelFormat.size = sizeof(DdsPixelFormat);
+	header.caps = kDdsCapsTexture | (levels.size() > 1 ? kDdsCapsComplex | kDdsCapsMipMap : 0);
+
+	// legacy headers where they exist so older tools read the files too, BC7 needs the DX10 extension
+	DdsHeaderDx10 dx10;
+	memset(&dx10, 0, sizeof(dx10));
+	bool useDx10 = format == Texture_BC7;
+	if (format == Texture_RGBA8)
+	{
+		header.pixelFormat.flags = kDdpfRGB | kDdpfAlphaPixels;
+		header.pixelFormat.rgbBitCount = 32;
+		header.pixelFormat.rMask = 0x000000FF;
+		header.pixelFormat.gMask = 0x0000FF00;
+		header.pixelFormat.bMask = 0x00FF0000;
+		header.pixelFormat.aMask = 0xFF000000;
+	}
+	else
+	{
+		header.pixelFormat.flags = kDdpfFourCC;
+		header.pixelFormat.fourCC = useDx10 ? MakeFourCC('D', 'X', '1', '0') : MakeFourCC('D', 'X', 'T', format == Texture_BC1 ? '1' : '5');
+		dx10.dxgiFormat = GetDxgiFormat(format);
+		dx10.resourceDimension = kDimensionTexture2D;
+		dx10.arraySize = 1;
+	}
+
+	size_t dataOffset = sizeof(kDdsMagic) + sizeof(header) + (useDx10 ? sizeof(dx10) : 0);
+	size_t fileSize = dataOffset;
+	for (size_t i = 0; i < levels.size(); i++)
+		fileSize += GetLevelSize(format, levels[i].width, levels[i].height);
+
+	std::vector<unsigned char> data(fileSize, 0);
+	memcpy(&data[0], &kDdsMagic, sizeof(kDdsMagic));
+	memcpy(&data[sizeof(kDdsMagic)], &header, sizeof(header));
+	if (useDx10)
+		memcpy(&data[sizeof(kDdsMagic) + sizeof(header)], &dx10, sizeof(dx10));
+
+	size_t offset = dataOffset;
+	for (size_t i = 0; i < levels.size(); i++)
+	{
+		CompressBlocks(levels[i].texels.data(), levels[i].width, levels[i].height, format, &data[offset], jobs);
+		offset += GetLevelSize(format, levels[i].width, levels[i].height);
+	}
+	return WriteFile(path, data);
+}
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+DdsFile::DdsFile()
+{
+	Close();
+}
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+bool DdsFile::Open(const char *path)
+{
+	Close();
+	if (!mFile.Open(path))
+		return false;
+
+	const unsigned char *data = mFile.GetData();
+	size_t size = mFile.GetSize();
+
+	uint32_t magic;
+	DdsHeader header;
+	if (size < sizeof(magic) + sizeof(header))
+	{
+		Close();
+		return false;
+	}
+	memcpy(&magic, data, sizeof(magic));
+	memcpy(&header, data + sizeof(magic), sizeof(header));
+	size_t offset = sizeof(magic) + sizeof(header);
+
+	bool valid = magic == kDdsMagic && header.size == sizeof(header) && header.pixelFormat.size == sizeof(DdsPixelFormat) &&
+		!(header.caps2 & (kDdsCaps2CubeMap | kDdsCaps2Volume)) && header.width && header.height;
+
+	const DdsPixelFormat &pf = header.pixelFormat;
+	if (valid && (pf.flags & kDdpfFourCC) && pf.fourCC == MakeFourCC('D', 'X', '1', '0'))
+	{
+		DdsHeaderDx10 dx10;
+		valid = size >= offset + sizeof(dx10);
+		if (valid)
+		{
+			memcpy(&dx10, data + offset, sizeof(dx10));
+			offset += sizeof(dx10);
+			valid = dx10.resourceDimension == kDimensionTexture2D && dx10.arraySize == 1 && !(dx10.miscFlag & kMiscTextureCube);
+			if (dx10.dxgiFormat == kDxgiBC1)
+				mFormat = Texture_BC1;
+			else if (dx10.dxgiFormat == kDxgiBC3)
+				mFormat = Texture_BC3;
+			else if (dx10.dxgiFormat == kDxgiBC7)
+				mFormat = Texture_BC7;
+			else
+				valid = valid && dx10.dxgiFormat == kDxgiRGBA8;
+		}
+	}
+	else if (valid && (pf.flags & kDdpfFourCC))
+	{
+		valid = pf.fourCC == MakeFourCC('D', 'X', 'T', '1') || pf.fourCC == MakeFourCC('D', 'X', 'T', '5');
+		mFormat = pf.fourCC == MakeFourCC('D', 'X', 'T', '1') ? Texture_BC1 : Texture_BC3;
+	}
+	else
+		valid = valid && (pf.flags & kDdpfRGB) && pf.rgbBitCount == 32 && pf.rMask == 0x000000FF && pf.gMask == 0x0000FF00 &&
+			pf.bMask == 0x00FF0000;
+
+	uint32_t mipCount = (header.flags & kDdsdMipMapCount) && header.mipMapCount ? header.mipMapCount : 1;
+	valid = valid && mipCount <= std::min(::GetMipCount(header.width, header.height), kMaxMipLevels);
+	// D3D11 only takes block compressed textures whose top level is a multiple of the block size
+	valid = valid && (!IsBlockCompressed(mFormat) || (header.width % 4 == 0 && header.height % 4 == 0));
+	if (!valid)
+	{
+		Close();
+		return false;
+	}
+
+	uint32_t width = header.width, height = header.height;
+	for (uint32_t i = 0; i < mipCount; i++)
+	{
+		TextureLevel &level = mLevels[i];
+		level.data = data + offset;
+		level.width = width;
+		level.height = height;
+		level.rowPitch = GetRowPitch(mFormat, width);
+		level.size = GetLevelSize(mFormat, width, height);
+		offset += level.size;
+		if (offset > size)
+		{
+			Close();
+			return false;
+		}
+		width = std::max(1u, width / 2);
+		height = std::max(1u, height / 2);
+	}
+	mLevelsCount = mipCount;
+	return true;
+}
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+void DdsFile::Close()
+{
+	mFile.Close();
+	mFormat = Texture_RGBA8;
+	memset(mLevels, 0, sizeof(mLevels));
+	mLevelsCount = 0;
+}
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+bool OpenOrBuildTexture(DdsFile &file, const char *path, const uint32_t *texels, uint32_t width, uint32_t height,
+	TextureFormat format, JobSystem *jobs)
+{
+	// a file left by a build with another format or source size is rebuilt
+	if (file.Open(path))
+	{
+		if (file.GetFormat() == format && file.GetWidth() == width && file.GetHeight() == height &&
+			file.GetMipCount() == GetMipCount(width, height))
+			return true;
+		file.Close();
+	}
+
+	std::vector<TextureImage> levels;
+	GenerateMips(texels, width, height, levels);
+	return SaveDds(path, levels, format, jobs) && file.Open(path);
+}
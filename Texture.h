@@ -0,0 +1,99 @@
+#pragma once
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Texture pipeline: mip chains, BC block compression and memory mapped DDS loading.
+// GenerateMips halves R8G8B8A8 images with a 2x2 box filter, four (SSE) or eight (AVX2) output texels at a time.
+// CompressBlocks encodes 4x4 blocks to BC1 (opaque color), BC3 (BC1 color + interpolated alpha) or BC7 (mode 6 only:
+// one subset, RGBA endpoints with p-bits and 16 interpolation steps), spreading rows of blocks over the job system.
+// SaveDds writes the whole chain, DdsFile maps it back and hands out per level pointers that go to
+// D3D11_SUBRESOURCE_DATA as they are.
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+#include "MappedFile.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+class JobSystem;
+
+enum TextureFormat
+{
+	Texture_RGBA8, // DXGI_FORMAT_R8G8B8A8_UNORM
+	Texture_BC1,   // DXGI_FORMAT_BC1_UNORM, 8 bytes per block, alpha is dropped
+	Texture_BC3,   // DXGI_FORMAT_BC3_UNORM, 16 bytes per block
+	Texture_BC7,   // DXGI_FORMAT_BC7_UNORM, 16 bytes per block
+};
+
+// texels packed as R8G8B8A8, red in the low byte
+struct TextureImage
+{
+	uint32_t              width;
+	uint32_t              height;
+	std::vector<uint32_t> texels;
+};
+
+// same as D3D11_REQ_MIP_LEVELS, a 16384 texture
+const uint32_t kMaxMipLevels = 15;
+
+unsigned GetDxgiFormat(TextureFormat format);
+bool IsBlockCompressed(TextureFormat format);
+// bytes per row of texels, or per row of 4x4 blocks
+size_t GetRowPitch(TextureFormat format, uint32_t width);
+size_t GetLevelSize(TextureFormat format, uint32_t width, uint32_t height);
+// down to 1x1
+uint32_t GetMipCount(uint32_t width, uint32_t height);
+
+// next level, max(1, size / 2); odd sizes drop the last row or column
+void Downsample(const TextureImage &src, TextureImage &dst);
+// scalar reference of Downsample, same results
+void DownsampleReference(const TextureImage &src, TextureImage &dst);
+// levels[0] is a copy of the source
+void GenerateMips(const uint32_t *texels, uint32_t width, uint32_t height, std::vector<TextureImage> &levels);
+
+// GetLevelSize(format, width, height) bytes; edge blocks repeat the last row and column, jobs may be null
+void CompressBlocks(const uint32_t *texels, uint32_t width, uint32_t height, TextureFormat format, unsigned char *blocks, JobSystem *jobs);
+// false for BC7 blocks in any mode but 6, the only one CompressBlocks writes
+bool DecompressBlocks(const unsigned char *blocks, uint32_t width, uint32_t height, TextureFormat format, uint32_t *texels);
+
+// BC formats need the top level to be a multiple of 4 in both directions, like D3D11
+bool SaveDds(const char *path, const std::vector<TextureImage> &levels, TextureFormat format, JobSystem *jobs);
+
+struct TextureLevel
+{
+	const void *data; // into the mapping
+	uint32_t   width;
+	uint32_t   height;
+	size_t     rowPitch;
+	size_t     size;
+};
+
+// R8G8B8A8_UNORM, DXT1, DXT5 and DX10 headers with the four formats above; 2D textures without arrays only
+class DdsFile
+{
+public:
+	DdsFile();
+
+	bool Open(const char *path);
+	void Close();
+
+	bool IsOpen() const { return mFile.IsOpen(); }
+	TextureFormat GetFormat() const { return mFormat; }
+	uint32_t GetWidth() const { return mLevelsCount ? mLevels[0].width : 0; }
+	uint32_t GetHeight() const { return mLevelsCount ? mLevels[0].height : 0; }
+	uint32_t GetMipCount() const { return mLevelsCount; }
+	// valid until Close
+	const TextureLevel& GetLevel(uint32_t level) const { return mLevels[level]; }
+
+private:
+	DdsFile(const DdsFile&);
+	DdsFile& operator=(const DdsFile&);
+
+	MappedFile    mFile;
+	TextureFormat mFormat;
+	TextureLevel  mLevels[kMaxMipLevels];
+	uint32_t      mLevelsCount;
+};
+
+// maps path, building it first when it is missing or holds another format, size or mip count: full mip chain
+// compressed to format
+bool OpenOrBuildTexture(DdsFile &file, const char *path, const uint32_t *texels, uint32_t width, uint32_t height,
+	TextureFormat format, JobSystem *jobs);
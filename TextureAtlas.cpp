@@ -0,0 +1,191 @@
+#include "TextureAtlas.h"
+
+#include <algorithm>
+#include <cassert>
+#include <functional>
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+namespace
+{
+	bool SameLayout(const TextureArrayDesc &a, const TextureArrayDesc &b)
+	{
+		return a.format == b.format && a.width == b.width && a.height == b.height && a.mipCount == b.mipCount;
+	}
+
+	uint32_t AlignUp(uint32_t value, uint32_t alignment)
+	{
+		return (value + alignment - 1) & ~(alignment - 1);
+	}
+}
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// std::min and std::max take it by reference
+const uint32_t TextureArrayAllocator::kMaxSlices;
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+TextureArrayAllocator::TextureArrayAllocator(uint32_t slicesPerArray)
+	: mSlicesPerArray(std::min(std::max(slicesPerArray, 1u), kMaxSlices))
+{
+}
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+bool TextureArrayAllocator::Allocate(const TextureArrayDesc &desc, TextureSlot &slot)
+{
+	if (!desc.width || !desc.height || !desc.mipCount || desc.mipCount > GetMipCount(desc.width, desc.height))
+		return false;
+
+	for (size_t i = 0; i < mArrays.size(); i++)
+	{
+		Array &array = mArrays[i];
+		if (!SameLayout(array.desc, desc))
+			continue;
+
+		slot.array = static_cast<uint32_t>(i);
+		if (!array.freeSlices.empty())
+		{
+			slot.slice = array.freeSlices.back();
+			array.freeSlices.pop_back();
+			return true;
+		}
+		if (array.sliceCount < mSlicesPerArray)
+		{
+			slot.slice = array.sliceCount++;
+			return true;
+		}
+	}
+
+	Array array;
+	array.desc = desc;
+	array.sliceCount = 1;
+	mArrays.push_back(array);
+	slot.array = static_cast<uint32_t>(mArrays.size() - 1);
+	slot.slice = 0;
+	return true;
+}
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+void TextureArrayAllocator::Free(const TextureSlot &slot)
+{
+	assert(slot.array < mArrays.size() && slot.slice < mArrays[slot.array].sliceCount);
+	Array &array = mArrays[slot.array];
+	// the lowest free slice is the last one, holes near the start are filled first
+	std::vector<uint32_t>::iterator position =
+		std::lower_bound(array.freeSlices.begin(), array.freeSlices.end(), slot.slice, std::greater<uint32_t>());
+	assert(position == array.freeSlices.end() || *position != slot.slice);
+	array.freeSlices.insert(position, slot.slice);
+}
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+TextureArrayStats TextureArrayAllocator::GetStats() const
+{
+	TextureArrayStats stats = { GetArrayCount(), 0, 0 };
+	for (size_t i = 0; i < mArrays.size(); i++)
+	{
+		stats.allocatedSlices += mArrays[i].sliceCount;
+		stats.slices += mArrays[i].sliceCount - static_cast<uint32_t>(mArrays[i].freeSlices.size());
+	}
+	return stats;
+}
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+AtlasPacker::AtlasPacker(uint32_t width, uint32_t height, uint32_t alignment)
+	: mWidth(width), mHeight(height), mAlignment(alignment), mCount(0), mUsedTexels(0)
+{
+	assert(alignment && !(alignment & (alignment - 1)) && !(width % alignment) && !(height % alignment));
+	Reset();
+}
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+void AtlasPacker::Reset()
+{
+	Segment floor = { 0, 0, mWidth };
+	mSkyline.assign(1, floor);
+	mCount = 0;
+	mUsedTexels = 0;
+}
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+bool AtlasPacker::Fit(size_t index, uint32_t width, uint32_t height, uint32_t &y) const
+{
+	if (mSkyline[index].x + width > mWidth)
+		return false;
+
+	// the rectangle rests on the highest segment under it
+	y = 0;
+	uint32_t covered = 0;
+	for (size_t i = index; covered < width; i++)
+	{
+		y = std::max(y, mSkyline[i].y);
+		if (y + height > mHeight)
+			return false;
+		covered += mSkyline[i].width;
+	}
+	return true;
+}
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// bottom-left: the position with the lowest top, on the narrowest segment when tops are equal so wide gaps stay open
+bool AtlasPacker::Insert(uint32_t width, uint32_t height, AtlasRect &rect)
+{
+	if (!width || !height)
+		return false;
+	uint32_t alignedWidth = AlignUp(width, mAlignment);
+	uint32_t alignedHeight = AlignUp(height, mAlignment);
+	if (alignedWidth > mWidth || alignedHeight > mHeight)
+		return false;
+
+	size_t best = mSkyline.size();
+	uint32_t bestY = 0, bestTop = UINT32_MAX, bestWidth = UINT32_MAX;
+	for (size_t i = 0; i < mSkyline.size(); i++)
+	{
+		uint32_t y;
+		if (!Fit(i, alignedWidth, alignedHeight, y))
+			continue;
+		uint32_t top = y + alignedHeight;
+		if (top < bestTop || (top == bestTop && mSkyline[i].width < bestWidth))
+		{
+			best = i;
+			bestY = y;
+			bestTop = top;
+			bestWidth = mSkyline[i].width;
+		}
+	}
+	if (best == mSkyline.size())
+		return false;
+
+	// the new segment replaces the tops it covers, the one it ends in is cut
+	Segment segment = { mSkyline[best].x, bestTop, alignedWidth };
+	mSkyline.insert(mSkyline.begin() + best, segment);
+	uint32_t end = segment.x + segment.width;
+	for (size_t i = best + 1; i < mSkyline.size();)
+	{
+		Segment &next = mSkyline[i];
+		if (next.x >= end)
+			break;
+		uint32_t nextEnd = next.x + next.width;
+		if (nextEnd <= end)
+		{
+			mSkyline.erase(mSkyline.begin() + i);
+			continue;
+		}
+		next.width = nextEnd - end;
+		next.x = end;
+		break;
+	}
+	for (size_t i = 0; i + 1 < mSkyline.size();)
+	{
+		if (mSkyline[i].y == mSkyline[i + 1].y)
+		{
+			mSkyline[i].width += mSkyline[i + 1].width;
+			mSkyline.erase(mSkyline.begin() + i + 1);
+		}
+		else
+			i++;
+	}
+
+	rect.x = segment.x;
+	rect.y = bestY;
+	rect.width = width;
+	rect.height = height;
+	mCount++;
+	mUsedTexels += uint64_t(width) * height;
+	return true;
+}
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+void GetAtlasUvTransform(const AtlasRect &rect, uint32_t pageWidth, uint32_t pageHeight, float scaleOffset[4])
+{
+	scaleOffset[0] = float(rect.width) / pageWidth;
+	scaleOffset[1] = float(rect.height) / pageHeight;
+	scaleOffset[2] = float(rect.x) / pageWidth;
+	scaleOffset[3] = float(rect.y) / pageHeight;
+}
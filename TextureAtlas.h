@@ -0,0 +1,120 @@
+#pragma once
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Many textures behind one binding.
+// TextureArrayAllocator hands out slices of Texture2DArrays: textures with the same format, size and mip count share
+// an array and a draw picks its slice with an index (per instance in SimpleVertexShaderInstanced) instead of binding
+// a view of its own. Slots are assigned while the textures are loaded, the arrays are created afterwards with
+// GetSliceCount slices since a D3D11 array cannot grow.
+// AtlasPacker is for textures that do not share a size: it places rectangles on a page with the skyline bottom-left
+// heuristic and the draw picks its texture with a uv scale and offset. Positions and sizes are rounded up to the
+// alignment, so BC blocks never straddle two textures and the first mips of every texture stay inside its rectangle.
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+#include "Texture.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+struct TextureArrayDesc
+{
+	TextureFormat format;
+	uint32_t      width;
+	uint32_t      height;
+	uint32_t      mipCount;
+};
+
+struct TextureSlot
+{
+	uint32_t array;
+	uint32_t slice;
+};
+
+struct TextureArrayStats
+{
+	uint32_t arrays;
+	uint32_t slices;          // in use
+	uint32_t allocatedSlices; // what the arrays are created with, freed slices included
+};
+
+class TextureArrayAllocator
+{
+public:
+	// same as D3D11_REQ_TEXTURE2D_ARRAY_AXIS_DIMENSION
+	static const uint32_t kMaxSlices = 2048;
+
+	// slicesPerArray is clamped to kMaxSlices
+	explicit TextureArrayAllocator(uint32_t slicesPerArray = kMaxSlices);
+
+	// a free slice of the first array laid out like desc, a new array when they are all full; false for an empty
+	// desc or more mips than its size has
+	bool Allocate(const TextureArrayDesc &desc, TextureSlot &slot);
+	// the slice goes back to its array and is handed out again before the array grows
+	void Free(const TextureSlot &slot);
+	void Clear() { mArrays.clear(); }
+
+	uint32_t GetArrayCount() const { return static_cast<uint32_t>(mArrays.size()); }
+	const TextureArrayDesc& GetArrayDesc(uint32_t array) const { return mArrays[array].desc; }
+	// the ArraySize to create the array with, one past the highest slice handed out
+	uint32_t GetSliceCount(uint32_t array) const { return mArrays[array].sliceCount; }
+
+	TextureArrayStats GetStats() const;
+
+private:
+	struct Array
+	{
+		TextureArrayDesc      desc;
+		uint32_t              sliceCount;
+		std::vector<uint32_t> freeSlices;
+	};
+
+	uint32_t           mSlicesPerArray;
+	std::vector<Array> mArrays;
+};
+
+struct AtlasRect
+{
+	uint32_t x;
+	uint32_t y;
+	uint32_t width;
+	uint32_t height;
+};
+
+class AtlasPacker
+{
+public:
+	// alignment is a power of two and divides width and height: 4 keeps BC blocks apart, 4 << n also mips 1 to n
+	AtlasPacker(uint32_t width, uint32_t height, uint32_t alignment = 4);
+
+	// false when the page has no room left; rect is the texture's own size at an aligned position
+	bool Insert(uint32_t width, uint32_t height, AtlasRect &rect);
+	void Reset();
+
+	uint32_t GetWidth() const { return mWidth; }
+	uint32_t GetHeight() const { return mHeight; }
+	uint32_t GetAlignment() const { return mAlignment; }
+	size_t GetCount() const { return mCount; }
+	// texels of the inserted textures over the page; alignment padding and the holes under the skyline are empty
+	double GetFillRatio() const { return double(mUsedTexels) / (double(mWidth) * mHeight); }
+
+private:
+	// the top of a column range of the page, the segments cover the page width left to right
+	struct Segment
+	{
+		uint32_t x;
+		uint32_t y;
+		uint32_t width;
+	};
+
+	// y is where a width x height rectangle starting at segment index would be placed
+	bool Fit(size_t index, uint32_t width, uint32_t height, uint32_t &y) const;
+
+	uint32_t             mWidth;
+	uint32_t             mHeight;
+	uint32_t             mAlignment;
+	std::vector<Segment> mSkyline;
+	size_t               mCount;
+	uint64_t             mUsedTexels;
+};
+
+// uv scale (xy) and offset (zw) that map a texture's 0..1 coordinates to its rect on a width x height page
+void GetAtlasUvTransform(const AtlasRect &rect, uint32_t pageWidth, uint32_t pageHeight, float scaleOffset[4]);
@@ -0,0 +1,376 @@
+#include "Trace.h"
+
+#if TRACE_ENABLED
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_set>
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+struct TraceEvent
+{
+	const char *name;
+	uint64_t   beginNs;
+	uint64_t   endNs;
+};
+
+// one writer: its thread, or the GpuTrace that made it. The writer fills an event before it publishes the count, so
+// the exporter reads what is below the count without a lock.
+class TraceTrack
+{
+public:
+	TraceTrack(const std::string &name, uint32_t id, bool thread, size_t capacity)
+		: mName(name), mId(id), mThread(thread), mEvents(new TraceEvent[capacity]), mCapacity(capacity), mCount(0), mDropped(0)
+	{
+	}
+
+	void Record(const char *name, uint64_t beginNs, uint64_t endNs)
+	{
+		size_t count = mCount.load(std::memory_order_relaxed);
+		if (count == mCapacity)
+		{
+			mDropped.store(mDropped.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+			return;
+		}
+		TraceEvent &event = mEvents[count];
+		event.name = name;
+		event.beginNs = beginNs;
+		event.endNs = endNs;
+		mCount.store(count + 1, std::memory_order_release);
+	}
+
+	const std::string& GetName() const { return mName; }
+	uint32_t GetId() const { return mId; }
+	bool IsThread() const { return mThread; }
+	size_t GetCount() const { return mCount.load(std::memory_order_acquire); }
+	const TraceEvent& GetEvent(size_t i) const { return mEvents[i]; }
+	uint64_t GetDropped() const { return mDropped.load(std::memory_order_relaxed); }
+
+private:
+	TraceTrack(const TraceTrack&);
+	TraceTrack& operator=(const TraceTrack&);
+
+	std::string                   mName;
+	uint32_t                      mId;     // the tid of the export
+	bool                          mThread;
+	std::unique_ptr<TraceEvent[]> mEvents;
+	size_t                        mCapacity;
+	std::atomic<size_t>           mCount;
+	std::atomic<uint64_t>         mDropped;
+};
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+namespace
+{
+	std::atomic<bool>                        gRecording(false);
+	std::atomic<size_t>                      gEventsPerThread(0); // 0 until the session begins
+	uint64_t                                 gSessionBeginNs = 0;
+	std::mutex                               gTracksMutex;
+	std::vector<std::unique_ptr<TraceTrack>> gTracks;             // under gTracksMutex, never removed
+	std::mutex                               gNamesMutex;
+	std::unordered_set<std::string>          gNames;              // under gNamesMutex, the nodes never move
+
+	// plain data, the track is made on the thread's first span
+	thread_local TraceTrack *tTrack = nullptr;
+	thread_local const char *tThreadName = nullptr;
+	thread_local int        tThreadIndex = -1;
+
+	TraceTrack* CreateTrack(const char *name, int index, bool thread)
+	{
+		std::lock_guard<std::mutex> lock(gTracksMutex);
+		uint32_t id = static_cast<uint32_t>(gTracks.size() + 1);
+		std::string trackName = name ? name : "thread";
+		if (index >= 0 || !name)
+			trackName += " " + std::to_string(index >= 0 ? index : static_cast<int>(id));
+		gTracks.push_back(std::unique_ptr<TraceTrack>(new TraceTrack(trackName, id, thread, gEventsPerThread.load())));
+		return gTracks.back().get();
+	}
+
+	TraceTrack* GetThreadTrack()
+	{
+		if (!tTrack && gEventsPerThread.load(std::memory_order_acquire))
+			tTrack = CreateTrack(tThreadName, tThreadIndex, true);
+		return tTrack;
+	}
+
+	void WriteJsonString(FILE *file, const char *text)
+	{
+		fputc('"', file);
+		for (const char *c = text; *c; c++)
+		{
+			if (*c == '"' || *c == '\\')
+				fprintf(file, "\\%c", *c);
+			else if (static_cast<unsigned char>(*c) < 0x20)
+				fprintf(file, "\\u%04x", static_cast<unsigned>(*c));
+			else
+				fputc(*c, file);
+		}
+		fputc('"', file);
+	}
+}
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+void TraceBeginSession(size_t eventsPerThread)
+{
+	size_t none = 0;
+	if (!eventsPerThread || !gEventsPerThread.compare_exchange_strong(none, eventsPerThread))
+		return;
+	gSessionBeginNs = TraceNowNs();
+	GetThreadTrack();
+	gRecording.store(true, std::memory_order_release);
+}
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+void TraceEndSession()
+{
+	gRecording.store(false, std::memory_order_release);
+}
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+bool TraceIsRecording()
+{
+	return gRecording.load(std::memory_order_relaxed);
+}
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+uint64_t TraceNowNs()
+{
+	std::chrono::nanoseconds now = std::chrono::steady_clock::now().time_since_epoch();
+	return static_cast<uint64_t>(now.count());
+}
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+void TraceSetThreadName(const char *name, int index)
+{
+	tThreadName = name;
+	tThreadIndex = index;
+}
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+const char* TraceInternName(const char *name)
+{
+	std::lock_guard<std::mutex> lock(gNamesMutex);
+	return gNames.insert(name).first->c_str();
+}
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+void TraceRecord(const char *name, uint64_t beginNs, uint64_t endNs)
+{
+	TraceTrack *track = GetThreadTrack();
+	if (track)
+		track->Record(name, beginNs, endNs);
+}
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+TraceTrack* TraceCreateTrack(const char *name)
+{
+	if (!gEventsPerThread.load(std::memory_order_acquire))
+		return nullptr;
+	return CreateTrack(name, -1, false);
+}
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+void TraceRecord(TraceTrack *track, const char *name, uint64_t beginNs, uint64_t endNs)
+{
+	if (track)
+		track->Record(name, beginNs, endNs);
+}
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// one event per line; the threads first, then the other tracks, each with its spans in the order they ended
+bool TraceExport(const char *path)
+{
+	FILE *file = fopen(path, "w");
+	if (!file)
+		return false;
+
+	std::lock_guard<std::mutex> lock(gTracksMutex);
+	fprintf(file, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+	const char *separator = "";
+	for (size_t t = 0; t < gTracks.size(); t++)
+	{
+		const TraceTrack &track = *gTracks[t];
+		unsigned tid = track.GetId();
+		fprintf(file, "%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%u,\"args\":{\"name\":", separator, tid);
+		WriteJsonString(file, track.GetName().c_str());
+		fprintf(file, "}},\n{\"name\":\"thread_sort_index\",\"ph\":\"M\",\"pid\":1,\"tid\":%u,\"args\":{\"sort_index\":%u}}",
+			tid, track.IsThread() ? tid : tid + 1000);
+		separator = ",\n";
+	}
+
+	for (size_t t = 0; t < gTracks.size(); t++)
+	{
+		const TraceTrack &track = *gTracks[t];
+		size_t count = track.GetCount();
+		for (size_t i = 0; i < count; i++)
+		{
+			const TraceEvent &event = track.GetEvent(i);
+			uint64_t beginNs = event.beginNs > gSessionBeginNs ? event.beginNs - gSessionBeginNs : 0;
+			uint64_t durationNs = event.endNs > event.beginNs ? event.endNs - event.beginNs : 0;
+			fprintf(file, ",\n{\"name\":");
+			WriteJsonString(file, event.name);
+			fprintf(file, ",\"cat\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":%u,\"ts\":%.3f,\"dur\":%.3f}",
+				track.IsThread() ? "cpu" : "gpu", track.GetId(), beginNs / 1000.0, durationNs / 1000.0);
+		}
+	}
+	fprintf(file, "\n]}\n");
+	return fclose(file) == 0;
+}
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+TraceStats TraceGetStats()
+{
+	TraceStats stats = {};
+	std::lock_guard<std::mutex> lock(gTracksMutex);
+	stats.tracks = static_cast<uint32_t>(gTracks.size());
+	for (size_t t = 0; t < gTracks.size(); t++)
+	{
+		stats.events += gTracks[t]->GetCount();
+		stats.dropped += gTracks[t]->GetDropped();
+	}
+	return stats;
+}
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+GpuTrace::GpuTrace(GpuTimestampBackend &backend, const char *trackName, uint32_t framesInFlight,
+	uint32_t timestampsPerFrame)
+	: mBackend(backend)
+	, mTrack(nullptr)
+	, mTrackName(trackName)
+	, mTimestampsPerFrame(timestampsPerFrame < 2 ? 2 : timestampsPerFrame)
+	, mFrames(framesInFlight ? framesInFlight : 1)
+	, mTimestamps(mTimestampsPerFrame)
+	, mFrameIndex(0)
+	, mCurrent(nullptr)
+{
+	for (size_t i = 0; i < mFrames.size(); i++)
+	{
+		Frame &frame = mFrames[i];
+		frame.spans.reserve(mTimestampsPerFrame / 2);
+		frame.timestamps = 0;
+		frame.reserved = 0;
+		frame.anchorNs = 0;
+		frame.pending = false;
+	}
+	GpuTraceStats none = {};
+	mStats = none;
+}
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+void GpuTrace::BeginFrame()
+{
+	mCurrent = nullptr;
+	if (!TraceIsRecording())
+		return;
+	if (!mTrack)
+		mTrack = TraceCreateTrack(mTrackName);
+
+	// the slot is reused every framesInFlight frames, a frame that is still not ready is dropped
+	uint32_t slot = static_cast<uint32_t>(mFrameIndex % mFrames.size());
+	Frame &frame = mFrames[slot];
+	if (frame.pending && !Collect(frame, slot))
+	{
+		frame.pending = false;
+		mStats.droppedFrames++;
+	}
+
+	Span whole = { "gpu frame", 0, kNoSpan };
+	frame.spans.clear();
+	frame.spans.push_back(whole);
+	frame.timestamps = 1;
+	frame.reserved = 2;
+	mBackend.BeginFrame(slot);
+	frame.anchorNs = TraceNowNs();
+	mBackend.WriteTimestamp(slot, 0);
+	mCurrent = &frame;
+}
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+void GpuTrace::EndFrame()
+{
+	if (!mCurrent)
+		return;
+
+	uint32_t slot = static_cast<uint32_t>(mFrameIndex % mFrames.size());
+	Frame &frame = *mCurrent;
+	frame.spans[0].end = frame.timestamps;
+	mBackend.WriteTimestamp(slot, frame.timestamps++);
+	mBackend.EndFrame(slot);
+	frame.pending = true;
+	mCurrent = nullptr;
+	mFrameIndex++;
+
+	for (uint32_t i = 0; i < mFrames.size(); i++)
+		if (i != slot && mFrames[i].pending)
+			Collect(mFrames[i], i);
+}
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// a span takes its end timestamp when it begins, so an open span can always end
+uint32_t GpuTrace::BeginSpan(const char *name)
+{
+	if (!mCurrent)
+		return kNoSpan;
+	Frame &frame = *mCurrent;
+	if (frame.reserved + 2 > mTimestampsPerFrame)
+	{
+		mStats.droppedSpans++;
+		return kNoSpan;
+	}
+
+	frame.reserved += 2;
+	Span span = { name, frame.timestamps, kNoSpan };
+	frame.spans.push_back(span);
+	mBackend.WriteTimestamp(static_cast<uint32_t>(mFrameIndex % mFrames.size()), frame.timestamps++);
+	return static_cast<uint32_t>(frame.spans.size() - 1);
+}
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+void GpuTrace::EndSpan(uint32_t span)
+{
+	if (!mCurrent || span >= mCurrent->spans.size())
+		return;
+	Frame &frame = *mCurrent;
+	frame.spans[span].end = frame.timestamps;
+	mBackend.WriteTimestamp(static_cast<uint32_t>(mFrameIndex % mFrames.size()), frame.timestamps++);
+}
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+void GpuTrace::Flush(double timeoutMs)
+{
+	uint64_t deadlineNs = TraceNowNs() + static_cast<uint64_t>(timeoutMs * 1000000.0);
+	for (;;)
+	{
+		bool pending = false;
+		for (uint32_t i = 0; i < mFrames.size(); i++)
+			pending = (mFrames[i].pending && !Collect(mFrames[i], i)) || pending;
+		if (!pending)
+			return;
+		if (TraceNowNs() > deadlineNs)
+			break;
+		std::this_thread::yield();
+	}
+
+	for (size_t i = 0; i < mFrames.size(); i++)
+		if (mFrames[i].pending)
+		{
+			mFrames[i].pending = false;
+			mStats.droppedFrames++;
+		}
+}
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// the spans go on the GPU track, placed from the frame's anchor
+bool GpuTrace::Collect(Frame &frame, uint32_t slot)
+{
+	uint64_t frequency = 0;
+	if (!mBackend.ReadFrame(slot, frame.timestamps, mTimestamps.data(), frequency))
+		return false;
+
+	frame.pending = false;
+	mStats.frames++;
+	if (!frequency)
+	{
+		mStats.droppedFrames++;
+		return true;
+	}
+
+	double nsPerTick = 1e9 / double(frequency);
+	uint64_t first = mTimestamps[0];
+	for (size_t i = 0; i < frame.spans.size(); i++)
+	{
+		const Span &span = frame.spans[i];
+		if (span.end == kNoSpan || mTimestamps[span.begin] < first || mTimestamps[span.end] < mTimestamps[span.begin])
+			continue;
+		uint64_t beginNs = frame.anchorNs + static_cast<uint64_t>(double(mTimestamps[span.begin] - first) * nsPerTick);
+		uint64_t endNs = frame.anchorNs + static_cast<uint64_t>(double(mTimestamps[span.end] - first) * nsPerTick);
+		TraceRecord(mTrack, span.name, beginNs, endNs);
+		mStats.spans++;
+	}
+	return true;
+}
+#endif
@@ -0,0 +1,205 @@
+#pragma once
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Scoped CPU and GPU trace markers, exported as Chrome trace-event JSON (chrome://tracing, ui.perfetto.dev).
+// TRACE_SCOPE records a span from its line to the end of the enclosing block on the calling thread. Every thread
+// writes to a fixed buffer of its own, taken on its first span of the session, so recording takes no lock: two clock
+// reads and a store; once the buffer is full the later spans are dropped and counted. Nothing is recorded outside
+// TraceBeginSession / TraceEndSession, a marker then costs one relaxed load.
+// Span names are not copied: literals, or TRACE_SCOPE_DYNAMIC, which interns the name once per distinct string.
+// GpuTrace brackets a frame and its GPU spans with timestamp queries through a GpuTimestampBackend (D3D11 in
+// main.cpp, a stub in HeadlessMain.cpp) and, once the frame's queries are ready, records the spans on a GPU track.
+// There is no clock calibration in D3D11: a frame's spans are placed from the CPU time its first timestamp was
+// issued, the offsets within the frame are the GPU's own.
+// TRACE_ENABLED is 0 in release builds (NDEBUG) unless the build defines it, the macros are then empty and nothing
+// else here is compiled.
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+#ifndef TRACE_ENABLED
+#ifdef NDEBUG
+#define TRACE_ENABLED 0
+#else
+#define TRACE_ENABLED 1
+#endif
+#endif
+
+#if TRACE_ENABLED
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#define TRACE_CONCAT_INNER(a, b) a##b
+#define TRACE_CONCAT(a, b) TRACE_CONCAT_INNER(a, b)
+#define TRACE_SCOPE(name) TraceScope TRACE_CONCAT(traceScope, __LINE__)(name)
+// for names that do not outlive the scope, task names
+#define TRACE_SCOPE_DYNAMIC(name) \
+	TraceScope TRACE_CONCAT(traceScope, __LINE__)(TraceIsRecording() ? TraceInternName(name) : nullptr)
+// trace is a GpuTrace*, null when there is no GPU tracing
+#define TRACE_GPU_SCOPE(trace, name) GpuTraceScope TRACE_CONCAT(gpuTraceScope, __LINE__)(trace, name)
+#define TRACE_GPU_BEGIN_FRAME(trace) ((trace) ? (trace)->BeginFrame() : (void)0)
+#define TRACE_GPU_END_FRAME(trace) ((trace) ? (trace)->EndFrame() : (void)0)
+// index >= 0 is appended to the name
+#define TRACE_THREAD_NAME(name, index) TraceSetThreadName(name, index)
+#else
+#define TRACE_SCOPE(name)
+#define TRACE_SCOPE_DYNAMIC(name)
+#define TRACE_GPU_SCOPE(trace, name)
+#define TRACE_GPU_BEGIN_FRAME(trace)
+#define TRACE_GPU_END_FRAME(trace)
+#define TRACE_THREAD_NAME(name, index)
+#endif
+
+#if TRACE_ENABLED
+struct TraceStats
+{
+	uint32_t tracks;  // threads that recorded, and the GPU tracks
+	uint64_t events;
+	uint64_t dropped; // recorded after a track was full
+};
+
+class TraceTrack;
+
+// once per run: every thread that records gets eventsPerThread spans; the calling thread takes its buffer here
+void TraceBeginSession(size_t eventsPerThread = 256 * 1024);
+void TraceEndSession();
+bool TraceIsRecording();
+
+// steady clock, the same on every thread
+uint64_t TraceNowNs();
+// the calling thread's track; the name is kept for its track, which is made on its first span
+void TraceSetThreadName(const char *name, int index = -1);
+// a copy of name that lives until the process ends, one per distinct string
+const char* TraceInternName(const char *name);
+// a span on the calling thread's track
+void TraceRecord(const char *name, uint64_t beginNs, uint64_t endNs);
+
+// a track that is not a thread, written by one thread at a time; null when the session has not begun
+TraceTrack* TraceCreateTrack(const char *name);
+void TraceRecord(TraceTrack *track, const char *name, uint64_t beginNs, uint64_t endNs);
+
+// every span recorded so far, as Chrome trace-event JSON; after TraceEndSession, or the spans being recorded are missed
+bool TraceExport(const char *path);
+TraceStats TraceGetStats();
+
+class TraceScope
+{
+public:
+	// a null name records nothing
+	explicit TraceScope(const char *name)
+		: mName(name && TraceIsRecording() ? name : nullptr)
+		, mBeginNs(mName ? TraceNowNs() : 0)
+	{
+	}
+
+	~TraceScope()
+	{
+		if (mName)
+			TraceRecord(mName, mBeginNs, TraceNowNs());
+	}
+
+private:
+	TraceScope(const TraceScope&);
+	TraceScope& operator=(const TraceScope&);
+
+	const char *mName;
+	uint64_t   mBeginNs;
+};
+
+class GpuTimestampBackend
+{
+public:
+	virtual ~GpuTimestampBackend() {}
+
+	// the frame's disjoint query, around all of its timestamps; slot < the GpuTrace's framesInFlight
+	virtual void BeginFrame(uint32_t slot) = 0;
+	virtual void EndFrame(uint32_t slot) = 0;
+	// index < the GpuTrace's timestampsPerFrame
+	virtual void WriteTimestamp(uint32_t slot, uint32_t index) = 0;
+	// never waits: false until the GPU has passed EndFrame. frequency is 0 when the timestamps are not reliable
+	// (the disjoint query says the clock changed)
+	virtual bool ReadFrame(uint32_t slot, uint32_t count, uint64_t *timestamps, uint64_t &frequency) = 0;
+};
+
+struct GpuTraceStats
+{
+	uint64_t frames;         // read back
+	uint64_t spans;          // recorded, the frame spans included
+	uint64_t droppedSpans;   // past timestampsPerFrame
+	uint64_t droppedFrames;  // not ready when their slot came round again, or disjoint
+};
+
+class GpuTrace
+{
+public:
+	static const uint32_t kNoSpan = UINT32_MAX;
+
+	// timestampsPerFrame covers the frame's begin and end, two per span
+	GpuTrace(GpuTimestampBackend &backend, const char *trackName, uint32_t framesInFlight, uint32_t timestampsPerFrame);
+
+	// render thread; does nothing while the session is not recording. The slot of the frame that is framesInFlight
+	// frames old is read back first.
+	void BeginFrame();
+	void EndFrame();
+	// kNoSpan outside a frame or when the frame has no timestamps left
+	uint32_t BeginSpan(const char *name);
+	void EndSpan(uint32_t span);
+
+	// reads back every frame still in flight, waits up to timeoutMs for the GPU
+	void Flush(double timeoutMs = 100.0);
+
+	const GpuTraceStats& GetStats() const { return mStats; }
+
+private:
+	struct Span
+	{
+		const char *name;
+		uint32_t   begin; // timestamp indices
+		uint32_t   end;
+	};
+
+	struct Frame
+	{
+		std::vector<Span> spans;       // spans[0] is the frame
+		uint32_t          timestamps;  // written so far
+		uint32_t          reserved;    // written, and the ends of the open spans and the frame
+		uint64_t          anchorNs;    // CPU time of the first timestamp
+		bool              pending;     // ended, not read back yet
+	};
+
+	GpuTrace(const GpuTrace&);
+	GpuTrace& operator=(const GpuTrace&);
+
+	bool Collect(Frame &frame, uint32_t slot);
+
+	GpuTimestampBackend   &mBackend;
+	TraceTrack            *mTrack;
+	const char            *mTrackName;
+	uint32_t              mTimestampsPerFrame;
+	std::vector<Frame>    mFrames;
+	std::vector<uint64_t> mTimestamps; // Collect's read back
+	uint64_t              mFrameIndex;
+	Frame                 *mCurrent;   // between BeginFrame and EndFrame
+	GpuTraceStats         mStats;
+};
+
+class GpuTraceScope
+{
+public:
+	GpuTraceScope(GpuTrace *trace, const char *name)
+		: mTrace(trace)
+		, mSpan(trace ? trace->BeginSpan(name) : GpuTrace::kNoSpan)
+	{
+	}
+
+	~GpuTraceScope()
+	{
+		if (mSpan != GpuTrace::kNoSpan)
+			mTrace->EndSpan(mSpan);
+	}
+
+private:
+	GpuTraceScope(const GpuTraceScope&);
+	GpuTraceScope& operator=(const GpuTraceScope&);
+
+	GpuTrace *mTrace;
+	uint32_t mSpan;
+};
+#endif
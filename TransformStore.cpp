@@ -0,0 +1,292 @@
+#include "TransformStore.h"
+
+#include <cstdint>
+#include <cstring>
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#else
+#include <emmintrin.h>
+#endif
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+namespace
+{
+	const size_t kAlignFloats = 8; // 32 bytes
+
+#if defined(__AVX2__)
+	typedef __m256 VFloat;
+	const size_t kLanes = 8;
+
+	inline VFloat VLoad(const float *p) { return _mm256_load_ps(p); }
+	inline VFloat VSet(float a) { return _mm256_set1_ps(a); }
+	inline VFloat VAdd(VFloat a, VFloat b) { return _mm256_add_ps(a, b); }
+	inline VFloat VSub(VFloat a, VFloat b) { return _mm256_sub_ps(a, b); }
+	inline VFloat VMul(VFloat a, VFloat b) { return _mm256_mul_ps(a, b); }
+	inline VFloat VMulAdd(VFloat a, VFloat b, VFloat c) { return _mm256_fmadd_ps(a, b, c); }
+
+	// 8 lanes x 8 values -> 8 floats of each of the 8 matrices
+	void StoreTransposed(const VFloat *rows, float *out0, size_t stride)
+	{
+		__m256 t0 = _mm256_unpacklo_ps(rows[0], rows[1]);
+		__m256 t1 = _mm256_unpackhi_ps(rows[0], rows[1]);
+		__m256 t2 = _mm256_unpacklo_ps(rows[2], rows[3]);
+		__m256 t3 = _mm256_unpackhi_ps(rows[2], rows[3]);
+		__m256 t4 = _mm256_unpacklo_ps(rows[4], rows[5]);
+		__m256 t5 = _mm256_unpackhi_ps(rows[4], rows[5]);
+		__m256 t6 = _mm256_unpacklo_ps(rows[6], rows[7]);
+		__m256 t7 = _mm256_unpackhi_ps(rows[6], rows[7]);
+
+		__m256 s0 = _mm256_shuffle_ps(t0, t2, 0x44);
+		__m256 s1 = _mm256_shuffle_ps(t0, t2, 0xEE);
+		__m256 s2 = _mm256_shuffle_ps(t1, t3, 0x44);
+		__m256 s3 = _mm256_shuffle_ps(t1, t3, 0xEE);
+		__m256 s4 = _mm256_shuffle_ps(t4, t6, 0x44);
+		__m256 s5 = _mm256_shuffle_ps(t4, t6, 0xEE);
+		__m256 s6 = _mm256_shuffle_ps(t5, t7, 0x44);
+		__m256 s7 = _mm256_shuffle_ps(t5, t7, 0xEE);
+
+		_mm256_storeu_ps(out0 + 0 * stride, _mm256_permute2f128_ps(s0, s4, 0x20));
+		_mm256_storeu_ps(out0 + 1 * stride, _mm256_permute2f128_ps(s1, s5, 0x20));
+		_mm256_storeu_ps(out0 + 2 * stride, _mm256_permute2f128_ps(s2, s6, 0x20));
+		_mm256_storeu_ps(out0 + 3 * stride, _mm256_permute2f128_ps(s3, s7, 0x20));
+		_mm256_storeu_ps(out0 + 4 * stride, _mm256_permute2f128_ps(s0, s4, 0x31));
+		_mm256_storeu_ps(out0 + 5 * stride, _mm256_permute2f128_ps(s1, s5, 0x31));
+		_mm256_storeu_ps(out0 + 6 * stride, _mm256_permute2f128_ps(s2, s6, 0x31));
+		_mm256_storeu_ps(out0 + 7 * stride, _mm256_permute2f128_ps(s3, s7, 0x31));
+	}
+
+	// the 16 element vectors of kLanes matrices back to kLanes consecutive Mat4
+	void StoreMatrices(const VFloat *m, Mat4 *out)
+	{
+		float *base = &out[0].m[0][0];
+		StoreTransposed(m, base, 16);
+		StoreTransposed(m + 8, base + 8, 16);
+	}
+#else
+	typedef __m128 VFloat;
+	const size_t kLanes = 4;
+
+	inline VFloat VLoad(const float *p) { return _mm_load_ps(p); }
+	inline VFloat VSet(float a) { return _mm_set1_ps(a); }
+	inline VFloat VAdd(VFloat a, VFloat b) { return _mm_add_ps(a, b); }
+	inline VFloat VSub(VFloat a, VFloat b) { return _mm_sub_ps(a, b); }
+	inline VFloat VMul(VFloat a, VFloat b) { return _mm_mul_ps(a, b); }
+	inline VFloat VMulAdd(VFloat a, VFloat b, VFloat c) { return _mm_add_ps(_mm_mul_ps(a, b), c); }
+
+	void StoreMatrices(const VFloat *m, Mat4 *out)
+	{
+		// one 4x4 transpose per matrix row
+		for (int row = 0; row < 4; row++)
+		{
+			__m128 r0 = m[row * 4 + 0], r1 = m[row * 4 + 1], r2 = m[row * 4 + 2], r3 = m[row * 4 + 3];
+			_MM_TRANSPOSE4_PS(r0, r1, r2, r3);
+			_mm_storeu_ps(out[0].m[row], r0);
+			_mm_storeu_ps(out[1].m[row], r1);
+			_mm_storeu_ps(out[2].m[row], r2);
+			_mm_storeu_ps(out[3].m[row], r3);
+		}
+	}
+#endif
+}
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+TransformStore::TransformStore()
+	: mCount(0)
+	, mCapacity(0)
+{
+	for (int c = 0; c < NumComponents; c++)
+		mComponents[c] = nullptr;
+}
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+void TransformStore::Resize(size_t count)
+{
+	if (count > mCapacity)
+	{
+		size_t capacity = (count + kBatch - 1) / kBatch * kBatch;
+		std::vector<float> memory(capacity * NumComponents + kAlignFloats, 0.0f);
+
+		// every component starts on a 32 byte boundary since capacity is a multiple of 8 floats
+		float *base = &memory[0];
+		base += (kAlignFloats - (reinterpret_cast<uintptr_t>(base) / sizeof(float)) % kAlignFloats) % kAlignFloats;
+
+		float *components[NumComponents];
+		for (int c = 0; c < NumComponents; c++)
+		{
+			components[c] = base + c * capacity;
+			if (mCount)
+				memcpy(components[c], mComponents[c], mCount * sizeof(float));
+			mComponents[c] = components[c];
+		}
+		mMemory.swap(memory);
+		mCapacity = capacity;
+	}
+
+	// padding lanes included, they are computed along with the last batch
+	size_t padded = (count + kBatch - 1) / kBatch * kBatch;
+	for (size_t i = mCount; i < padded; i++)
+	{
+		mComponents[PositionX][i] = mComponents[PositionY][i] = mComponents[PositionZ][i] = 0.0f;
+		mComponents[RotationX][i] = mComponents[RotationY][i] = mComponents[RotationZ][i] = 0.0f;
+		mComponents[RotationW][i] = 1.0f;
+		mComponents[ScaleX][i] = mComponents[ScaleY][i] = mComponents[ScaleZ][i] = 1.0f;
+	}
+	mCount = count;
+}
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+void TransformStore::Set(size_t index, const Vec3 &position, const Vec4 &rotation, const Vec3 &scale)
+{
+	mComponents[PositionX][index] = position.x;
+	mComponents[PositionY][index] = position.y;
+	mComponents[PositionZ][index] = position.z;
+	mComponents[RotationX][index] = rotation.x;
+	mComponents[RotationY][index] = rotation.y;
+	mComponents[RotationZ][index] = rotation.z;
+	mComponents[RotationW][index] = rotation.w;
+	mComponents[ScaleX][index] = scale.x;
+	mComponents[ScaleY][index] = scale.y;
+	mComponents[ScaleZ][index] = scale.z;
+}
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+Mat4 TransformStore::Compose(const Vec3 &position, const Vec4 &rotation, const Vec3 &scale)
+{
+	float x2 = rotation.x + rotation.x, y2 = rotation.y + rotation.y, z2 = rotation.z + rotation.z;
+	float xx = rotation.x * x2, yy = rotation.y * y2, zz = rotation.z * z2;
+	float xy = rotation.x * y2, xz = rotation.x * z2, yz = rotation.y * z2;
+	float wx = rotation.w * x2, wy = rotation.w * y2, wz = rotation.w * z2;
+
+	Mat4 r = { {
+		{ (1.0f - (yy + zz)) * scale.x, (xy + wz) * scale.x, (xz - wy) * scale.x, 0.0f },
+		{ (xy - wz) * scale.y, (1.0f - (xx + zz)) * scale.y, (yz + wx) * scale.y, 0.0f },
+		{ (xz + wy) * scale.z, (yz - wx) * scale.z, (1.0f - (xx + yy)) * scale.z, 0.0f },
+		{ position.x, position.y, position.z, 1.0f } } };
+	return r;
+}
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+void TransformStore::ComputeWorlds(size_t begin, size_t end, Mat4 *worlds) const
+{
+	Compute(begin, end, nullptr, worlds);
+}
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+void TransformStore::ComputeWorldViewProj(size_t begin, size_t end, const Mat4 &viewProj, Mat4 *worldViewProj) const
+{
+	Compute(begin, end, &viewProj, worldViewProj);
+}
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+namespace
+{
+	// kLanes transforms starting at components[c] + i; vp is null for plain world matrices
+	void ComputeLanes(float *const *components, size_t i, const VFloat *vp, Mat4 *out, size_t storeCount)
+	{
+		const VFloat one = VSet(1.0f);
+		const VFloat zero = VSet(0.0f);
+
+		VFloat qx = VLoad(components[TransformStore::RotationX] + i);
+		VFloat qy = VLoad(components[TransformStore::RotationY] + i);
+		VFloat qz = VLoad(components[TransformStore::RotationZ] + i);
+		VFloat qw = VLoad(components[TransformStore::RotationW] + i);
+		VFloat sx = VLoad(components[TransformStore::ScaleX] + i);
+		VFloat sy = VLoad(components[TransformStore::ScaleY] + i);
+		VFloat sz = VLoad(components[TransformStore::ScaleZ] + i);
+
+		VFloat x2 = VAdd(qx, qx), y2 = VAdd(qy, qy), z2 = VAdd(qz, qz);
+		VFloat xx = VMul(qx, x2), yy = VMul(qy, y2), zz = VMul(qz, z2);
+		VFloat xy = VMul(qx, y2), xz = VMul(qx, z2), yz = VMul(qy, z2);
+		VFloat wx = VMul(qw, x2), wy = VMul(qw, y2), wz = VMul(qw, z2);
+
+		// element e of the 16 is one vector over the lanes, same layout as Compose
+		VFloat m[16];
+		m[0] = VMul(VSub(one, VAdd(yy, zz)), sx);
+		m[1] = VMul(VAdd(xy, wz), sx);
+		m[2] = VMul(VSub(xz, wy), sx);
+		m[3] = zero;
+		m[4] = VMul(VSub(xy, wz), sy);
+		m[5] = VMul(VSub(one, VAdd(xx, zz)), sy);
+		m[6] = VMul(VAdd(yz, wx), sy);
+		m[7] = zero;
+		m[8] = VMul(VAdd(xz, wy), sz);
+		m[9] = VMul(VSub(yz, wx), sz);
+		m[10] = VMul(VSub(one, VAdd(xx, yy)), sz);
+		m[11] = zero;
+		m[12] = VLoad(components[TransformStore::PositionX] + i);
+		m[13] = VLoad(components[TransformStore::PositionY] + i);
+		m[14] = VLoad(components[TransformStore::PositionZ] + i);
+		m[15] = one;
+
+		if (vp)
+		{
+			// the affine world has (0, 0, 0, 1) as its last column: 3 multiply-adds per element, plus the row 3 term
+			VFloat r[16];
+			for (int row = 0; row < 4; row++)
+				for (int col = 0; col < 4; col++)
+				{
+					VFloat sum = row == 3 ? vp[12 + col] : VMul(m[row * 4 + 2], vp[8 + col]);
+					if (row == 3)
+						sum = VMulAdd(m[14], vp[8 + col], sum);
+					sum = VMulAdd(m[row * 4 + 1], vp[4 + col], sum);
+					r[row * 4 + col] = VMulAdd(m[row * 4 + 0], vp[col], sum);
+				}
+			memcpy(m, r, sizeof(m));
+		}
+
+		if (storeCount == kLanes)
+			StoreMatrices(m, out);
+		else
+		{
+			// the padding lanes of the last batch are computed but not stored
+			Mat4 tail[kLanes];
+			StoreMatrices(m, tail);
+			memcpy(out, tail, storeCount * sizeof(Mat4));
+		}
+	}
+}
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+void TransformStore::Compute(size_t begin, size_t end, const Mat4 *viewProj, Mat4 *out) const
+{
+	if (end > mCount)
+		end = mCount;
+
+	VFloat vp[16];
+	if (viewProj)
+		for (int i = 0; i < 16; i++)
+			vp[i] = VSet(viewProj->m[i / 4][i % 4]);
+
+	// an unaligned begin is handled by the scalar path up to the next lane boundary
+	size_t i = begin;
+	for (; i < end && i % kLanes; i++)
+	{
+		Vec3 position = { mComponents[PositionX][i], mComponents[PositionY][i], mComponents[PositionZ][i] };
+		Vec4 rotation = { mComponents[RotationX][i], mComponents[RotationY][i], mComponents[RotationZ][i], mComponents[RotationW][i] };
+		Vec3 scale = { mComponents[ScaleX][i], mComponents[ScaleY][i], mComponents[ScaleZ][i] };
+		Mat4 world = Compose(position, rotation, scale);
+		out[i - begin] = viewProj ? MatMultiply(world, *viewProj) : world;
+	}
+
+	for (; i < end; i += kLanes)
+		ComputeLanes(const_cast<float *const *>(mComponents), i, viewProj ? vp : nullptr, out + (i - begin),
+			end - i < kLanes ? end - i : kLanes);
+}
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+void TransformStore::ComputeWorldViewProjIndexed(const uint32_t *indices, size_t count, const Mat4 &viewProj, Mat4 *worldViewProj) const
+{
+	VFloat vp[16];
+	for (int i = 0; i < 16; i++)
+		vp[i] = VSet(viewProj.m[i / 4][i % 4]);
+
+	// scattered transforms are gathered into one aligned batch first
+	alignas(32) float block[NumComponents][kLanes];
+	float *components[NumComponents];
+	for (int c = 0; c < NumComponents; c++)
+		components[c] = block[c];
+
+	for (size_t i = 0; i < count; i += kLanes)
+	{
+		size_t lanes = count - i < kLanes ? count - i : kLanes;
+		for (size_t lane = 0; lane < kLanes; lane++)
+		{
+			// unused lanes repeat the last transform
+			uint32_t index = indices[i + (lane < lanes ? lane : lanes - 1)];
+			for (int c = 0; c < NumComponents; c++)
+				block[c][lane] = mComponents[c][index];
+		}
+		ComputeLanes(components, 0, vp, worldViewProj + i, lanes);
+	}
+}
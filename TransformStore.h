@@ -0,0 +1,65 @@
+#pragma once
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Structure-of-arrays transform storage with batched matrix kernels.
+// Positions, rotation quaternions and scales live in separate contiguous 32 byte aligned arrays, so the kernels load
+// one component of 8 (AVX2) or 4 (SSE) transforms per instruction, build the matrices lane-parallel and transpose
+// them back to Mat4 on store. ComputeWorldViewProj premultiplies the camera so a vertex needs a single transform.
+// Matrices follow MathUtils / DirectXMath: world = scale * rotation * translation, row vectors.
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+#include "MathUtils.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+class TransformStore
+{
+public:
+	// arrays are padded to a whole batch so the kernels never branch on the tail
+	static const size_t kBatch = 8;
+
+	enum Component
+	{
+		PositionX, PositionY, PositionZ,
+		RotationX, RotationY, RotationZ, RotationW,
+		ScaleX, ScaleY, ScaleZ,
+		NumComponents
+	};
+
+	TransformStore();
+
+	// keeps existing transforms, new ones are identity
+	void Resize(size_t count);
+	size_t GetCount() const { return mCount; }
+
+	// rotation is a unit quaternion (x, y, z, w) like XMQuaternionRotationAxis
+	void Set(size_t index, const Vec3 &position, const Vec4 &rotation, const Vec3 &scale);
+	// raw component array, GetCount() valid elements
+	float* GetComponent(Component component) { return mComponents[component]; }
+	const float* GetComponent(Component component) const { return mComponents[component]; }
+
+	void ComputeWorlds(size_t begin, size_t end, Mat4 *worlds) const;
+	// worldViewProj[i - begin] = world(i) * viewProj
+	void ComputeWorldViewProj(size_t begin, size_t end, const Mat4 &viewProj, Mat4 *worldViewProj) const;
+	// worldViewProj[i] = world(indices[i]) * viewProj, for the visible subset after culling
+	void ComputeWorldViewProjIndexed(const uint32_t *indices, size_t count, const Mat4 &viewProj, Mat4 *worldViewProj) const;
+
+	// scalar reference, same as XMMatrixAffineTransformation with a zero rotation origin
+	static Mat4 Compose(const Vec3 &position, const Vec4 &rotation, const Vec3 &scale);
+
+private:
+	void Compute(size_t begin, size_t end, const Mat4 *viewProj, Mat4 *out) const;
+
+	std::vector<float> mMemory;
+	float              *mComponents[NumComponents];
+	size_t             mCount;
+	size_t             mCapacity; // per component, multiple of kBatch
+};
+
+// axis must be normalized
+inline Vec4 QuatRotationAxis(const Vec3 &axis, float angle)
+{
+	float s = std::sin(angle * 0.5f);
+	Vec4 q = { axis.x * s, axis.y * s, axis.z * s, std::cos(angle * 0.5f) };
+	return q;
+}
@@ -0,0 +1,49 @@
+#pragma once
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Lock-free single producer / single consumer triple buffer.
+// The writer fills its back buffer and publishes it by swapping it with the middle one; the reader swaps its front
+// buffer with the middle one only when something new was published. Neither side ever waits and the reader always
+// sees a complete snapshot, intermediate snapshots are dropped when the writer is faster.
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+#include <atomic>
+
+template <class T>
+class TripleBuffer
+{
+public:
+	TripleBuffer() : mWrite(0), mRead(1), mMiddle(2) {}
+
+	// before the threads start, to size or seed all three buffers
+	T& GetBuffer(unsigned index) { return mBuffers[index]; }
+
+	// writer thread
+	T& GetWriteBuffer() { return mBuffers[mWrite]; }
+	void Publish()
+	{
+		mWrite = mMiddle.exchange(mWrite | kFresh, std::memory_order_acq_rel) & kIndexMask;
+	}
+
+	// reader thread: true if a newer snapshot became the read buffer
+	bool Update()
+	{
+		if (!(mMiddle.load(std::memory_order_relaxed) & kFresh))
+			return false;
+		mRead = mMiddle.exchange(mRead, std::memory_order_acq_rel) & kIndexMask;
+		return true;
+	}
+	const T& GetReadBuffer() const { return mBuffers[mRead]; }
+
+private:
+	static const unsigned kIndexMask = 3;
+	static const unsigned kFresh = 4; // set in mMiddle by Publish, cleared by Update
+
+	TripleBuffer(const TripleBuffer&);
+	TripleBuffer& operator=(const TripleBuffer&);
+
+	T mBuffers[3];
+
+	// each index is touched by one thread only, mMiddle is the exchange point
+	unsigned              mWrite;
+	unsigned              mRead;
+	std::atomic<unsigned> mMiddle;
+};
@@ -0,0 +1,72 @@
+#include "UploadRing.h"
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+UploadRing::UploadRing(size_t capacity)
+	: mCapacity(capacity / kAlignment * kAlignment)
+	, mHead(0)
+	, mTail(0)
+	, mFailedAllocations(0)
+	, mMappedLap(~static_cast<uint64_t>(0))
+	, mFirstFrame(0)
+{
+}
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+bool UploadRing::BeginFrame()
+{
+	uint64_t lap = mHead.load(std::memory_order_relaxed) / mCapacity;
+	bool discard = lap != mMappedLap;
+	mMappedLap = lap;
+	return discard;
+}
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+void UploadRing::EndFrame(uint64_t fence)
+{
+	FrameMark mark = { fence, mHead.load(std::memory_order_acquire) };
+	mFrames.push_back(mark);
+}
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+void UploadRing::Retire(uint64_t completedFence)
+{
+	while (mFirstFrame < mFrames.size() && mFrames[mFirstFrame].fence <= completedFence)
+	{
+		mTail.store(mFrames[mFirstFrame].head, std::memory_order_release);
+		mFirstFrame++;
+	}
+
+	// the retired marks are dropped once they are half of the storage, the frames in flight move to the front
+	if (mFirstFrame * 2 >= mFrames.size())
+	{
+		mFrames.erase(mFrames.begin(), mFrames.begin() + mFirstFrame);
+		mFirstFrame = 0;
+	}
+}
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+size_t UploadRing::Allocate(size_t bytes)
+{
+	bytes = (bytes + kAlignment - 1) / kAlignment * kAlignment;
+	if (!bytes || bytes > mCapacity)
+	{
+		mFailedAllocations++;
+		return kInvalidOffset;
+	}
+
+	uint64_t head = mHead.load(std::memory_order_relaxed);
+	for (;;)
+	{
+		// an allocation never straddles the end of the buffer, the rest of the lap is skipped instead
+		uint64_t start = head;
+		uint64_t offset = start % mCapacity;
+		if (offset + bytes > mCapacity)
+			start += mCapacity - offset;
+		uint64_t end = start + bytes;
+
+		if (end - mTail.load(std::memory_order_acquire) > mCapacity)
+		{
+			mFailedAllocations++;
+			return kInvalidOffset;
+		}
+
+		// on failure head is reloaded and the placement is recomputed
+		if (mHead.compare_exchange_weak(head, end, std::memory_order_acq_rel, std::memory_order_relaxed))
+			return static_cast<size_t>(start % mCapacity);
+	}
+}
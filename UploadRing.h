@@ -0,0 +1,59 @@
+#pragma once
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Per-frame ring allocator for dynamic constant data, independent of the graphics API.
+// It hands out 256 byte aligned offsets into one big buffer (D3D11_USAGE_DYNAMIC in main.cpp) and tracks which
+// frames still own which bytes: EndFrame stamps the current head with a fence value, Retire releases every frame
+// whose fence the GPU has passed. Allocate is lock-free and can be called from several threads while a frame is open.
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+class UploadRing
+{
+public:
+	// constant buffer offsets (VSSetConstantBuffers1) are multiples of 16 constants
+	static const size_t kAlignment = 256;
+	static const size_t kInvalidOffset = ~static_cast<size_t>(0);
+
+	// capacity is rounded down to kAlignment
+	explicit UploadRing(size_t capacity);
+
+	// render thread: true when the backing buffer should be mapped with DISCARD instead of NO_OVERWRITE,
+	// that is on the first frame and whenever the previous frames wrapped around the end of the buffer
+	bool BeginFrame();
+	// render thread: the bytes allocated so far belong to a frame that is done when fence completes
+	void EndFrame(uint64_t fence);
+	// render thread: fences are expected to increase, frees every frame up to completedFence
+	void Retire(uint64_t completedFence);
+
+	// any thread: offset in bytes, or kInvalidOffset if the request would overwrite data still in flight
+	size_t Allocate(size_t bytes);
+
+	size_t GetCapacity() const { return mCapacity; }
+	size_t GetUsedBytes() const { return static_cast<size_t>(mHead.load() - mTail.load()); }
+	size_t GetFailedAllocations() const { return mFailedAllocations.load(); }
+
+private:
+	struct FrameMark
+	{
+		uint64_t fence;
+		uint64_t head;
+	};
+
+	UploadRing(const UploadRing&);
+	UploadRing& operator=(const UploadRing&);
+
+	size_t mCapacity;
+
+	// byte positions since creation, the offset in the buffer is position % mCapacity
+	std::atomic<uint64_t> mHead;
+	std::atomic<uint64_t> mTail;
+	std::atomic<size_t>   mFailedAllocations;
+
+	uint64_t               mMappedLap;
+	// a queue that does not allocate every frame: mFrames[mFirstFrame..] are in flight
+	std::vector<FrameMark> mFrames;
+	size_t                 mFirstFrame;
+};
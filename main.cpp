@@ -1,19 +1,42 @@
 #include <windows.h>
 #include <d3d11_1.h>
+#include <dxgi1_3.h>
 #include <d3dcompiler.h>
 #include <d3d11shader.h>
 
 #include <directxcolors.h>
+#include <algorithm>
+#include <atomic>
 #include <vector>
 
-// timers
-#include <chrono>
-#include <sstream>
-#include <iomanip>
+#include "AssetStreamer.h"
+#include "Culling.h"
+#include "FrameArena.h"
+#include "FramePacer.h"
+#include "FrameStats.h"
+#include "InstanceBatcher.h"
+#include "JobSystem.h"
+#include "LoopScheduler.h"
+#include "Mesh.h"
+#include "RenderGraph.h"
+#include "RenderQueue.h"
+#include "ResolutionScaler.h"
+#include "ShaderCache.h"
+#include "ShaderPermutations.h"
+#include "Simulation.h"
+#include "StateCache.h"
+#include "TransformStore.h"
+#include "StateFilter.h"
+#include "TaskGraph.h"
+#include "Texture.h"
+#include "TextureAtlas.h"
+#include "Trace.h"
+#include "UploadRing.h"
 ///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 // Global vars
-const int gWidth = 600;
-const int gHeight = 450;
+// back buffer size, follows the window
+int gWidth = 600;
+int gHeight = 450;
 
 HINSTANCE ghInst = nullptr;
 HWND       ghWnd = nullptr;
@@ -22,54 +45,248 @@ ID3D11Device        *gDevice        = nullptr;
 ID3D11DeviceContext *gDeviceContext = nullptr;
 IDXGISwapChain      *gSwapChain     = nullptr;
 
-ID3D11RenderTargetView *gRenderTargetView = nullptr;
-ID3D11DepthStencilView *gDepthStencilView = nullptr;
+ID3D11RenderTargetView *gRenderTargetView = nullptr; // back buffer
+ID3D11DepthStencilView *gDepthStencilView = nullptr; // owned by gRenderTargets
+
+// dynamic resolution: the scene renders into the top left gRenderWidth x gRenderHeight of the scene color, a scale of
+// the back buffer that gResolutionScaler adjusts to the GPU time, and a fullscreen triangle stretches it to the back
+// buffer. The scene targets are allocated at the largest scale, a new scale is only a new viewport.
+bool             gUseDynamicResolution = true;
+double           gResolutionTargetMs = 0.0; // 0 follows the display refresh interval
+ResolutionScaler gResolutionScaler(DefaultResolutionSettings());
+UINT             gRenderWidth = 0;
+UINT             gRenderHeight = 0;
+UINT             gSceneWidth = 0; // scene targets size
+UINT             gSceneHeight = 0;
+ID3D11RenderTargetView   *gSceneTargetView = nullptr;         // owned by gRenderTargets
+ID3D11ShaderResourceView *gSceneShaderResourceView = nullptr; // owned by gRenderTargets
+ID3D11VertexShader       *gUpscaleVS = nullptr;
+ID3D11PixelShader        *gUpscalePS = nullptr;
+ID3D11SamplerState       *gUpscaleSampler = nullptr; // owned by gStateCache
+ID3D11Buffer             *gUpscaleCBuffer = nullptr; // uv scale and clamp of the rendered region
+
+// WM_SIZE only records the new client size, the main loop resizes between frames
+bool gResizePending = false;
+int  gPendingWidth = 0;
+int  gPendingHeight = 0;
+
+// kept for deferred contexts, which start every command list from the default state
+const PipelineState *gScenePipeline = nullptr; // owned by gStateCache
+D3D11_VIEWPORT      gViewport;
 
 ID3D11VertexShader   *gVSShader = nullptr;
-ID3D11PixelShader    *gPSShader = nullptr;
+ID3D11VertexShader   *gVSInstancedShader = nullptr;
+ID3D11PixelShader    *gPSShader = nullptr; // the variant of gSceneFeatures drawn this frame, owned by gShaderPermutations
 
-ID3D11SamplerState                     *gSampler = nullptr;
-ID3D11ShaderResourceView *gTexShaderResourceView = nullptr;
+// scene pixel shader variants, A and S toggle the features; a combination not drawn before is compiled on the
+// permutation threads and the frames until it is ready draw the plain variant
+enum ScenePixelFeature
+{
+	SceneFeature_AlphaTest,  // clips texels with alpha below 0.5
+	SceneFeature_ShowSlices, // tints every texture array slice its own color
+	SceneFeature_Count
+};
+const char *const kScenePixelFeatures[SceneFeature_Count] = { "ALPHA_TEST", "SHOW_SLICES" };
+constexpr ShaderVariantKey kSceneAlphaTest = ShaderFeature(SceneFeature_AlphaTest);
+constexpr ShaderVariantKey kSceneShowSlices = ShaderFeature(SceneFeature_ShowSlices);
+
+ShaderPermutations *gShaderPermutations = nullptr;
+ShaderProgramId    gScenePSProgram = 0;
+ShaderVariantKey   gSceneFeatures = {};
+
+ID3D11SamplerState                     *gSampler = nullptr; // owned by gStateCache
+ID3D11ShaderResourceView *gTexShaderResourceView = nullptr; // the whole checker array
+ID3D11ShaderResourceView *gBoundTexture = nullptr; // the streamed texture once resident, the checker array until then
+
+// texture arrays: DXMinimalApp.exe -textures N makes N tinted checkers, object i samples checker i % N. They share one
+// format and size, so gTextureArrays puts them in one Texture2DArray: the instanced draws bind it once and pick the
+// slice per instance, the per-object draws bind a view of their slice, which the state filter skips when it repeats
+int gTexturesCount = 1;
+TextureArrayAllocator                  gTextureArrays;
+std::vector<TextureSlot>               gTextureSlots;      // per checker
+std::vector<ID3D11ShaderResourceView*> gTextureSliceViews; // per checker, one slice each
 
 enum ConstanBuffer
 {
-	CB_Appliation,
-	CB_Frame,
 	CB_Object,
 	NumConstantBuffers
 };
-ID3D11Buffer* gCBuffers[NumConstantBuffers] = { nullptr, nullptr, nullptr };
+ID3D11Buffer* gCBuffers[NumConstantBuffers] = { nullptr };
 UINT gCBObjectBind = 0;
 ID3D11InputLayout *gInputLayout = nullptr;
+ID3D11InputLayout *gInstancedInputLayout = nullptr;
+
+// instanced draw path: per-object matrices go to a per-instance vertex buffer instead of CB_Object
+bool gUseInstancing = true;
+const size_t gMaxInstances = 4096;
+ID3D11Buffer *gInstanceBuffer = nullptr;
+
+// camera, premultiplied into every object matrix so the vertex shader does a single transform
+const float gNearZ = 0.1f;
+const float gFarZ = 100.0f;
+Mat4        gViewProj;
+Frustum     gFrustum;
+
+// the two quads, DXMinimalApp.exe -objects N adds N - 2 copies on a grid behind them
+int gObjectsCount = 2;
+TransformStore    gTransforms;
+ArenaVector<Mat4> gObjectMatrices; // world * view * projection of the visible objects
+ArenaVector<UINT> gObjectConstants;
+
+// frustum culling: every object has a leaf in gBvh, only the visible ones get a matrix and a draw
+bool gUseCulling = true;
+Bvh                   gBvh;
+std::vector<uint32_t> gObjectProxies;
+std::vector<Aabb>     gObjectBounds;
+ArenaVector<uint32_t> gVisibleObjects; // in draw order
+
+// draw order: the visible objects are sorted by their gDrawQueue key before their matrices are computed, so every
+// draw path submits them in that order. DXMinimalApp.exe -sort state|depth|off
+bool        gSortDraws = true;
+DrawOrder   gOpaqueOrder = Order_State;
+RenderQueue gDrawQueue;
+
+// multithreaded recording: the objects are split in chunks recorded on deferred contexts by the job system,
+// the command lists are executed on gDeviceContext in chunk order so the frame never depends on scheduling
+bool gUseDeferredContexts = false;
+int  gRecordThreads = 0; // 0 uses all hardware threads
+const size_t gMinObjectsPerList = 64;
+JobSystem *gJobSystem = nullptr; // also runs the InitRender task graph
+
+struct RecordContext
+{
+	ID3D11DeviceContext  *context;
+	ID3D11DeviceContext1 *context1;     // binds ring windows, null without gUploadBuffer
+	ID3D11Buffer         *objectBuffer; // dynamic CB_Object for objects that did not fit in the ring
+	ID3D11CommandList    *commandList;
+};
+std::vector<RecordContext> gRecordContexts;
+
+// dynamic per-object constants: sub-allocated from one DYNAMIC buffer and bound with VSSetConstantBuffers1 offsets,
+// only created when the runtime supports constant buffer offsetting and no-overwrite maps of dynamic constant buffers
+// (otherwise CB_Object + UpdateSubresource is used)
+ID3D11DeviceContext1 *gDeviceContext1 = nullptr;
+ID3D11Buffer         *gUploadBuffer = nullptr;
+unsigned char        *gUploadData = nullptr; // mapped between MapUploadRing and UnmapUploadRing
+const size_t gUploadRingSize = 1024 * 1024;
+UploadRing   gUploadRing(gUploadRingSize);
+
+// one event query per frame in flight acts as the ring's fence
+const UINT64 gFramesInFlight = kFramesInFlight;
+ID3D11Query *gFrameQueries[gFramesInFlight] = { nullptr, nullptr, nullptr };
+UINT64 gUploadFrame = 1;
+UINT64 gRetiredUploadFrame = 0;
+
+// frame timing, the window title is refreshed a few times per second from the rolling window
+SteadyFrameClock gFrameClock;
+FrameStats       gFrameStats(gFrameClock);
+
+// presentation: every mode goes through the pacer, which delays the start of a frame so it is done just before the
+// vblank it is shown at; low latency uses a flip model chain with one queued frame and its waitable object
+PresentMode gPresentMode = Present_VSync;
+bool        gUsePacing = true;
+bool        gFlipModel = false;
+FramePacer  *gFramePacer = nullptr;
+HANDLE      gFrameLatencyWaitable = nullptr;
+HANDLE      gPacingTimer = nullptr;
+double      gQpcFrequency = 0.0;
+
+// main loop scheduling between messages: by default no frames while minimized or occluded; -loop capped sleeps on
+// gPacingTimer between frames at -fpscap, which is meant for -present uncapped (vsync paces the loop already).
+// The loop thread's CPU time is shown in the title.
+LoopMode       gLoopMode = Loop_IdleWhenHidden;
+double         gFrameCapMs = 1000.0 / 60.0;
+ThreadCpuClock gLoopCpuClock;
+LoopScheduler  *gLoopScheduler = nullptr;
+bool           gMinimized = false;
+bool           gOccluded = false; // Present said nothing of the window is visible
+LoopStats      gLastTitleLoopStats;
+
+// transient data goes to arenas: the frame arena of each thread is reset by RenderTick, init steps use ScratchArena.
+// The visible objects, their matrices and constants and gDrawQueue are made on the render thread's frame arena by
+// UpdateObjectTransforms and dropped by ReleaseFrameLists at the end of the frame.
+// Built with COUNT_HEAP_ALLOCATIONS, the heap allocations still made by RenderTick and the recording jobs are counted,
+// a steady frame should make none; the title shows the last frame's, the totals are reported on exit
+uint64_t              gLastFrameHeapAllocations = 0;
+uint64_t              gMaxFrameHeapAllocations = 0;
+uint64_t              gHeapAllocationFrames = 0; // frames that made any
+uint64_t              gRenderTicks = 0;
+std::atomic<uint64_t> gJobHeapAllocations(0);
+
+// optional GPU span per frame: disjoint + begin/end timestamps, read back gFramesInFlight frames later
+bool gGpuTiming = true;
+struct GpuFrameTimer
+{
+	ID3D11Query *disjoint;
+	ID3D11Query *begin;
+	ID3D11Query *end;
+	UINT64      frame;
+	bool        pending;
+} gGpuTimers[gFramesInFlight];
+
+#if TRACE_ENABLED
+// -trace file.json records the CPU spans of init and of every frame, and the frames' GPU spans through timestamp queries
+// of their own; written on exit
+char     gTracePath[MAX_PATH] = "";
+GpuTrace *gGpuTrace = nullptr; // while recording
+// timestamps per frame in flight, the frame, the passes and the instanced draws
+const uint32_t gTraceTimestamps = 64;
+#endif
+
+// -mesh path draws a .dxmesh instead of the quad, which is built into Quad.dxmesh on the first run
+char gMeshPath[MAX_PATH] = "Quad.dxmesh";
+bool gCustomMesh = false;
+
+// -texture path streams a .dds on the I/O threads; the checker, built with its mips into Checker.dds, is the placeholder
+char gTexturePath[MAX_PATH] = "";
+bool gCustomTexture = false;
+AssetStreamer *gAssetStreamer = nullptr;
+AssetId       gStreamedTexture = 0;
+// uploads per frame, a 2048x2048 BC7 level is 4 MB
+const StreamBudget gStreamBudget = { 4 * 1024 * 1024, 2.0 };
 
 struct GeomBuf
 {
-	ID3D11Buffer *vertexBuffer;
-	size_t       verticesCount;
-} gQuad;
-
-float gAngleAnim = 0.0f;
+	ID3D11Buffer     *vertexBuffer;
+	ID3D11Buffer     *indexBuffer;
+	UINT             vertexStride;
+	UINT             indicesCount;
+	DXGI_FORMAT      indexFormat;
+	MeshVertexFormat vertexFormat;
+	Aabb             bounds; // local, for culling
+} gMesh;
+
+// object transforms advance on their own thread at a fixed 60 Hz, independent of the frame rate
+const double gSimulationStepMs = 1000.0 / 60.0;
+Simulation *gSimulation = nullptr;
 ///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 #define SAFE_RELEASE( p ) if (p) { p->Release(); p = nullptr; }
 #define RETURN_IF_FAILED(hr) if (FAILED(hr)) { assert(false); return hr; }
 ///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
-struct MyVertex
-{
-	float x, y, z;
-	float u, v;
-	MyVertex(float _x, float _y, float _z, float _u, float _v) : x(_x), y(_y), z(_z), u(_u), v(_v) {}
-};
-///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 HRESULT CreateGeometry()
 {
-	std::vector<MyVertex> vBuf = {
+	const MeshVertex quad[] = {
 		{ -1.0f, -1.0f, 0.0f, 0.0f, 0.0f, }, { -1.0f, 1.0f, 0.0f, 0.0f, 1.0f }, { 1.0f, 1.0f, 0.0f, 1.0f, 1.0f },
 		{ 1.0f, 1.0f, 0.0f, 1.0f, 1.0f }, { 1.0f, -1.0f, 0.0f, 1.0f, 0.0f }, { -1.0f, -1.0f, 0.0f, 0.0f, 0.0f } };
-	gQuad.verticesCount = vBuf.size();
 
+	MeshFile mesh;
+	bool opened = gCustomMesh ? mesh.Open(gMeshPath) : OpenOrBuildMesh(mesh, gMeshPath, quad, ARRAYSIZE(quad));
+	if (!opened)
+	{
+		assert(false);
+		return E_FAIL;
+	}
+	gMesh.vertexStride = static_cast<UINT>(mesh.GetVertexStride());
+	gMesh.indicesCount = static_cast<UINT>(mesh.GetIndicesCount());
+	gMesh.indexFormat = mesh.GetIndexSize() == 2 ? DXGI_FORMAT_R16_UINT : DXGI_FORMAT_R32_UINT;
+	gMesh.vertexFormat = mesh.GetVertexFormat();
+	gMesh.bounds.min = mesh.GetBoundsMin();
+	gMesh.bounds.max = mesh.GetBoundsMax();
+
+	// both buffers are initialized straight from the mapping, the file is unmapped when mesh goes out of scope
 	D3D11_BUFFER_DESC vbd;
 	vbd.Usage = D3D11_USAGE_IMMUTABLE;
-	vbd.ByteWidth = gQuad.verticesCount * sizeof(MyVertex);
+	vbd.ByteWidth = static_cast<UINT>(mesh.GetVerticesCount() * mesh.GetVertexStride());
 	vbd.BindFlags = D3D11_BIND_VERTEX_BUFFER;
 	vbd.CPUAccessFlags = 0;
 	vbd.MiscFlags = 0;
@@ -78,8 +295,17 @@ HRESULT CreateGeometry()
 	D3D11_SUBRESOURCE_DATA vinitData;
 	vinitData.SysMemPitch = 0;
 	vinitData.SysMemSlicePitch = 0;
-	vinitData.pSysMem = &vBuf[0];
-	HRESULT hr = gDevice->CreateBuffer(&vbd, &vinitData, &gQuad.vertexBuffer);
+	vinitData.pSysMem = mesh.GetVertices();
+	HRESULT hr = gDevice->CreateBuffer(&vbd, &vinitData, &gMesh.vertexBuffer);
+	RETURN_IF_FAILED(hr);
+
+	D3D11_BUFFER_DESC ibd = vbd;
+	ibd.ByteWidth = static_cast<UINT>(mesh.GetIndicesCount() * mesh.GetIndexSize());
+	ibd.BindFlags = D3D11_BIND_INDEX_BUFFER;
+
+	D3D11_SUBRESOURCE_DATA iinitData = vinitData;
+	iinitData.pSysMem = mesh.GetIndices();
+	hr = gDevice->CreateBuffer(&ibd, &iinitData, &gMesh.indexBuffer);
 	return hr;
 }
 ///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
@@ -93,16 +319,18 @@ HRESULT CreateCBuffers()
 	cbd.MiscFlags = 0;
 	cbd.StructureByteStride = 0;
 
-	HRESULT hr = gDevice->CreateBuffer(&cbd, nullptr, &gCBuffers[CB_Appliation]);
-	RETURN_IF_FAILED(hr);
-	hr = gDevice->CreateBuffer(&cbd, nullptr, &gCBuffers[CB_Frame]);
-	RETURN_IF_FAILED(hr);
-	hr = gDevice->CreateBuffer(&cbd, nullptr, &gCBuffers[CB_Object]);
-	RETURN_IF_FAILED(hr);
-
-	// fill rarely updated matrices
-	DirectX::XMMATRIX projMat = DirectX::XMMatrixPerspectiveFovLH(DirectX::XMConvertToRadians(45.0f), static_cast<float>(gWidth) / gHeight, 0.1f, 100.0f);
-	gDeviceContext->UpdateSubresource(gCBuffers[CB_Appliation], 0, nullptr, &projMat, 0, 0);
+	// initial contents instead of UpdateSubresource, this runs on a worker thread during InitRender
+	DirectX::XMMATRIX identMat = DirectX::XMMatrixIdentity();
+	D3D11_SUBRESOURCE_DATA initData = { &identMat, 0, 0 };
+	HRESULT hr = gDevice->CreateBuffer(&cbd, &initData, &gCBuffers[CB_Object]);
+	return hr;
+}
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// at init and after a resize, the projection follows the back buffer's aspect ratio
+void UpdateCamera()
+{
+	// rarely updated matrices stay on the CPU, they are folded into the per-object matrix
+	DirectX::XMMATRIX projMat = DirectX::XMMatrixPerspectiveFovLH(DirectX::XMConvertToRadians(45.0f), static_cast<float>(gWidth) / gHeight, gNearZ, gFarZ);
 
 	// we can track mouse updates and change view (camera) matrix accordingly
 	DirectX::XMFLOAT4 vTarget(0.0f, 0.0f, 1.0f, 0.0f);
@@ -113,33 +341,204 @@ HRESULT CreateCBuffers()
 	DirectX::XMVECTOR pos = DirectX::XMLoadFloat4(&vPos);
 	DirectX::XMVECTOR up = DirectX::XMLoadFloat4(&vUp);
 	DirectX::XMMATRIX viewMat = DirectX::XMMatrixLookAtLH(pos, target, up);
-	gDeviceContext->UpdateSubresource(gCBuffers[CB_Frame], 0, nullptr, &viewMat, 0, 0);
+	DirectX::XMStoreFloat4x4(reinterpret_cast<DirectX::XMFLOAT4X4*>(&gViewProj), DirectX::XMMatrixMultiply(viewMat, projMat));
+	gFrustum = ExtractFrustum(gViewProj);
+}
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+HRESULT CreateUploadRing()
+{
+	HRESULT hr = gDeviceContext->QueryInterface(__uuidof(ID3D11DeviceContext1), reinterpret_cast<void**>(&gDeviceContext1));
+	if (FAILED(hr))
+		return S_OK; // D3D11.0 runtime, keep using CB_Object
+
+	// MapUploadRing appends to the buffer with D3D11_MAP_WRITE_NO_OVERWRITE, which dynamic constant buffers only take
+	// with its own cap
+	D3D11_FEATURE_DATA_D3D11_OPTIONS options;
+	hr = gDevice->CheckFeatureSupport(D3D11_FEATURE_D3D11_OPTIONS, &options, sizeof(options));
+	if (FAILED(hr) || !options.ConstantBufferOffsetting || !options.MapNoOverwriteOnDynamicConstantBuffer)
+	{
+		OutputDebugStringA("No constant buffer offsetting or no-overwrite maps of constant buffers, using CB_Object\n");
+		SAFE_RELEASE(gDeviceContext1);
+		return S_OK;
+	}
 
-	DirectX::XMMATRIX identMat = DirectX::XMMatrixIdentity();
-	gDeviceContext->UpdateSubresource(gCBuffers[CB_Object], 0, nullptr, &identMat, 0, 0);
+	D3D11_BUFFER_DESC cbd;
+	cbd.Usage = D3D11_USAGE_DYNAMIC;
+	cbd.ByteWidth = static_cast<UINT>(gUploadRing.GetCapacity());
+	cbd.BindFlags = D3D11_BIND_CONSTANT_BUFFER;
+	cbd.CPUAccessFlags = D3D11_CPU_ACCESS_WRITE;
+	cbd.MiscFlags = 0;
+	cbd.StructureByteStride = 0;
+
+	hr = gDevice->CreateBuffer(&cbd, nullptr, &gUploadBuffer);
+	RETURN_IF_FAILED(hr);
+
+	D3D11_QUERY_DESC qd;
+	qd.Query = D3D11_QUERY_EVENT;
+	qd.MiscFlags = 0;
+	for (UINT64 i = 0; i < gFramesInFlight; i++)
+	{
+		hr = gDevice->CreateQuery(&qd, &gFrameQueries[i]);
+		RETURN_IF_FAILED(hr);
+	}
+	return hr;
+}
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+HRESULT CreateGpuTimers()
+{
+	ZeroMemory(gGpuTimers, sizeof(gGpuTimers));
+	if (!gGpuTiming)
+		return S_OK;
+
+	D3D11_QUERY_DESC disjointDesc = { D3D11_QUERY_TIMESTAMP_DISJOINT, 0 };
+	D3D11_QUERY_DESC timestampDesc = { D3D11_QUERY_TIMESTAMP, 0 };
+	for (UINT64 i = 0; i < gFramesInFlight; i++)
+	{
+		HRESULT hr = gDevice->CreateQuery(&disjointDesc, &gGpuTimers[i].disjoint);
+		RETURN_IF_FAILED(hr);
+		hr = gDevice->CreateQuery(&timestampDesc, &gGpuTimers[i].begin);
+		RETURN_IF_FAILED(hr);
+		hr = gDevice->CreateQuery(&timestampDesc, &gGpuTimers[i].end);
+		RETURN_IF_FAILED(hr);
+	}
+	return S_OK;
+}
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+#if TRACE_ENABLED
+// GpuTrace's queries, a disjoint query and gTraceTimestamps timestamps per frame in flight
+class D3DTimestampBackend : public GpuTimestampBackend
+{
+public:
+	D3DTimestampBackend() { ZeroMemory(mFrames, sizeof(mFrames)); }
+
+	HRESULT Create()
+	{
+		D3D11_QUERY_DESC disjointDesc = { D3D11_QUERY_TIMESTAMP_DISJOINT, 0 };
+		D3D11_QUERY_DESC timestampDesc = { D3D11_QUERY_TIMESTAMP, 0 };
+		for (UINT64 i = 0; i < gFramesInFlight; i++)
+		{
+			HRESULT hr = gDevice->CreateQuery(&disjointDesc, &mFrames[i].disjoint);
+			RETURN_IF_FAILED(hr);
+			for (uint32_t j = 0; j < gTraceTimestamps; j++)
+			{
+				hr = gDevice->CreateQuery(&timestampDesc, &mFrames[i].timestamps[j]);
+				RETURN_IF_FAILED(hr);
+			}
+		}
+		return S_OK;
+	}
+
+	void Release()
+	{
+		for (UINT64 i = 0; i < gFramesInFlight; i++)
+		{
+			SAFE_RELEASE(mFrames[i].disjoint);
+			for (uint32_t j = 0; j < gTraceTimestamps; j++)
+				SAFE_RELEASE(mFrames[i].timestamps[j]);
+		}
+	}
+
+	void BeginFrame(uint32_t slot) override { gDeviceContext->Begin(mFrames[slot].disjoint); }
+	void EndFrame(uint32_t slot) override { gDeviceContext->End(mFrames[slot].disjoint); }
+	void WriteTimestamp(uint32_t slot, uint32_t index) override { gDeviceContext->End(mFrames[slot].timestamps[index]); }
+
+	bool ReadFrame(uint32_t slot, uint32_t count, uint64_t *timestamps, uint64_t &frequency) override
+	{
+		D3D11_QUERY_DATA_TIMESTAMP_DISJOINT disjoint;
+		if (gDeviceContext->GetData(mFrames[slot].disjoint, &disjoint, sizeof(disjoint), D3D11_ASYNC_GETDATA_DONOTFLUSH) != S_OK)
+			return false;
+		for (uint32_t i = 0; i < count; i++)
+			if (gDeviceContext->GetData(mFrames[slot].timestamps[i], &timestamps[i], sizeof(UINT64), D3D11_ASYNC_GETDATA_DONOTFLUSH) != S_OK)
+				return false;
+		frequency = disjoint.Disjoint ? 0 : disjoint.Frequency;
+		return true;
+	}
+
+private:
+	struct Frame
+	{
+		ID3D11Query *disjoint;
+		ID3D11Query *timestamps[gTraceTimestamps];
+	} mFrames[gFramesInFlight];
+};
+
+D3DTimestampBackend gTimestampBackend;
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+HRESULT CreateGpuTrace()
+{
+	if (!TraceIsRecording())
+		return S_OK;
 
+	HRESULT hr = gTimestampBackend.Create();
+	RETURN_IF_FAILED(hr);
+	gGpuTrace = new GpuTrace(gTimestampBackend, "GPU", static_cast<uint32_t>(gFramesInFlight), gTraceTimestamps);
 	return S_OK;
 }
 ///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
-HRESULT CreateInputLayout(ID3DBlob* vsCompiledCode)
+// after Cleanup, the GPU spans were read back before the device went
+void ExportTrace()
+{
+	TraceEndSession();
+	if (!gTracePath[0])
+		return;
+
+	TraceStats stats = TraceGetStats();
+	char report[MAX_PATH + 96];
+	snprintf(report, sizeof(report), "Trace: %llu events on %u tracks, %llu dropped, %s %s\n",
+		static_cast<unsigned long long>(stats.events), stats.tracks, static_cast<unsigned long long>(stats.dropped),
+		TraceExport(gTracePath) ? "written to" : "FAILED to write", gTracePath);
+	OutputDebugStringA(report);
+}
+#endif
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+HRESULT CreateInputLayout(const ShaderBlob &vsCompiledCode, bool instanced, ID3D11InputLayout **inputLayout)
 {
 	// create input layout for IA stage
 	D3D11_INPUT_ELEMENT_DESC vertexDesc[] =
 	{
 		{ "POSITION", 0, DXGI_FORMAT_R32G32B32_FLOAT, 0, 0, D3D11_INPUT_PER_VERTEX_DATA, 0 },
-		{ "TEXCOORD", 0, DXGI_FORMAT_R32G32_FLOAT, 0, 12, D3D11_INPUT_PER_VERTEX_DATA, 0 } // 12 offset (x,y,z) from MyVertex struct
+		{ "TEXCOORD", 0, DXGI_FORMAT_R32G32_FLOAT, 0, 12, D3D11_INPUT_PER_VERTEX_DATA, 0 }, // 12 offset (x,y,z) from MeshVertex struct
+		// slot 1 steps once per instance, rows of InstanceData::world and its texture slice
+		{ "WORLD", 0, DXGI_FORMAT_R32G32B32A32_FLOAT, 1, 0, D3D11_INPUT_PER_INSTANCE_DATA, 1 },
+		{ "WORLD", 1, DXGI_FORMAT_R32G32B32A32_FLOAT, 1, 16, D3D11_INPUT_PER_INSTANCE_DATA, 1 },
+		{ "WORLD", 2, DXGI_FORMAT_R32G32B32A32_FLOAT, 1, 32, D3D11_INPUT_PER_INSTANCE_DATA, 1 },
+		{ "WORLD", 3, DXGI_FORMAT_R32G32B32A32_FLOAT, 1, 48, D3D11_INPUT_PER_INSTANCE_DATA, 1 },
+		{ "TEXINDEX", 0, DXGI_FORMAT_R32_UINT, 1, 64, D3D11_INPUT_PER_INSTANCE_DATA, 1 }
 	};
+	UINT elementsCount = instanced ? ARRAYSIZE(vertexDesc) : 2;
+
+	// MeshVertexQuantized: the shader still sees float3 position and float2 texCoord
+	if (gMesh.vertexFormat == MeshVertex_Quantized)
+	{
+		vertexDesc[0].Format = DXGI_FORMAT_R16G16B16A16_FLOAT;
+		vertexDesc[1].Format = DXGI_FORMAT_R16G16_UNORM;
+		vertexDesc[1].AlignedByteOffset = 8;
+	}
 
 	HRESULT hr = gDevice->CreateInputLayout(
-		vertexDesc, ARRAYSIZE(vertexDesc), vsCompiledCode->GetBufferPointer(), vsCompiledCode->GetBufferSize(), &gInputLayout);
+		vertexDesc, elementsCount, vsCompiledCode.GetBytecode(), vsCompiledCode.GetBytecodeSize(), inputLayout);
+	return hr;
+}
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+HRESULT CreateInstanceBuffer()
+{
+	D3D11_BUFFER_DESC ibd;
+	ibd.Usage = D3D11_USAGE_DYNAMIC;
+	ibd.ByteWidth = gMaxInstances * sizeof(InstanceData);
+	ibd.BindFlags = D3D11_BIND_VERTEX_BUFFER;
+	ibd.CPUAccessFlags = D3D11_CPU_ACCESS_WRITE;
+	ibd.MiscFlags = 0;
+	ibd.StructureByteStride = 0;
+
+	HRESULT hr = gDevice->CreateBuffer(&ibd, nullptr, &gInstanceBuffer);
 	return hr;
 }
 ///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
-HRESULT ReflectVSGlobalCBuffer(ID3DBlob* vsCompiledCode)
+HRESULT ReflectCBuffers(const void *bytecode, size_t bytecodeSize, ShaderReflection &reflection)
 {
 	// reflect data example
 	ID3D11ShaderReflection *reflector = nullptr;
-	HRESULT hr = D3DReflect(vsCompiledCode->GetBufferPointer(), vsCompiledCode->GetBufferSize(), __uuidof(ID3D11ShaderReflection), (void**)&reflector);
+	HRESULT hr = D3DReflect(bytecode, bytecodeSize, __uuidof(ID3D11ShaderReflection), (void**)&reflector);
 	RETURN_IF_FAILED(hr);
 
 	D3D11_SHADER_DESC desc;
@@ -153,15 +552,16 @@ HRESULT ReflectVSGlobalCBuffer(ID3DBlob* vsCompiledCode)
 		HRESULT hr = cbuffer->GetDesc(&cbDesc);
 		RETURN_IF_FAILED(hr);
 
-		if (!strcmp(cbDesc.Name, "$Globals"))
-		{
-			D3D11_SHADER_INPUT_BIND_DESC resDesc;
-			hr = reflector->GetResourceBindingDescByName(cbDesc.Name, &resDesc);
-			RETURN_IF_FAILED(hr);
+		D3D11_SHADER_INPUT_BIND_DESC resDesc;
+		hr = reflector->GetResourceBindingDescByName(cbDesc.Name, &resDesc);
+		RETURN_IF_FAILED(hr);
 
-			gCBObjectBind = resDesc.BindPoint;
-			break;
-		}
+		// stored in the shader cache, the renderer looks bindings up by name ("$Globals" for perObjectWorldMatrix)
+		ShaderCBufferBinding binding;
+		strncpy_s(binding.name, cbDesc.Name, _TRUNCATE);
+		binding.bindPoint = resDesc.BindPoint;
+		binding.size = cbDesc.Size;
+		reflection.cbuffers.push_back(binding);
 	}
 	SAFE_RELEASE(reflector);
 
@@ -169,20 +569,75 @@ HRESULT ReflectVSGlobalCBuffer(ID3DBlob* vsCompiledCode)
 	return hr;
 }
 ///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
-HRESULT CreateVertexShaderAndInputLayout()
+class D3DShaderCompiler : public ShaderCompiler
 {
-	const char vs[] =
-		"	cbuffer PerApplication : register(b0)"
-		"	{"
-		"		float4x4 projectionMatrix;"
-		"	}"
+public:
+	const char* GetVersion() const override { return D3DCOMPILER_DLL_A; }
 
-		"	cbuffer PerFrame : register(b1)"
-		"	{"
-		"		float4x4 viewMatrix;"
-		"	}"
+	bool Compile(const ShaderSource &source, std::vector<unsigned char> &bytecode, ShaderReflection &reflection) override
+	{
+		ScratchArena<1024> scratch;
+		ArenaVector<D3D_SHADER_MACRO> macros(&scratch);
+		for (size_t i = 0; i < source.defines.size(); i++)
+		{
+			D3D_SHADER_MACRO macro = { source.defines[i].name.c_str(), source.defines[i].value.c_str() };
+			macros.push_back(macro);
+		}
+		D3D_SHADER_MACRO terminator = { nullptr, nullptr };
+		macros.push_back(terminator);
+
+		ID3DBlob* compiledCode = nullptr;
+		ID3DBlob* errors = nullptr;
+		HRESULT hr = D3DCompile(source.code, source.codeSize, source.name, &macros[0], nullptr,
+			source.entryPoint, source.target, 0, 0, &compiledCode, &errors);
+		if (errors)
+			OutputDebugStringA(static_cast<const char*>(errors->GetBufferPointer()));
+		SAFE_RELEASE(errors);
+		if (FAILED(hr))
+			return false;
+
+		const unsigned char *code = static_cast<const unsigned char*>(compiledCode->GetBufferPointer());
+		bytecode.assign(code, code + compiledCode->GetBufferSize());
+		hr = ReflectCBuffers(compiledCode->GetBufferPointer(), compiledCode->GetBufferSize(), reflection);
+		SAFE_RELEASE(compiledCode);
+		return SUCCEEDED(hr);
+	}
+};
+
+D3DShaderCompiler gShaderCompiler;
+ShaderCache       gShaderCache("ShaderCache");
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// shader variants are created on the permutation threads, ID3D11Device is free threaded
+class D3DShaderObjectFactory : public ShaderObjectFactory
+{
+public:
+	void* CreateShader(const ShaderProgramDesc &program, const ShaderBlob &blob) override
+	{
+		// vs_ and ps_ profiles, the renderer has no other stage
+		HRESULT hr;
+		if (program.target[0] == 'v')
+		{
+			ID3D11VertexShader *shader = nullptr;
+			hr = gDevice->CreateVertexShader(blob.GetBytecode(), blob.GetBytecodeSize(), nullptr, &shader);
+			return SUCCEEDED(hr) ? shader : nullptr;
+		}
+		ID3D11PixelShader *shader = nullptr;
+		hr = gDevice->CreatePixelShader(blob.GetBytecode(), blob.GetBytecodeSize(), nullptr, &shader);
+		return SUCCEEDED(hr) ? shader : nullptr;
+	}
+
+	void ReleaseShader(void *shader) override
+	{
+		static_cast<IUnknown*>(shader)->Release();
+	}
+};
 
-		"	float4x4 perObjectWorldMatrix;"
+D3DShaderObjectFactory gShaderFactory;
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+HRESULT CompileVertexShaders(ShaderBlob &vsCompiledCode, ShaderBlob &vsInstancedCompiledCode)
+{
+	const char vs[] =
+		"	float4x4 worldViewProjMatrix;"
 
 		"	struct VertexInputType"
 		"	{"
@@ -194,189 +649,458 @@ HRESULT CreateVertexShaderAndInputLayout()
 		"	{"
 		"		float4 position : SV_POSITION;"
 		"		float2 texCoord : TEXCOORD;"
+		"		nointerpolation uint slice : TEXINDEX;"
 		"	};"
 
+		// the per-object draws bind a view of their own slice
 		"	PixelInputType SimpleVertexShader(VertexInputType input)"
 		"	{"
 		"		PixelInputType output;"
 		
 		"		input.position.w = 1.0f;"
-		"		output.position = mul(perObjectWorldMatrix, input.position);"
-		"		output.position = mul(viewMatrix, output.position);"
-		"		output.position = mul(projectionMatrix, output.position);"
+		"		output.position = mul(worldViewProjMatrix, input.position);"
 
 		"		output.texCoord = input.texCoord;"
+		"		output.slice = 0;"
 		"		return output;"
-		"	}";
+		"	}"
+
+		"	struct InstancedVertexInputType"
+		"	{"
+		"		float4 position : POSITION;"
+		"		float2 texCoord : TEXCOORD;"
+		"		float4 wvp0 : WORLD0;"
+		"		float4 wvp1 : WORLD1;"
+		"		float4 wvp2 : WORLD2;"
+		"		float4 wvp3 : WORLD3;"
+		"		uint slice : TEXINDEX;"
+		"	};"
 
-	ID3DBlob* vsCompiledCode = nullptr;
-	HRESULT hr = D3DCompile(vs, ARRAYSIZE(vs), "SimpleVS", nullptr, nullptr,
-		"SimpleVertexShader", "vs_4_0", 0, 0, &vsCompiledCode, nullptr);
-	RETURN_IF_FAILED(hr); // check the error blob if something goes wrong
+		"	PixelInputType SimpleVertexShaderInstanced(InstancedVertexInputType input)"
+		"	{"
+		"		PixelInputType output;"
 
-	hr = gDevice->CreateVertexShader(vsCompiledCode->GetBufferPointer(), vsCompiledCode->GetBufferSize(), nullptr, &gVSShader);
-	assert(SUCCEEDED(hr));
+		// rows come straight from the instance buffer, so this is v * M like the cbuffer path
+		"		float4x4 worldViewProjMatrix = float4x4(input.wvp0, input.wvp1, input.wvp2, input.wvp3);"
+		"		input.position.w = 1.0f;"
+		"		output.position = mul(input.position, worldViewProjMatrix);"
 
-	hr = CreateInputLayout(vsCompiledCode);
-	assert(SUCCEEDED(hr));
+		"		output.texCoord = input.texCoord;"
+		"		output.slice = input.slice;"
+		"		return output;"
+		"	}";
 
-	hr = ReflectVSGlobalCBuffer(vsCompiledCode);
-	assert(SUCCEEDED(hr));
+	ShaderSource source = { "SimpleVS", vs, ARRAYSIZE(vs), "SimpleVertexShader", "vs_4_0", {} };
+	if (!gShaderCache.Load(source, gShaderCompiler, vsCompiledCode))
+	{
+		assert(false); // the compiler errors went to the debug output
+		return E_FAIL;
+	}
+
+	// same source, the instanced entry point reads the world matrix from input slot 1
+	source.entryPoint = "SimpleVertexShaderInstanced";
+	if (!gShaderCache.Load(source, gShaderCompiler, vsInstancedCompiledCode))
+	{
+		assert(false);
+		return E_FAIL;
+	}
+	return S_OK;
+}
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+HRESULT CreateVertexShaders(const ShaderBlob &vsCompiledCode, const ShaderBlob &vsInstancedCompiledCode)
+{
+	HRESULT hr = gDevice->CreateVertexShader(vsCompiledCode.GetBytecode(), vsCompiledCode.GetBytecodeSize(), nullptr, &gVSShader);
+	RETURN_IF_FAILED(hr);
+
+	hr = gDevice->CreateVertexShader(vsInstancedCompiledCode.GetBytecode(), vsInstancedCompiledCode.GetBytecodeSize(), nullptr, &gVSInstancedShader);
+	return hr;
+}
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// needs gMesh.vertexFormat from CreateGeometry
+HRESULT CreateInputLayouts(const ShaderBlob &vsCompiledCode, const ShaderBlob &vsInstancedCompiledCode)
+{
+	HRESULT hr = CreateInputLayout(vsCompiledCode, false, &gInputLayout);
+	RETURN_IF_FAILED(hr);
 
-	SAFE_RELEASE(vsCompiledCode);
+	hr = CreateInputLayout(vsInstancedCompiledCode, true, &gInstancedInputLayout);
 	return hr;
 }
 ///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+HRESULT BindObjectCBuffer(const ShaderBlob &vsCompiledCode)
+{
+	int globalsBind = vsCompiledCode.GetReflection().FindCBuffer("$Globals");
+	assert(globalsBind >= 0);
+	gCBObjectBind = globalsBind >= 0 ? globalsBind : 0;
+	return S_OK;
+}
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 HRESULT CreatePixelShader()
 {
 	const char ps[] =
-		"	Texture2D defaultTexture : register(t0);"
+		"	Texture2DArray defaultTexture : register(t0);"
 		"	sampler linearSampler : register(s0);"
 
 		"	struct PixelInputType"
 		"	{"
 		"		float4 position : SV_POSITION;"
 		"		float2 texCoord : TEXCOORD;"
+		"		nointerpolation uint slice : TEXINDEX;"
 		"	};"
 
+		// slices past the end of the bound array read its last one, the streamed texture has a single slice;
+		// the features are 0 or 1 defines, the preprocessor lines need line breaks of their own
 		"	float4 SimplePixelShader(PixelInputType input) : SV_TARGET"
 		"	{"
-		"		return defaultTexture.Sample( linearSampler, input.texCoord );"
+		"		float4 color = defaultTexture.Sample( linearSampler, float3(input.texCoord, input.slice) );"
+		"\n#if ALPHA_TEST\n"
+		"		clip(color.a - 0.5f);"
+		"\n#endif\n"
+		"\n#if SHOW_SLICES\n"
+		"		color.rgb = lerp(color.rgb, frac(input.slice * float3(0.31f, 0.57f, 0.83f)), 0.5f);"
+		"\n#endif\n"
+		"		return color;"
 		"	}";
 
-	ID3DBlob* psCompiledCode = nullptr;
-	HRESULT hr = D3DCompile(ps, ARRAYSIZE(ps), "SimplePS", nullptr, nullptr,
-		"SimplePixelShader", "ps_4_0", 0, 0, &psCompiledCode, nullptr);
-	RETURN_IF_FAILED(hr);
-
-	hr = gDevice->CreatePixelShader(psCompiledCode->GetBufferPointer(), psCompiledCode->GetBufferSize(), nullptr, &gPSShader);
-	SAFE_RELEASE(psCompiledCode);
-	return hr;
+	// the plain variant is compiled here, the others when a frame first draws them
+	gShaderPermutations = new ShaderPermutations(gShaderCache, gShaderCompiler, gShaderFactory);
+	ShaderProgramDesc program = { "SimplePS", ps, ARRAYSIZE(ps), "SimplePixelShader", "ps_4_0", kScenePixelFeatures,
+		SceneFeature_Count, ShaderVariantKey{ 0 } };
+	if (!gShaderPermutations->AddProgram(program, gScenePSProgram))
+	{
+		assert(false);
+		return E_FAIL;
+	}
+	gPSShader = static_cast<ID3D11PixelShader*>(gShaderPermutations->GetShader(gScenePSProgram, gSceneFeatures));
+	return S_OK;
+}
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// white cells of checker 0, the others get a color of their own
+UINT32 GetCheckerTint(UINT32 checker)
+{
+	return checker ? 0xFF404040 | (checker * 2654435761u) >> 8 : 0xFFFFFFFF;
 }
 ///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 HRESULT CreateDefaultTexture()
 {
-	// create 8x8 checker texture with 1 mip
+	// create 8x8 checker textures, BC1 with the full mip chain, in the slices of one array
 	UINT32 iWidth = 8;
 	UINT32 iHeight = 8;
+	UINT checkersCount = static_cast<UINT>(gTexturesCount);
+
+	std::vector<DdsFile> dds(checkersCount);
+	gTextureSlots.resize(checkersCount);
+	for (UINT c = 0; c < checkersCount; c++)
+	{
+		ScratchArena<512> scratch;
+		ArenaVector<UINT32> buf(iWidth * iHeight, 0, &scratch);
+		for (UINT32 i = 0; i < iHeight; i++)
+			for (UINT32 j = 0; j < iWidth; j++)
+			{
+				if ((j + i) % 2)
+					buf[i * iWidth + j] = GetCheckerTint(c);
+				else
+					buf[i * iWidth + j] = 0x00000000;
+			}
 
+		char path[32] = "Checker.dds";
+		if (c)
+			snprintf(path, sizeof(path), "CheckerTint%u.dds", c);
+		if (!OpenOrBuildTexture(dds[c], path, &buf[0], iWidth, iHeight, Texture_BC1, nullptr))
+		{
+			assert(false);
+			return E_FAIL;
+		}
+
+		TextureArrayDesc layout = { dds[c].GetFormat(), dds[c].GetWidth(), dds[c].GetHeight(), dds[c].GetMipCount() };
+		if (!gTextureArrays.Allocate(layout, gTextureSlots[c]) || gTextureSlots[c].array != 0)
+		{
+			assert(false); // every checker is built the same way
+			return E_FAIL;
+		}
+	}
+
+	const TextureArrayDesc &layout = gTextureArrays.GetArrayDesc(0);
 	D3D11_TEXTURE2D_DESC desc;
-	desc.Width = iWidth;
-	desc.Height = iHeight;
-	desc.Format = DXGI_FORMAT_R8G8B8A8_TYPELESS;
-	desc.MipLevels = 1;
-	desc.ArraySize = 1;
-	desc.Usage = D3D11_USAGE_DEFAULT;
+	desc.Width = layout.width;
+	desc.Height = layout.height;
+	desc.Format = static_cast<DXGI_FORMAT>(GetDxgiFormat(layout.format));
+	desc.MipLevels = layout.mipCount;
+	desc.ArraySize = gTextureArrays.GetSliceCount(0);
+	desc.Usage = D3D11_USAGE_IMMUTABLE;
 	desc.BindFlags = D3D11_BIND_SHADER_RESOURCE;
 	desc.CPUAccessFlags = 0;
 	desc.MiscFlags = 0;
 	desc.SampleDesc.Count = 1;
 	desc.SampleDesc.Quality = 0;
 
-	UINT32 bufSize = iWidth * iHeight;
-	UINT32* buf = new UINT32[bufSize];
-	for (UINT32 i = 0; i < iHeight; i++)
-		for (UINT32 j = 0; j < iWidth; j++)
+	// every level points into the mappings, the files are unmapped when dds goes out of scope
+	std::vector<D3D11_SUBRESOURCE_DATA> mipData(desc.ArraySize * desc.MipLevels);
+	for (UINT c = 0; c < checkersCount; c++)
+		for (UINT i = 0; i < desc.MipLevels; i++)
 		{
-			if ((j + i) % 2)
-				buf[i * iWidth + j] = 0xFFFFFFFF;
-			else
-				buf[i * iWidth + j] = 0x00000000;
+			const TextureLevel &level = dds[c].GetLevel(i);
+			D3D11_SUBRESOURCE_DATA &data = mipData[D3D11CalcSubresource(i, gTextureSlots[c].slice, desc.MipLevels)];
+			data.pSysMem = level.data;
+			data.SysMemPitch = static_cast<UINT>(level.rowPitch);
+			data.SysMemSlicePitch = static_cast<UINT>(level.size);
 		}
 
-	D3D11_SUBRESOURCE_DATA mipData;
-	mipData.pSysMem = static_cast<void*>(buf);
-	mipData.SysMemPitch = iWidth * sizeof(UINT32);
-	mipData.SysMemSlicePitch = 0;
-
 	ID3D11Texture2D *tex = nullptr;
-	HRESULT hr = gDevice->CreateTexture2D(&desc, &mipData, &tex);
-	delete[] buf;
+	HRESULT hr = gDevice->CreateTexture2D(&desc, mipData.data(), &tex);
 	RETURN_IF_FAILED(hr);
 
 	D3D11_SHADER_RESOURCE_VIEW_DESC srvDesc;
-	srvDesc.Format = DXGI_FORMAT_R8G8B8A8_UNORM;
-	srvDesc.ViewDimension = D3D11_SRV_DIMENSION_TEXTURE2D;
-	srvDesc.Texture2D.MostDetailedMip = 0;
-	srvDesc.Texture2D.MipLevels = 1;
+	srvDesc.Format = desc.Format;
+	srvDesc.ViewDimension = D3D11_SRV_DIMENSION_TEXTURE2DARRAY;
+	srvDesc.Texture2DArray.MostDetailedMip = 0;
+	srvDesc.Texture2DArray.MipLevels = desc.MipLevels;
+	srvDesc.Texture2DArray.FirstArraySlice = 0;
+	srvDesc.Texture2DArray.ArraySize = desc.ArraySize;
 	hr = gDevice->CreateShaderResourceView(tex, &srvDesc, &gTexShaderResourceView);
+
+	gTextureSliceViews.assign(checkersCount, nullptr);
+	srvDesc.Texture2DArray.ArraySize = 1;
+	for (UINT c = 0; c < checkersCount && SUCCEEDED(hr); c++)
+	{
+		srvDesc.Texture2DArray.FirstArraySlice = gTextureSlots[c].slice;
+		hr = gDevice->CreateShaderResourceView(tex, &srvDesc, &gTextureSliceViews[c]);
+	}
 	SAFE_RELEASE(tex);
 
 	return hr;
 }
 ///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
-HRESULT CreateSampler()
+// streamed textures are created empty and filled with UpdateSubresource one level at a time, the runtime copies the
+// data right away so the streamer frees its staging memory after the last level
+class D3DUploadDevice : public UploadDevice
 {
-	D3D11_SAMPLER_DESC sdesc;
-	sdesc.AddressU = D3D11_TEXTURE_ADDRESS_WRAP;
-	sdesc.AddressV = D3D11_TEXTURE_ADDRESS_WRAP;
-	sdesc.AddressW = D3D11_TEXTURE_ADDRESS_WRAP;
-	sdesc.ComparisonFunc = D3D11_COMPARISON_NEVER;
-	sdesc.Filter = D3D11_FILTER_MIN_MAG_MIP_POINT;
-	sdesc.MinLOD = -FLT_MAX;
-	sdesc.MaxLOD = FLT_MAX;
-	sdesc.MipLODBias = 0.0f;
-	sdesc.MaxAnisotropy = 0;
-
-	HRESULT hr = gDevice->CreateSamplerState(&sdesc, &gSampler);
-	return hr;
-}
+public:
+	void* CreateTexture(TextureFormat format, uint32_t width, uint32_t height, uint32_t mipCount) override
+	{
+		D3D11_TEXTURE2D_DESC desc;
+		desc.Width = width;
+		desc.Height = height;
+		desc.Format = static_cast<DXGI_FORMAT>(GetDxgiFormat(format));
+		desc.MipLevels = mipCount;
+		desc.ArraySize = 1;
+		desc.Usage = D3D11_USAGE_DEFAULT;
+		desc.BindFlags = D3D11_BIND_SHADER_RESOURCE;
+		desc.CPUAccessFlags = 0;
+		desc.MiscFlags = 0;
+		desc.SampleDesc.Count = 1;
+		desc.SampleDesc.Quality = 0;
+
+		ID3D11Texture2D *tex = nullptr;
+		if (FAILED(gDevice->CreateTexture2D(&desc, nullptr, &tex)))
+			return nullptr;
+
+		// the view keeps the texture alive; an array of one slice, the texture SimplePixelShader samples is an array
+		D3D11_SHADER_RESOURCE_VIEW_DESC srvDesc;
+		srvDesc.Format = desc.Format;
+		srvDesc.ViewDimension = D3D11_SRV_DIMENSION_TEXTURE2DARRAY;
+		srvDesc.Texture2DArray.MostDetailedMip = 0;
+		srvDesc.Texture2DArray.MipLevels = mipCount;
+		srvDesc.Texture2DArray.FirstArraySlice = 0;
+		srvDesc.Texture2DArray.ArraySize = 1;
+		ID3D11ShaderResourceView *srv = nullptr;
+		HRESULT hr = gDevice->CreateShaderResourceView(tex, &srvDesc, &srv);
+		SAFE_RELEASE(tex);
+		return SUCCEEDED(hr) ? srv : nullptr;
+	}
+
+	void UploadTextureLevel(void *texture, uint32_t level, const TextureLevel &data) override
+	{
+		ID3D11Resource *resource = nullptr;
+		static_cast<ID3D11ShaderResourceView*>(texture)->GetResource(&resource);
+		gDeviceContext->UpdateSubresource(resource, level, nullptr, data.data, static_cast<UINT>(data.rowPitch), 0);
+		SAFE_RELEASE(resource);
+	}
+
+	void ReleaseTexture(void *texture) override
+	{
+		static_cast<ID3D11ShaderResourceView*>(texture)->Release();
+	}
+};
+
+D3DUploadDevice gUploadDevice;
 ///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
-HRESULT CreateAndSetDS()
+// the cache's descriptors are the D3D11 ones field by field, they are passed on as they are
+class D3DStateFactory : public StateFactory
 {
-	D3D11_DEPTH_STENCIL_DESC dsDesc;
-	dsDesc.DepthEnable = TRUE;
-	dsDesc.DepthFunc = D3D11_COMPARISON_LESS;
-	dsDesc.DepthWriteMask = D3D11_DEPTH_WRITE_MASK_ALL;
-	dsDesc.StencilEnable = FALSE;
+public:
+	void* CreateState(StateKind kind, const void *desc) override
+	{
+		static_assert(sizeof(DepthStencilDesc) == sizeof(D3D11_DEPTH_STENCIL_DESC), "DepthStencilDesc layout");
+		static_assert(sizeof(RasterizerDesc) == sizeof(D3D11_RASTERIZER_DESC), "RasterizerDesc layout");
+		static_assert(sizeof(SamplerDesc) == sizeof(D3D11_SAMPLER_DESC), "SamplerDesc layout");
+		static_assert(sizeof(BlendDesc) == sizeof(D3D11_BLEND_DESC), "BlendDesc layout");
 
-	ID3D11DepthStencilState *dsState = nullptr;
-	HRESULT hr = gDevice->CreateDepthStencilState(&dsDesc, &dsState);
-	RETURN_IF_FAILED(hr);
-	gDeviceContext->OMSetDepthStencilState(dsState, 0);
-	SAFE_RELEASE(dsState);
+		HRESULT hr = E_INVALIDARG;
+		switch (kind)
+		{
+		case State_DepthStencil:
+		{
+			ID3D11DepthStencilState *state = nullptr;
+			hr = gDevice->CreateDepthStencilState(static_cast<const D3D11_DEPTH_STENCIL_DESC*>(desc), &state);
+			return SUCCEEDED(hr) ? state : nullptr;
+		}
+		case State_Rasterizer:
+		{
+			ID3D11RasterizerState *state = nullptr;
+			hr = gDevice->CreateRasterizerState(static_cast<const D3D11_RASTERIZER_DESC*>(desc), &state);
+			return SUCCEEDED(hr) ? state : nullptr;
+		}
+		case State_Sampler:
+		{
+			ID3D11SamplerState *state = nullptr;
+			hr = gDevice->CreateSamplerState(static_cast<const D3D11_SAMPLER_DESC*>(desc), &state);
+			return SUCCEEDED(hr) ? state : nullptr;
+		}
+		case State_Blend:
+		{
+			ID3D11BlendState *state = nullptr;
+			hr = gDevice->CreateBlendState(static_cast<const D3D11_BLEND_DESC*>(desc), &state);
+			return SUCCEEDED(hr) ? state : nullptr;
+		}
+		default:
+			return nullptr;
+		}
+	}
 
-	return hr;
+	void ReleaseState(StateKind kind, void *state) override
+	{
+		switch (kind)
+		{
+		case State_DepthStencil: static_cast<ID3D11DepthStencilState*>(state)->Release(); break;
+		case State_Rasterizer:   static_cast<ID3D11RasterizerState*>(state)->Release(); break;
+		case State_Sampler:      static_cast<ID3D11SamplerState*>(state)->Release(); break;
+		case State_Blend:        static_cast<ID3D11BlendState*>(state)->Release(); break;
+		default: break;
+		}
+	}
+};
+
+D3DStateFactory gStateFactory;
+StateCache      gStateCache(gStateFactory);
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+HRESULT CreateSampler()
+{
+	SamplerDesc sdesc = DefaultSamplerDesc();
+	sdesc.addressU = D3D11_TEXTURE_ADDRESS_WRAP;
+	sdesc.addressV = D3D11_TEXTURE_ADDRESS_WRAP;
+	sdesc.addressW = D3D11_TEXTURE_ADDRESS_WRAP;
+	sdesc.filter = D3D11_FILTER_MIN_MAG_MIP_POINT;
+
+	gSampler = static_cast<ID3D11SamplerState*>(gStateCache.GetSampler(sdesc));
+	return gSampler ? S_OK : E_FAIL;
 }
 ///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
-HRESULT CreateAndSetRS()
+// the scene's depth, rasterizer and blend states as one bundle, created at load time so no frame waits for them
+HRESULT CreatePipelineStates()
 {
-	D3D11_RASTERIZER_DESC rsDesc;
-	ZeroMemory(&rsDesc, sizeof(rsDesc));
-	rsDesc.FillMode = D3D11_FILL_SOLID;
-	rsDesc.CullMode = D3D11_CULL_NONE; // D3D11_CULL_BACK;
-
-	ID3D11RasterizerState *rsState = nullptr;
-	HRESULT hr = gDevice->CreateRasterizerState(&rsDesc, &rsState);
+	PipelineDesc desc;
+	desc.depthStencil = DefaultDepthStencilDesc();
+	desc.rasterizer = DefaultRasterizerDesc();
+	desc.rasterizer.cullMode = D3D11_CULL_NONE; // D3D11_CULL_BACK;
+	desc.rasterizer.depthClipEnable = FALSE;
+	desc.blend = DefaultBlendDesc();
+
+	gScenePipeline = gStateCache.GetPipeline(desc);
+	return gScenePipeline ? S_OK : E_FAIL;
+}
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// at init and after ResizeBuffers
+HRESULT CreateBackBufferView()
+{
+	ID3D11Texture2D* pBackBuffer = nullptr;
+	HRESULT hr = gSwapChain->GetBuffer(0, __uuidof(ID3D11Texture2D), reinterpret_cast<void**>(&pBackBuffer));
 	RETURN_IF_FAILED(hr);
-	gDeviceContext->RSSetState(rsState);
-	SAFE_RELEASE(rsState);
 
+	hr = gDevice->CreateRenderTargetView(pBackBuffer, nullptr, &gRenderTargetView);
+	pBackBuffer->Release();
 	return hr;
 }
 ///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
-HRESULT CreateSwapChainAndBackbuffer(HWND hWnd)
+// the fullscreen triangle that stretches the scene's region to the back buffer, no vertex buffer or input layout
+HRESULT CreateUpscalePass()
 {
-	// Obtain DXGI factory from device
-	IDXGIFactory1* dxgiFactory = nullptr;
-	IDXGIDevice* dxgiDevice = nullptr;
-	HRESULT hr = gDevice->QueryInterface(__uuidof(IDXGIDevice), reinterpret_cast<void**>(&dxgiDevice));
-	RETURN_IF_FAILED(hr);
+	const char upscale[] =
+		"	cbuffer UpscaleConstants : register(b0)"
+		"	{"
+		"		float4 uvScale;" // xy: rendered region / scene texture size, zw: its last texel centers
+		"	};"
 
-	IDXGIAdapter* adapter = nullptr;
-	hr = dxgiDevice->GetAdapter(&adapter);
-	assert(SUCCEEDED(hr));
+		"	Texture2D sceneTexture : register(t0);"
+		"	sampler linearClampSampler : register(s0);"
 
-	hr = adapter->GetParent(__uuidof(IDXGIFactory1), reinterpret_cast<void**>(&dxgiFactory));
-	adapter->Release();
-	dxgiDevice->Release();
-	RETURN_IF_FAILED(hr);
+		"	struct PixelInputType"
+		"	{"
+		"		float4 position : SV_POSITION;"
+		"		float2 texCoord : TEXCOORD;"
+		"	};"
 
-	DXGI_SWAP_CHAIN_DESC sd;
-	sd.BufferCount = 1;
-	sd.BufferDesc.Width = gWidth;
-	sd.BufferDesc.Height = gHeight; // swapChain stretch buffer to the window size (but resolutions can be different)
-	sd.BufferDesc.RefreshRate.Numerator = 0;
+		"	PixelInputType UpscaleVertexShader(uint vertexId : SV_VertexID)"
+		"	{"
+		"		PixelInputType output;"
+		"		float2 uv = float2((vertexId << 1) & 2, vertexId & 2);"
+		"		output.position = float4(uv * float2(2.0f, -2.0f) + float2(-1.0f, 1.0f), 0.0f, 1.0f);"
+		"		output.texCoord = uv * uvScale.xy;"
+		"		return output;"
+		"	}"
+
+		// the clamp keeps the bilinear footprint out of the unused part of the texture
+		"	float4 UpscalePixelShader(PixelInputType input) : SV_TARGET"
+		"	{"
+		"		return sceneTexture.Sample(linearClampSampler, min(input.texCoord, uvScale.zw));"
+		"	}";
+
+	ShaderSource source = { "UpscaleVS", upscale, ARRAYSIZE(upscale), "UpscaleVertexShader", "vs_4_0", {} };
+	ShaderBlob vsCompiledCode;
+	if (!gShaderCache.Load(source, gShaderCompiler, vsCompiledCode))
+	{
+		assert(false);
+		return E_FAIL;
+	}
+	HRESULT hr = gDevice->CreateVertexShader(vsCompiledCode.GetBytecode(), vsCompiledCode.GetBytecodeSize(), nullptr, &gUpscaleVS);
+	RETURN_IF_FAILED(hr);
+
+	source.name = "UpscalePS";
+	source.entryPoint = "UpscalePixelShader";
+	source.target = "ps_4_0";
+	ShaderBlob psCompiledCode;
+	if (!gShaderCache.Load(source, gShaderCompiler, psCompiledCode))
+	{
+		assert(false);
+		return E_FAIL;
+	}
+	hr = gDevice->CreatePixelShader(psCompiledCode.GetBytecode(), psCompiledCode.GetBytecodeSize(), nullptr, &gUpscalePS);
+	RETURN_IF_FAILED(hr);
+
+	SamplerDesc sdesc = DefaultSamplerDesc();
+	sdesc.minLOD = 0.0f;
+	gUpscaleSampler = static_cast<ID3D11SamplerState*>(gStateCache.GetSampler(sdesc));
+	if (!gUpscaleSampler)
+		return E_FAIL;
+
+	D3D11_BUFFER_DESC cbd;
+	cbd.Usage = D3D11_USAGE_DEFAULT;
+	cbd.ByteWidth = 4 * sizeof(float);
+	cbd.BindFlags = D3D11_BIND_CONSTANT_BUFFER;
+	cbd.CPUAccessFlags = 0;
+	cbd.MiscFlags = 0;
+	cbd.StructureByteStride = 0;
+	hr = gDevice->CreateBuffer(&cbd, nullptr, &gUpscaleCBuffer);
+	return hr;
+}
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// vsync and uncapped: the single buffer blt model chain, Present blocks once three frames are queued
+HRESULT CreateBltSwapChain(IDXGIFactory1 *dxgiFactory, HWND hWnd)
+{
+	DXGI_SWAP_CHAIN_DESC sd;
+	sd.BufferCount = 1;
+	sd.BufferDesc.Width = gWidth;
+	sd.BufferDesc.Height = gHeight; // swapChain stretch buffer to the window size (but resolutions can be different)
+	sd.BufferDesc.RefreshRate.Numerator = 0;
 	sd.BufferDesc.RefreshRate.Denominator = 0;
 	sd.BufferDesc.Format = DXGI_FORMAT_R8G8B8A8_UNORM;
 	sd.BufferDesc.Scaling = DXGI_MODE_SCALING_CENTERED;
@@ -388,58 +1112,339 @@ HRESULT CreateSwapChainAndBackbuffer(HWND hWnd)
 	sd.SampleDesc.Quality = 0;
 	sd.Windowed = TRUE;
 	sd.Flags = 0;
-	hr = dxgiFactory->CreateSwapChain(gDevice, &sd, &gSwapChain);
-	dxgiFactory->Release();
+	HRESULT hr = dxgiFactory->CreateSwapChain(gDevice, &sd, &gSwapChain);
+	return hr;
+}
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// low latency: flip model with at most one queued frame, the waitable object is signaled when there is room for the
+// next one; fails on runtimes without IDXGISwapChain2
+HRESULT CreateLowLatencySwapChain(IDXGIFactory1 *dxgiFactory, HWND hWnd)
+{
+	IDXGIFactory2 *dxgiFactory2 = nullptr;
+	HRESULT hr = dxgiFactory->QueryInterface(__uuidof(IDXGIFactory2), reinterpret_cast<void**>(&dxgiFactory2));
+	if (FAILED(hr))
+		return hr;
+
+	DXGI_SWAP_CHAIN_DESC1 sd;
+	ZeroMemory(&sd, sizeof(sd));
+	sd.Width = gWidth;
+	sd.Height = gHeight;
+	sd.Format = DXGI_FORMAT_R8G8B8A8_UNORM;
+	sd.SampleDesc.Count = 1;
+	sd.SampleDesc.Quality = 0;
+	sd.BufferUsage = DXGI_USAGE_RENDER_TARGET_OUTPUT;
+	sd.BufferCount = 2;
+	sd.Scaling = DXGI_SCALING_STRETCH;
+	sd.SwapEffect = DXGI_SWAP_EFFECT_FLIP_SEQUENTIAL;
+	sd.AlphaMode = DXGI_ALPHA_MODE_UNSPECIFIED;
+	sd.Flags = DXGI_SWAP_CHAIN_FLAG_FRAME_LATENCY_WAITABLE_OBJECT;
+
+	IDXGISwapChain1 *swapChain1 = nullptr;
+	hr = dxgiFactory2->CreateSwapChainForHwnd(gDevice, hWnd, &sd, nullptr, nullptr, &swapChain1);
+	dxgiFactory2->Release();
+	if (FAILED(hr))
+		return hr;
+
+	IDXGISwapChain2 *swapChain2 = nullptr;
+	hr = swapChain1->QueryInterface(__uuidof(IDXGISwapChain2), reinterpret_cast<void**>(&swapChain2));
+	if (FAILED(hr))
+	{
+		swapChain1->Release();
+		return hr;
+	}
+	swapChain2->SetMaximumFrameLatency(1);
+	gFrameLatencyWaitable = swapChain2->GetFrameLatencyWaitableObject();
+	swapChain2->Release();
+
+	gSwapChain = swapChain1;
+	gFlipModel = true;
+	return S_OK;
+}
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+HRESULT CreateSwapChainAndBackbuffer(HWND hWnd)
+{
+	// Obtain DXGI factory from device
+	IDXGIFactory1* dxgiFactory = nullptr;
+	IDXGIDevice* dxgiDevice = nullptr;
+	HRESULT hr = gDevice->QueryInterface(__uuidof(IDXGIDevice), reinterpret_cast<void**>(&dxgiDevice));
 	RETURN_IF_FAILED(hr);
 
-	// Create a render target view
-	ID3D11Texture2D* pBackBuffer = nullptr;
-	hr = gSwapChain->GetBuffer(0, __uuidof(ID3D11Texture2D), reinterpret_cast<void**>(&pBackBuffer));
+	IDXGIAdapter* adapter = nullptr;
+	hr = dxgiDevice->GetAdapter(&adapter);
+	assert(SUCCEEDED(hr));
+
+	hr = adapter->GetParent(__uuidof(IDXGIFactory1), reinterpret_cast<void**>(&dxgiFactory));
+	adapter->Release();
+	dxgiDevice->Release();
 	RETURN_IF_FAILED(hr);
 
-	hr = gDevice->CreateRenderTargetView(pBackBuffer, nullptr, &gRenderTargetView);
-	pBackBuffer->Release();
+	if (gPresentMode == Present_LowLatency)
+	{
+		hr = CreateLowLatencySwapChain(dxgiFactory, hWnd);
+		if (FAILED(hr))
+		{
+			// before Windows 8.1
+			OutputDebugStringA("No frame latency waitable swap chain, falling back to vsync\n");
+			gPresentMode = Present_VSync;
+		}
+	}
+
+	if (!gSwapChain)
+		hr = CreateBltSwapChain(dxgiFactory, hWnd);
+	dxgiFactory->Release();
+	RETURN_IF_FAILED(hr);
+
+	hr = CreateBackBufferView();
 	return hr;
 }
 ///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
-HRESULT CreateDepthTexture()
+#ifndef CREATE_WAITABLE_TIMER_HIGH_RESOLUTION
+#define CREATE_WAITABLE_TIMER_HIGH_RESOLUTION 0x00000002
+#endif
+
+// after the swap chain, which may have fallen back to vsync
+HRESULT CreateFramePacer()
+{
+	// a first guess, the vblanks refine it
+	DEVMODE displayMode;
+	ZeroMemory(&displayMode, sizeof(displayMode));
+	displayMode.dmSize = sizeof(displayMode);
+	double refreshMs = 1000.0 / 60.0;
+	if (EnumDisplaySettings(nullptr, ENUM_CURRENT_SETTINGS, &displayMode) && displayMode.dmDisplayFrequency > 1)
+		refreshMs = 1000.0 / displayMode.dmDisplayFrequency;
+	gFramePacer = new FramePacer(gFrameClock, gPresentMode, refreshMs);
+
+	LARGE_INTEGER frequency;
+	QueryPerformanceFrequency(&frequency);
+	gQpcFrequency = static_cast<double>(frequency.QuadPart);
+
+	// Sleep rounds up to the 15.6 ms system tick, the high resolution timer (Windows 10 1803) does not
+	gPacingTimer = CreateWaitableTimerExW(nullptr, nullptr, CREATE_WAITABLE_TIMER_HIGH_RESOLUTION, TIMER_ALL_ACCESS);
+	return S_OK;
+}
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// the frame graph's targets; a D3DRenderTarget has the views its usage flags ask for
+struct D3DRenderTarget
 {
-	D3D11_TEXTURE2D_DESC depthStencilDesc;
-	depthStencilDesc.Width = gWidth;
-	depthStencilDesc.Height = gHeight;
-	depthStencilDesc.Format = DXGI_FORMAT_D24_UNORM_S8_UINT;
-	depthStencilDesc.ArraySize = 1;
-	depthStencilDesc.MipLevels = 1;
-	depthStencilDesc.Usage = D3D11_USAGE_DEFAULT;
-	depthStencilDesc.CPUAccessFlags = 0;
-	depthStencilDesc.MiscFlags = 0;
-	depthStencilDesc.BindFlags = D3D11_BIND_DEPTH_STENCIL;
-	depthStencilDesc.SampleDesc.Count = 1;
-	depthStencilDesc.SampleDesc.Quality = 0;
+	ID3D11Texture2D          *texture;
+	ID3D11RenderTargetView   *targetView;
+	ID3D11DepthStencilView   *depthView;
+	ID3D11ShaderResourceView *resourceView;
+};
 
-	ID3D11Texture2D *depthStencilBuffer;
-	HRESULT hr = gDevice->CreateTexture2D(&depthStencilDesc, 0, &depthStencilBuffer);
-	RETURN_IF_FAILED(hr);
+class D3DRenderTargetFactory : public RenderTargetFactory
+{
+public:
+	void* CreateTarget(const RenderTargetDesc &desc, unsigned usage) override
+	{
+		D3D11_TEXTURE2D_DESC textureDesc;
+		textureDesc.Width = desc.width;
+		textureDesc.Height = desc.height;
+		textureDesc.Format = static_cast<DXGI_FORMAT>(desc.format);
+		textureDesc.ArraySize = 1;
+		textureDesc.MipLevels = 1;
+		textureDesc.Usage = D3D11_USAGE_DEFAULT;
+		textureDesc.CPUAccessFlags = 0;
+		textureDesc.MiscFlags = 0;
+		textureDesc.BindFlags = (usage & Usage_Target ? D3D11_BIND_RENDER_TARGET : 0) |
+			(usage & Usage_Depth ? D3D11_BIND_DEPTH_STENCIL : 0) | (usage & Usage_Read ? D3D11_BIND_SHADER_RESOURCE : 0);
+		textureDesc.SampleDesc.Count = 1;
+		textureDesc.SampleDesc.Quality = 0;
+
+		D3DRenderTarget *target = new D3DRenderTarget();
+		HRESULT hr = gDevice->CreateTexture2D(&textureDesc, 0, &target->texture);
+		if (SUCCEEDED(hr) && (usage & Usage_Target))
+			hr = gDevice->CreateRenderTargetView(target->texture, nullptr, &target->targetView);
+		if (SUCCEEDED(hr) && (usage & Usage_Depth))
+			hr = gDevice->CreateDepthStencilView(target->texture, nullptr, &target->depthView);
+		if (SUCCEEDED(hr) && (usage & Usage_Read))
+			hr = gDevice->CreateShaderResourceView(target->texture, nullptr, &target->resourceView);
+		if (FAILED(hr))
+		{
+			ReleaseTarget(target);
+			return nullptr;
+		}
+		return target;
+	}
 
-	hr = gDevice->CreateDepthStencilView(depthStencilBuffer, 0, &gDepthStencilView);
-	depthStencilBuffer->Release();
-	return hr;
+	void ReleaseTarget(void *object) override
+	{
+		D3DRenderTarget *target = static_cast<D3DRenderTarget*>(object);
+		SAFE_RELEASE(target->resourceView);
+		SAFE_RELEASE(target->depthView);
+		SAFE_RELEASE(target->targetView);
+		SAFE_RELEASE(target->texture);
+		delete target;
+	}
+};
+
+D3DRenderTargetFactory gRenderTargetFactory;
+RenderTargetPool       gRenderTargets(gRenderTargetFactory);
+
+// the scene pass draws into color and depth, the upscale pass stretches color to the back buffer. Rebuilt with the
+// back buffer size, the passes run every frame in RenderTick.
+RenderGraph      gFrameGraph;
+RenderResourceId gSceneColor = kNoRenderResource;
+RenderResourceId gSceneDepth = kNoRenderResource;
+RenderResourceId gBackBuffer = kNoRenderResource;
+
+// the frame's passes, defined with RenderTick
+void DrawScene();
+void UpscaleScene();
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// color and depth the scene is drawn to, at the largest scale of the current back buffer size
+HRESULT CreateSceneTargets()
+{
+	float maxScale = gResolutionScaler.GetSettings().maxScale;
+	gSceneWidth = std::max(1u, static_cast<UINT>(gWidth * maxScale + 0.5f));
+	gSceneHeight = std::max(1u, static_cast<UINT>(gHeight * maxScale + 0.5f));
+
+	RenderTargetDesc colorDesc = { gSceneWidth, gSceneHeight, DXGI_FORMAT_R8G8B8A8_UNORM, 4, false, {} };
+	memcpy(colorDesc.clear, DirectX::Colors::AliceBlue.f, sizeof(colorDesc.clear));
+	RenderTargetDesc depthDesc = { gSceneWidth, gSceneHeight, DXGI_FORMAT_D24_UNORM_S8_UINT, 4, true, { 1.0f, 0.0f } };
+	RenderTargetDesc backBufferDesc = { UINT(gWidth), UINT(gHeight), DXGI_FORMAT_R8G8B8A8_UNORM, 4, false, {} };
+
+	gFrameGraph.Clear();
+	gSceneColor = gFrameGraph.CreateTarget("scene color", colorDesc);
+	gSceneDepth = gFrameGraph.CreateTarget("scene depth", depthDesc);
+	gBackBuffer = gFrameGraph.ImportTarget("back buffer", backBufferDesc);
+
+	RenderPassId scene = gFrameGraph.AddPass("scene", [] { DrawScene(); });
+	gFrameGraph.Write(scene, gSceneColor);
+	gFrameGraph.Write(scene, gSceneDepth);
+	RenderPassId upscale = gFrameGraph.AddPass("upscale", [] { UpscaleScene(); });
+	gFrameGraph.Read(upscale, gSceneColor);
+	gFrameGraph.Write(upscale, gBackBuffer);
+
+	if (!gFrameGraph.Compile() || !gRenderTargets.Realize(gFrameGraph))
+		return E_FAIL;
+
+	// deferred contexts bind the scene targets themselves
+	const D3DRenderTarget *color =
+		static_cast<const D3DRenderTarget*>(gRenderTargets.GetTargetOf(gFrameGraph, gSceneColor));
+	const D3DRenderTarget *depth =
+		static_cast<const D3DRenderTarget*>(gRenderTargets.GetTargetOf(gFrameGraph, gSceneDepth));
+	gSceneTargetView = color->targetView;
+	gSceneShaderResourceView = color->resourceView;
+	gDepthStencilView = depth->depthView;
+
+	RenderGraphStats stats = gFrameGraph.GetStats();
+	char report[160];
+	snprintf(report, sizeof(report), "Frame graph: %u passes (%u culled), %u targets in %u textures, %.1f MB\n",
+		stats.passes, stats.culledPasses, stats.transients, stats.physicals, stats.physicalBytes / (1024.0 * 1024.0));
+	OutputDebugStringA(report);
+	return S_OK;
 }
 ///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// the scene's viewport, the scaled region of the scene targets
 void SetupViewport()
 {
-	D3D11_VIEWPORT vp;
-	vp.Width = static_cast<FLOAT>(gWidth);
-	vp.Height = static_cast<FLOAT>(gHeight);
-	vp.TopLeftX = 0;
-	vp.TopLeftY = 0;
-	vp.MinDepth = 0.0f;
-	vp.MaxDepth = 1.0f;
-	gDeviceContext->RSSetViewports(1, &vp);
+	gViewport.Width = static_cast<FLOAT>(gRenderWidth);
+	gViewport.Height = static_cast<FLOAT>(gRenderHeight);
+	gViewport.TopLeftX = 0;
+	gViewport.TopLeftY = 0;
+	gViewport.MinDepth = 0.0f;
+	gViewport.MaxDepth = 1.0f;
+}
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// depth, rasterizer, blend state and viewport shared by every draw of the scene
+void BindSceneState(ID3D11DeviceContext *context)
+{
+	context->OMSetDepthStencilState(static_cast<ID3D11DepthStencilState*>(gScenePipeline->depthStencil), 0);
+	context->RSSetState(static_cast<ID3D11RasterizerState*>(gScenePipeline->rasterizer));
+	context->OMSetBlendState(static_cast<ID3D11BlendState*>(gScenePipeline->blend), nullptr, 0xFFFFFFFF);
+	context->RSSetViewports(1, &gViewport);
+}
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// the scene targets and state, deferred contexts set it at the start of each command list; the immediate context gets
+// its targets from the frame graph
+void BindOutputState(ID3D11DeviceContext *context)
+{
+	context->OMSetRenderTargets(1, &gSceneTargetView, gDepthStencilView);
+	BindSceneState(context);
+}
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// immediate context only, after the scale or the back buffer changed; the next BindSceneState uses the new viewport
+void ApplyRenderSize()
+{
+	gResolutionScaler.GetRenderSize(gWidth, gHeight, gRenderWidth, gRenderHeight);
+	gRenderWidth = std::min(gRenderWidth, gSceneWidth);
+	gRenderHeight = std::min(gRenderHeight, gSceneHeight);
+	SetupViewport();
+
+	float uvScale[4] = {
+		static_cast<float>(gRenderWidth) / gSceneWidth, static_cast<float>(gRenderHeight) / gSceneHeight,
+		(gRenderWidth - 0.5f) / gSceneWidth, (gRenderHeight - 0.5f) / gSceneHeight };
+	gDeviceContext->UpdateSubresource(gUpscaleCBuffer, 0, nullptr, uvScale, 0, 0);
+}
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+HRESULT CreateRecordContexts()
+{
+	if (!gUseDeferredContexts)
+		return S_OK;
+
+	D3D11_BUFFER_DESC cbd;
+	cbd.Usage = D3D11_USAGE_DYNAMIC;
+	cbd.ByteWidth = sizeof(Mat4);
+	cbd.BindFlags = D3D11_BIND_CONSTANT_BUFFER;
+	cbd.CPUAccessFlags = D3D11_CPU_ACCESS_WRITE;
+	cbd.MiscFlags = 0;
+	cbd.StructureByteStride = 0;
+
+	// one context per thread is enough: every chunk is recorded by one job, chunks never share a context
+	gRecordContexts.resize(gJobSystem->GetThreadsCount());
+	for (size_t i = 0; i < gRecordContexts.size(); i++)
+	{
+		RecordContext &rc = gRecordContexts[i];
+		ZeroMemory(&rc, sizeof(rc));
+
+		HRESULT hr = gDevice->CreateDeferredContext(0, &rc.context);
+		RETURN_IF_FAILED(hr);
+		hr = gDevice->CreateBuffer(&cbd, nullptr, &rc.objectBuffer);
+		RETURN_IF_FAILED(hr);
+		if (gUploadBuffer)
+		{
+			hr = rc.context->QueryInterface(__uuidof(ID3D11DeviceContext1), reinterpret_cast<void**>(&rc.context1));
+			RETURN_IF_FAILED(hr);
+		}
+	}
+	return S_OK;
+}
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// the first frame does not wait for the requested texture, the checker is drawn until it is resident
+HRESULT StartStreaming()
+{
+	gBoundTexture = gTexShaderResourceView;
+	gAssetStreamer = new AssetStreamer(gUploadDevice, gFrameClock);
+	if (gCustomTexture)
+		gStreamedTexture = gAssetStreamer->RequestTexture(gTexturePath);
+	return S_OK;
+}
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+void ReportInitTimings(const TaskGraph &graph)
+{
+	std::vector<TaskId> path = graph.GetCriticalPath();
+	double pathMs = 0.0;
+	for (size_t i = 0; i < path.size(); i++)
+		pathMs += graph.GetDurationMs(path[i]);
+
+	char line[160];
+	for (TaskId id = 0; id < graph.GetTasksCount(); id++)
+	{
+		const TaskTiming &timing = graph.GetTiming(id);
+		bool critical = std::find(path.begin(), path.end(), id) != path.end();
+		snprintf(line, sizeof(line), "Init %c %-16s %7.2f .. %7.2f ms, thread %d%s\n", critical ? '*' : ' ', graph.GetName(id),
+			timing.startMs, timing.endMs, timing.thread, graph.GetState(id) == Task_Done ? "" : " (failed or skipped)");
+		OutputDebugStringA(line);
+	}
+	snprintf(line, sizeof(line), "Init: %.1f ms, %.1f ms of steps, critical path (*) %.1f ms\n", graph.GetWallMs(),
+		graph.GetWorkMs(), pathMs);
+	OutputDebugStringA(line);
 }
 ///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 HRESULT InitRender(HWND hWnd)
 {
+	TRACE_SCOPE("InitRender");
 	HRESULT hr = S_OK;
 
 	UINT createDeviceFlags = 0;
@@ -451,100 +1456,960 @@ HRESULT InitRender(HWND hWnd)
 	D3D_FEATURE_LEVEL featureLevels[] =	{ D3D_FEATURE_LEVEL_10_0 };
 	UINT numFeatureLevels = ARRAYSIZE(featureLevels);
 
-	hr = D3D11CreateDevice(nullptr, D3D_DRIVER_TYPE_HARDWARE, nullptr, createDeviceFlags, 
-		featureLevels, numFeatureLevels, D3D11_SDK_VERSION, &gDevice, nullptr, &gDeviceContext);
-	RETURN_IF_FAILED(hr);
-
-	// create WHERE we are going to draw our objects
-	hr = CreateSwapChainAndBackbuffer(hWnd);
+	{
+		TRACE_SCOPE("device");
+		hr = D3D11CreateDevice(nullptr, D3D_DRIVER_TYPE_HARDWARE, nullptr, createDeviceFlags, 
+			featureLevels, numFeatureLevels, D3D11_SDK_VERSION, &gDevice, nullptr, &gDeviceContext);
+	}
 	RETURN_IF_FAILED(hr);
 
-	hr = CreateDepthTexture();
-	RETURN_IF_FAILED(hr);
+	// the rest is a graph: ID3D11Device is free threaded, so resources are created on the job system's workers while
+	// everything that touches the immediate context (or the window) stays on this thread
+	gJobSystem = new JobSystem(gRecordThreads);
+	TaskGraph graph(gFrameClock);
+	ShaderBlob vsCompiledCode, vsInstancedCompiledCode;
 
-	gDeviceContext->OMSetRenderTargets(1, &gRenderTargetView, gDepthStencilView);
+	// create WHERE we are going to draw our objects
+	TaskId swapChain = graph.Add("swapchain", Task_MainThread, [hWnd] { return SUCCEEDED(CreateSwapChainAndBackbuffer(hWnd)); });
+	graph.Add("frame pacer", Task_MainThread, [] { return SUCCEEDED(CreateFramePacer()); }, { swapChain });
+	TaskId sceneTargets = graph.Add("scene targets", Task_AnyThread, [] { return SUCCEEDED(CreateSceneTargets()); });
 
 	// create WHAT we are going to draw - geometry
-	hr = CreateGeometry();
-	RETURN_IF_FAILED(hr);
+	TaskId geometry = graph.Add("geometry", Task_AnyThread, [] { return SUCCEEDED(CreateGeometry()); });
 
 	// create HOW we are going to draw - vertex shader, input layout, transform matrices...
-	hr = CreateVertexShaderAndInputLayout();
-	RETURN_IF_FAILED(hr);
-
-	hr = CreateCBuffers();
-	RETURN_IF_FAILED(hr);
-
-	// create pixel shader, texture, sampler, depth and rasterizer states
-	hr = CreatePixelShader();
-	RETURN_IF_FAILED(hr);
-
-	hr = CreateDefaultTexture();
-	RETURN_IF_FAILED(hr);
+	TaskId vsCompile = graph.Add("vs compile", Task_AnyThread,
+		[&] { return SUCCEEDED(CompileVertexShaders(vsCompiledCode, vsInstancedCompiledCode)); });
+	graph.Add("vs create", Task_AnyThread,
+		[&] { return SUCCEEDED(CreateVertexShaders(vsCompiledCode, vsInstancedCompiledCode)); }, { vsCompile });
+	graph.Add("input layout", Task_AnyThread,
+		[&] { return SUCCEEDED(CreateInputLayouts(vsCompiledCode, vsInstancedCompiledCode)); }, { vsCompile, geometry });
+	graph.Add("cbuffer bind", Task_AnyThread, [&] { return SUCCEEDED(BindObjectCBuffer(vsCompiledCode)); }, { vsCompile });
+	graph.Add("cbuffers", Task_AnyThread, []
+	{
+		UpdateCamera();
+		return SUCCEEDED(CreateCBuffers());
+	});
+	graph.Add("instance buffer", Task_AnyThread, [] { return SUCCEEDED(CreateInstanceBuffer()); });
+	// queries the immediate context for ID3D11DeviceContext1
+	TaskId uploadRing = graph.Add("upload ring", Task_MainThread, [] { return SUCCEEDED(CreateUploadRing()); });
+	graph.Add("gpu timers", Task_AnyThread, [] { return SUCCEEDED(CreateGpuTimers()); });
+#if TRACE_ENABLED
+	graph.Add("gpu trace", Task_AnyThread, [] { return SUCCEEDED(CreateGpuTrace()); });
+#endif
 
-	hr = CreateSampler();
-	RETURN_IF_FAILED(hr);
+	// create pixel shader, texture, sampler and the pipeline states
+	graph.Add("ps", Task_AnyThread, [] { return SUCCEEDED(CreatePixelShader()); });
+	TaskId texture = graph.Add("texture", Task_AnyThread, [] { return SUCCEEDED(CreateDefaultTexture()); });
+	graph.Add("streamer", Task_MainThread, [] { return SUCCEEDED(StartStreaming()); }, { texture });
+	graph.Add("sampler", Task_AnyThread, [] { return SUCCEEDED(CreateSampler()); });
+	TaskId pipelineStates = graph.Add("pipeline states", Task_AnyThread, [] { return SUCCEEDED(CreatePipelineStates()); });
+	TaskId upscale = graph.Add("upscale", Task_AnyThread, [] { return SUCCEEDED(CreateUpscalePass()); });
+	graph.Add("bind output", Task_MainThread, []
+	{
+		ApplyRenderSize();
+		BindOutputState(gDeviceContext);
+		return true;
+	}, { swapChain, sceneTargets, pipelineStates, upscale });
 
-	hr = CreateAndSetDS();
-	RETURN_IF_FAILED(hr);
+	graph.Add("record contexts", Task_AnyThread, [] { return SUCCEEDED(CreateRecordContexts()); }, { uploadRing });
 
-	hr = CreateAndSetRS();
-	RETURN_IF_FAILED(hr);
+	bool succeeded = graph.Run(*gJobSystem);
+	ReportInitTimings(graph);
+	if (!succeeded)
+	{
+		assert(false);
+		return E_FAIL;
+	}
 
-	SetupViewport();
+	ShaderCacheStats cacheStats = gShaderCache.GetStats();
+	char cacheReport[160];
+	snprintf(cacheReport, sizeof(cacheReport), "Shader cache: %u hits, %u misses, %.1f ms compiling, %.1f ms saved\n",
+		cacheStats.hits, cacheStats.misses, cacheStats.compileMs, cacheStats.savedMs);
+	OutputDebugStringA(cacheReport);
 	return true;
 }
 ///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 void Cleanup()
 {
+	// releases the streamed textures, before the device goes
+	delete gAssetStreamer;
+	gAssetStreamer = nullptr;
+
+	for (size_t i = 0; i < gRecordContexts.size(); i++)
+	{
+		SAFE_RELEASE(gRecordContexts[i].commandList);
+		SAFE_RELEASE(gRecordContexts[i].objectBuffer);
+		SAFE_RELEASE(gRecordContexts[i].context1);
+		SAFE_RELEASE(gRecordContexts[i].context);
+	}
+	gRecordContexts.clear();
+	delete gJobSystem;
+	gJobSystem = nullptr;
+
+	delete gFramePacer;
+	gFramePacer = nullptr;
+	if (gPacingTimer)
+		CloseHandle(gPacingTimer);
+	gPacingTimer = nullptr;
+	if (gFrameLatencyWaitable)
+		CloseHandle(gFrameLatencyWaitable);
+	gFrameLatencyWaitable = nullptr;
+
 	for (int i = 0; i < NumConstantBuffers; i++)
 		SAFE_RELEASE(gCBuffers[i]);
-	SAFE_RELEASE(gSampler);
 	SAFE_RELEASE(gTexShaderResourceView);
-	SAFE_RELEASE(gQuad.vertexBuffer);
+	for (size_t i = 0; i < gTextureSliceViews.size(); i++)
+		SAFE_RELEASE(gTextureSliceViews[i]);
+	SAFE_RELEASE(gMesh.vertexBuffer);
+	SAFE_RELEASE(gMesh.indexBuffer);
+	SAFE_RELEASE(gInstanceBuffer);
+	for (UINT64 i = 0; i < gFramesInFlight; i++)
+	{
+		SAFE_RELEASE(gFrameQueries[i]);
+		SAFE_RELEASE(gGpuTimers[i].disjoint);
+		SAFE_RELEASE(gGpuTimers[i].begin);
+		SAFE_RELEASE(gGpuTimers[i].end);
+	}
+#if TRACE_ENABLED
+	if (gGpuTrace)
+	{
+		gDeviceContext->Flush();
+		gGpuTrace->Flush();
+		delete gGpuTrace;
+		gGpuTrace = nullptr;
+	}
+	gTimestampBackend.Release();
+#endif
+	SAFE_RELEASE(gUploadBuffer);
+	SAFE_RELEASE(gDeviceContext1);
 	SAFE_RELEASE(gInputLayout);
+	SAFE_RELEASE(gInstancedInputLayout);
 	SAFE_RELEASE(gVSShader);
-	SAFE_RELEASE(gPSShader);
-	SAFE_RELEASE(gDepthStencilView);
+	SAFE_RELEASE(gVSInstancedShader);
+	if (gShaderPermutations)
+	{
+		ShaderPermutationStats variantStats = gShaderPermutations->GetStats();
+		char variantReport[160];
+		snprintf(variantReport, sizeof(variantReport), "Shader variants: %u compiled, %u failed, %u shaders, %llu fallback draws, %.1f ms compiling\n",
+			variantStats.compiled, variantStats.failed, variantStats.shaders,
+			static_cast<unsigned long long>(variantStats.fallbackServed), variantStats.compileMs);
+		OutputDebugStringA(variantReport);
+	}
+	delete gShaderPermutations;
+	gShaderPermutations = nullptr;
+	gPSShader = nullptr;
+	gStateCache.Clear();
+	gSampler = nullptr;
+	gUpscaleSampler = nullptr;
+	gScenePipeline = nullptr;
+	SAFE_RELEASE(gUpscaleCBuffer);
+	SAFE_RELEASE(gUpscaleVS);
+	SAFE_RELEASE(gUpscalePS);
+	gFrameGraph.Clear();
+	gRenderTargets.Clear();
+	gSceneShaderResourceView = nullptr;
+	gSceneTargetView = nullptr;
+	gDepthStencilView = nullptr;
 	SAFE_RELEASE(gRenderTargetView);
 	SAFE_RELEASE(gSwapChain);
 	SAFE_RELEASE(gDeviceContext);
 	SAFE_RELEASE(gDevice);
 }
 ///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
-void UpdatePerObjectBuffer(float updateAngle)
+// fills gVisibleObjects from gTransforms
+void CullObjects()
 {
-	gAngleAnim += updateAngle;
-	DirectX::XMFLOAT4 vUp(0.0f, 1.0f, 0.0f, 0.0f);
-	DirectX::FXMVECTOR up = DirectX::XMLoadFloat4(&vUp);
-	DirectX::XMMATRIX rotateMat = DirectX::XMMatrixRotationAxis(up, gAngleAnim);
-	gDeviceContext->UpdateSubresource(gCBuffers[CB_Object], 0, nullptr, &rotateMat, 0, 0);
+	// at most every object, a frame arena vector that grows leaves its old buffers behind
+	size_t count = gTransforms.GetCount();
+	gVisibleObjects.clear();
+	gVisibleObjects.reserve(count);
+	if (!gUseCulling)
+	{
+		for (size_t i = 0; i < count; i++)
+			gVisibleObjects.push_back(static_cast<uint32_t>(i));
+		return;
+	}
+
+	gObjectBounds.resize(count);
+	ComputeBounds(gTransforms, 0, count, gMesh.bounds, gObjectBounds.data());
+
+	// leaves only move when an object leaves its fattened box, Refit then fixes their ancestors in one pass
+	for (size_t i = gObjectProxies.size(); i < count; i++)
+		gObjectProxies.push_back(gBvh.Insert(gObjectBounds[i], static_cast<uint32_t>(i)));
+	for (size_t i = 0; i < count; i++)
+		gBvh.Move(gObjectProxies[i], gObjectBounds[i]);
+	gBvh.Refit();
+
+	// back to object order, the two quads at the origin depend on it with the depth test and the draw sort is stable
+	gBvh.Cull(gFrustum, gVisibleObjects);
+	std::sort(gVisibleObjects.begin(), gVisibleObjects.end());
 }
 ///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
-void RenderTick()
+// slice of the checker array the object samples
+UINT GetObjectTexture(uint32_t object)
+{
+	return gTextureSlots[object % gTextureSlots.size()].slice;
+}
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// what the per-object draws bind: the view of the object's slice, the streamed texture once it replaced the checkers
+ID3D11ShaderResourceView* GetObjectTextureView(uint32_t object)
+{
+	if (gBoundTexture != gTexShaderResourceView)
+		return gBoundTexture;
+	return gTextureSliceViews[object % gTextureSliceViews.size()];
+}
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// every object is opaque and uses the one pixel shader, the texture field is the object's checker slice (there is one
+// array); the depth is the clip w of the object's origin, its distance along the view direction
+void SortVisibleObjects()
+{
+	if (!gSortDraws)
+		return;
+
+	const float *x = gTransforms.GetComponent(TransformStore::PositionX);
+	const float *y = gTransforms.GetComponent(TransformStore::PositionY);
+	const float *z = gTransforms.GetComponent(TransformStore::PositionZ);
+	gDrawQueue.Clear();
+	gDrawQueue.Reserve(gVisibleObjects.size());
+	for (size_t i = 0; i < gVisibleObjects.size(); i++)
+	{
+		uint32_t object = gVisibleObjects[i];
+		float depth = x[object] * gViewProj.m[0][3] + y[object] * gViewProj.m[1][3] + z[object] * gViewProj.m[2][3] + gViewProj.m[3][3];
+		gDrawQueue.Add(MakeSortKey(0, gOpaqueOrder, 0, GetObjectTexture(object), QuantizeDepth(depth, gNearZ, gFarZ)), object);
+	}
+	gDrawQueue.Sort();
+	for (size_t i = 0; i < gVisibleObjects.size(); i++)
+		gVisibleObjects[i] = gDrawQueue[i].payload;
+}
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// newest simulation snapshot, blended for the time the frame starts
+void UpdateObjectTransforms()
+{
+	LinearArena &arena = GetFrameArena();
+	gVisibleObjects = ArenaVector<uint32_t>(&arena);
+	gObjectMatrices = ArenaVector<Mat4>(&arena);
+	gObjectConstants = ArenaVector<UINT>(&arena);
+	gDrawQueue = RenderQueue(&arena);
+
+	gSimulation->Interpolate(gFrameClock.NowMs(), gTransforms);
+	CullObjects();
+	SortVisibleObjects();
+	gObjectMatrices.resize(gVisibleObjects.size());
+}
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// back to empty lists on the heap, nothing may point into the frame arena once the next frame resets it
+void ReleaseFrameLists()
+{
+	gVisibleObjects = ArenaVector<uint32_t>();
+	gObjectMatrices = ArenaVector<Mat4>();
+	gObjectConstants = ArenaVector<UINT>();
+	gDrawQueue = RenderQueue();
+}
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// any thread, ranges of visible objects of different calls must not overlap
+void ComputeObjectMatrices(size_t begin, size_t end)
+{
+	gTransforms.ComputeWorldViewProjIndexed(gVisibleObjects.data() + begin, end - begin, gViewProj, gObjectMatrices.data() + begin);
+}
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+void RetireUploadFrames()
+{
+	// frames gRetiredUploadFrame + 1 .. gUploadFrame - 1 are in flight, each fenced by gFrameQueries[frame % gFramesInFlight]
+	while (gRetiredUploadFrame + 1 < gUploadFrame)
+	{
+		UINT64 frame = gRetiredUploadFrame + 1;
+		// the oldest frame has to finish before its query is reused by the current one
+		bool mustWait = gUploadFrame - frame >= gFramesInFlight;
+		UINT flags = mustWait ? 0 : D3D11_ASYNC_GETDATA_DONOTFLUSH;
+
+		HRESULT hr = gDeviceContext->GetData(gFrameQueries[frame % gFramesInFlight], nullptr, 0, flags);
+		while (hr == S_FALSE && mustWait)
+			hr = gDeviceContext->GetData(gFrameQueries[frame % gFramesInFlight], nullptr, 0, flags);
+		if (hr != S_OK)
+			break;
+
+		gRetiredUploadFrame = frame;
+		gUploadRing.Retire(frame);
+	}
+}
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+bool MapUploadRing()
+{
+	if (!gUploadBuffer)
+		return false;
+
+	RetireUploadFrames();
+
+	D3D11_MAP mapType = gUploadRing.BeginFrame() ? D3D11_MAP_WRITE_DISCARD : D3D11_MAP_WRITE_NO_OVERWRITE;
+	D3D11_MAPPED_SUBRESOURCE mapped;
+	HRESULT hr = gDeviceContext->Map(gUploadBuffer, 0, mapType, 0, &mapped);
+	if (FAILED(hr))
+		return false;
+
+	gUploadData = static_cast<unsigned char*>(mapped.pData);
+	return true;
+}
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// returns the first 16 byte constant of the copy in gUploadBuffer, UINT_MAX if the ring is full; thread safe while mapped
+UINT UploadConstants(const void *data, size_t size)
 {
-	gDeviceContext->ClearRenderTargetView(gRenderTargetView, DirectX::Colors::AliceBlue);
-	gDeviceContext->ClearDepthStencilView(gDepthStencilView, D3D11_CLEAR_DEPTH, 1.0f, 0);
-	gDeviceContext->VSSetShader(gVSShader, nullptr, 0);
-	gDeviceContext->PSSetShader(gPSShader, nullptr, 0);
+	size_t offset = gUploadRing.Allocate(size);
+	if (offset == UploadRing::kInvalidOffset)
+		return UINT_MAX;
 
-	UINT stride = sizeof(MyVertex);
+	memcpy(gUploadData + offset, data, size);
+	return static_cast<UINT>(offset / 16);
+}
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+void UnmapUploadRing()
+{
+	gDeviceContext->Unmap(gUploadBuffer, 0);
+	gUploadData = nullptr;
+}
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// after the frame's last draw that reads from the ring
+void SignalUploadFrame()
+{
+	gDeviceContext->End(gFrameQueries[gUploadFrame % gFramesInFlight]);
+	gUploadRing.EndFrame(gUploadFrame);
+	gUploadFrame++;
+}
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+class D3DStateSink : public StateSink
+{
+public:
+	void SetShader(ShaderStage stage, const void *shader) override
+	{
+		if (stage == Stage_Vertex)
+			gDeviceContext->VSSetShader(static_cast<ID3D11VertexShader*>(const_cast<void*>(shader)), nullptr, 0);
+		else
+			gDeviceContext->PSSetShader(static_cast<ID3D11PixelShader*>(const_cast<void*>(shader)), nullptr, 0);
+	}
+
+	void SetInputLayout(const void *layout) override
+	{
+		gDeviceContext->IASetInputLayout(static_cast<ID3D11InputLayout*>(const_cast<void*>(layout)));
+	}
+
+	void SetPrimitiveTopology(unsigned topology) override
+	{
+		gDeviceContext->IASetPrimitiveTopology(static_cast<D3D11_PRIMITIVE_TOPOLOGY>(topology));
+	}
+
+	void SetIndexBuffer(const void *buffer, unsigned format, unsigned offset) override
+	{
+		gDeviceContext->IASetIndexBuffer(static_cast<ID3D11Buffer*>(const_cast<void*>(buffer)), static_cast<DXGI_FORMAT>(format), offset);
+	}
+
+	void SetVertexBuffers(unsigned startSlot, unsigned count, const void *const *buffers, const unsigned *strides, const unsigned *offsets) override
+	{
+		ID3D11Buffer *d3dBuffers[StateFilter::kMaxSlots];
+		ToD3D(buffers, count, d3dBuffers);
+		gDeviceContext->IASetVertexBuffers(startSlot, count, d3dBuffers, strides, offsets);
+	}
+
+	void SetConstantBuffers(ShaderStage stage, unsigned startSlot, unsigned count, const void *const *buffers,
+		const unsigned *firstConstants, const unsigned *numConstants) override
+	{
+		ID3D11Buffer *d3dBuffers[StateFilter::kMaxSlots];
+		ToD3D(buffers, count, d3dBuffers);
+
+		bool windowed = false;
+		for (unsigned i = 0; i < count; i++)
+			windowed = windowed || numConstants[i] != 0;
+
+		if (!windowed)
+		{
+			if (stage == Stage_Vertex)
+				gDeviceContext->VSSetConstantBuffers(startSlot, count, d3dBuffers);
+			else
+				gDeviceContext->PSSetConstantBuffers(startSlot, count, d3dBuffers);
+			return;
+		}
+
+		// whole buffers have no constant count to pass to *SetConstantBuffers1, bind them one by one
+		for (unsigned i = 0; i < count; i++)
+		{
+			if (numConstants[i] == 0)
+			{
+				if (stage == Stage_Vertex)
+					gDeviceContext->VSSetConstantBuffers(startSlot + i, 1, &d3dBuffers[i]);
+				else
+					gDeviceContext->PSSetConstantBuffers(startSlot + i, 1, &d3dBuffers[i]);
+			}
+			else if (stage == Stage_Vertex)
+				gDeviceContext1->VSSetConstantBuffers1(startSlot + i, 1, &d3dBuffers[i], &firstConstants[i], &numConstants[i]);
+			else
+				gDeviceContext1->PSSetConstantBuffers1(startSlot + i, 1, &d3dBuffers[i], &firstConstants[i], &numConstants[i]);
+		}
+	}
+
+	void SetSamplers(ShaderStage stage, unsigned startSlot, unsigned count, const void *const *samplers) override
+	{
+		ID3D11SamplerState *d3dSamplers[StateFilter::kMaxSlots];
+		ToD3D(samplers, count, d3dSamplers);
+		if (stage == Stage_Vertex)
+			gDeviceContext->VSSetSamplers(startSlot, count, d3dSamplers);
+		else
+			gDeviceContext->PSSetSamplers(startSlot, count, d3dSamplers);
+	}
+
+	void SetShaderResources(ShaderStage stage, unsigned startSlot, unsigned count, const void *const *views) override
+	{
+		ID3D11ShaderResourceView *d3dViews[StateFilter::kMaxSlots];
+		ToD3D(views, count, d3dViews);
+		if (stage == Stage_Vertex)
+			gDeviceContext->VSSetShaderResources(startSlot, count, d3dViews);
+		else
+			gDeviceContext->PSSetShaderResources(startSlot, count, d3dViews);
+	}
+
+private:
+	template <class T>
+	static void ToD3D(const void *const *objects, unsigned count, T **d3dObjects)
+	{
+		for (unsigned i = 0; i < count; i++)
+			d3dObjects[i] = static_cast<T*>(const_cast<void*>(objects[i]));
+	}
+};
+
+D3DStateSink gStateSink;
+StateFilter  gStateFilter(gStateSink);
+// filter counters of the last complete frame
+StateFilterStats gLastFrameStateStats = { 0, 0 };
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+void UpdatePerObjectBuffer(const Mat4 &worldViewProj, UINT firstConstant)
+{
+	if (firstConstant != UINT_MAX)
+	{
+		UINT numConstants = UploadRing::kAlignment / 16;
+		gStateFilter.SetConstantBuffers(Stage_Vertex, gCBObjectBind, 1, AsObjects(&gUploadBuffer), &firstConstant, &numConstants);
+		return;
+	}
+
+	gDeviceContext->UpdateSubresource(gCBuffers[CB_Object], 0, nullptr, &worldViewProj, 0, 0);
+	gStateFilter.SetConstantBuffers(Stage_Vertex, gCBObjectBind, 1, AsObjects(&gCBuffers[CB_Object]));
+}
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+class D3DInstanceBackend : public InstanceBackend
+{
+public:
+	size_t GetInstanceCapacity() const override { return gMaxInstances; }
+
+	InstanceData* MapInstances(size_t count) override
+	{
+		D3D11_MAPPED_SUBRESOURCE mapped;
+		HRESULT hr = gDeviceContext->Map(gInstanceBuffer, 0, D3D11_MAP_WRITE_DISCARD, 0, &mapped);
+		if (FAILED(hr))
+			return nullptr;
+		return static_cast<InstanceData*>(mapped.pData);
+	}
+
+	void UnmapInstances() override
+	{
+		gDeviceContext->Unmap(gInstanceBuffer, 0);
+	}
+
+	void DrawInstanced(size_t indicesCount, size_t instanceCount) override
+	{
+		TRACE_SCOPE("draw instanced");
+		TRACE_GPU_SCOPE(gGpuTrace, "draw instanced");
+		gStateFilter.Apply();
+		gDeviceContext->DrawIndexedInstanced(static_cast<UINT>(indicesCount), static_cast<UINT>(instanceCount), 0, 0, 0);
+	}
+};
+
+D3DInstanceBackend gInstanceBackend;
+InstanceBatcher    gInstanceBatcher;
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+void RenderTickInstanced()
+{
+	gStateFilter.SetShader(Stage_Vertex, gVSInstancedShader);
+	gStateFilter.SetShader(Stage_Pixel, gPSShader);
+
+	UINT strides[2] = { gMesh.vertexStride, sizeof(InstanceData) };
+	UINT offsets[2] = { 0, 0 };
+	ID3D11Buffer *buffers[2] = { gMesh.vertexBuffer, gInstanceBuffer };
+	gStateFilter.SetInputLayout(gInstancedInputLayout);
+	gStateFilter.SetIndexBuffer(gMesh.indexBuffer, gMesh.indexFormat, 0);
+	gStateFilter.SetVertexBuffers(0, 2, AsObjects(buffers), strides, offsets);
+	gStateFilter.SetPrimitiveTopology(D3D11_PRIMITIVE_TOPOLOGY_TRIANGLELIST);
+
+	gStateFilter.SetSamplers(Stage_Pixel, 0, 1, AsObjects(&gSampler));
+	gStateFilter.SetShaderResources(Stage_Pixel, 0, 1, AsObjects(&gBoundTexture));
+
+	UpdateObjectTransforms();
+	ComputeObjectMatrices(0, gObjectMatrices.size());
+	gInstanceBatcher.Begin();
+	for (size_t i = 0; i < gObjectMatrices.size(); i++)
+		gInstanceBatcher.Add(gObjectMatrices[i], GetObjectTexture(gVisibleObjects[i]));
+	gInstanceBatcher.Submit(gInstanceBackend, gMesh.indicesCount);
+}
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// reports finished spans to gFrameStats, never waits for the GPU
+void CollectGpuTimer(GpuFrameTimer &timer)
+{
+	if (!timer.pending)
+		return;
+
+	D3D11_QUERY_DATA_TIMESTAMP_DISJOINT disjoint;
+	if (gDeviceContext->GetData(timer.disjoint, &disjoint, sizeof(disjoint), D3D11_ASYNC_GETDATA_DONOTFLUSH) != S_OK)
+		return;
+
+	UINT64 begin = 0, end = 0;
+	if (gDeviceContext->GetData(timer.begin, &begin, sizeof(begin), D3D11_ASYNC_GETDATA_DONOTFLUSH) != S_OK ||
+		gDeviceContext->GetData(timer.end, &end, sizeof(end), D3D11_ASYNC_GETDATA_DONOTFLUSH) != S_OK)
+		return;
+
+	timer.pending = false;
+	if (disjoint.Disjoint || !disjoint.Frequency)
+		return;
+
+	double gpuMs = double(end - begin) * 1000.0 / disjoint.Frequency;
+	gFrameStats.ReportGpuTime(timer.frame, static_cast<float>(gpuMs));
+
+	// the resolution only changes the GPU cost, without timestamps the scale stays where it is
+	if (!gUseDynamicResolution)
+		return;
+	if (gResolutionTargetMs <= 0.0 && gPresentMode != Present_Uncapped)
+		gResolutionScaler.SetTargetMs(gFramePacer->GetRefreshMs());
+	if (gResolutionScaler.AddFrame(gpuMs))
+		ApplyRenderSize();
+}
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+void BeginGpuTimer()
+{
+	if (!gGpuTiming)
+		return;
+
+	GpuFrameTimer &timer = gGpuTimers[gFrameStats.GetFrameIndex() % gFramesInFlight];
+	// the slot is reused every gFramesInFlight frames, a span that is still not ready is dropped
+	CollectGpuTimer(timer);
+	timer.frame = gFrameStats.GetFrameIndex();
+	timer.pending = true;
+	gDeviceContext->Begin(timer.disjoint);
+	gDeviceContext->End(timer.begin);
+}
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+void EndGpuTimer()
+{
+	if (!gGpuTiming)
+		return;
+
+	GpuFrameTimer &timer = gGpuTimers[gFrameStats.GetFrameIndex() % gFramesInFlight];
+	gDeviceContext->End(timer.end);
+	gDeviceContext->End(timer.disjoint);
+
+	for (UINT64 i = 0; i < gFramesInFlight; i++)
+		if (&gGpuTimers[i] != &timer)
+			CollectGpuTimer(gGpuTimers[i]);
+}
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+void RenderTickPerObject()
+{
+	gStateFilter.SetShader(Stage_Vertex, gVSShader);
+	gStateFilter.SetShader(Stage_Pixel, gPSShader);
+
+	UINT stride = gMesh.vertexStride;
+	UINT offset = 0;
+	gStateFilter.SetInputLayout(gInputLayout);
+	gStateFilter.SetIndexBuffer(gMesh.indexBuffer, gMesh.indexFormat, 0);
+	gStateFilter.SetVertexBuffers(0, 1, AsObjects(&gMesh.vertexBuffer), &stride, &offset);
+	gStateFilter.SetPrimitiveTopology(D3D11_PRIMITIVE_TOPOLOGY_TRIANGLELIST);
+
+	UpdateObjectTransforms();
+	ComputeObjectMatrices(0, gObjectMatrices.size());
+
+	// all per-object constants are written up front, the ring has to be unmapped before the draws read it
+	gObjectConstants.assign(gObjectMatrices.size(), UINT_MAX);
+	bool ringMapped = MapUploadRing();
+	if (ringMapped)
+	{
+		for (size_t i = 0; i < gObjectMatrices.size(); i++)
+			gObjectConstants[i] = UploadConstants(&gObjectMatrices[i], sizeof(Mat4));
+		UnmapUploadRing();
+	}
+
+	gStateFilter.SetSamplers(Stage_Pixel, 0, 1, AsObjects(&gSampler));
+	for (size_t i = 0; i < gObjectMatrices.size(); i++)
+	{
+		TRACE_SCOPE("draw");
+		ID3D11ShaderResourceView *view = GetObjectTextureView(gVisibleObjects[i]);
+		gStateFilter.SetShaderResources(Stage_Pixel, 0, 1, AsObjects(&view));
+		UpdatePerObjectBuffer(gObjectMatrices[i], gObjectConstants[i]);
+		gStateFilter.Apply();
+		gDeviceContext->DrawIndexed(gMesh.indicesCount, 0, 0);
+	}
+
+	if (ringMapped)
+		SignalUploadFrame();
+}
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// runs on a job thread, the state filter shadows gDeviceContext only so the full state is set directly
+void RecordObjects(RecordContext &rc, size_t begin, size_t end, bool ringMapped)
+{
+	TRACE_SCOPE("record");
+	ID3D11DeviceContext *context = rc.context;
+	BindOutputState(context);
+
+	UINT stride = gMesh.vertexStride;
 	UINT offset = 0;
-	gDeviceContext->IASetInputLayout(gInputLayout);
-	gDeviceContext->IASetVertexBuffers(0, 1, &gQuad.vertexBuffer, &stride, &offset);
-	gDeviceContext->IASetPrimitiveTopology(D3D11_PRIMITIVE_TOPOLOGY_TRIANGLELIST);
+	context->IASetInputLayout(gInputLayout);
+	context->IASetIndexBuffer(gMesh.indexBuffer, gMesh.indexFormat, 0);
+	context->IASetVertexBuffers(0, 1, &gMesh.vertexBuffer, &stride, &offset);
+	context->IASetPrimitiveTopology(D3D11_PRIMITIVE_TOPOLOGY_TRIANGLELIST);
+	context->VSSetShader(gVSShader, nullptr, 0);
+	context->PSSetShader(gPSShader, nullptr, 0);
+	context->PSSetSamplers(0, 1, &gSampler);
+
+	UINT numConstants = UploadRing::kAlignment / 16;
+	ID3D11ShaderResourceView *boundView = nullptr;
+	for (size_t i = begin; i < end; i++)
+	{
+		TRACE_SCOPE("draw");
+		// -sort state groups the objects by slice, the view then only changes between the groups
+		ID3D11ShaderResourceView *view = GetObjectTextureView(gVisibleObjects[i]);
+		if (view != boundView)
+		{
+			context->PSSetShaderResources(0, 1, &view);
+			boundView = view;
+		}
+
+		// the ring is shared by all chunks, Allocate is lock-free
+		UINT firstConstant = ringMapped ? UploadConstants(&gObjectMatrices[i], sizeof(Mat4)) : UINT_MAX;
+		if (firstConstant != UINT_MAX)
+			rc.context1->VSSetConstantBuffers1(gCBObjectBind, 1, &gUploadBuffer, &firstConstant, &numConstants);
+		else
+		{
+			D3D11_MAPPED_SUBRESOURCE mapped;
+			if (FAILED(context->Map(rc.objectBuffer, 0, D3D11_MAP_WRITE_DISCARD, 0, &mapped)))
+				continue;
+			memcpy(mapped.pData, &gObjectMatrices[i], sizeof(Mat4));
+			context->Unmap(rc.objectBuffer, 0);
+			context->VSSetConstantBuffers(gCBObjectBind, 1, &rc.objectBuffer);
+		}
+		context->DrawIndexed(gMesh.indicesCount, 0, 0);
+	}
+
+	HRESULT hr = context->FinishCommandList(FALSE, &rc.commandList);
+	assert(SUCCEEDED(hr));
+}
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+void RenderTickDeferred()
+{
+	UpdateObjectTransforms();
+
+	size_t objectsCount = gObjectMatrices.size();
+	if (!objectsCount)
+		return;
+	size_t listsCount = (objectsCount + gMinObjectsPerList - 1) / gMinObjectsPerList;
+	if (listsCount > gRecordContexts.size())
+		listsCount = gRecordContexts.size();
+	size_t objectsPerList = (objectsCount + listsCount - 1) / listsCount;
+
+	// the immediate context keeps the ring mapped while the chunks record, none of the lists runs before Unmap
+	bool ringMapped = gRecordContexts[0].context1 && MapUploadRing();
+	auto recordChunks = [ringMapped, objectsCount, objectsPerList](size_t begin, size_t end)
+	{
+		uint64_t heapBefore = GetThreadHeapAllocations();
+		for (size_t chunk = begin; chunk < end; chunk++)
+		{
+			size_t first = chunk * objectsPerList;
+			size_t last = first + objectsPerList < objectsCount ? first + objectsPerList : objectsCount;
+			ComputeObjectMatrices(first, last);
+			RecordObjects(gRecordContexts[chunk], first, last, ringMapped);
+		}
+		// the render thread counts its own
+		if (gJobSystem->GetThreadIndex() != 0)
+			gJobHeapAllocations += GetThreadHeapAllocations() - heapBefore;
+	};
+	gJobSystem->ParallelFor(listsCount, 1, recordChunks);
+	if (ringMapped)
+		UnmapUploadRing();
+
+	{
+		TRACE_SCOPE("execute command lists");
+		TRACE_GPU_SCOPE(gGpuTrace, "command lists");
+		for (size_t i = 0; i < listsCount; i++)
+		{
+			if (!gRecordContexts[i].commandList)
+				continue;
+			gDeviceContext->ExecuteCommandList(gRecordContexts[i].commandList, FALSE);
+			SAFE_RELEASE(gRecordContexts[i].commandList);
+		}
+	}
+
+	// executing without restoring leaves the immediate context in the default state
+	BindOutputState(gDeviceContext);
+	gStateFilter.Invalidate();
+
+	if (ringMapped)
+		SignalUploadFrame();
+}
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// uploads what the I/O threads have staged, within gStreamBudget, and swaps the placeholder once the texture is complete
+void PumpStreaming()
+{
+	TRACE_SCOPE("streaming");
+	gAssetStreamer->Pump(gStreamBudget);
+	if (gCustomTexture && gAssetStreamer->GetResource(gStreamedTexture))
+		gBoundTexture = static_cast<ID3D11ShaderResourceView*>(gAssetStreamer->GetResource(gStreamedTexture));
+}
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// the frame graph's D3D11 side: targets are bound and cleared before a pass and its reads go to the pixel shader's
+// first slots. The back buffer is the only imported target; the flip model unbinds it at every Present, so it is bound
+// again every frame like the rest.
+class D3DRenderGraphBackend : public RenderGraphBackend
+{
+public:
+	void BeginPass(const RenderGraph &graph, RenderPassId pass) override
+	{
+		ID3D11RenderTargetView *targetViews[RenderGraph::kMaxTargets];
+		const std::vector<RenderResourceId> &targets = graph.GetTargets(pass);
+		for (size_t i = 0; i < targets.size(); i++)
+			targetViews[i] = targets[i] == gBackBuffer ? gRenderTargetView : GetTarget(graph, targets[i])->targetView;
+		RenderResourceId depth = graph.GetDepthTarget(pass);
+		ID3D11DepthStencilView *depthView = depth != kNoRenderResource ? GetTarget(graph, depth)->depthView : nullptr;
+		gDeviceContext->OMSetRenderTargets(static_cast<UINT>(targets.size()), targetViews, depthView);
+
+		const std::vector<RenderResourceId> &clears = graph.GetClears(pass);
+		for (size_t i = 0; i < clears.size(); i++)
+		{
+			const RenderTargetDesc &desc = graph.GetDesc(clears[i]);
+			const D3DRenderTarget *target = GetTarget(graph, clears[i]);
+			if (desc.depth)
+				gDeviceContext->ClearDepthStencilView(target->depthView, D3D11_CLEAR_DEPTH | D3D11_CLEAR_STENCIL,
+					desc.clear[0], static_cast<UINT8>(desc.clear[1]));
+			else
+				gDeviceContext->ClearRenderTargetView(target->targetView, desc.clear);
+		}
 
-	UpdatePerObjectBuffer(0.05f - DirectX::XM_PIDIV2);
-	gDeviceContext->VSSetConstantBuffers(0, 2, &gCBuffers[CB_Appliation]);
-	gDeviceContext->VSSetConstantBuffers(gCBObjectBind, 1, &gCBuffers[CB_Object]);
-	gDeviceContext->PSSetSamplers(0, 1, &gSampler);
-	gDeviceContext->PSSetShaderResources(0, 1, &gTexShaderResourceView);
-	gDeviceContext->Draw(gQuad.verticesCount, 0);
+		const std::vector<RenderResourceId> &reads = graph.GetReads(pass);
+		for (size_t i = 0; i < reads.size(); i++)
+			gStateFilter.SetShaderResources(Stage_Pixel, static_cast<UINT>(i), 1,
+				AsObjects(&GetTarget(graph, reads[i])->resourceView));
+	}
 
-	UpdatePerObjectBuffer(DirectX::XM_PIDIV2);
-	gDeviceContext->Draw(gQuad.verticesCount, 0);
+	// binding a read as a target later would silently unbind it, behind the filter's back
+	void EndPass(const RenderGraph &graph, RenderPassId pass) override
+	{
+		ID3D11ShaderResourceView *noView = nullptr;
+		for (size_t i = 0; i < graph.GetReads(pass).size(); i++)
+			gStateFilter.SetShaderResources(Stage_Pixel, static_cast<UINT>(i), 1, AsObjects(&noView));
+		gStateFilter.Apply();
+	}
 
-	gSwapChain->Present(1, 0);
+private:
+	static D3DRenderTarget* GetTarget(const RenderGraph &graph, RenderResourceId resource)
+	{
+		return static_cast<D3DRenderTarget*>(gRenderTargets.GetTargetOf(graph, resource));
+	}
+};
+
+D3DRenderGraphBackend gRenderGraphBackend;
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// the scene pass, the frame graph has bound and cleared the scene targets
+void DrawScene()
+{
+	TRACE_SCOPE("scene");
+	TRACE_GPU_SCOPE(gGpuTrace, "scene");
+	gPSShader = static_cast<ID3D11PixelShader*>(gShaderPermutations->GetShader(gScenePSProgram, gSceneFeatures));
+	BindSceneState(gDeviceContext);
+	if (gUseDeferredContexts)
+		RenderTickDeferred();
+	else if (gUseInstancing)
+		RenderTickInstanced();
+	else
+		RenderTickPerObject();
+}
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// stretches the scene's region to the back buffer, the frame graph binds both
+void UpscaleScene()
+{
+	TRACE_SCOPE("upscale");
+	TRACE_GPU_SCOPE(gGpuTrace, "upscale");
+	D3D11_VIEWPORT viewport = { 0.0f, 0.0f, static_cast<FLOAT>(gWidth), static_cast<FLOAT>(gHeight), 0.0f, 1.0f };
+	gDeviceContext->RSSetViewports(1, &viewport);
+
+	gStateFilter.SetShader(Stage_Vertex, gUpscaleVS);
+	gStateFilter.SetShader(Stage_Pixel, gUpscalePS);
+	gStateFilter.SetInputLayout(nullptr);
+	gStateFilter.SetPrimitiveTopology(D3D11_PRIMITIVE_TOPOLOGY_TRIANGLELIST);
+	gStateFilter.SetConstantBuffers(Stage_Vertex, 0, 1, AsObjects(&gUpscaleCBuffer));
+	gStateFilter.SetConstantBuffers(Stage_Pixel, 0, 1, AsObjects(&gUpscaleCBuffer));
+	gStateFilter.SetSamplers(Stage_Pixel, 0, 1, AsObjects(&gUpscaleSampler));
+	gStateFilter.Apply();
+	gDeviceContext->Draw(3, 0);
+}
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+void RenderTick()
+{
+	TRACE_SCOPE("render tick");
+	BeginArenaFrame();
+	uint64_t heapBefore = GetThreadHeapAllocations();
+	gJobHeapAllocations = 0;
+	gStateFilter.ResetStats();
+	PumpStreaming();
+	BeginGpuTimer();
+	TRACE_GPU_BEGIN_FRAME(gGpuTrace);
+
+	gFrameGraph.Execute(gRenderGraphBackend);
+	ReleaseFrameLists();
+
+	TRACE_GPU_END_FRAME(gGpuTrace);
+	EndGpuTimer();
+	gFrameStats.EndSubmit();
+	gFramePacer->EndFrame();
+	gLastFrameStateStats = gStateFilter.GetStats();
+
+	double presentStartMs = gFrameClock.NowMs();
+	HRESULT hr;
+	{
+		TRACE_SCOPE("present");
+		hr = gSwapChain->Present(gPresentMode == Present_Uncapped ? 0 : 1, 0);
+	}
+	gOccluded = hr == DXGI_STATUS_OCCLUDED;
+
+	// the runtime and the driver allocate from their own heaps, only the app's operator new is seen
+	gLastFrameHeapAllocations = GetThreadHeapAllocations() - heapBefore + gJobHeapAllocations.load();
+	gMaxFrameHeapAllocations = std::max(gMaxFrameHeapAllocations, gLastFrameHeapAllocations);
+	gHeapAllocationFrames += gLastFrameHeapAllocations ? 1 : 0;
+	gRenderTicks++;
+
+	// a window on the blt model has no frame statistics, but a Present that blocked returned right after a vblank
+	double presentEndMs = gFrameClock.NowMs();
+	if (!gFlipModel && gPresentMode == Present_VSync && presentEndMs - presentStartMs > 1.0)
+		gFramePacer->OnVBlank(presentEndMs);
+}
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// spins the last half millisecond, the timer may wake up a little late
+void WaitUntilMs(double ms)
+{
+	double remainingMs = ms - gFrameClock.NowMs();
+	if (gPacingTimer && remainingMs > 1.0)
+	{
+		LARGE_INTEGER dueTime;
+		dueTime.QuadPart = -static_cast<LONGLONG>((remainingMs - 0.5) * 10000.0); // relative, in 100 ns units
+		if (SetWaitableTimer(gPacingTimer, &dueTime, 0, nullptr, nullptr, FALSE))
+			WaitForSingleObject(gPacingTimer, INFINITE);
+	}
+	while (gFrameClock.NowMs() < ms)
+		SwitchToThread();
+}
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+void WaitForFrameStart()
+{
+	TRACE_SCOPE("wait for frame start");
+	// low latency: signaled when the queued frame went on screen, so there is room for this one
+	if (gFrameLatencyWaitable)
+		WaitForSingleObjectEx(gFrameLatencyWaitable, 1000, TRUE);
+
+	// flip model and fullscreen chains report the last vblank as a QPC time; on Windows the steady clock counts QPC
+	// ticks from the same origin, so it converts to gFrameClock time directly
+	DXGI_FRAME_STATISTICS stats;
+	if (SUCCEEDED(gSwapChain->GetFrameStatistics(&stats)) && stats.SyncQPCTime.QuadPart)
+		gFramePacer->OnVBlank(stats.SyncQPCTime.QuadPart * 1000.0 / gQpcFrequency);
+
+	if (gUsePacing)
+		WaitUntilMs(gFramePacer->ScheduleFrame());
+}
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// returns at wakeMs or as soon as a message arrives; without the high resolution timer the timeout rounds up to the
+// system tick, which the scheduler's slack absorbs
+void WaitForMessagesUntil(double wakeMs)
+{
+	double remainingMs = wakeMs - gFrameClock.NowMs();
+	if (remainingMs <= 0.0)
+		return;
+
+	if (gPacingTimer)
+	{
+		LARGE_INTEGER dueTime;
+		dueTime.QuadPart = -static_cast<LONGLONG>(remainingMs * 10000.0); // relative, in 100 ns units
+		if (SetWaitableTimer(gPacingTimer, &dueTime, 0, nullptr, nullptr, FALSE))
+		{
+			MsgWaitForMultipleObjectsEx(1, &gPacingTimer, INFINITE, QS_ALLINPUT, MWMO_INPUTAVAILABLE);
+			return;
+		}
+	}
+	MsgWaitForMultipleObjectsEx(0, nullptr, static_cast<DWORD>(remainingMs + 1.0), QS_ALLINPUT, MWMO_INPUTAVAILABLE);
+}
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// while occluded no frame is presented, a test Present tells when the window shows again
+void UpdateVisibility()
+{
+	if (gOccluded && !gMinimized)
+		gOccluded = gSwapChain->Present(0, DXGI_PRESENT_TEST) == DXGI_STATUS_OCCLUDED;
+	gLoopScheduler->SetHidden(gMinimized || gOccluded);
+}
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+void ReportLoopStats()
+{
+	LoopStats stats = gLoopScheduler->GetStats();
+	char line[200];
+	snprintf(line, sizeof(line), "Loop: %llu frames in %.0f ms, cpu %.0f ms (%.1f%%); rendering %.0f ms, sleeping %.0f ms, "
+		"spinning %.0f ms, idle %.0f ms\n", static_cast<unsigned long long>(stats.frames), stats.wallMs, stats.cpuMs,
+		stats.wallMs > 0.0 ? 100.0 * stats.cpuMs / stats.wallMs : 0.0, stats.renderMs, stats.sleepMs, stats.spinMs, stats.idleMs);
+	OutputDebugStringA(line);
+}
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+void ReportArenaStats()
+{
+	ArenaStats arena = GetFrameArenaStats();
+	char heapAllocations[100] = "";
+	if (IsCountingHeapAllocations())
+		snprintf(heapAllocations, sizeof(heapAllocations), "; RenderTick heap allocations in %llu of %llu frames, at most %llu",
+			static_cast<unsigned long long>(gHeapAllocationFrames), static_cast<unsigned long long>(gRenderTicks),
+			static_cast<unsigned long long>(gMaxFrameHeapAllocations));
+	char line[200];
+	snprintf(line, sizeof(line), "Frame arena: peak %zu bytes, %zu bytes reserved in %llu blocks%s\n", arena.peakBytes,
+		arena.reservedBytes, static_cast<unsigned long long>(arena.blockAllocations), heapAllocations);
+	OutputDebugStringA(line);
+}
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+void ReportStateCacheStats()
+{
+	static const char *const kindNames[NumStateKinds] = { "depth", "raster", "sampler", "blend", "pipeline" };
+	StateCacheStats stats = gStateCache.GetStats();
+	char line[400];
+	int length = snprintf(line, sizeof(line), "State cache:");
+	for (int kind = 0; kind < NumStateKinds && length < static_cast<int>(sizeof(line)); kind++)
+	{
+		length += snprintf(line + length, sizeof(line) - length, " %s %u objects, %llu/%llu hits;", kindNames[kind],
+			stats.objects[kind], static_cast<unsigned long long>(stats.hits[kind]),
+			static_cast<unsigned long long>(stats.lookups[kind]));
+	}
+	if (length < static_cast<int>(sizeof(line)))
+		snprintf(line + length, sizeof(line) - length, " %u failures\n", stats.failures);
+	OutputDebugStringA(line);
+}
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// between frames: everything sized by the back buffer is recreated, the rest of the renderer is kept
+HRESULT ResizeOutput(int width, int height)
+{
+	// ResizeBuffers fails while a view of the back buffer exists
+	gDeviceContext->OMSetRenderTargets(0, nullptr, nullptr);
+	SAFE_RELEASE(gRenderTargetView);
+	gDeviceContext->Flush();
+
+	// the flags have to match the ones the chain was created with
+	UINT flags = gFrameLatencyWaitable ? DXGI_SWAP_CHAIN_FLAG_FRAME_LATENCY_WAITABLE_OBJECT : 0;
+	HRESULT hr = gSwapChain->ResizeBuffers(0, width, height, DXGI_FORMAT_UNKNOWN, flags);
+	RETURN_IF_FAILED(hr);
+	gWidth = width;
+	gHeight = height;
+
+	hr = CreateBackBufferView();
+	RETURN_IF_FAILED(hr);
+	hr = CreateSceneTargets();
+	RETURN_IF_FAILED(hr);
+
+	// the cost per pixel is learned again at the new size, from the current scale
+	gResolutionScaler.Reset(gResolutionScaler.GetScale());
+	ApplyRenderSize();
+	UpdateCamera();
+	return S_OK;
 }
 ///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 // There are windows specific functions below
@@ -561,6 +2426,16 @@ LRESULT CALLBACK WndProc(HWND hWnd, UINT message, WPARAM wParam, LPARAM lParam)
 			EndPaint(hWnd, &ps);
 		}
 		break;
+	case WM_SIZE:
+		// minimizing reports 0 x 0, the buffers keep their size
+		gMinimized = wParam == SIZE_MINIMIZED;
+		if (!gMinimized && LOWORD(lParam) && HIWORD(lParam))
+		{
+			gResizePending = true;
+			gPendingWidth = LOWORD(lParam);
+			gPendingHeight = HIWORD(lParam);
+		}
+		break;
 	case WM_DESTROY:
 		PostQuitMessage(0);
 		break;
@@ -571,6 +2446,12 @@ LRESULT CALLBACK WndProc(HWND hWnd, UINT message, WPARAM wParam, LPARAM lParam)
 			case 27:
 				PostQuitMessage(0);
 				break;
+			case 'A':
+				gSceneFeatures = gSceneFeatures ^ kSceneAlphaTest;
+				break;
+			case 'S':
+				gSceneFeatures = gSceneFeatures ^ kSceneShowSlices;
+				break;
 			}
 		}
 		break;
@@ -603,7 +2484,7 @@ HRESULT InitWindow(HINSTANCE hInstance, int nCmdShow)
 	ghInst = hInstance;
 	RECT rc = { 0, 0, gWidth, gHeight };
 	AdjustWindowRect(&rc, WS_OVERLAPPEDWINDOW, FALSE);
-	ghWnd = CreateWindow(L"WindowClass", L"Minimal DX App", WS_OVERLAPPED | WS_CAPTION | WS_SYSMENU | WS_MINIMIZEBOX,
+	ghWnd = CreateWindow(L"WindowClass", L"Minimal DX App", WS_OVERLAPPEDWINDOW,
 		CW_USEDEFAULT, CW_USEDEFAULT, rc.right - rc.left, rc.bottom - rc.top, nullptr, nullptr, hInstance, nullptr);
 	if (!ghWnd)
 		return E_FAIL;
@@ -620,16 +2501,122 @@ int WINAPI wWinMain(_In_ HINSTANCE hInstance, _In_opt_ HINSTANCE hPrevInstance,
 	if (FAILED(InitWindow(hInstance, nCmdShow)))
 		return 0;
 
+	// DXMinimalApp.exe -stats frames.csv (or .json) appends a summary line every second
+	// -objects N -draw perobject|instanced|deferred -threads N pick the scene size and the recording path
+	// -cull off draws every object without frustum culling, -sort state|depth|off orders the draws by state then depth,
+	// strictly front to back, or leaves them in object order; -textures N spreads N checkers over the objects,
+	// -mesh file.dxmesh replaces the quad and -texture file.dds the checkers; -present vsync|uncapped|lowlatency picks the presentation mode and
+	// -pacing off starts every frame as soon as the previous one is presented; -dynres off renders at the window size,
+	// -dynres ms sets the GPU time the dynamic resolution aims for (the refresh interval by default);
+	// -loop fullspeed|capped|idle picks how the loop waits between frames and -fpscap N the capped rate;
+	// at run time A toggles the alpha test and S the texture array slice tint of the scene pixel shader;
+	// -trace file.json writes the CPU and GPU spans of the run as Chrome trace-event JSON on exit (debug builds)
+	int argc = 0;
+	LPWSTR *argv = CommandLineToArgvW(GetCommandLineW(), &argc);
+	for (int i = 1; argv && i + 1 < argc; i++)
+	{
+		if (!wcscmp(argv[i], L"-stats"))
+		{
+			char path[MAX_PATH];
+			WideCharToMultiByte(CP_ACP, 0, argv[++i], -1, path, MAX_PATH, nullptr, nullptr);
+			size_t len = strlen(path);
+			bool json = len >= 5 && !_stricmp(path + len - 5, ".json");
+			gFrameStats.EnableExport(path, json ? FrameStats_JSON : FrameStats_CSV, 1000.0);
+		}
+		else if (!wcscmp(argv[i], L"-mesh"))
+		{
+			WideCharToMultiByte(CP_ACP, 0, argv[++i], -1, gMeshPath, MAX_PATH, nullptr, nullptr);
+			gCustomMesh = true;
+		}
+		else if (!wcscmp(argv[i], L"-texture"))
+		{
+			WideCharToMultiByte(CP_ACP, 0, argv[++i], -1, gTexturePath, MAX_PATH, nullptr, nullptr);
+			gCustomTexture = true;
+		}
+		else if (!wcscmp(argv[i], L"-objects"))
+		{
+			gObjectsCount = _wtoi(argv[++i]);
+			if (gObjectsCount < 2)
+				gObjectsCount = 2;
+		}
+		else if (!wcscmp(argv[i], L"-textures"))
+		{
+			gTexturesCount = _wtoi(argv[++i]);
+			gTexturesCount = std::min(std::max(gTexturesCount, 1), static_cast<int>(TextureArrayAllocator::kMaxSlices));
+		}
+		else if (!wcscmp(argv[i], L"-draw"))
+		{
+			i++;
+			gUseDeferredContexts = !wcscmp(argv[i], L"deferred");
+			gUseInstancing = !wcscmp(argv[i], L"instanced");
+		}
+		else if (!wcscmp(argv[i], L"-threads"))
+			gRecordThreads = _wtoi(argv[++i]);
+		else if (!wcscmp(argv[i], L"-cull"))
+			gUseCulling = wcscmp(argv[++i], L"off") != 0;
+		else if (!wcscmp(argv[i], L"-sort"))
+		{
+			i++;
+			gSortDraws = wcscmp(argv[i], L"off") != 0;
+			gOpaqueOrder = !wcscmp(argv[i], L"depth") ? Order_FrontToBack : Order_State;
+		}
+		else if (!wcscmp(argv[i], L"-present"))
+		{
+			i++;
+			gPresentMode = !wcscmp(argv[i], L"uncapped") ? Present_Uncapped :
+				!wcscmp(argv[i], L"lowlatency") ? Present_LowLatency : Present_VSync;
+		}
+		else if (!wcscmp(argv[i], L"-pacing"))
+			gUsePacing = wcscmp(argv[++i], L"off") != 0;
+		else if (!wcscmp(argv[i], L"-dynres"))
+		{
+			i++;
+			gUseDynamicResolution = wcscmp(argv[i], L"off") != 0;
+			gResolutionTargetMs = _wtof(argv[i]);
+			if (gResolutionTargetMs > 0.0)
+				gResolutionScaler.SetTargetMs(gResolutionTargetMs);
+		}
+		else if (!wcscmp(argv[i], L"-loop"))
+		{
+			i++;
+			gLoopMode = !wcscmp(argv[i], L"fullspeed") ? Loop_FullSpeed :
+				!wcscmp(argv[i], L"capped") ? Loop_Capped : Loop_IdleWhenHidden;
+		}
+		else if (!wcscmp(argv[i], L"-fpscap"))
+		{
+			double fps = _wtof(argv[++i]);
+			if (fps > 0.0)
+				gFrameCapMs = 1000.0 / fps;
+		}
+#if TRACE_ENABLED
+		else if (!wcscmp(argv[i], L"-trace"))
+			WideCharToMultiByte(CP_ACP, 0, argv[++i], -1, gTracePath, MAX_PATH, nullptr, nullptr);
+#endif
+	}
+	LocalFree(argv);
+
+	// before InitRender, so its steps are recorded
+	TRACE_THREAD_NAME("main", -1);
+#if TRACE_ENABLED
+	if (gTracePath[0])
+		TraceBeginSession();
+#endif
+
+	// after the command line, it decides which contexts and threads are created
 	if (FAILED(InitRender(ghWnd)))
 	{
 		assert(false);
 		Cleanup();
+#if TRACE_ENABLED
+		ExportTrace();
+#endif
 		return 0;
 	}
 
-	__int64 countsPerSec = 0;
-	QueryPerformanceFrequency((LARGE_INTEGER*)(&countsPerSec));
-	float mSecondsPerCount = 1.0f / countsPerSec;
+	gSimulation = new Simulation(gFrameClock, gObjectsCount, gSimulationStepMs);
+	gSimulation->Start();
+	gLoopScheduler = new LoopScheduler(gFrameClock, gLoopCpuClock, gLoopMode, gFrameCapMs);
+	gLastTitleLoopStats = gLoopScheduler->GetStats();
 
 	// Main message loop
 	MSG msg = { 0 };
@@ -642,23 +2629,68 @@ int WINAPI wWinMain(_In_ HINSTANCE hInstance, _In_opt_ HINSTANCE hPrevInstance,
 		}
 		else
 		{
-			__int64 mPrevTime = 0, mCurrTime = 0;
+			if (gResizePending)
+			{
+				gResizePending = false;
+				if ((gPendingWidth != gWidth || gPendingHeight != gHeight) && FAILED(ResizeOutput(gPendingWidth, gPendingHeight)))
+					break;
+			}
 
-			QueryPerformanceCounter((LARGE_INTEGER*)(&mPrevTime));
-			RenderTick();
-			QueryPerformanceCounter((LARGE_INTEGER*)(&mCurrTime));
+			UpdateVisibility();
+			LoopAction action = gLoopScheduler->Next();
+			if (action == Loop_Sleep || action == Loop_Idle)
+			{
+				WaitForMessagesUntil(gLoopScheduler->GetWakeMs());
+				continue;
+			}
+			if (action == Loop_Spin)
+			{
+				SwitchToThread();
+				continue;
+			}
 
-			float delta = max(0, (mCurrTime - mPrevTime) * mSecondsPerCount);
+			gLoopScheduler->BeginFrame();
+			WaitForFrameStart();
+			gFrameStats.BeginFrame();
+			gFramePacer->BeginFrame();
+			RenderTick();
+			gFrameStats.EndPresent();
+			gLoopScheduler->EndFrame();
 
-			int FPS = static_cast<int>(1.0f / delta);
-			std::ostringstream title;
-			title.precision(5);
-			title << std::fixed << "Minimal DX App FPS: " << std::setw(6) << FPS;
-			SetWindowTextA(ghWnd, title.str().c_str());
+			if (gFrameStats.TitleUpdateDue())
+			{
+				// the loop thread's share of a core since the last title
+				LoopStats loopStats = gLoopScheduler->GetStats();
+				double wallMs = loopStats.wallMs - gLastTitleLoopStats.wallMs;
+				double cpuPercent = wallMs > 0.0 ? 100.0 * (loopStats.cpuMs - gLastTitleLoopStats.cpuMs) / wallMs : 0.0;
+				gLastTitleLoopStats = loopStats;
+
+				const char *modeNames[] = { "vsync", "uncapped", "low latency" };
+				char heapAllocs[32] = "";
+				if (IsCountingHeapAllocations())
+					snprintf(heapAllocs, sizeof(heapAllocs), ", heap allocs %llu", static_cast<unsigned long long>(gLastFrameHeapAllocations));
+				char prefix[160];
+				snprintf(prefix, sizeof(prefix), "Minimal DX App [%s%s, %ux%u, state calls %u/%u, loop cpu %.0f%%%s]",
+					modeNames[gPresentMode], gUsePacing ? "" : " unpaced", gRenderWidth, gRenderHeight,
+					gLastFrameStateStats.issued, gLastFrameStateStats.requested, cpuPercent, heapAllocs);
+				char title[224];
+				gFrameStats.FormatTitle(title, sizeof(title), prefix);
+				SetWindowTextA(ghWnd, title);
+			}
 		}
 	}
 
+	ReportLoopStats();
+	ReportArenaStats();
+	ReportStateCacheStats();
+	delete gLoopScheduler;
+	gLoopScheduler = nullptr;
+	delete gSimulation;
+	gSimulation = nullptr;
 	Cleanup();
+#if TRACE_ENABLED
+	ExportTrace();
+#endif
 
 	return (int)msg.wParam;
 }